@@ -6,6 +6,10 @@ isnot1x1conv = @(l) (isequal(l.type, 'conv') && ...
   ~(size(l.filters, 1) == 1 && size(l.filters, 2) == 1 && ...
   isequal(l.stride, [1 1]) && isequal(l.pad, [0 0 0 0])));
 ispooling = @(l) isequal(l.type, 'pool');
+% layers that treat every pixel separately: they run on the compact
+% M x 1 output of a perforated layer, so its mask is carried through them
+ispointwise = @(l) (isequal(l.type, 'conv') && ~isnot1x1conv(l)) || ...
+  any(strcmp(l.type, {'relu', 'normalize', 'dropout', 'noffset', 'softmax'}));
 
 convLayersData = cell(0, 1);
 for i = 1:length(net.layers)
@@ -27,10 +31,16 @@ for i = 1:length(net.layers)
   end
 
   for nextLayer = i+1:length(net.layers)
-    if isnot1x1conv(net.layers{nextLayer}) || ispooling(net.layers{nextLayer})
+    if ~ispointwise(net.layers{nextLayer})
       break;
     end
   end
+
+  % the interpolation is done by the indices of the next convolution or
+  % pooling; any other spatial layer would get the compact output
+  if ~isnot1x1conv(net.layers{nextLayer}) && ~ispooling(net.layers{nextLayer})
+    continue;
+  end
   
   if nextPoolingIndex == nextLayer
     perforationTypes = [PerforationType.Uniform PerforationType.Grid PerforationType.Structure ...
@@ -4,6 +4,9 @@ for i = 1:numel(net.layers)
   if isfield(net.layers{i}, 'opindices')
     net.layers{i} = rmfield(net.layers{i}, 'opindices');
   end
+  if isfield(net.layers{i}, 'winograd')
+    net.layers{i} = rmfield(net.layers{i}, 'winograd');
+  end
 end
 
 end
@@ -12,6 +12,18 @@ for i = 1:length(net.layers)
     case 'pool'
       l.opindices = vl_nnpoolidx(inputSizesData(i,:), l.pool, 'method', l.method, 'pad', l.pad, ...
         'stride', l.stride, 'inindices', interpolationIndicesIn);
+
+      % on the CPU, the windows that read a perforated input can keep each
+      % of their (interpolated, hence repeated) sources once. This is
+      % faster when it saves enough loads, i.e. when the deduplicated
+      % indices are clearly smaller (in practice, max pooling only)
+      if ~useGpu && ~isempty(interpolationIndicesIn)
+        deduplicated = vl_nnpoolidx(inputSizesData(i,:), l.pool, 'method', l.method, 'pad', l.pad, ...
+          'stride', l.stride, 'inindices', interpolationIndicesIn, 'deduplicate');
+        if numel(deduplicated) < 0.9 * numel(l.opindices)
+          l.opindices = deduplicated;
+        end
+      end
       
       % CPU and GPU implementations use different order of opindices tensor to improve memory coalescing
       if useGpu
@@ -22,13 +34,50 @@ for i = 1:length(net.layers)
       if inputSizesData(i+1, 1) == 1 && inputSizesData(i+1, 2) == 1
         continue;
       end
-      % Skip 1x1 convolutions
-      if size(l.filters, 1) == 1 && size(l.filters, 2) == 1 && isequal(l.stride, [1 1]) && isequal(l.pad, [0 0 0 0])
+      % Skip dense 1x1 convolutions. A perforated one is still evaluated
+      % with opindices: on the CPU, vl_nnconv multiplies the listed rows of
+      % the input in place, without the windowed im2col
+      is1x1 = size(l.filters, 1) == 1 && size(l.filters, 2) == 1 && isequal(l.stride, [1 1]) && isequal(l.pad, [0 0 0 0]);
+      if is1x1 && isempty(nonPerforatedIndices) && isempty(interpolationIndicesIn)
         continue;
       end
       
-      l.opindices = vl_nnconvidx(inputSizesData(i,:), size(l.filters), 'pad', l.pad, 'stride', l.stride, ...
-        'inindices', interpolationIndicesIn, 'maskindices', nonPerforatedIndices);
+      % 3x3 stride-1 layers with a dense output or a grid of computed
+      % rows and columns are evaluated by the Winograd code on the CPU
+      % (see vl_nnconv); the opindices are still used by the backward pass
+      l.winograd = ~useGpu && isempty(interpolationIndicesIn) && ...
+        size(l.filters, 1) == 3 && size(l.filters, 2) == 3 && isequal(l.stride, [1 1]);
+      if l.winograd && isempty(nonPerforatedIndices)
+        numGroups = inputSizesData(i, 3) / size(l.filters, 3);
+        l.winograd = size(l.filters, 3) >= 32 && size(l.filters, 4) / numGroups >= 32;
+      elseif l.winograd
+        pad = l.pad .* ones(1, 4);
+        mask = false(inputSizesData(i, 1:2) + [pad(1)+pad(2) pad(3)+pad(4)] - 2);
+        mask(nonPerforatedIndices(:, :, :, 1) + 1) = true;
+        l.winograd = size(nonPerforatedIndices, 4) == 1 && size(l.filters, 3) >= 128 && ...
+          isequal(mask, bsxfun(@and, any(mask, 2), any(mask, 1)));
+      end
+
+      if isfield(l, 'interpolationIndicesOut') && size(nonPerforatedIndices, 4) == 1 && ~l.winograd && ~is1x1
+        % compute the outputs along a Z-order curve for locality; the
+        % indices that address the computed outputs are renumbered (1x1
+        % layers keep the memory order, whose runs are multiplied in place)
+        [l.opindices, order] = vl_nnconvidx(inputSizesData(i,:), size(l.filters), 'pad', l.pad, 'stride', l.stride, ...
+          'inindices', interpolationIndicesIn, 'maskindices', nonPerforatedIndices, 'order', 'morton');
+        inverse = zeros(size(order), 'int32');
+        inverse(order + 1) = 0:numel(order)-1;
+        for j = i+1:length(net.layers)
+          if isequal(vl_getfielddefault(net.layers{j}, 'interpolationIndicesIn'), l.interpolationIndicesOut)
+            net.layers{j}.interpolationIndicesIn = inverse(l.interpolationIndicesOut + 1);
+            break;
+          end
+        end
+        l.nonPerforatedIndices = nonPerforatedIndices(order + 1);
+        l.interpolationIndicesOut = inverse(l.interpolationIndicesOut + 1);
+      else
+        l.opindices = vl_nnconvidx(inputSizesData(i,:), size(l.filters), 'pad', l.pad, 'stride', l.stride, ...
+          'inindices', interpolationIndicesIn, 'maskindices', nonPerforatedIndices);
+      end
 
       if useGpu
         l.opindices = gpuArray(l.opindices);
@@ -2,26 +2,10 @@ function [ interpolationIndices ] = non_perforated_indices_to_intepolation_indic
   nonPerforatedIndices, outputSize )
 % Finds nearest neighbor for each output spatial position.
 % For non-perforated positions that is the position itself.
-% The ties are broken randomly.
+% The ties go to the non-perforated position nearest in memory, which
+% is deterministic and keeps the copies local.
 
-mask = false(outputSize);
-mask(nonPerforatedIndices + 1) = true;
-[row, col] = find(mask);
-nonPerforatedPositions = [row col];
-[row, col] = ind2sub([outputSize(1) outputSize(2)], 1:(outputSize(1)*outputSize(2)));
-allPositions = [row' col'];
-
-searcher = KDTreeSearcher(nonPerforatedPositions);
-nnIndices = searcher.knnsearch(allPositions, 'IncludeTies', true);
-
-% rng(0);
-% Selects a random nearest neighbor. This leaves non-perforated positions in place,
-% since they have unique nearest neighbor.
-nearestIndex = zeros(size(nnIndices, 1), 1);
-for i = 1:size(nnIndices, 1)
-  nearestIndex(i) = nnIndices{i}(randperm(numel(nnIndices{i}), 1));
-end
-nearestIndex = reshape(nearestIndex, outputSize);
-interpolationIndices = int32(nearestIndex) - 1;
+interpolationIndices = vl_nninterpidx(int32(nonPerforatedIndices), outputSize, ...
+  'ties', 'nearest');
 
 end
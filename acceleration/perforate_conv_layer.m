@@ -8,7 +8,8 @@ assert(strcmp(net.layers{convLayerData.nextPoolingIndex}.type, 'pool'));
 outputSize = convLayerData.outputSize;
 sz = outputSize(1:2);
 
-% rng(i);
+% the masks of a layer are the same on every run
+previousRng = rng(i);
 
 if perforationType == PerforationType.Uniform
   weights = rand(sz);
@@ -52,4 +53,6 @@ end
 
 net.layers{i}.rate = rate;
 
+rng(previousRng);
+
 end
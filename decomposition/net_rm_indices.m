@@ -25,4 +25,9 @@ function net_new = net_rm_indices(net_new, layer_no)
         net_new.layers{layer_no+1} = ...
             rmfield(net_new.layers{layer_no+1}, 'opindices');
     end
+
+    if isfield(net_new.layers{layer_no+1}, 'winograd')
+        net_new.layers{layer_no+1} = ...
+            rmfield(net_new.layers{layer_no+1}, 'winograd');
+    end
 end
\ No newline at end of file
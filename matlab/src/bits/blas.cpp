@@ -0,0 +1,308 @@
+/** @file blas.cpp
+ ** @brief CPU BLAS backends
+ ** @author Michael Figurnov
+ **/
+
+/*
+ Copyright (C) 2015 Michael Figurnov.
+ All rights reserved.
+
+ This file is part of the VLFeat library and is made available under
+ the terms of the BSD license (see the COPYING file).
+ */
+
+#include "blas.hpp"
+#include "threads.hpp"
+
+#if defined(VL_BLAS_BLIS)
+#include <stdint.h>
+#endif
+
+#ifndef VL_BLAS_INT
+#define VL_BLAS_INT ptrdiff_t
+#endif
+
+#if defined(_WIN32) || defined(__hpux)
+#define VL_BLAS_FUNC(x) x
+#else
+#define VL_BLAS_FUNC(x) x ## _
+#endif
+
+/* the reference code is run in parallel only if there is enough work */
+static const ptrdiff_t minParallelVolume = 32768 ;
+
+/* below this volume a product gains little from the threads of the BLAS */
+static const ptrdiff_t minThreadedGemmVolume = 1 << 21 ;
+
+/* ---------------------------------------------------------------- */
+/*                                                      Linked BLAS */
+/* ---------------------------------------------------------------- */
+
+#if !defined(VL_BLAS_NONE)
+extern "C" {
+  void VL_BLAS_FUNC(sgemm)(char const * transa, char const * transb,
+                           VL_BLAS_INT const * m, VL_BLAS_INT const * n, VL_BLAS_INT const * k,
+                           float const * alpha,
+                           float const * a, VL_BLAS_INT const * lda,
+                           float const * b, VL_BLAS_INT const * ldb,
+                           float const * beta,
+                           float * c, VL_BLAS_INT const * ldc) ;
+
+  void VL_BLAS_FUNC(sgemv)(char const * trans,
+                           VL_BLAS_INT const * m, VL_BLAS_INT const * n,
+                           float const * alpha,
+                           float const * a, VL_BLAS_INT const * lda,
+                           float const * x, VL_BLAS_INT const * incx,
+                           float const * beta,
+                           float * y, VL_BLAS_INT const * incy) ;
+}
+#endif
+
+#if defined(VL_BLAS_OPENBLAS)
+extern "C" {
+  void openblas_set_num_threads(int numThreads) ;
+  int openblas_get_num_threads(void) ;
+}
+static char const * linkedName = "OpenBLAS" ;
+static int linked_get_num_threads() { return openblas_get_num_threads() ; }
+static void linked_set_num_threads(int numThreads) { openblas_set_num_threads(numThreads) ; }
+#elif defined(VL_BLAS_MKL)
+extern "C" {
+  void mkl_set_num_threads(int numThreads) ;
+  int mkl_get_max_threads(void) ;
+}
+static char const * linkedName = "MKL" ;
+static int linked_get_num_threads() { return mkl_get_max_threads() ; }
+static void linked_set_num_threads(int numThreads) { mkl_set_num_threads(numThreads) ; }
+#elif defined(VL_BLAS_BLIS)
+extern "C" {
+  void bli_thread_set_num_threads(int64_t numThreads) ;
+  int64_t bli_thread_get_num_threads(void) ;
+}
+static char const * linkedName = "BLIS" ;
+static int linked_get_num_threads() { return (int)bli_thread_get_num_threads() ; }
+static void linked_set_num_threads(int numThreads) { bli_thread_set_num_threads(numThreads) ; }
+#elif defined(VL_BLAS_NONE)
+static char const * linkedName = "reference" ;
+static int linked_get_num_threads() { return 0 ; }
+static void linked_set_num_threads(int) { }
+#else
+static char const * linkedName = "BLAS" ;
+static int linked_get_num_threads() { return 0 ; }
+static void linked_set_num_threads(int) { }
+#endif
+
+/* ---------------------------------------------------------------- */
+/*                                                        Settings */
+/* ---------------------------------------------------------------- */
+
+#if defined(VL_BLAS_NONE)
+static VlBlasBackend backendSetting = vlBlasReference ;
+#else
+static VlBlasBackend backendSetting = vlBlasLinked ;
+#endif
+
+/* zero means the default; -1 that the default of the linked BLAS is not known yet */
+static int numThreadsSetting = 0 ;
+static int linkedDefaultNumThreads = -1 ;
+
+VlBlasBackend vl_blas_get_backend()
+{
+  return backendSetting ;
+}
+
+VlBlasBackend vl_blas_set_backend(VlBlasBackend backend)
+{
+  VlBlasBackend previous = backendSetting ;
+#if !defined(VL_BLAS_NONE)
+  backendSetting = backend ;
+#else
+  (void)backend ;
+#endif
+  return previous ;
+}
+
+char const * vl_blas_get_backend_name()
+{
+  return (backendSetting == vlBlasReference) ? "reference" : linkedName ;
+}
+
+int vl_blas_get_num_threads()
+{
+  if (backendSetting == vlBlasReference) {
+    return (numThreadsSetting > 0) ? numThreadsSetting : vl_get_num_threads() ;
+  }
+  return linked_get_num_threads() ;
+}
+
+int vl_blas_set_num_threads(int numThreads)
+{
+  int previous = numThreadsSetting ;
+  numThreadsSetting = (numThreads > 0) ? numThreads : 0 ;
+  if (numThreadsSetting == previous) { return previous ; }
+  if (linkedDefaultNumThreads < 0) {
+    linkedDefaultNumThreads = linked_get_num_threads() ;
+  }
+  if (numThreadsSetting > 0) {
+    linked_set_num_threads(numThreadsSetting) ;
+  } else if (linkedDefaultNumThreads > 0) {
+    linked_set_num_threads(linkedDefaultNumThreads) ;
+  }
+  return previous ;
+}
+
+/* ---------------------------------------------------------------- */
+/*                                                   Reference code */
+/* ---------------------------------------------------------------- */
+
+/* column J of C is computed by one thread */
+static void
+sgemm_reference(char op1, char op2,
+                ptrdiff_t m, ptrdiff_t n, ptrdiff_t k,
+                float alpha,
+                float const * a, ptrdiff_t lda,
+                float const * b, ptrdiff_t ldb,
+                float beta,
+                float * c, ptrdiff_t ldc)
+{
+  bool transA = (op1 == 't' || op1 == 'T') ;
+  bool transB = (op2 == 't' || op2 == 'T') ;
+  ptrdiff_t strideB = transB ? ldb : 1 ;
+  ptrdiff_t stepB = transB ? 1 : ldb ;
+  int numThreads = vl_blas_get_num_threads() ;
+#pragma omp parallel for num_threads(numThreads) if(n > 1 && m * n * k >= minParallelVolume)
+  for (ptrdiff_t j = 0 ; j < n ; ++j) {
+    float * cj = c + j * ldc ;
+    float const * bj = b + j * stepB ;
+    if (beta == 0) {
+      for (ptrdiff_t i = 0 ; i < m ; ++i) { cj[i] = 0 ; }
+    } else if (beta != 1) {
+      for (ptrdiff_t i = 0 ; i < m ; ++i) { cj[i] *= beta ; }
+    }
+    if (alpha == 0) { continue ; }
+    if (transA) {
+      for (ptrdiff_t i = 0 ; i < m ; ++i) {
+        float const * ai = a + i * lda ;
+        float accum = 0 ;
+        for (ptrdiff_t l = 0 ; l < k ; ++l) { accum += ai[l] * bj[l * strideB] ; }
+        cj[i] += alpha * accum ;
+      }
+    } else {
+      for (ptrdiff_t l = 0 ; l < k ; ++l) {
+        float const * al = a + l * lda ;
+        float blj = alpha * bj[l * strideB] ;
+        for (ptrdiff_t i = 0 ; i < m ; ++i) { cj[i] += al[i] * blj ; }
+      }
+    }
+  }
+}
+
+/* the increments are positive */
+static void
+sgemv_reference(char op,
+                ptrdiff_t m, ptrdiff_t n,
+                float alpha,
+                float const * a, ptrdiff_t lda,
+                float const * x, ptrdiff_t incx,
+                float beta,
+                float * y, ptrdiff_t incy)
+{
+  bool trans = (op == 't' || op == 'T') ;
+  ptrdiff_t lengthY = trans ? n : m ;
+  ptrdiff_t lengthX = trans ? m : n ;
+  for (ptrdiff_t i = 0 ; i < lengthY ; ++i) {
+    y[i * incy] = (beta == 0) ? 0 : beta * y[i * incy] ;
+  }
+  if (alpha == 0) { return ; }
+  if (trans) {
+    for (ptrdiff_t i = 0 ; i < lengthY ; ++i) {
+      float const * ai = a + i * lda ;
+      float accum = 0 ;
+      for (ptrdiff_t l = 0 ; l < lengthX ; ++l) { accum += ai[l] * x[l * incx] ; }
+      y[i * incy] += alpha * accum ;
+    }
+  } else {
+    for (ptrdiff_t l = 0 ; l < lengthX ; ++l) {
+      float const * al = a + l * lda ;
+      float xl = alpha * x[l * incx] ;
+      for (ptrdiff_t i = 0 ; i < lengthY ; ++i) { y[i * incy] += al[i] * xl ; }
+    }
+  }
+}
+
+/* ---------------------------------------------------------------- */
+/*                                                        Interface */
+/* ---------------------------------------------------------------- */
+
+void vl_blas_sgemm(char op1, char op2,
+                   ptrdiff_t m, ptrdiff_t n, ptrdiff_t k,
+                   float alpha,
+                   float const * a, ptrdiff_t lda,
+                   float const * b, ptrdiff_t ldb,
+                   float beta,
+                   float * c, ptrdiff_t ldc)
+{
+#if !defined(VL_BLAS_NONE)
+  if (backendSetting == vlBlasLinked) {
+    VL_BLAS_INT m_ = m, n_ = n, k_ = k, lda_ = lda, ldb_ = ldb, ldc_ = ldc ;
+    VL_BLAS_FUNC(sgemm)(&op1, &op2,
+                        &m_, &n_, &k_,
+                        &alpha,
+                        a, &lda_,
+                        b, &ldb_,
+                        &beta,
+                        c, &ldc_) ;
+    return ;
+  }
+#endif
+  sgemm_reference(op1, op2, m, n, k, alpha, a, lda, b, ldb, beta, c, ldc) ;
+}
+
+void vl_blas_sgemv(char op,
+                   ptrdiff_t m, ptrdiff_t n,
+                   float alpha,
+                   float const * a, ptrdiff_t lda,
+                   float const * x, ptrdiff_t incx,
+                   float beta,
+                   float * y, ptrdiff_t incy)
+{
+#if !defined(VL_BLAS_NONE)
+  if (backendSetting == vlBlasLinked) {
+    VL_BLAS_INT m_ = m, n_ = n, lda_ = lda, incx_ = incx, incy_ = incy ;
+    VL_BLAS_FUNC(sgemv)(&op,
+                        &m_, &n_,
+                        &alpha,
+                        a, &lda_,
+                        x, &incx_,
+                        &beta,
+                        y, &incy_) ;
+    return ;
+  }
+#endif
+  sgemv_reference(op, m, n, alpha, a, lda, x, incx, beta, y, incy) ;
+}
+
+void vl_blas_sgemm_strided_batched(char op1, char op2,
+                                   ptrdiff_t m, ptrdiff_t n, ptrdiff_t k,
+                                   float alpha,
+                                   float const * a, ptrdiff_t lda, ptrdiff_t strideA,
+                                   float const * b, ptrdiff_t ldb, ptrdiff_t strideB,
+                                   float beta,
+                                   float * c, ptrdiff_t ldc, ptrdiff_t strideC,
+                                   ptrdiff_t batchSize)
+{
+  /* the products are independent unless they are summed into C */
+  int numThreads = vl_get_num_threads() ;
+  bool concurrent = (strideC != 0 && batchSize > 1 &&
+                     (batchSize >= numThreads || m * n * k < minThreadedGemmVolume)) ;
+#pragma omp parallel for num_threads(numThreads) if(concurrent)
+  for (ptrdiff_t s = 0 ; s < batchSize ; ++s) {
+    vl_blas_sgemm(op1, op2,
+                  m, n, k,
+                  alpha,
+                  a + s * strideA, lda,
+                  b + s * strideB, ldb,
+                  (strideC == 0 && s > 0) ? 1.0f : beta,
+                  c + s * strideC, ldc) ;
+  }
+}
@@ -0,0 +1,89 @@
+/** @file blas.hpp
+ ** @brief CPU BLAS backends
+ ** @author Michael Figurnov
+ **/
+
+/*
+ Copyright (C) 2015 Michael Figurnov.
+ All rights reserved.
+
+ This file is part of the VLFeat library and is made available under
+ the terms of the BSD license (see the COPYING file).
+ */
+
+#ifndef VL_NNBLAS_H
+#define VL_NNBLAS_H
+
+#include <cstddef>
+
+/*
+ The CPU code calls the matrix products through these functions, so
+ that the BLAS is chosen in a single place.
+
+ At build time, the BLAS is the Fortran interface of any BLAS (e.g.
+ MATLAB's libmwblas or the reference BLAS), or, by defining
+ VL_BLAS_OPENBLAS, VL_BLAS_MKL or VL_BLAS_BLIS, one of these libraries,
+ whose number of threads can then be set. VL_BLAS_NONE builds without
+ any BLAS. VL_BLAS_INT is the integer type of the BLAS interface:
+ ptrdiff_t by default (libmwblas and ILP64 libraries), int for LP64
+ libraries.
+
+ At run time, vl_blas_set_backend() selects the linked BLAS
+ (vlBlasLinked) or the built-in reference code (vlBlasReference),
+ which is portable but several times slower; with VL_BLAS_NONE only
+ the latter is available. Both functions return the previous setting.
+
+ vl_blas_set_num_threads() sets the number of threads of the linked
+ BLAS (zero restores its default) and of the reference code (zero
+ means vl_get_num_threads()). The generic Fortran BLAS has no thread
+ control and keeps its own setting.
+
+ vl_blas_sgemm_strided_batched() computes C_s = alpha op(A_s) op(B_s)
+ + beta C_s for s = 0, ..., batchSize - 1, where X_s = X + s * strideX.
+ A zero stride uses the same matrix for all the products; if strideC
+ is zero, the products are summed into C and beta only scales its
+ initial content. Otherwise the products must write disjoint elements
+ of C, and they are computed concurrently, one per thread, when there
+ are at least as many of them as threads or when they are too small
+ to keep the threads of the BLAS busy; the linked BLAS must then be
+ thread-safe (as MATLAB's BLAS, OpenBLAS, MKL and BLIS are).
+ */
+
+enum VlBlasBackend {
+  vlBlasLinked = 0,
+  vlBlasReference
+} ;
+
+VlBlasBackend vl_blas_get_backend() ;
+VlBlasBackend vl_blas_set_backend(VlBlasBackend backend) ;
+char const * vl_blas_get_backend_name() ;
+
+int vl_blas_get_num_threads() ;
+int vl_blas_set_num_threads(int numThreads) ;
+
+void vl_blas_sgemm(char op1, char op2,
+                   ptrdiff_t m, ptrdiff_t n, ptrdiff_t k,
+                   float alpha,
+                   float const * a, ptrdiff_t lda,
+                   float const * b, ptrdiff_t ldb,
+                   float beta,
+                   float * c, ptrdiff_t ldc) ;
+
+void vl_blas_sgemv(char op,
+                   ptrdiff_t m, ptrdiff_t n,
+                   float alpha,
+                   float const * a, ptrdiff_t lda,
+                   float const * x, ptrdiff_t incx,
+                   float beta,
+                   float * y, ptrdiff_t incy) ;
+
+void vl_blas_sgemm_strided_batched(char op1, char op2,
+                                   ptrdiff_t m, ptrdiff_t n, ptrdiff_t k,
+                                   float alpha,
+                                   float const * a, ptrdiff_t lda, ptrdiff_t strideA,
+                                   float const * b, ptrdiff_t ldb, ptrdiff_t strideB,
+                                   float beta,
+                                   float * c, ptrdiff_t ldc, ptrdiff_t strideC,
+                                   ptrdiff_t batchSize) ;
+
+#endif /* defined(VL_NNBLAS_H) */
@@ -0,0 +1,82 @@
+/** @file dedup.cpp
+ ** @brief Deduplicated pooling windows
+ ** @author Michael Figurnov
+ **/
+
+/*
+ Copyright (C) 2015 Michael Figurnov.
+ All rights reserved.
+
+ This file is part of the VLFeat library and is made available under
+ the terms of the BSD license (see the COPYING file).
+ */
+
+#include "dedup.hpp"
+
+/*
+ The windows are short (at most a few dozen indices), so the earlier
+ entries of a window are simply searched linearly.
+ */
+
+static inline bool is_first_occurrence(int const* window, int x)
+{
+  for (int u = 0 ; u < x ; ++u) {
+    if (window[u] == window[x]) { return false ; }
+  }
+  return true ;
+}
+
+int dedup_count_entries(int const* indices,
+                        int numWindows,
+                        int windowSize)
+{
+  int numEntries = 0 ;
+  for (int w = 0 ; w < numWindows ; ++w) {
+    int const* window = indices + (ptrdiff_t)w * windowSize ;
+    for (int x = 0 ; x < windowSize ; ++x) {
+      if (window[x] != -1 && is_first_occurrence(window, x)) {
+        ++ numEntries ;
+      }
+    }
+  }
+  return numEntries ;
+}
+
+void dedup_encode(int* encoded,
+                  int const* indices,
+                  int height,
+                  int width,
+                  int depth,
+                  int windowSize,
+                  int numEntries,
+                  int entrySize)
+{
+  encoded[0] = VL_DEDUP_MAGIC ;
+  encoded[1] = windowSize ;
+  encoded[2] = height ;
+  encoded[3] = width ;
+  encoded[4] = depth ;
+  encoded[5] = numEntries ;
+  encoded[6] = entrySize ;
+
+  int numWindows = dedup_num_windows(encoded) ;
+  int* offsets = encoded + VL_DEDUP_HEADER_SIZE ;
+  int* entries = offsets + numWindows + 1 ;
+  int entry = 0 ;
+  for (int w = 0 ; w < numWindows ; ++w) {
+    int const* window = indices + (ptrdiff_t)w * windowSize ;
+    offsets[w] = entry ;
+    for (int x = 0 ; x < windowSize ; ++x) {
+      if (window[x] == -1) { continue ; }
+      int e = offsets[w] ;
+      while (e < entry && entries[entrySize*e] != window[x]) { ++ e ; }
+      if (e == entry) {
+        entries[entrySize*entry] = window[x] ;
+        if (entrySize == 2) { entries[2*entry + 1] = 0 ; }
+        ++ entry ;
+      }
+      if (entrySize == 2) { ++ entries[2*e + 1] ; }
+    }
+  }
+  offsets[numWindows] = entry ;
+}
@@ -0,0 +1,82 @@
+/** @file dedup.hpp
+ ** @brief Deduplicated pooling windows
+ ** @author Michael Figurnov
+ **/
+
+/*
+ Copyright (C) 2015 Michael Figurnov.
+ All rights reserved.
+
+ This file is part of the VLFeat library and is made available under
+ the terms of the BSD license (see the COPYING file).
+ */
+
+#ifndef VL_NNDEDUP_H
+#define VL_NNDEDUP_H
+
+#include <stddef.h>
+
+/*
+ The POOLINDICES of a layer that reads a perforated input (InIndices)
+ list the same source pixel many times in a window, because the
+ missing pixels are copied from their nearest computed neighbour.
+ The deduplicated form keeps every distinct source of a window once,
+ with the number of times it occurs if the counts are stored:
+
+   header   [VL_DEDUP_MAGIC, windowSize, height, width, depth, numEntries, entrySize]
+   offsets  numWindows + 1 values: window w is made of the entries
+            offsets[w], ..., offsets[w + 1] - 1
+   entries  numEntries entries [index, count] (entrySize 2), or just
+            [index] (entrySize 1)
+
+ where HEIGHT x WIDTH x DEPTH is the geometry of the plain index array
+ (numWindows = height * width * depth / windowSize). The entries keep
+ the order of the first occurrences, so the max pooling (and its
+ derivative) resolves ties as with the plain indices. Only the average
+ pooling needs the counts: it divides by their sum, as the padding
+ (-1) is dropped.
+
+ VL_DEDUP_MAGIC is smaller than -1 and differs from VL_RLE_MAGIC.
+ */
+
+enum {
+  VL_DEDUP_MAGIC = -0x445550,
+  VL_DEDUP_HEADER_SIZE = 7
+} ;
+
+inline bool dedup_is_encoded(int const* indices, ptrdiff_t numElements) {
+  return numElements >= VL_DEDUP_HEADER_SIZE && indices[0] == VL_DEDUP_MAGIC ;
+}
+inline int dedup_window_size(int const* encoded) { return encoded[1] ; }
+inline int dedup_height(int const* encoded) { return encoded[2] ; }
+inline int dedup_width(int const* encoded) { return encoded[3] ; }
+inline int dedup_depth(int const* encoded) { return encoded[4] ; }
+inline int dedup_num_entries(int const* encoded) { return encoded[5] ; }
+inline int dedup_entry_size(int const* encoded) { return encoded[6] ; }
+inline int dedup_num_windows(int const* encoded) {
+  return encoded[1] ? (int)((ptrdiff_t)encoded[2] * encoded[3] * encoded[4] / encoded[1]) : 0 ;
+}
+inline int const* dedup_offsets(int const* encoded) { return encoded + VL_DEDUP_HEADER_SIZE ; }
+inline int const* dedup_entries(int const* encoded) {
+  return encoded + VL_DEDUP_HEADER_SIZE + dedup_num_windows(encoded) + 1 ;
+}
+
+/* number of int32 values of the encoding of an array with these many windows and entries */
+inline ptrdiff_t dedup_encoded_size(ptrdiff_t numWindows, ptrdiff_t numEntries, int entrySize) {
+  return VL_DEDUP_HEADER_SIZE + numWindows + 1 + entrySize * numEntries ;
+}
+
+int dedup_count_entries(int const* indices,
+                        int numWindows,
+                        int windowSize) ;
+
+void dedup_encode(int* encoded,
+                  int const* indices,
+                  int height,
+                  int width,
+                  int depth,
+                  int windowSize,
+                  int numEntries,
+                  int entrySize) ;
+
+#endif /* defined(VL_NNDEDUP_H) */
@@ -0,0 +1,265 @@
+/** @file epilogue.cpp
+ ** @brief Bias and ReLU applied to the output of a GEMM
+ ** @author Michael Figurnov
+ **/
+
+/*
+ Copyright (C) 2015 Michael Figurnov.
+ All rights reserved.
+
+ This file is part of the VLFeat library and is made available under
+ the terms of the BSD license (see the COPYING file).
+ */
+
+#pragma GCC optimize ("tree-vectorize")
+
+#include "epilogue.hpp"
+#include "threads.hpp"
+
+/*
+ The epilogues are usually called per image from kernels that already
+ run one image per thread, where a nested parallel region would be
+ serialized anyway; only a large block is split across the threads.
+ */
+static const ptrdiff_t minParallelVolume = 32768 ;
+
+template<typename T>
+void bias_relu_columns_cpu(T* y,
+                           ptrdiff_t ldy,
+                           T const* biases,
+                           ptrdiff_t m,
+                           ptrdiff_t n,
+                           bool relu)
+{
+#pragma omp parallel for num_threads(vl_get_num_threads()) if(n > 1 && m * n >= minParallelVolume)
+  for (ptrdiff_t j = 0 ; j < n ; ++j) {
+    T* __restrict__ column = y + j * ldy ;
+    T const bias = biases ? biases[j] : (T)0 ;
+    if (relu) {
+      for (ptrdiff_t i = 0 ; i < m ; ++i) {
+        T const value = column[i] + bias ;
+        column[i] = (value > 0) ? value : (T)0 ;
+      }
+    } else if (biases) {
+      for (ptrdiff_t i = 0 ; i < m ; ++i) {
+        column[i] += bias ;
+      }
+    }
+  }
+}
+
+template<typename T>
+void bias_relu_rows_cpu(T* y,
+                        ptrdiff_t ldy,
+                        T const* biases,
+                        ptrdiff_t m,
+                        ptrdiff_t n,
+                        bool relu)
+{
+#pragma omp parallel for num_threads(vl_get_num_threads()) if(n > 1 && m * n >= minParallelVolume)
+  for (ptrdiff_t j = 0 ; j < n ; ++j) {
+    T* __restrict__ column = y + j * ldy ;
+    if (relu && biases) {
+      for (ptrdiff_t i = 0 ; i < m ; ++i) {
+        T const value = column[i] + biases[i] ;
+        column[i] = (value > 0) ? value : (T)0 ;
+      }
+    } else if (relu) {
+      for (ptrdiff_t i = 0 ; i < m ; ++i) {
+        column[i] = (column[i] > 0) ? column[i] : (T)0 ;
+      }
+    } else if (biases) {
+      for (ptrdiff_t i = 0 ; i < m ; ++i) {
+        column[i] += biases[i] ;
+      }
+    }
+  }
+}
+
+template<typename T>
+void sum_columns_cpu(T* sums,
+                     T const* y,
+                     ptrdiff_t ldy,
+                     ptrdiff_t m,
+                     ptrdiff_t n,
+                     bool accumulate)
+{
+#pragma omp parallel for num_threads(vl_get_num_threads()) if(n > 1 && m * n >= minParallelVolume)
+  for (ptrdiff_t j = 0 ; j < n ; ++j) {
+    T const* __restrict__ column = y + j * ldy ;
+    T sum = 0 ;
+    for (ptrdiff_t i = 0 ; i < m ; ++i) {
+      sum += column[i] ;
+    }
+    sums[j] = accumulate ? sums[j] + sum : sum ;
+  }
+}
+
+template<typename T>
+void sum_rows_cpu(T* sums,
+                  T const* y,
+                  ptrdiff_t ldy,
+                  ptrdiff_t m,
+                  ptrdiff_t n,
+                  bool accumulate)
+{
+  /* the threads own disjoint row ranges and sweep all the columns */
+  ptrdiff_t const blockSize = 256 ;
+  ptrdiff_t const numBlocks = (m + blockSize - 1) / blockSize ;
+#pragma omp parallel for num_threads(vl_get_num_threads()) if(numBlocks > 1 && m * n >= minParallelVolume)
+  for (ptrdiff_t b = 0 ; b < numBlocks ; ++b) {
+    ptrdiff_t const begin = b * blockSize ;
+    ptrdiff_t const end = (begin + blockSize < m) ? begin + blockSize : m ;
+    T* __restrict__ blockSums = sums + begin ;
+    if (!accumulate) {
+      for (ptrdiff_t i = begin ; i < end ; ++i) { sums[i] = 0 ; }
+    }
+    for (ptrdiff_t j = 0 ; j < n ; ++j) {
+      T const* __restrict__ column = y + j * ldy + begin ;
+      for (ptrdiff_t i = 0 ; i < end - begin ; ++i) {
+        blockSums[i] += column[i] ;
+      }
+    }
+  }
+}
+
+template<typename T>
+void interpolate_cpu(T* y,
+                     T const* x,
+                     int const* indices,
+                     ptrdiff_t numPixels,
+                     ptrdiff_t m,
+                     ptrdiff_t depth)
+{
+#pragma omp parallel for num_threads(vl_get_num_threads()) if(depth > 1 && numPixels * depth >= minParallelVolume)
+  for (ptrdiff_t j = 0 ; j < depth ; ++j) {
+    T* __restrict__ dst = y + j * numPixels ;
+    T const* __restrict__ src = x + j * m ;
+    for (ptrdiff_t p = 0 ; p < numPixels ; ++p) {
+      int idxValue = indices[p] ;
+      dst[p] = (idxValue != -1) ? src[idxValue] : (T)0 ;
+    }
+  }
+}
+
+template<typename T>
+void interpolate_backward_cpu(T* derX,
+                              T const* derY,
+                              int const* indices,
+                              ptrdiff_t numPixels,
+                              ptrdiff_t m,
+                              ptrdiff_t depth)
+{
+#pragma omp parallel for num_threads(vl_get_num_threads()) if(depth > 1 && numPixels * depth >= minParallelVolume)
+  for (ptrdiff_t j = 0 ; j < depth ; ++j) {
+    T* __restrict__ dst = derX + j * m ;
+    T const* __restrict__ src = derY + j * numPixels ;
+    for (ptrdiff_t i = 0 ; i < m ; ++i) { dst[i] = 0 ; }
+    for (ptrdiff_t p = 0 ; p < numPixels ; ++p) {
+      int idxValue = indices[p] ;
+      if (idxValue != -1) { dst[idxValue] += src[p] ; }
+    }
+  }
+}
+
+template<typename T>
+void interpolate_hwc_cpu(T* y,
+                         T const* x,
+                         int const* indices,
+                         ptrdiff_t numPixels,
+                         ptrdiff_t depth)
+{
+#pragma omp parallel for num_threads(vl_get_num_threads()) if(numPixels > 1 && numPixels * depth >= minParallelVolume)
+  for (ptrdiff_t p = 0 ; p < numPixels ; ++p) {
+    T* __restrict__ dst = y + p * depth ;
+    int idxValue = indices[p] ;
+    if (idxValue == -1) {
+      for (ptrdiff_t j = 0 ; j < depth ; ++j) { dst[j] = 0 ; }
+    } else {
+      T const* __restrict__ src = x + (ptrdiff_t)idxValue * depth ;
+      for (ptrdiff_t j = 0 ; j < depth ; ++j) { dst[j] = src[j] ; }
+    }
+  }
+}
+
+/* several pixels of Y may add to the same pixel of X: sequential */
+template<typename T>
+void interpolate_backward_hwc_cpu(T* derX,
+                                  T const* derY,
+                                  int const* indices,
+                                  ptrdiff_t numPixels,
+                                  ptrdiff_t m,
+                                  ptrdiff_t depth)
+{
+  for (ptrdiff_t i = 0 ; i < m * depth ; ++i) { derX[i] = 0 ; }
+  for (ptrdiff_t p = 0 ; p < numPixels ; ++p) {
+    int idxValue = indices[p] ;
+    if (idxValue == -1) { continue ; }
+    T* __restrict__ dst = derX + (ptrdiff_t)idxValue * depth ;
+    T const* __restrict__ src = derY + p * depth ;
+    for (ptrdiff_t j = 0 ; j < depth ; ++j) { dst[j] += src[j] ; }
+  }
+}
+
+template
+void bias_relu_columns_cpu<float>(float* y,
+                                  ptrdiff_t ldy,
+                                  float const* biases,
+                                  ptrdiff_t m,
+                                  ptrdiff_t n,
+                                  bool relu) ;
+
+template
+void bias_relu_rows_cpu<float>(float* y,
+                               ptrdiff_t ldy,
+                               float const* biases,
+                               ptrdiff_t m,
+                               ptrdiff_t n,
+                               bool relu) ;
+
+template
+void sum_columns_cpu<float>(float* sums,
+                            float const* y,
+                            ptrdiff_t ldy,
+                            ptrdiff_t m,
+                            ptrdiff_t n,
+                            bool accumulate) ;
+
+template
+void sum_rows_cpu<float>(float* sums,
+                         float const* y,
+                         ptrdiff_t ldy,
+                         ptrdiff_t m,
+                         ptrdiff_t n,
+                         bool accumulate) ;
+
+template
+void interpolate_cpu<float>(float* y,
+                            float const* x,
+                            int const* indices,
+                            ptrdiff_t numPixels,
+                            ptrdiff_t m,
+                            ptrdiff_t depth) ;
+
+template
+void interpolate_backward_cpu<float>(float* derX,
+                                     float const* derY,
+                                     int const* indices,
+                                     ptrdiff_t numPixels,
+                                     ptrdiff_t m,
+                                     ptrdiff_t depth) ;
+
+template
+void interpolate_hwc_cpu<float>(float* y,
+                                float const* x,
+                                int const* indices,
+                                ptrdiff_t numPixels,
+                                ptrdiff_t depth) ;
+
+template
+void interpolate_backward_hwc_cpu<float>(float* derX,
+                                         float const* derY,
+                                         int const* indices,
+                                         ptrdiff_t numPixels,
+                                         ptrdiff_t m,
+                                         ptrdiff_t depth) ;
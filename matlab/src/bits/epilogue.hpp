@@ -0,0 +1,111 @@
+/** @file epilogue.hpp
+ ** @brief Bias and ReLU applied to the output of a GEMM
+ ** @author Michael Figurnov
+ **/
+
+/*
+ Copyright (C) 2015 Michael Figurnov.
+ All rights reserved.
+
+ This file is part of the VLFeat library and is made available under
+ the terms of the BSD license (see the COPYING file).
+ */
+
+#ifndef VL_NNEPILOGUE_H
+#define VL_NNEPILOGUE_H
+
+#include <cstddef>
+
+/*
+ The convolutions compute their output as a sequence of GEMMs. These
+ functions finish a M x N block Y of that output (column-major, with
+ leading dimension LDY) right after the GEMM that wrote it, while it
+ is still in the cache, instead of making a separate pass over the
+ whole output.
+
+ bias_relu_columns_cpu() adds BIASES[j] to column j of Y (the default
+ layout, where the columns are the channels); bias_relu_rows_cpu()
+ adds BIASES[i] to row i (the channel-last layout). BIASES may be
+ NULL. If RELU is true, the result is then clamped at zero.
+
+ sum_columns_cpu() and sum_rows_cpu() are the corresponding bias
+ derivatives: SUMS[j] (resp. SUMS[i]) is set to, or incremented by if
+ ACCUMULATE is true, the sum of column j (resp. row i) of Y.
+ */
+
+template<typename T>
+void bias_relu_columns_cpu(T* y,
+                           ptrdiff_t ldy,
+                           T const* biases,
+                           ptrdiff_t m,
+                           ptrdiff_t n,
+                           bool relu) ;
+
+template<typename T>
+void bias_relu_rows_cpu(T* y,
+                        ptrdiff_t ldy,
+                        T const* biases,
+                        ptrdiff_t m,
+                        ptrdiff_t n,
+                        bool relu) ;
+
+template<typename T>
+void sum_columns_cpu(T* sums,
+                     T const* y,
+                     ptrdiff_t ldy,
+                     ptrdiff_t m,
+                     ptrdiff_t n,
+                     bool accumulate) ;
+
+template<typename T>
+void sum_rows_cpu(T* sums,
+                  T const* y,
+                  ptrdiff_t ldy,
+                  ptrdiff_t m,
+                  ptrdiff_t n,
+                  bool accumulate) ;
+
+/*
+ Nearest-neighbour interpolation of a perforated output. X holds the
+ M computed pixels of each of the DEPTH channels of one image; Y gets
+ the NUMPIXELS pixels of the full resolution output, pixel p being a
+ copy of pixel INDICES[p] of X, or zero if INDICES[p] is -1.
+ The _hwc variants use channel-last images (DEPTH x pixels in memory);
+ interpolate_hwc_cpu() does not need M.
+
+ The backward functions set DERX to the adjoint: each pixel of X
+ receives the sum of the derivatives of the pixels of Y copied from it.
+ */
+
+template<typename T>
+void interpolate_cpu(T* y,
+                     T const* x,
+                     int const* indices,
+                     ptrdiff_t numPixels,
+                     ptrdiff_t m,
+                     ptrdiff_t depth) ;
+
+template<typename T>
+void interpolate_backward_cpu(T* derX,
+                              T const* derY,
+                              int const* indices,
+                              ptrdiff_t numPixels,
+                              ptrdiff_t m,
+                              ptrdiff_t depth) ;
+
+template<typename T>
+void interpolate_hwc_cpu(T* y,
+                         T const* x,
+                         int const* indices,
+                         ptrdiff_t numPixels,
+                         ptrdiff_t depth) ;
+
+template<typename T>
+void interpolate_backward_hwc_cpu(T* derX,
+                                  T const* derY,
+                                  int const* indices,
+                                  ptrdiff_t numPixels,
+                                  ptrdiff_t m,
+                                  ptrdiff_t depth) ;
+
+#endif /* defined(VL_NNEPILOGUE_H) */
@@ -0,0 +1,225 @@
+/** @file gather_gemm.cpp
+ ** @brief Indexed convolution as a fused gather and matrix product
+ ** @author Michael Figurnov
+ **/
+
+/*
+ Copyright (C) 2015 Michael Figurnov.
+ All rights reserved.
+
+ This file is part of the VLFeat library and is made available under
+ the terms of the BSD license (see the COPYING file).
+ */
+
+#include "gather_gemm.hpp"
+#include "threads.hpp"
+
+#include <algorithm>
+#include <vector>
+
+#ifndef _MSC_VER
+#pragma GCC optimize ("tree-vectorize")
+#endif
+
+/*
+ The product C = A * B, where A is the (implicit) m x k im2col matrix
+ of one image and B the k x n filter matrix of one group, follows the
+ usual blocking of high performance GEMMs:
+
+ - B is packed once per group into panels of NR columns;
+ - for each block of MC rows and KC columns of A, the corresponding
+   pixels are gathered from the data into panels of MR rows (this is
+   the only place where A exists, MC x KC values per thread);
+ - a MR x NR register tile of C is computed by the micro-kernel from
+   one panel of A and one panel of B.
+
+ The blocks of rows of the different images are independent and are
+ distributed among the CPU threads.
+ */
+
+namespace {
+  enum {
+    MR = 8,
+    NR = 4,
+    MC = 128,
+    KC = 256
+  } ;
+}
+
+/* B panel j: packed[(j * k + p) * NR + jj] = filters[(j * NR + jj) * k + p] */
+template<typename T>
+static void
+pack_filters(T* packed, T const* filters, int k, int n)
+{
+  int numPanels = (n + NR - 1) / NR ;
+  for (int j = 0 ; j < numPanels ; ++j) {
+    for (int p = 0 ; p < k ; ++p) {
+      for (int jj = 0 ; jj < NR ; ++jj) {
+        int f = j * NR + jj ;
+        packed[((ptrdiff_t)j * k + p) * NR + jj] = (f < n) ? filters[(ptrdiff_t)f * k + p] : 0 ;
+      }
+    }
+  }
+}
+
+/*
+ A panel i: packed[(i * kc + p) * MR + r] is the im2col element at row
+ i0 + i * MR + r and column p0 + p, where the column p0 + p corresponds
+ to the channel c and the window offset d.
+ */
+template<typename T>
+static void
+pack_gathered(T* packed,
+              T const* image,
+              ptrdiff_t area,
+              int const* indices,
+              int m,
+              int depthCol,
+              int i0, int mc,
+              int p0, int kc)
+{
+  int numPanels = (mc + MR - 1) / MR ;
+  for (int i = 0 ; i < numPanels ; ++i) {
+    int x0 = i0 + i * MR ;
+    int mr = std::min((int)MR, i0 + mc - x0) ;
+    T* panel = packed + (ptrdiff_t)i * kc * MR ;
+    for (int p = 0 ; p < kc ; ++p) {
+      int c = (p0 + p) / depthCol ;
+      int d = (p0 + p) % depthCol ;
+      T const* channel = image + c * area ;
+      int const* curIndices = indices + (ptrdiff_t)d * m + x0 ;
+      for (int r = 0 ; r < mr ; ++r) {
+        int idxValue = curIndices[r] ;
+        panel[p * MR + r] = (idxValue != -1) ? channel[idxValue] : 0 ;
+      }
+      for (int r = mr ; r < MR ; ++r) {
+        panel[p * MR + r] = 0 ;
+      }
+    }
+  }
+}
+
+/*
+ C(0:mr, 0:nr) = (accumulate ? C : bias) + A panel * B panel, clamped
+ at zero if relu is true (only for the last block of columns of A)
+ */
+template<typename T>
+static inline void
+micro_kernel(int kc,
+             T const* __restrict a,
+             T const* __restrict b,
+             T* c, ptrdiff_t ldc,
+             int mr, int nr,
+             bool accumulate,
+             T const* bias,
+             bool relu)
+{
+  T acc [NR][MR] ;
+  for (int jj = 0 ; jj < NR ; ++jj) {
+    for (int r = 0 ; r < MR ; ++r) { acc[jj][r] = 0 ; }
+  }
+  for (int p = 0 ; p < kc ; ++p) {
+    for (int jj = 0 ; jj < NR ; ++jj) {
+      T bv = b[p * NR + jj] ;
+      for (int r = 0 ; r < MR ; ++r) {
+        acc[jj][r] += a[p * MR + r] * bv ;
+      }
+    }
+  }
+  for (int jj = 0 ; jj < nr ; ++jj) {
+    T* col = c + jj * ldc ;
+    if (accumulate) {
+      for (int r = 0 ; r < mr ; ++r) { col[r] += acc[jj][r] ; }
+    } else {
+      T offset = bias ? bias[jj] : 0 ;
+      for (int r = 0 ; r < mr ; ++r) { col[r] = offset + acc[jj][r] ; }
+    }
+    if (relu) {
+      for (int r = 0 ; r < mr ; ++r) { col[r] = (col[r] > 0) ? col[r] : 0 ; }
+    }
+  }
+}
+
+template<typename T>
+void conv_indexed_gather_gemm_cpu(T* output,
+                                  T const* data,
+                                  T const* filters,
+                                  T const* biases,
+                                  int const* indices,
+                                  int indicesSize,
+                                  int width,
+                                  int height,
+                                  int depth,
+                                  int size,
+                                  int windowWidth,
+                                  int windowHeight,
+                                  int numFilters,
+                                  int numGroups,
+                                  bool relu)
+{
+  int depthCol = windowWidth * windowHeight ;
+  int m = indicesSize / depthCol ; /* num output pixels */
+  int filtersDepth = depth / numGroups ;
+  int n = numFilters / numGroups ; /* num filters per group */
+  int k = filtersDepth * depthCol ; /* filter volume */
+  int numFilterPanels = (n + NR - 1) / NR ;
+  int numRowBlocks = (m + MC - 1) / MC ;
+  int numTasks = size * numRowBlocks ;
+  ptrdiff_t area = (ptrdiff_t)width * height ;
+
+  std::vector<T> packedFilters ((ptrdiff_t)numFilterPanels * NR * k) ;
+
+  for (int g = 0 ; g < numGroups ; ++g) {
+    pack_filters(&packedFilters[0], filters + (ptrdiff_t)k * n * g, k, n) ;
+
+#pragma omp parallel num_threads(vl_get_num_threads()) if(numTasks > 1)
+    {
+      std::vector<T> packedData ((ptrdiff_t)MC * KC) ;
+
+#pragma omp for schedule(dynamic)
+      for (int task = 0 ; task < numTasks ; ++task) {
+        int s = task / numRowBlocks ;
+        int i0 = (task % numRowBlocks) * MC ;
+        int mc = std::min((int)MC, m - i0) ;
+        T const* image = data + ((ptrdiff_t)s * depth + g * filtersDepth) * area ;
+        T* out = output + ((ptrdiff_t)s * numFilters + g * n) * m + i0 ;
+
+        for (int p0 = 0 ; p0 < k ; p0 += KC) {
+          int kc = std::min((int)KC, k - p0) ;
+          pack_gathered(&packedData[0], image, area, indices, m, depthCol, i0, mc, p0, kc) ;
+          for (int j = 0 ; j < numFilterPanels ; ++j) {
+            T const* b = &packedFilters[0] + ((ptrdiff_t)j * k + p0) * NR ;
+            T const* bias = (biases && p0 == 0) ? biases + g * n + j * NR : NULL ;
+            int nr = std::min((int)NR, n - j * NR) ;
+            for (int i = 0 ; i * MR < mc ; ++i) {
+              micro_kernel(kc,
+                           &packedData[0] + (ptrdiff_t)i * kc * MR,
+                           b,
+                           out + (ptrdiff_t)j * NR * m + i * MR, m,
+                           std::min((int)MR, mc - i * MR), nr,
+                           p0 > 0,
+                           bias,
+                           relu && p0 + kc == k) ;
+            }
+          }
+        }
+      }
+    }
+  }
+}
+
+template void conv_indexed_gather_gemm_cpu<float>(float* output,
+                                                  float const* data,
+                                                  float const* filters,
+                                                  float const* biases,
+                                                  int const* indices,
+                                                  int indicesSize,
+                                                  int width,
+                                                  int height,
+                                                  int depth,
+                                                  int size,
+                                                  int windowWidth,
+                                                  int windowHeight,
+                                                  int numFilters,
+                                                  int numGroups,
+                                                  bool relu) ;
@@ -0,0 +1,46 @@
+/** @file gather_gemm.hpp
+ ** @brief Indexed convolution as a fused gather and matrix product
+ ** @author Michael Figurnov
+ **/
+
+/*
+ Copyright (C) 2015 Michael Figurnov.
+ All rights reserved.
+
+ This file is part of the VLFeat library and is made available under
+ the terms of the BSD license (see the COPYING file).
+ */
+
+#ifndef VL_NNGATHER_GEMM_H
+#define VL_NNGATHER_GEMM_H
+
+#include <stddef.h>
+
+/*
+ Computes the same result as im2col_indexed_cpu followed by a GEMM
+ with the filters (and the addition of the biases), without forming
+ the im2col matrix. Blocks of it are gathered from DATA with INDICES
+ directly into small packed panels consumed by a cache-blocked GEMM
+ kernel, and the result is written in the HEIGHT x WIDTH x NUMFILTERS
+ x SIZE layout of the output. BIASES may be NULL. If RELU is true,
+ the output is clamped at zero when its tiles are written.
+ */
+
+template<typename T>
+void conv_indexed_gather_gemm_cpu(T* output,
+                                  T const* data,
+                                  T const* filters,
+                                  T const* biases,
+                                  int const* indices,
+                                  int indicesSize,
+                                  int width,
+                                  int height,
+                                  int depth,
+                                  int size,
+                                  int windowWidth,
+                                  int windowHeight,
+                                  int numFilters,
+                                  int numGroups,
+                                  bool relu) ;
+
+#endif /* defined(VL_NNGATHER_GEMM_H) */
@@ -12,7 +12,13 @@ the terms of the BSD license (see the COPYING file).
 */
 
 #include "im2col.hpp"
+#include "threads.hpp"
+#include "im2col_simd.hpp"
+#include "runlength.hpp"
 #include <string.h>
+#include <algorithm>
+#include <utility>
+#include <vector>
 
 static inline int floor_divide(int a, int b) {
   if (a >= 0) return a/b;
@@ -164,6 +170,48 @@ template void im2col_cpu<double>(double* stacked,
 /*                          im2col with precalculated indices (CPU) */
 /* ---------------------------------------------------------------- */
 
+/*
+ The stacked matrix has layout (maskIndicesLength x size x depthCol x
+ depth), so that the columns of the images in a microbatch are stacked
+ vertically. Each (image, channel) pair reads from and writes to its
+ own slice, hence the pairs are distributed among the CPU threads.
+ The single precision rows go through the vectorized kernels of
+ im2col_simd.hpp.
+ */
+
+template <typename T>
+static inline void indexed_gather(T* __restrict__ dst,
+                                  T const* __restrict__ src,
+                                  int const* __restrict__ idx,
+                                  int n)
+{
+  for (int x = 0; x < n; ++x) {
+    int idxValue = idx[x];
+    dst[x] = (idxValue != -1) ? src[idxValue] : 0;
+  }
+}
+
+static inline void indexed_gather(float* dst, float const* src, int const* idx, int n)
+{
+  vl_indexed_gather(dst, src, idx, n);
+}
+
+template <typename T>
+static inline void indexed_scatter_add(T* dst, T const* src, int const* idx, int n)
+{
+  for (int x = 0; x < n; ++x) {
+    int idxValue = idx[x];
+    if (idxValue != -1) {
+      dst[idxValue] += src[x];
+    }
+  }
+}
+
+static inline void indexed_scatter_add(float* dst, float const* src, int const* idx, int n)
+{
+  vl_indexed_scatter_add(dst, src, idx, n);
+}
+
 template <typename T>
 void im2col_indexed_cpu(T* __restrict__ stacked,
                         T const* __restrict__ data,
@@ -176,28 +224,20 @@ void im2col_indexed_cpu(T* __restrict__ stacked,
                         int windowWidth,
                         int windowHeight)
 {
-  if (size == 1) {
-    for (int c = 0; c < depth; ++c) {
-      for (int x = 0; x < indicesSize; ++x) {
-        int idxValue = indices[x];
-        stacked[c * indicesSize + x] = (idxValue != -1) ? data[c * width * height + idxValue] : 0;
-      }
+  int depthCol = windowWidth * windowHeight;
+  int maskIndicesLength = indicesSize / depthCol;
+  int numSlices = size * depth;
+
+#pragma omp parallel for num_threads(vl_get_num_threads()) if(numSlices > 1)
+  for (int sc = 0; sc < numSlices; ++sc) {
+    int s = sc / depth;
+    int c = sc % depth;
+    T const* __restrict__ slice = data + (ptrdiff_t)sc * width * height;
+    for (int d = 0; d < depthCol; ++d) {
+      int const* __restrict__ curIndices = indices + d * maskIndicesLength;
+      T* __restrict__ curStacked = stacked + ((ptrdiff_t)(c * depthCol + d) * size + s) * maskIndicesLength;
+      indexed_gather(curStacked, slice, curIndices, maskIndicesLength);
     }
-  } else {
-    int depthCol = windowWidth * windowHeight;
-    int maskIndicesLength = indicesSize / depthCol;
-
-    for (int s = 0; s < size; ++s) {
-      for (int c = 0; c < depth; ++c) {
-        for (int d = 0; d < depthCol; ++d) {
-          for (int x = 0; x < maskIndicesLength; ++x) {
-            int idxValue = indices[d * maskIndicesLength + x];
-            stacked[((c * depthCol + d) * size + s) * maskIndicesLength + x] =
-              (idxValue != -1) ? data[(s * depth + c) * width * height + idxValue] : 0;
-          }
-        }
-      }
-    }    
   }
 }
 
@@ -297,6 +337,12 @@ template void col2im_cpu<double>(double* data,
                                  size_t padTop,
                                  size_t padBottom);
 
+/*
+ Several columns may scatter to the same pixel of an image, but never
+ to a different (image, channel) slice, so the slices are processed in
+ parallel without write races.
+ */
+
 template<typename T>
 void col2im_indexed_cpu(T* data,
                         T const* stacked,
@@ -309,32 +355,20 @@ void col2im_indexed_cpu(T* data,
                         int windowWidth,
                         int windowHeight)
 {
-  memset(data, 0, sizeof(T)*width*height*depth*size);
-
-  if (size == 1) {
-    for (int c = 0; c < depth; ++c) {
-      for (int x = 0; x < indicesSize; ++x) {
-        int idxValue = indices[x];
-        if (idxValue != -1) {
-          data[c * width * height + idxValue] += stacked[c * indicesSize + x];
-        }
-      }
-    }
-  } else {
-    int depthCol = windowWidth * windowHeight;
-    int maskIndicesLength = indicesSize / depthCol;
-
-    for (int s = 0; s < size; ++s) {
-      for (int c = 0; c < depth; ++c) {
-        for (int d = 0; d < depthCol; ++d) {
-          for (int x = 0; x < maskIndicesLength; ++x) {
-            int idxValue = indices[d * maskIndicesLength + x];
-            if (idxValue != -1) {
-              data[(s * depth + c) * width * height + idxValue] += stacked[((c * depthCol + d) * size + s) * maskIndicesLength + x];
-            }
-          }
-        }
-      }
+  int depthCol = windowWidth * windowHeight;
+  int maskIndicesLength = indicesSize / depthCol;
+  int numSlices = size * depth;
+
+#pragma omp parallel for num_threads(vl_get_num_threads()) if(numSlices > 1)
+  for (int sc = 0; sc < numSlices; ++sc) {
+    int s = sc / depth;
+    int c = sc % depth;
+    T* slice = data + (ptrdiff_t)sc * width * height;
+    memset(slice, 0, sizeof(T)*width*height);
+    for (int d = 0; d < depthCol; ++d) {
+      int const* curIndices = indices + d * maskIndicesLength;
+      T const* curStacked = stacked + ((ptrdiff_t)(c * depthCol + d) * size + s) * maskIndicesLength;
+      indexed_scatter_add(slice, curStacked, curIndices, maskIndicesLength);
     }
   }
 }
@@ -362,6 +396,264 @@ template void col2im_indexed_cpu<double>(double* data,
                                          int windowHeight);
 
 
+/* ---------------------------------------------------------------- */
+/*                           im2col and col2im with index runs (CPU) */
+/* ---------------------------------------------------------------- */
+
+/*
+ Each list of the encoded indices is a row of the stacked matrix
+ (one window offset), hence a run of consecutive pixels is a single
+ memcpy (or a vectorizable loop of additions for col2im).
+ */
+
+template <typename T>
+void im2col_indexed_runs_cpu(T* stacked,
+                             T const* data,
+                             int const* encodedIndices,
+                             int width,
+                             int height,
+                             int depth,
+                             int size)
+{
+  int depthCol = rle_num_lists(encodedIndices);
+  int maskIndicesLength = rle_list_length(encodedIndices);
+  int const* lists = rle_lists(encodedIndices);
+  int const* runs = rle_runs(encodedIndices);
+  int numSlices = size * depth;
+
+#pragma omp parallel for num_threads(vl_get_num_threads()) if(numSlices > 1)
+  for (int sc = 0; sc < numSlices; ++sc) {
+    int s = sc / depth;
+    int c = sc % depth;
+    T const* slice = data + (ptrdiff_t)sc * width * height;
+    for (int d = 0; d < depthCol; ++d) {
+      int const* curRuns = runs + 2 * (ptrdiff_t)lists[2*d];
+      T* curStacked = stacked + ((ptrdiff_t)(c * depthCol + d) * size + s) * maskIndicesLength;
+      for (int r = 0; r < lists[2*d + 1]; ++r) {
+        int start = curRuns[2*r];
+        int length = curRuns[2*r + 1];
+        if (start != -1) {
+          memcpy(curStacked, slice + start, sizeof(T) * length);
+        } else {
+          memset(curStacked, 0, sizeof(T) * length);
+        }
+        curStacked += length;
+      }
+    }
+  }
+}
+
+template void im2col_indexed_runs_cpu<float>(float* stacked,
+                                             float const* data,
+                                             int const* encodedIndices,
+                                             int width,
+                                             int height,
+                                             int depth,
+                                             int size);
+
+template<typename T>
+void col2im_indexed_runs_cpu(T* data,
+                             T const* stacked,
+                             int const* encodedIndices,
+                             int width,
+                             int height,
+                             int depth,
+                             int size)
+{
+  int depthCol = rle_num_lists(encodedIndices);
+  int maskIndicesLength = rle_list_length(encodedIndices);
+  int const* lists = rle_lists(encodedIndices);
+  int const* runs = rle_runs(encodedIndices);
+  int numSlices = size * depth;
+
+#pragma omp parallel for num_threads(vl_get_num_threads()) if(numSlices > 1)
+  for (int sc = 0; sc < numSlices; ++sc) {
+    int s = sc / depth;
+    int c = sc % depth;
+    T* slice = data + (ptrdiff_t)sc * width * height;
+    memset(slice, 0, sizeof(T)*width*height);
+    for (int d = 0; d < depthCol; ++d) {
+      int const* curRuns = runs + 2 * (ptrdiff_t)lists[2*d];
+      T const* curStacked = stacked + ((ptrdiff_t)(c * depthCol + d) * size + s) * maskIndicesLength;
+      for (int r = 0; r < lists[2*d + 1]; ++r) {
+        int start = curRuns[2*r];
+        int length = curRuns[2*r + 1];
+        if (start != -1) {
+          T* __restrict__ dst = slice + start;
+          T const* __restrict__ src = curStacked;
+          for (int x = 0; x < length; ++x) {
+            dst[x] += src[x];
+          }
+        }
+        curStacked += length;
+      }
+    }
+  }
+}
+
+template void col2im_indexed_runs_cpu<float>(float* data,
+                                             float const* stacked,
+                                             int const* encodedIndices,
+                                             int width,
+                                             int height,
+                                             int depth,
+                                             int size);
+
+/* ---------------------------------------------------------------- */
+/*                        im2col and col2im, channel-last data (CPU) */
+/* ---------------------------------------------------------------- */
+
+/*
+ In the channel-last layout the channels of a pixel are contiguous,
+ so every index addresses a whole vector of channels and the gather
+ (scatter-add) of a column is a sequence of vector copies (additions)
+ instead of depth strided accesses.
+ */
+
+template <typename T>
+void im2col_indexed_hwc_cpu(T* stacked,
+                            T const* data,
+                            int const* indices,
+                            int indicesSize,
+                            int width,
+                            int height,
+                            int depth,
+                            int size,
+                            int windowWidth,
+                            int windowHeight,
+                            int numGroups)
+{
+  int depthCol = windowWidth * windowHeight;
+  int maskIndicesLength = indicesSize / depthCol;
+  int groupDepth = depth / numGroups;
+  int numCols = size * maskIndicesLength;
+  ptrdiff_t groupStride = (ptrdiff_t)numCols * depthCol * groupDepth;
+
+#pragma omp parallel for num_threads(vl_get_num_threads()) if(numCols > 1)
+  for (int col = 0; col < numCols; ++col) {
+    int s = col / maskIndicesLength;
+    int x = col % maskIndicesLength;
+    T const* image = data + (ptrdiff_t)s * width * height * depth;
+    T* curStacked = stacked + (ptrdiff_t)col * depthCol * groupDepth;
+    for (int d = 0; d < depthCol; ++d) {
+      int idxValue = indices[d * maskIndicesLength + x];
+      for (int g = 0; g < numGroups; ++g) {
+        T* dst = curStacked + g * groupStride + d * groupDepth;
+        if (idxValue != -1) {
+          memcpy(dst, image + (ptrdiff_t)idxValue * depth + g * groupDepth, sizeof(T) * groupDepth);
+        } else {
+          memset(dst, 0, sizeof(T) * groupDepth);
+        }
+      }
+    }
+  }
+}
+
+template void im2col_indexed_hwc_cpu<float>(float* stacked,
+                                            float const* data,
+                                            int const* indices,
+                                            int indicesSize,
+                                            int width,
+                                            int height,
+                                            int depth,
+                                            int size,
+                                            int windowWidth,
+                                            int windowHeight,
+                                            int numGroups);
+
+template<typename T>
+void col2im_indexed_hwc_cpu(T* data,
+                            T const* stacked,
+                            int const* indices,
+                            int indicesSize,
+                            int width,
+                            int height,
+                            int depth,
+                            int size,
+                            int windowWidth,
+                            int windowHeight,
+                            int numGroups)
+{
+  int depthCol = windowWidth * windowHeight;
+  int maskIndicesLength = indicesSize / depthCol;
+  int groupDepth = depth / numGroups;
+  ptrdiff_t imageVolume = (ptrdiff_t)width * height * depth;
+  ptrdiff_t groupStride = (ptrdiff_t)size * maskIndicesLength * depthCol * groupDepth;
+
+  /* the columns of an image may add to the same pixel, the images are independent */
+#pragma omp parallel for num_threads(vl_get_num_threads()) if(size > 1)
+  for (int s = 0; s < size; ++s) {
+    T* image = data + s * imageVolume;
+    memset(image, 0, sizeof(T) * imageVolume);
+    for (int x = 0; x < maskIndicesLength; ++x) {
+      T const* curStacked = stacked + ((ptrdiff_t)s * maskIndicesLength + x) * depthCol * groupDepth;
+      for (int d = 0; d < depthCol; ++d) {
+        int idxValue = indices[d * maskIndicesLength + x];
+        if (idxValue == -1) { continue; }
+        for (int g = 0; g < numGroups; ++g) {
+          T* __restrict__ dst = image + (ptrdiff_t)idxValue * depth + g * groupDepth;
+          T const* __restrict__ src = curStacked + g * groupStride + d * groupDepth;
+          for (int c = 0; c < groupDepth; ++c) {
+            dst[c] += src[c];
+          }
+        }
+      }
+    }
+  }
+}
+
+template void col2im_indexed_hwc_cpu<float>(float* data,
+                                            float const* stacked,
+                                            int const* indices,
+                                            int indicesSize,
+                                            int width,
+                                            int height,
+                                            int depth,
+                                            int size,
+                                            int windowWidth,
+                                            int windowHeight,
+                                            int numGroups);
+
+/* ---------------------------------------------------------------- */
+/*                                                  transpose (CPU) */
+/* ---------------------------------------------------------------- */
+
+template<typename T>
+void transpose12_cpu(T* transposed,
+                     T const* data,
+                     size_t d1,
+                     size_t d2,
+                     size_t d3)
+{
+  /* blocks of 32 x 32 elements stay in the L1 cache */
+  ptrdiff_t const block = 32;
+  ptrdiff_t numBlocks1 = ((ptrdiff_t)d1 + block - 1) / block;
+  ptrdiff_t numBlocks2 = ((ptrdiff_t)d2 + block - 1) / block;
+  ptrdiff_t numTasks = (ptrdiff_t)d3 * numBlocks1 * numBlocks2;
+
+#pragma omp parallel for num_threads(vl_get_num_threads()) if(numTasks > 1)
+  for (ptrdiff_t task = 0; task < numTasks; ++task) {
+    ptrdiff_t k = task / (numBlocks1 * numBlocks2);
+    ptrdiff_t i0 = (task % numBlocks1) * block;
+    ptrdiff_t j0 = ((task / numBlocks1) % numBlocks2) * block;
+    ptrdiff_t i1 = (i0 + block < (ptrdiff_t)d1) ? i0 + block : (ptrdiff_t)d1;
+    ptrdiff_t j1 = (j0 + block < (ptrdiff_t)d2) ? j0 + block : (ptrdiff_t)d2;
+    T const* src = data + k * d1 * d2;
+    T* dst = transposed + k * d1 * d2;
+    for (ptrdiff_t j = j0; j < j1; ++j) {
+      for (ptrdiff_t i = i0; i < i1; ++i) {
+        dst[i * d2 + j] = src[j * d1 + i];
+      }
+    }
+  }
+}
+
+template void transpose12_cpu<float>(float* transposed,
+                                     float const* data,
+                                     size_t d1,
+                                     size_t d2,
+                                     size_t d3);
+
 template<typename T>
 void transpose23_cpu(T* transposed,
                      T const* data,
@@ -369,9 +661,10 @@ void transpose23_cpu(T* transposed,
                      size_t d2,
                      size_t d3)
 {
-  for (int k = 0; k < d3; ++k) {
-    for (int j = 0; j < d2; ++j) {
-      memcpy(transposed + j*(d1*d3) + k*d1, data + k*(d1*d2) + j*d1, d1 * sizeof(float));
+#pragma omp parallel for num_threads(vl_get_num_threads()) if(d2*d3 > 1)
+  for (int k = 0; k < (int)d3; ++k) {
+    for (size_t j = 0; j < d2; ++j) {
+      memcpy(transposed + j*(d1*d3) + k*d1, data + k*(d1*d2) + j*d1, d1 * sizeof(T));
     }
   }
 }
@@ -430,3 +723,34 @@ void conv_indices_cpu(int* indices,
     }
   }
 }
+
+/* spreads the 32 bits of x over the even bits of the result */
+static inline unsigned long long morton_spread(unsigned int x)
+{
+  unsigned long long v = x ;
+  v = (v | (v << 16)) & 0x0000ffff0000ffffULL ;
+  v = (v | (v << 8))  & 0x00ff00ff00ff00ffULL ;
+  v = (v | (v << 4))  & 0x0f0f0f0f0f0f0f0fULL ;
+  v = (v | (v << 2))  & 0x3333333333333333ULL ;
+  v = (v | (v << 1))  & 0x5555555555555555ULL ;
+  return v ;
+}
+
+void mask_indices_order_cpu(int* order,
+                            int const* maskIndices,
+                            int maskIndicesLength,
+                            int height,
+                            bool morton)
+{
+  std::vector<std::pair<unsigned long long, int> > keys(maskIndicesLength) ;
+  for (int i = 0; i < maskIndicesLength; ++i) {
+    unsigned int y = maskIndices[i] % height ;
+    unsigned int x = maskIndices[i] / height ;
+    keys[i].first = morton ? (morton_spread(y) | (morton_spread(x) << 1)) : maskIndices[i] ;
+    keys[i].second = i ;
+  }
+  std::sort(keys.begin(), keys.end()) ;
+  for (int i = 0; i < maskIndicesLength; ++i) {
+    order[i] = keys[i].second ;
+  }
+}
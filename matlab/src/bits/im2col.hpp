@@ -16,7 +16,6 @@ the terms of the BSD license (see the COPYING file).
 
 #include <assert.h>
 #include <stddef.h>
-#include "mex.h"
 
 template <typename T>
 void im2col_cpu(T* stacked,
@@ -72,6 +71,70 @@ void col2im_indexed_cpu(T* data,
                         int windowWidth,
                         int windowHeight) ;
 
+/*
+ Same as im2col_indexed_cpu and col2im_indexed_cpu, with the indices
+ run-length encoded (see runlength.hpp): each run is copied (added)
+ as a whole.
+ */
+template <typename T>
+void im2col_indexed_runs_cpu(T* stacked,
+                             T const* data,
+                             int const* encodedIndices,
+                             int width,
+                             int height,
+                             int depth,
+                             int size) ;
+
+template<typename T>
+void col2im_indexed_runs_cpu(T* data,
+                             T const* stacked,
+                             int const* encodedIndices,
+                             int width,
+                             int height,
+                             int depth,
+                             int size) ;
+
+/*
+ Same as im2col_indexed_cpu and col2im_indexed_cpu, for channel-last
+ data (DEPTH x HEIGHT x WIDTH x SIZE in memory). The stacked matrix of
+ group g is a (filter volume) x (SIZE * number of output pixels)
+ matrix, whose columns list the channels of the group for each window
+ offset: the channel c at offset d is row d * (DEPTH / numGroups) + c.
+ */
+template <typename T>
+void im2col_indexed_hwc_cpu(T* stacked,
+                            T const* data,
+                            int const* indices,
+                            int indicesSize,
+                            int width,
+                            int height,
+                            int depth,
+                            int size,
+                            int windowWidth,
+                            int windowHeight,
+                            int numGroups) ;
+
+template<typename T>
+void col2im_indexed_hwc_cpu(T* data,
+                            T const* stacked,
+                            int const* indices,
+                            int indicesSize,
+                            int width,
+                            int height,
+                            int depth,
+                            int size,
+                            int windowWidth,
+                            int windowHeight,
+                            int numGroups) ;
+
+/* transposes the first two dimensions of a d1 x d2 x d3 array */
+template<typename T>
+void transpose12_cpu(T* transposed,
+                     T const* data,
+                     size_t d1,
+                     size_t d2,
+                     size_t d3);
+
 template<typename T>
 void transpose23_cpu(T* transposed,
                      T const* data,
@@ -96,6 +159,19 @@ void conv_indices_cpu(int* indices,
                       int padTop,
                       int padBottom);
 
+/*
+ mask_indices_order_cpu() sets ORDER to the permutation of the
+ MASKINDICESLENGTH offsets of a column-major map with HEIGHT rows that
+ sorts them by offset or, with MORTON, along the Z-order curve of
+ their (row, column) coordinates, so that consecutive entries are
+ close in both directions. Equal keys keep their order.
+ */
+void mask_indices_order_cpu(int* order,
+                            int const* maskIndices,
+                            int maskIndicesLength,
+                            int height,
+                            bool morton);
+
 #ifdef ENABLE_GPU
 template <typename T>
 void im2col_gpu(T* stacked,
@@ -0,0 +1,215 @@
+/** @file im2col_simd.cpp
+ ** @brief Vectorized indexed gather and scatter-add (CPU)
+ ** @author Michael Figurnov
+ **/
+
+/*
+ Copyright (C) 2015 Michael Figurnov.
+ All rights reserved.
+
+ This file is part of the VLFeat library and is made available under
+ the terms of the BSD license (see the COPYING file).
+ */
+
+#include "im2col_simd.hpp"
+
+#include <string.h>
+
+#if !defined(VL_DISABLE_SIMD) && defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define VL_INDEXED_SIMD 1
+#include <immintrin.h>
+#endif
+
+/* ---------------------------------------------------------------- */
+/*                                                           Scalar */
+/* ---------------------------------------------------------------- */
+
+static void
+gather_scalar(float* dst, float const* src, int const* idx, int n)
+{
+  for (int x = 0 ; x < n ; ++x) {
+    int idxValue = idx[x] ;
+    dst[x] = (idxValue != -1) ? src[idxValue] : 0 ;
+  }
+}
+
+static void
+scatter_add_scalar(float* dst, float const* src, int const* idx, int n)
+{
+  for (int x = 0 ; x < n ; ++x) {
+    int idxValue = idx[x] ;
+    if (idxValue != -1) {
+      dst[idxValue] += src[x] ;
+    }
+  }
+}
+
+#ifdef VL_INDEXED_SIMD
+
+/* ---------------------------------------------------------------- */
+/*                                                             AVX2 */
+/* ---------------------------------------------------------------- */
+
+/*
+ The padding lanes (index -1) are masked out of the hardware gather,
+ so they are never loaded and receive zero. AVX2 has no scatter
+ instruction, hence the scatter-add stays scalar.
+ */
+
+__attribute__((target("avx2")))
+static void
+gather_avx2(float* dst, float const* src, int const* idx, int n)
+{
+  __m256i const minusOne = _mm256_set1_epi32(-1) ;
+  __m256 const zero = _mm256_setzero_ps() ;
+  int x = 0 ;
+  for ( ; x + 8 <= n ; x += 8) {
+    __m256i i = _mm256_loadu_si256((__m256i const*)(idx + x)) ;
+    __m256 valid = _mm256_castsi256_ps(_mm256_andnot_si256(_mm256_cmpeq_epi32(i, minusOne), minusOne)) ;
+    _mm256_storeu_ps(dst + x, _mm256_mask_i32gather_ps(zero, src, i, valid, 4)) ;
+  }
+  gather_scalar(dst + x, src, idx + x, n - x) ;
+}
+
+/* ---------------------------------------------------------------- */
+/*                                                          AVX-512 */
+/* ---------------------------------------------------------------- */
+
+__attribute__((target("avx512f")))
+static void
+gather_avx512(float* dst, float const* src, int const* idx, int n)
+{
+  __m512i const minusOne = _mm512_set1_epi32(-1) ;
+  __m512 const zero = _mm512_setzero_ps() ;
+  int x = 0 ;
+  for ( ; x + 16 <= n ; x += 16) {
+    __m512i i = _mm512_loadu_si512(idx + x) ;
+    __mmask16 valid = _mm512_cmpneq_epi32_mask(i, minusOne) ;
+    _mm512_storeu_ps(dst + x, _mm512_mask_i32gather_ps(zero, valid, i, src, 4)) ;
+  }
+  gather_scalar(dst + x, src, idx + x, n - x) ;
+}
+
+/*
+ Several columns can add to the same pixel (e.g. when the input is
+ perforated and interpolated). A vector of 16 indices is scattered in
+ one gather-add-scatter step only if its valid lanes are pairwise
+ distinct, which VPCONFLICTD tells; otherwise it falls back to scalar
+ adds, which keeps the result exact and identical to the scalar code.
+ */
+
+__attribute__((target("avx512f,avx512cd")))
+static void
+scatter_add_avx512(float* dst, float const* src, int const* idx, int n)
+{
+  __m512i const minusOne = _mm512_set1_epi32(-1) ;
+  int x = 0 ;
+  for ( ; x + 16 <= n ; x += 16) {
+    __m512i i = _mm512_loadu_si512(idx + x) ;
+    __mmask16 valid = _mm512_cmpneq_epi32_mask(i, minusOne) ;
+    __m512i conflicts = _mm512_maskz_conflict_epi32(valid, i) ;
+    if (_mm512_mask_test_epi32_mask(valid, conflicts, conflicts)) {
+      scatter_add_scalar(dst, src + x, idx + x, 16) ;
+      continue ;
+    }
+    __m512 sum = _mm512_add_ps(_mm512_mask_i32gather_ps(_mm512_setzero_ps(), valid, i, dst, 4),
+                               _mm512_loadu_ps(src + x)) ;
+    _mm512_mask_i32scatter_ps(dst, valid, i, sum, 4) ;
+  }
+  scatter_add_scalar(dst, src + x, idx + x, n - x) ;
+}
+
+#endif /* VL_INDEXED_SIMD */
+
+/* ---------------------------------------------------------------- */
+/*                                                         Dispatch */
+/* ---------------------------------------------------------------- */
+
+typedef void (*IndexedFunction)(float* dst, float const* src, int const* idx, int n) ;
+
+struct IndexedImplementation
+{
+  IndexedFunction gather ;
+  IndexedFunction scatterAdd ;
+  char const * name ;
+} ;
+
+static IndexedImplementation const scalarImplementation =
+  {gather_scalar, scatter_add_scalar, "scalar"} ;
+
+#ifdef VL_INDEXED_SIMD
+static IndexedImplementation const avx2Implementation =
+  {gather_avx2, scatter_add_scalar, "avx2"} ;
+static IndexedImplementation const avx512Implementation =
+  {gather_avx512, scatter_add_avx512, "avx512"} ;
+#endif
+
+/* the implementation called NAME if the CPU supports it, or NULL */
+static IndexedImplementation const *
+findIndexedImplementation(char const * name)
+{
+  if (strcmp(name, scalarImplementation.name) == 0) {
+    return &scalarImplementation ;
+  }
+#ifdef VL_INDEXED_SIMD
+  __builtin_cpu_init() ;
+  if (strcmp(name, avx2Implementation.name) == 0 &&
+      __builtin_cpu_supports("avx2")) {
+    return &avx2Implementation ;
+  }
+  if (strcmp(name, avx512Implementation.name) == 0 &&
+      __builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512cd")) {
+    return &avx512Implementation ;
+  }
+#endif
+  return NULL ;
+}
+
+static IndexedImplementation const *
+selectIndexedImplementation()
+{
+  IndexedImplementation const * impl = findIndexedImplementation("avx512") ;
+  if (impl == NULL) impl = findIndexedImplementation("avx2") ;
+  if (impl == NULL) impl = &scalarImplementation ;
+  return impl ;
+}
+
+static IndexedImplementation const * indexedImplementation = selectIndexedImplementation() ;
+
+void
+vl_indexed_gather(float* dst, float const* src, int const* idx, int n)
+{
+  indexedImplementation->gather(dst, src, idx, n) ;
+}
+
+void
+vl_indexed_scatter_add(float* dst, float const* src, int const* idx, int n)
+{
+  indexedImplementation->scatterAdd(dst, src, idx, n) ;
+}
+
+char const *
+vl_indexed_simd_name()
+{
+  return indexedImplementation->name ;
+}
+
+bool
+vl_indexed_simd_supported(char const * name)
+{
+  return findIndexedImplementation(name) != NULL ;
+}
+
+bool
+vl_indexed_simd_force(char const * name)
+{
+  IndexedImplementation const * impl ;
+  if (name == NULL || strcmp(name, "auto") == 0) {
+    impl = selectIndexedImplementation() ;
+  } else {
+    impl = findIndexedImplementation(name) ;
+    if (impl == NULL) return false ;
+  }
+  indexedImplementation = impl ;
+  return true ;
+}
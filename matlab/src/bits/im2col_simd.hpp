@@ -0,0 +1,43 @@
+/** @file im2col_simd.hpp
+ ** @brief Vectorized indexed gather and scatter-add (CPU)
+ ** @author Michael Figurnov
+ **/
+
+/*
+ Copyright (C) 2015 Michael Figurnov.
+ All rights reserved.
+
+ This file is part of the VLFeat library and is made available under
+ the terms of the BSD license (see the COPYING file).
+ */
+
+#ifndef VL_NNIM2COL_SIMD_H
+#define VL_NNIM2COL_SIMD_H
+
+/*
+ The inner loops of im2col_indexed_cpu and col2im_indexed_cpu:
+
+   gather:       dst[x] = (idx[x] != -1) ? src[idx[x]] : 0
+   scatter-add:  if (idx[x] != -1) dst[idx[x]] += src[x]
+
+ for x = 0, ..., n - 1. An implementation is selected at load time
+ according to the instruction sets supported by the CPU (AVX-512,
+ AVX2 or plain C++). Defining VL_DISABLE_SIMD at compile time forces
+ the plain C++ version.
+
+ vl_indexed_simd_force selects the implementation "avx512", "avx2"
+ or "scalar" instead, e.g. to compare them; NULL or "auto" restores
+ the automatic choice. It returns false, and changes nothing, if the
+ CPU (or the build) does not support NAME. The selection is global,
+ so it should not be changed while another thread runs the kernels.
+ */
+
+void vl_indexed_gather(float* dst, float const* src, int const* idx, int n) ;
+void vl_indexed_scatter_add(float* dst, float const* src, int const* idx, int n) ;
+
+/* name of the selected implementation ("avx512", "avx2" or "scalar") */
+char const * vl_indexed_simd_name() ;
+bool vl_indexed_simd_supported(char const * name) ;
+bool vl_indexed_simd_force(char const * name) ;
+
+#endif /* defined(VL_NNIM2COL_SIMD_H) */
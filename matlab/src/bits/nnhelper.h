@@ -15,6 +15,7 @@ the terms of the BSD license (see the COPYING file).
 #define VL_NNHELPER_H
 
 #include "mex.h"
+#include "perfcnn.hpp"
 #ifdef ENABLE_GPU
 #include "gpu/mxGPUArray.h"
 #endif
@@ -330,6 +331,33 @@ packed_data_init_with_geom_int (PackedData * map,
   }
 }
 
+/*
+ A channel-last array is a DEPTH x HEIGHT x WIDTH x SIZE MATLAB array.
+ These functions convert between the dimensions of such an array and
+ its (logical) HEIGHT x WIDTH x DEPTH x SIZE geometry, which is the one
+ the MEX files reason with and pass to libperfcnn.
+ */
+
+PackedDataGeometry
+packed_data_geom_from_channel_last (PackedDataGeometry geom)
+{
+  PackedDataGeometry logical = geom ;
+  logical.height = geom.width ;
+  logical.width = geom.depth ;
+  logical.depth = geom.height ;
+  return logical ;
+}
+
+PackedDataGeometry
+packed_data_geom_to_channel_last (PackedDataGeometry geom)
+{
+  PackedDataGeometry array = geom ;
+  array.height = geom.depth ;
+  array.width = geom.height ;
+  array.depth = geom.width ;
+  return array ;
+}
+
 /*
  * Checks whether an GPU array is valid.
  * Becomes invalid e.g. in case of re-initialisation of the GPU.
@@ -448,4 +476,26 @@ bool packed_data_are_compatible(PackedData const * a, PackedData const * b)
   }
 }
 
+/* views of a PackedData buffer for the libperfcnn functions */
+
+perfcnn::Tensor packed_data_get_tensor(PackedData const * map,
+                                       perfcnn::Layout layout = perfcnn::layoutDefault)
+{
+  return perfcnn::Tensor(map->memory,
+                         perfcnn::TensorGeometry(map->geom.height,
+                                                 map->geom.width,
+                                                 map->geom.depth,
+                                                 map->geom.size),
+                         layout) ;
+}
+
+perfcnn::IndexTensor packed_data_get_index_tensor(PackedData const * map)
+{
+  return perfcnn::IndexTensor(map->memoryInt,
+                              perfcnn::TensorGeometry(map->geom.height,
+                                                      map->geom.width,
+                                                      map->geom.depth,
+                                                      map->geom.size)) ;
+}
+
 #endif
@@ -12,9 +12,10 @@ the terms of the BSD license (see the COPYING file).
 */
 
 #include "normalize.hpp"
+#include "threads.hpp"
 #include <algorithm>
 #include <cmath>
-#include <blas.h>
+#include <stdlib.h>
 #include <string.h>
 
 /* ---------------------------------------------------------------- */
@@ -130,6 +131,180 @@ inline float fast_pow(float a, float b)
 #endif
 #endif
 
+#ifdef VL_NNNORMALIZE_FAST
+/*
+ The planes of an image are visited in turn, with the window sums of
+ the squares of a plane in the buffer ACC. The threads split the
+ images, and the pixels of an image into NUMBLOCKS blocks when there
+ are fewer images than threads; each thread has its own buffer. A
+ block is NUMPIXELS pixels of a plane of OFFSET pixels.
+ */
+
+static int
+normalize_partition(int* numUnits, int* numBlocks,
+                    int offset, size_t depth, size_t num, size_t normDepth)
+{
+  ptrdiff_t numPixels = (ptrdiff_t)offset * num ;
+  int numWorkers = vl_get_num_threads_for(numPixels, numPixels * depth * normDepth) ;
+  *numBlocks = 1 ;
+  if ((int)num < numWorkers) {
+    *numBlocks = std::min((numWorkers + (int)num - 1) / (int)num, offset) ;
+  }
+  *numUnits = (int)num * *numBlocks ;
+  return numWorkers ;
+}
+
+template<typename T>
+static void
+normalize_block_cpu(T* normalized,
+                    T const* data,
+                    T* acc,
+                    int numPixels,
+                    int offset,
+                    size_t depth,
+                    int m1, int m2,
+                    T kappa, T alpha, T beta)
+{
+  memset(acc, 0, sizeof(T) * numPixels) ;
+  for (int t = -m2 ; t < (signed)depth ; ++t) {
+    int tm = t - m1 - 1 ;
+    int tp = t + m2 ;
+    T const* xam = data + offset * (t-m1-1) ;
+    T const* xap = data + offset * (t+m2) ;
+    T *end = acc + numPixels ;
+    if (0 <= tm && tp < depth) {
+      for(T *xacc = acc ; xacc != end ; ++xacc, ++xam, ++xap) {
+        T am = *xam ;
+        T ap = *xap ;
+        *xacc += ap*ap - am*am ;
+      }
+    } else if (0 > tm && tp < depth) {
+      for(T *xacc = acc ; xacc != end ; ++xacc, ++xap) {
+        T ap = *xap ;
+        *xacc += ap*ap ;
+      }
+    } else if (0 <= tm && tp >= depth) {
+      for(T *xacc = acc ; xacc != end ; ++xacc, ++xam) {
+        T am = *xam ;
+        *xacc -= am*am ;
+      }
+    }
+    if (0 <= t && t < depth) {
+      T const* xx = data + offset * t ;
+      T* xy = normalized + offset * t ;
+      for(T *xacc = acc ; xacc != end ; ++xacc, ++xx, ++xy) {
+        (*xy) = (*xx) * fast_pow(kappa + alpha * (*xacc), -beta) ;
+      }
+    }
+  }
+}
+
+template<typename T>
+static void
+normalize_backward_block_cpu(T* normalized,
+                             T const* data,
+                             T const* dzdy,
+                             T* restrict acc,
+                             T* restrict acc2,
+                             int numPixels,
+                             int offset,
+                             size_t depth,
+                             int m1, int m2,
+                             T kappa, T alpha, T beta)
+{
+  T ab2 = 2*alpha*beta ;
+  memset(acc, 0, sizeof(T) * numPixels) ;
+  for (int t = -m2 ; t < (signed)depth ; ++t) {
+    /*
+      Compue the square of the input data x.^2 summed in the normalization window. This is done
+      incrementally, by updating the previous normalization window sum.
+    */
+    {
+      int const tm = t - m1 - 1 ;
+      int const tp = t + m2 ;
+      T const* restrict datam_ = data + offset * tm ;
+      T const* restrict datap_ = data + offset * tp ;
+      T *end = acc + numPixels ;
+
+      if (0 <= tm && tp < depth) {
+        for(T * restrict acc_ = acc ; acc_ != end ; ++acc_, ++datap_, ++datam_) {
+          T am = *datam_ ;
+          T ap = *datap_ ;
+          *acc_ += ap*ap - am*am ;
+        }
+      } else if (0 > tm && tp < depth) {
+        for(T * restrict acc_ = acc ; acc_ != end ; ++acc_, ++datap_) {
+          T ap = *datap_ ;
+          *acc_ += ap*ap ;
+        }
+      } else if (0 <= tm && tp >= depth) {
+        for(T * restrict acc_ = acc ; acc_ != end ; ++acc_, ++datam_) {
+          T am = *datam_ ;
+          *acc_ -= am*am ;
+        }
+      }
+    }
+
+    /*
+      Compute the arguments of the summation in the derivative
+      expression, storing them into acc2.
+    */
+    if (0 <= t && t < depth) {
+      T const* restrict data_ = data + offset * t ;
+      T const* restrict dzdy_ = dzdy + offset * t ;
+      T * restrict normalized_ = normalized + offset * t ;
+      T * restrict acc2_ = acc2 + numPixels * t ;
+      T * end = acc + numPixels ;
+      for(T * restrict acc_ = acc ; acc_ != end ;
+          ++acc_, ++acc2_, ++data_, ++dzdy_, ++normalized_) {
+        T L = kappa + alpha * (*acc_) ;
+        T Lbeta = fast_pow(L, -beta) ;
+        T temp1 = (*dzdy_) * Lbeta ;
+        T temp2 = (*data_) * ab2 * temp1 / L ;
+        *normalized_ = temp1 ;
+        *acc2_ = temp2 ;
+      }
+    }
+  }
+
+  /*
+    Integrate along feature channels in acc2, summing plane t-1 to
+    plane t.
+  */
+  for (int t = 1 ; t < (signed)depth ; ++t) {
+    T * restrict acc2_ = acc2 + t * numPixels ;
+    T const* restrict src_ = acc2_ - numPixels ;
+    T const* end = acc2_ + numPixels ;
+    for( ; acc2_ != end ; ++acc2_, ++src_) {
+      *acc2_ += *src_ ;
+    }
+  }
+
+  /*
+    Compute summation in the derivative expression from the integral
+    just obtained.
+  */
+  for (int t = 0 ; t < (signed)depth ; ++t) {
+    int q1 = t - m2 - 1 ;
+    int q2 = ((t + m1) <= (depth - 1)) ? t + m1 : depth - 1 ;
+    T const* restrict acc22_ = acc2 + numPixels * q2 ;
+    T const* restrict acc21_ = acc2 + numPixels * q1 ;
+    T const* restrict data_  = data + offset * t ;
+    T const* restrict end = data_  + numPixels ;
+    T * restrict normalized_ = normalized + offset * t ;
+    if (q1 >= 0) {
+      for( ; data_ != end ; ++data_, ++acc22_, ++acc21_, ++normalized_) {
+        *normalized_ -= (*acc22_ - *acc21_) * (*data_) ;
+      }
+    } else {
+      for( ; data_ != end ; ++data_, ++acc22_, ++normalized_) {
+        *normalized_ -= (*acc22_) * (*data_) ;
+      }
+    }
+  }
+}
+#endif
+
 template<typename T>
 void normalize_cpu(T* normalized,
                    T const* data,
@@ -140,11 +315,11 @@ void normalize_cpu(T* normalized,
                    size_t normDepth,
                    T kappa, T alpha, T beta)
 {
-  int t ;
   int m1 = ((signed)normDepth-1)/2 ;
   int m2 = (int)normDepth - m1 - 1 ;
   int offset = (int)width*(int)height ;
 #ifndef VL_NNNORMALIZE_FAST
+  int t ;
   for (int k = 0 ; k < num ; ++k) {
     for (int h = 0 ; h < height ; ++h) {
       for (int w = 0 ; w < width ; ++w) {
@@ -167,44 +342,26 @@ void normalize_cpu(T* normalized,
     normalized += width*height*depth ;
   }
 #else
-  T * acc = (T*) calloc(sizeof(T), width*height) ;
-  for (int k = 0 ; k < num ; ++k) {
-    memset(acc, 0, sizeof(T) * width*height) ;
-    for (t = -m2 ; t < (signed)depth ; ++t) {
-      int tm = t - m1 - 1 ;
-      int tp = t + m2 ;
-      T const* xam = data + offset * (t-m1-1) ;
-      T const* xap = data + offset * (t+m2) ;
-      T *end = acc + width*height ;
-      if (0 <= tm && tp < depth) {
-        for(T *xacc = acc ; xacc != end ; ++xacc, ++xam, ++xap) {
-          T am = *xam ;
-          T ap = *xap ;
-          *xacc += ap*ap - am*am ;
-        }
-      } else if (0 > tm && tp < depth) {
-        for(T *xacc = acc ; xacc != end ; ++xacc, ++xap) {
-          T ap = *xap ;
-          *xacc += ap*ap ;
-        }
-      } else if (0 <= tm && tp >= depth) {
-        for(T *xacc = acc ; xacc != end ; ++xacc, ++xam) {
-          T am = *xam ;
-          *xacc -= am*am ;
-        }
-      }
-      if (0 <= t && t < depth) {
-        T const* xx = data + offset * t ;
-        T* xy = normalized + offset * t ;
-        for(T *xacc = acc ; xacc != end ; ++xacc, ++xx, ++xy) {
-          (*xy) = (*xx) * fast_pow(kappa + alpha * (*xacc), -beta) ;
-        }
-      }
+  int numUnits, numBlocks ;
+  int numWorkers = normalize_partition(&numUnits, &numBlocks, offset, depth, num, normDepth) ;
+  size_t blockSize = (offset + numBlocks - 1) / numBlocks ;
+
+#pragma omp parallel num_threads(numWorkers) if(numWorkers > 1)
+  {
+    T * acc = (T*) malloc(sizeof(T) * blockSize) ;
+#pragma omp for schedule(static)
+    for (int u = 0 ; u < numUnits ; ++u) {
+      int k = u / numBlocks ;
+      int b = u % numBlocks ;
+      ptrdiff_t begin = (ptrdiff_t)offset * b / numBlocks ;
+      ptrdiff_t end = (ptrdiff_t)offset * (b + 1) / numBlocks ;
+      ptrdiff_t shift = (ptrdiff_t)offset * depth * k + begin ;
+      normalize_block_cpu(normalized + shift, data + shift, acc,
+                          (int)(end - begin), offset, depth, m1, m2,
+                          kappa, alpha, beta) ;
     }
-    data += width*height*depth ;
-    normalized += width*height*depth ;
+    free(acc) ;
   }
-  free(acc) ;
 #endif
 }
 
@@ -249,10 +406,10 @@ void normalizeBackward_cpu(T* normalized,
   int m1 = ((signed)normDepth-1)/2 ;
   int m2 = (int)normDepth - m1 - 1 ;
   int offset = (int)width*(int)height ;
+#ifndef VL_NNNORMALIZE_FAST
   T ab2 = 2*alpha*beta ;
   int t, q ;
 
-#ifndef VL_NNNORMALIZE_FAST
   for (int k = 0 ; k < num ; ++k) {
     for (int h = 0 ; h < height ; ++h) {
       for (int w = 0 ; w < width ; ++w) {
@@ -289,104 +446,29 @@ void normalizeBackward_cpu(T* normalized,
     dzdy += width*height*depth ;
   }
 #else
-  T * restrict acc = (T*) malloc(sizeof(T) * width*height) ;
-  T * restrict acc2 = (T*) malloc(sizeof(T) * width*height*depth) ;
-  for (int k = 0 ; k < num ; ++k) {
-    memset(acc, 0, sizeof(T) * width*height) ;
-    for (t = -m2 ; t < (signed)depth ; ++t) {
-      /*
-        Compue the square of the input data x.^2 summed in the normalization window. This is done
-        incrementally, by updating the previous normalization window sum.
-      */
-      {
-        int const tm = t - m1 - 1 ;
-        int const tp = t + m2 ;
-        T const* restrict datam_ = data + offset * tm ;
-        T const* restrict datap_ = data + offset * tp ;
-        T *end = acc + width*height ;
-
-        if (0 <= tm && tp < depth) {
-          for(T * restrict acc_ = acc ; acc_ != end ; ++acc_, ++datap_, ++datam_) {
-            T am = *datam_ ;
-            T ap = *datap_ ;
-            *acc_ += ap*ap - am*am ;
-          }
-        } else if (0 > tm && tp < depth) {
-          for(T * restrict acc_ = acc ; acc_ != end ; ++acc_, ++datap_) {
-            T ap = *datap_ ;
-            *acc_ += ap*ap ;
-          }
-        } else if (0 <= tm && tp >= depth) {
-          for(T * restrict acc_ = acc ; acc_ != end ; ++acc_, ++datam_) {
-            T am = *datam_ ;
-            *acc_ -= am*am ;
-          }
-        }
-      }
+  int numUnits, numBlocks ;
+  int numWorkers = normalize_partition(&numUnits, &numBlocks, offset, depth, num, normDepth) ;
+  size_t blockSize = (offset + numBlocks - 1) / numBlocks ;
 
-      /*
-        Compute the arguments of the summation in the derivative
-        expression, storing them into acc2.
-      */
-      if (0 <= t && t < depth) {
-        T const* restrict data_ = data + offset * t ;
-        T const* restrict dzdy_ = dzdy + offset * t ;
-        T * restrict normalized_ = normalized + offset * t ;
-        T * restrict acc2_ = acc2 + offset * t ;
-        T * end = acc + width*height ;
-        for(T * restrict acc_ = acc ; acc_ != end ;
-            ++acc_, ++acc2_, ++data_, ++dzdy_, ++normalized_) {
-          T L = kappa + alpha * (*acc_) ;
-          T Lbeta = fast_pow(L, -beta) ;
-          T temp1 = (*dzdy_) * Lbeta ;
-          T temp2 = (*data_) * ab2 * temp1 / L ;
-          *normalized_ = temp1 ;
-          *acc2_ = temp2 ;
-        }
-      }
-    }
-
-    /*
-      Integrate along feature channels in acc2, summing plane t-1 to
-      plane t.
-    */
-    for (t = 1 ; t < (signed)depth ; ++t) {
-      T * restrict acc2_ = acc2 + t * offset ;
-      T const* restrict src_ = acc2_ - offset ;
-      T const* end = acc2_ + offset ;
-      for( ; acc2_ != end ; ++acc2_, ++src_) {
-        *acc2_ += *src_ ;
-      }
+#pragma omp parallel num_threads(numWorkers) if(numWorkers > 1)
+  {
+    T * restrict acc = (T*) malloc(sizeof(T) * blockSize) ;
+    T * restrict acc2 = (T*) malloc(sizeof(T) * blockSize*depth) ;
+#pragma omp for schedule(static)
+    for (int u = 0 ; u < numUnits ; ++u) {
+      int k = u / numBlocks ;
+      int b = u % numBlocks ;
+      ptrdiff_t begin = (ptrdiff_t)offset * b / numBlocks ;
+      ptrdiff_t end = (ptrdiff_t)offset * (b + 1) / numBlocks ;
+      ptrdiff_t shift = (ptrdiff_t)offset * depth * k + begin ;
+      normalize_backward_block_cpu(normalized + shift, data + shift, dzdy + shift,
+                                   acc, acc2,
+                                   (int)(end - begin), offset, depth, m1, m2,
+                                   kappa, alpha, beta) ;
     }
-
-    /*
-      Compute summation in the derivative expression from the integral
-      just obtained.
-    */
-    for (t = 0 ; t < (signed)depth ; ++t) {
-      int q1 = t - m2 - 1 ;
-      int q2 = ((t + m1) <= (depth - 1)) ? t + m1 : depth - 1 ;
-      T const* restrict acc22_ = acc2 + offset * q2 ;
-      T const* restrict acc21_ = acc2 + offset * q1 ;
-      T const* restrict data_  = data + offset * t ;
-      T const* restrict end = data_  + width*height ;
-      T * restrict normalized_ = normalized + offset * t ;
-      if (q1 >= 0) {
-        for( ; data_ != end ; ++data_, ++acc22_, ++acc21_, ++normalized_) {
-          *normalized_ -= (*acc22_ - *acc21_) * (*data_) ;
-        }
-      } else {
-        for( ; data_ != end ; ++data_, ++acc22_, ++normalized_) {
-          *normalized_ -= (*acc22_) * (*data_) ;
-        }
-      }
-    }
-    data += width*height*depth ;
-    normalized += width*height*depth ;
-    dzdy += width*height*depth ;
+    free(acc) ;
+    free(acc2) ;
   }
-  free(acc) ;
-  free(acc2) ;
 #endif
 }
 
@@ -413,3 +495,121 @@ void normalizeBackward_cpu<double>(double* normalized,
                                    size_t normDetph,
                                    double kappa, double alpha, double beta) ;
 #endif
+
+/* ---------------------------------------------------------------- */
+/*                          normalize, channel-last data (CPU) */
+/* ---------------------------------------------------------------- */
+
+/*
+ With the channels of a pixel contiguous in memory, the window sum of
+ the squares slides along one contiguous vector per pixel. This is the
+ per-pixel algorithm above with offset = 1.
+ */
+
+template<typename T>
+void normalize_hwc_cpu(T* normalized,
+                       T const* data,
+                       size_t width,
+                       size_t height,
+                       size_t depth,
+                       size_t num,
+                       size_t normDepth,
+                       T kappa, T alpha, T beta)
+{
+  int m1 = ((signed)normDepth-1)/2 ;
+  int m2 = (int)normDepth - m1 - 1 ;
+  ptrdiff_t numPixels = (ptrdiff_t)width*height*num ;
+  int numWorkers = vl_get_num_threads_for(numPixels, numPixels * depth * normDepth) ;
+
+#pragma omp parallel for num_threads(numWorkers) if(numWorkers > 1)
+  for (ptrdiff_t p = 0 ; p < numPixels ; ++p) {
+    T const* restrict x = data + p * depth ;
+    T* restrict y = normalized + p * depth ;
+    T acc = 0 ;
+    for (int t = -m2 ; t < (signed)depth ; ++t) {
+      int tm = t - m1 - 1 ;
+      int tp = t + m2 ;
+      if (tp < (signed)depth) { acc += x[tp] * x[tp] ; }
+      if (tm >= 0) { acc -= x[tm] * x[tm] ; }
+      if (0 <= t) {
+        y[t] = x[t] * fast_pow(kappa + alpha * acc, -beta) ;
+      }
+    }
+  }
+}
+
+template
+void normalize_hwc_cpu<float>(float* normalized,
+                              float const* data,
+                              size_t width,
+                              size_t height,
+                              size_t depth,
+                              size_t num,
+                              size_t normDetph,
+                              float kappa, float alpha, float beta) ;
+
+template<typename T>
+void normalizeBackward_hwc_cpu(T* normalized,
+                               T const* data,
+                               T const* dzdy,
+                               size_t width,
+                               size_t height,
+                               size_t depth,
+                               size_t num,
+                               size_t normDepth,
+                               T kappa, T alpha, T beta)
+{
+  int m1 = ((signed)normDepth-1)/2 ;
+  int m2 = (int)normDepth - m1 - 1 ;
+  T ab2 = 2*alpha*beta ;
+  ptrdiff_t numPixels = (ptrdiff_t)width*height*num ;
+  int numWorkers = vl_get_num_threads_for(numPixels, numPixels * depth * normDepth) ;
+
+  /* each thread integrates into its own acc2 */
+#pragma omp parallel num_threads(numWorkers) if(numWorkers > 1)
+  {
+    T * restrict acc2 = (T*) malloc(sizeof(T) * depth) ;
+#pragma omp for schedule(static)
+    for (ptrdiff_t p = 0 ; p < numPixels ; ++p) {
+      T const* restrict x = data + p * depth ;
+      T const* restrict z = dzdy + p * depth ;
+      T* restrict y = normalized + p * depth ;
+      T acc = 0 ;
+
+      /* as in normalizeBackward_cpu, with the integral of the terms in acc2 */
+      for (int t = -m2 ; t < (signed)depth ; ++t) {
+        int tm = t - m1 - 1 ;
+        int tp = t + m2 ;
+        if (tp < (signed)depth) { acc += x[tp] * x[tp] ; }
+        if (tm >= 0) { acc -= x[tm] * x[tm] ; }
+        if (0 <= t) {
+          T L = kappa + alpha * acc ;
+          T Lbeta = fast_pow(L, -beta) ;
+          T temp1 = z[t] * Lbeta ;
+          y[t] = temp1 ;
+          acc2[t] = x[t] * ab2 * temp1 / L ;
+        }
+      }
+      for (int t = 1 ; t < (signed)depth ; ++t) {
+        acc2[t] += acc2[t-1] ;
+      }
+      for (int t = 0 ; t < (signed)depth ; ++t) {
+        int q1 = t - m2 - 1 ;
+        int q2 = ((t + m1) <= ((signed)depth - 1)) ? t + m1 : (signed)depth - 1 ;
+        y[t] -= (acc2[q2] - ((q1 >= 0) ? acc2[q1] : 0)) * x[t] ;
+      }
+    }
+    free(acc2) ;
+  }
+}
+
+template
+void normalizeBackward_hwc_cpu<float>(float* normalized,
+                                      float const* data,
+                                      float const* dzdy,
+                                      size_t width,
+                                      size_t height,
+                                      size_t depth,
+                                      size_t num,
+                                      size_t normDetph,
+                                      float kappa, float alpha, float beta) ;
@@ -37,6 +37,28 @@ void normalizeBackward_cpu(T* dzdx,
                            size_t normDetph,
                            T kappa, T alpha, T beta) ;
 
+/* the same, for channel-last data (the DEPTH values of a pixel are contiguous) */
+template<typename T>
+void normalize_hwc_cpu(T* normalized,
+                       T const* data,
+                       size_t width,
+                       size_t height,
+                       size_t depth,
+                       size_t num,
+                       size_t normDetph,
+                       T kappa, T alpha, T beta) ;
+
+template<typename T>
+void normalizeBackward_hwc_cpu(T* dzdx,
+                               T const* data,
+                               T const* dzdy,
+                               size_t width,
+                               size_t height,
+                               size_t depth,
+                               size_t num,
+                               size_t normDetph,
+                               T kappa, T alpha, T beta) ;
+
 #ifdef ENABLE_GPU
 template<typename T>
 void normalize_gpu(T* pooled,
@@ -0,0 +1,2769 @@
+/** @file perfcnn.cpp
+ ** @brief MATLAB-free interface to the perforated CNN kernels (libperfcnn)
+ ** @author Michael Figurnov
+ **/
+
+/*
+ Copyright (C) 2015 Michael Figurnov.
+ All rights reserved.
+
+ This file is part of the VLFeat library and is made available under
+ the terms of the BSD license (see the COPYING file).
+ */
+
+#include "perfcnn.hpp"
+#include "im2col.hpp"
+#include "im2col_simd.hpp"
+#include "gather_gemm.hpp"
+#include "runlength.hpp"
+#include "dedup.hpp"
+#include "pooling.hpp"
+#include "normalize.hpp"
+#include "threads.hpp"
+#include "epilogue.hpp"
+#include "perforation.hpp"
+#include "blas.hpp"
+#include "winograd.hpp"
+
+#include <algorithm>
+#include <map>
+#include <new>
+#include <utility>
+#include <vector>
+
+#if defined(__linux__)
+#include <unistd.h>
+#endif
+
+/* ---------------------------------------------------------------- */
+/*                                                          Helpers */
+/* ---------------------------------------------------------------- */
+
+using namespace perfcnn ;
+
+static char const * lastErrorMessage = "" ;
+
+static Error
+setError(Error error, char const * message)
+{
+  lastErrorMessage = message ;
+  return error ;
+}
+
+char const *
+perfcnn::getLastErrorMessage()
+{
+  return lastErrorMessage ;
+}
+
+perfcnn::TensorGeometry::TensorGeometry()
+: height(0), width(0), depth(0), size(0)
+{ }
+
+perfcnn::TensorGeometry::TensorGeometry(ptrdiff_t height, ptrdiff_t width, ptrdiff_t depth, ptrdiff_t size)
+: height(height), width(width), depth(depth), size(size)
+{ }
+
+ptrdiff_t
+perfcnn::TensorGeometry::getNumElements() const
+{
+  return height * width * depth * size ;
+}
+
+perfcnn::ConvOptions::ConvOptions()
+: strideY(1), strideX(1),
+  padTop(0), padBottom(0), padLeft(0), padRight(0)
+{ }
+
+perfcnn::PoolOptions::PoolOptions()
+: poolHeight(1), poolWidth(1),
+  strideY(1), strideX(1),
+  padTop(0), padBottom(0), padLeft(0), padRight(0),
+  method(NN_POOL_MAX)
+{ }
+
+perfcnn::NormalizeOptions::NormalizeOptions()
+: depth(5), kappa(2.0f), alpha(1e-4f), beta(0.75f)
+{ }
+
+perfcnn::ConvIndexedWorkspace::ConvIndexedWorkspace()
+: temp(NULL), tempSize(0)
+{ }
+
+static bool
+sameGeometry(TensorGeometry const & a, TensorGeometry const & b)
+{
+  return
+  a.height == b.height &&
+  a.width == b.width &&
+  a.depth == b.depth &&
+  a.size == b.size ;
+}
+
+/* OTHER (if not empty) must have the same layout as DATA */
+static Error
+checkLayout(Tensor const & data, Tensor const & other, char const * message)
+{
+  if (!other.isEmpty() && other.layout != data.layout) {
+    return setError(vlErrorInvalidArgument, message) ;
+  }
+  return vlSuccess ;
+}
+
+/* number of output positions stored in one slice of CONVINDICES */
+static ptrdiff_t
+getNumOutputPixels(IndexTensor const & convIndices)
+{
+  TensorGeometry geom = getIndicesGeometry(convIndices) ;
+  return geom.height * geom.width ;
+}
+
+/* the header and the lists of encoded indices must be consistent */
+static Error
+checkIndices(IndexTensor const & indices, char const * message)
+{
+  if (isDeduplicatedIndices(indices)) {
+    return setError(vlErrorInvalidArgument, "Deduplicated INDICES are only supported by the fast pooling.") ;
+  }
+  if (!isRunLengthIndices(indices)) {
+    return vlSuccess ;
+  }
+  int const * encoded = indices.memory ;
+  ptrdiff_t numElements = indices.geom.getNumElements() ;
+  if (rle_list_length(encoded) <= 0 ||
+      rle_height(encoded) < 0 || rle_width(encoded) < 0 || rle_depth(encoded) < 0 ||
+      rle_num_runs(encoded) < 0 ||
+      (ptrdiff_t)rle_height(encoded) * rle_width(encoded) * rle_depth(encoded) % rle_list_length(encoded) != 0 ||
+      numElements != rle_encoded_size(rle_num_lists(encoded), rle_num_runs(encoded))) {
+    return setError(vlErrorInvalidArgument, message) ;
+  }
+  int const * lists = rle_lists(encoded) ;
+  int const * runs = rle_runs(encoded) ;
+  for (int l = 0 ; l < rle_num_lists(encoded) ; ++l) {
+    ptrdiff_t length = 0 ;
+    if (lists[2*l] < 0 || lists[2*l + 1] < 1 ||
+        lists[2*l] + (ptrdiff_t)lists[2*l + 1] > rle_num_runs(encoded)) {
+      return setError(vlErrorInvalidArgument, message) ;
+    }
+    for (int r = lists[2*l] ; r < lists[2*l] + lists[2*l + 1] ; ++r) {
+      if (runs[2*r] < -1 || runs[2*r + 1] < 1) {
+        return setError(vlErrorInvalidArgument, message) ;
+      }
+      length += runs[2*r + 1] ;
+    }
+    if (length != rle_list_length(encoded)) {
+      return setError(vlErrorInvalidArgument, message) ;
+    }
+  }
+  return vlSuccess ;
+}
+
+/* the average pooling stores the count of every distinct index */
+static int
+getDedupEntrySize(PoolMethod method)
+{
+  return (method == NN_POOL_AVG) ? 2 : 1 ;
+}
+
+/* the offsets and the entries of deduplicated windows must be consistent */
+static Error
+checkDeduplicatedIndices(IndexTensor const & indices, char const * message)
+{
+  int const * encoded = indices.memory ;
+  ptrdiff_t numElements = indices.geom.getNumElements() ;
+  if (dedup_window_size(encoded) <= 0 ||
+      dedup_height(encoded) < 0 || dedup_width(encoded) < 0 || dedup_depth(encoded) < 0 ||
+      dedup_num_entries(encoded) < 0 ||
+      (dedup_entry_size(encoded) != 1 && dedup_entry_size(encoded) != 2) ||
+      (ptrdiff_t)dedup_height(encoded) * dedup_width(encoded) * dedup_depth(encoded) % dedup_window_size(encoded) != 0 ||
+      numElements != dedup_encoded_size(dedup_num_windows(encoded), dedup_num_entries(encoded), dedup_entry_size(encoded))) {
+    return setError(vlErrorInvalidArgument, message) ;
+  }
+  int const * offsets = dedup_offsets(encoded) ;
+  int const * entries = dedup_entries(encoded) ;
+  int entrySize = dedup_entry_size(encoded) ;
+  if (offsets[0] != 0 || offsets[dedup_num_windows(encoded)] != dedup_num_entries(encoded)) {
+    return setError(vlErrorInvalidArgument, message) ;
+  }
+  for (int w = 0 ; w < dedup_num_windows(encoded) ; ++w) {
+    ptrdiff_t length = 0 ;
+    if (offsets[w + 1] < offsets[w]) {
+      return setError(vlErrorInvalidArgument, message) ;
+    }
+    for (int e = offsets[w] ; e < offsets[w + 1] ; ++e) {
+      int count = (entrySize == 2) ? entries[2*e + 1] : 1 ;
+      if (entries[entrySize*e] < 0 || count < 1) {
+        return setError(vlErrorInvalidArgument, message) ;
+      }
+      length += count ;
+    }
+    if (length > dedup_window_size(encoded)) {
+      return setError(vlErrorInvalidArgument, message) ;
+    }
+  }
+  return vlSuccess ;
+}
+
+static Error
+checkConvIndexed(Tensor const & data,
+                 TensorGeometry const & filters,
+                 IndexTensor const & convIndices)
+{
+  TensorGeometry convIndicesGeom = getIndicesGeometry(convIndices) ;
+  Error error ;
+
+  if ((error = checkIndices(convIndices, "CONVINDICES are not valid run-length encoded indices.")) != vlSuccess) {
+    return error ;
+  }
+  if (filters.height == 0 || filters.width == 0 || filters.depth == 0 || filters.size == 0) {
+    return setError(vlErrorInvalidArgument, "A dimension of FILTERS is void.") ;
+  }
+  if (data.geom.depth % filters.depth != 0) {
+    return setError(vlErrorInvalidArgument, "The filter depth does not divide the image depth.") ;
+  }
+  if (filters.size % (data.geom.depth / filters.depth) != 0) {
+    return setError(vlErrorInvalidArgument, "The number of filter groups does not divide the total number of filters.") ;
+  }
+  if (convIndicesGeom.depth != filters.height * filters.width) {
+    return setError(vlErrorInvalidArgument, "CONVINDICES depth is not compatible with filters.") ;
+  }
+  if (convIndicesGeom.size != 1 && convIndicesGeom.size != data.geom.size) {
+    return setError(vlErrorInvalidArgument, "CONVINDICES size should be equal either one, or the number of input images.") ;
+  }
+  return vlSuccess ;
+}
+
+/* each of the HEIGHT x WIDTH pixels is copied from one of M computed pixels, or is zero (-1) */
+static Error
+checkInterpolationIndices(IndexTensor const & indices,
+                          ptrdiff_t m,
+                          ptrdiff_t numImages)
+{
+  if (indices.isEmpty()) {
+    return setError(vlErrorInvalidArgument, "INTERPOLATIONINDICES is empty.") ;
+  }
+  if (indices.geom.depth != 1) {
+    return setError(vlErrorInvalidArgument, "INTERPOLATIONINDICES depth is not one.") ;
+  }
+  if (indices.geom.size != 1 && indices.geom.size != numImages) {
+    return setError(vlErrorInvalidArgument, "INTERPOLATIONINDICES size should be equal either one, or the number of input images.") ;
+  }
+  ptrdiff_t numElements = indices.geom.getNumElements() ;
+  for (ptrdiff_t i = 0 ; i < numElements ; ++i) {
+    if (indices.memory[i] < -1 || indices.memory[i] >= m) {
+      return setError(vlErrorInvalidArgument, "INTERPOLATIONINDICES are out of range.") ;
+    }
+  }
+  return vlSuccess ;
+}
+
+static Error
+checkConvIndexedLayout(Tensor const & data,
+                       Tensor const & output,
+                       Tensor const & filters,
+                       IndexTensor const & convIndices)
+{
+  Error error ;
+  if ((error = checkLayout(data, output, "X and the output (or its derivative) do not have the same layout.")) != vlSuccess) {
+    return error ;
+  }
+  if (filters.layout != layoutDefault) {
+    return setError(vlErrorInvalidArgument, "FILTERS do not have the default layout.") ;
+  }
+  if (data.layout == layoutChannelLast && isRunLengthIndices(convIndices)) {
+    return setError(vlErrorInvalidArgument, "Run-length encoded CONVINDICES do not support channel-last DATA.") ;
+  }
+  return vlSuccess ;
+}
+
+/* gather (scatter) the columns of NUMIMAGES images starting at DATA */
+static void
+gatherColumns(float * stacked,
+              float const * data,
+              TensorGeometry const & dataGeom,
+              ptrdiff_t numImages,
+              IndexTensor const & convIndices,
+              TensorGeometry const & filters)
+{
+  if (isRunLengthIndices(convIndices)) {
+    im2col_indexed_runs_cpu<float>(stacked, data, convIndices.memory,
+                                   dataGeom.height, dataGeom.width, dataGeom.depth, numImages) ;
+  } else {
+    im2col_indexed_cpu<float>(stacked, data, convIndices.memory,
+                              getNumOutputPixels(convIndices) * convIndices.geom.depth,
+                              dataGeom.height, dataGeom.width, dataGeom.depth, numImages,
+                              filters.height, filters.width) ;
+  }
+}
+
+static void
+scatterColumns(float * data,
+               float const * stacked,
+               TensorGeometry const & dataGeom,
+               ptrdiff_t numImages,
+               IndexTensor const & convIndices,
+               TensorGeometry const & filters)
+{
+  if (isRunLengthIndices(convIndices)) {
+    col2im_indexed_runs_cpu<float>(data, stacked, convIndices.memory,
+                                   dataGeom.height, dataGeom.width, dataGeom.depth, numImages) ;
+  } else {
+    col2im_indexed_cpu<float>(data, stacked, convIndices.memory,
+                              getNumOutputPixels(convIndices) * convIndices.geom.depth,
+                              dataGeom.height, dataGeom.width, dataGeom.depth, numImages,
+                              filters.height, filters.width) ;
+  }
+}
+
+/* ---------------------------------------------------------------- */
+/*                                                          Indices */
+/* ---------------------------------------------------------------- */
+
+Error
+perfcnn::convIndicesGeometry(TensorGeometry & geom,
+                             TensorGeometry const & data,
+                             TensorGeometry const & filters,
+                             ConvOptions const & options,
+                             ptrdiff_t maskIndicesLength)
+{
+  if (options.strideX < 1 || options.strideY < 1) {
+    return setError(vlErrorInvalidArgument, "At least one element of STRIDE is smaller than one.") ;
+  }
+  if (filters.height == 0 || filters.width == 0 || filters.depth == 0) {
+    return setError(vlErrorInvalidArgument, "A dimension of FILTERS is void.") ;
+  }
+  if (data.depth % filters.depth != 0) {
+    return setError(vlErrorInvalidArgument, "The filter depth does not divide the image depth.") ;
+  }
+  if (filters.size % (data.depth / filters.depth) != 0) {
+    return setError(vlErrorInvalidArgument, "The number of filter groups does not divide the total number of filters.") ;
+  }
+  if (options.padLeft < 0 ||
+      options.padRight < 0 ||
+      options.padTop < 0 ||
+      options.padBottom < 0) {
+    return setError(vlErrorInvalidArgument, "An element of PAD is negative.") ;
+  }
+  if (data.height + (options.padTop + options.padBottom) < filters.height ||
+      data.width + (options.padLeft + options.padRight) < filters.width) {
+    return setError(vlErrorInvalidArgument, "FILTERS are larger than the DATA (including padding).") ;
+  }
+
+  if (maskIndicesLength > 0) {
+    geom = TensorGeometry(maskIndicesLength, 1, filters.height * filters.width, 1) ;
+  } else {
+    geom = TensorGeometry((data.height + (options.padTop + options.padBottom) - filters.height) / options.strideY + 1,
+                          (data.width + (options.padLeft + options.padRight) - filters.width) / options.strideX + 1,
+                          filters.height * filters.width,
+                          1) ;
+  }
+  return vlSuccess ;
+}
+
+Error
+perfcnn::convIndices(IndexTensor convIndices,
+                     TensorGeometry const & data,
+                     TensorGeometry const & filters,
+                     ConvOptions const & options,
+                     int const * inIndices,
+                     int const * maskIndices,
+                     ptrdiff_t maskIndicesLength)
+{
+  TensorGeometry full ;
+  TensorGeometry geom ;
+  Error error ;
+
+  if ((error = convIndicesGeometry(full, data, filters, options, 0)) != vlSuccess) {
+    return error ;
+  }
+  if (maskIndices) {
+    ptrdiff_t numOutputPixels = full.height * full.width ;
+    for (ptrdiff_t i = 0 ; i < maskIndicesLength ; ++i) {
+      if (maskIndices[i] < 0 || maskIndices[i] >= numOutputPixels) {
+        return setError(vlErrorInvalidArgument, "MASKINDICES contains an index outside of the output.") ;
+      }
+    }
+    geom = TensorGeometry(maskIndicesLength, 1, full.depth, 1) ;
+  } else {
+    maskIndicesLength = full.height * full.width ;
+    geom = full ;
+  }
+  if (!sameGeometry(convIndices.geom, geom)) {
+    return setError(vlErrorInvalidArgument, "CONVINDICES does not have the expected geometry.") ;
+  }
+
+  conv_indices_cpu(convIndices.memory, geom.getNumElements(),
+                   inIndices,
+                   maskIndices,
+                   maskIndicesLength,
+                   data.height, data.width, data.depth,
+                   filters.height, filters.width,
+                   options.strideY, options.strideX,
+                   options.padTop, options.padBottom, options.padLeft, options.padRight) ;
+  return vlSuccess ;
+}
+
+Error
+perfcnn::maskIndicesOrder(IndexTensor order,
+                          IndexTensor maskIndices,
+                          ptrdiff_t height,
+                          ptrdiff_t width,
+                          MaskOrder method)
+{
+  ptrdiff_t maskIndicesLength = maskIndices.geom.height ;
+  if (maskIndices.isEmpty()) {
+    return setError(vlErrorInvalidArgument, "MASKINDICES is empty.") ;
+  }
+  if (!sameGeometry(order.geom, TensorGeometry(maskIndicesLength, 1, 1, 1))) {
+    return setError(vlErrorInvalidArgument, "ORDER does not have the expected geometry.") ;
+  }
+  for (ptrdiff_t i = 0 ; i < maskIndicesLength ; ++i) {
+    if (maskIndices.memory[i] < 0 || maskIndices.memory[i] >= height * width) {
+      return setError(vlErrorInvalidArgument, "MASKINDICES contains an index outside of the output.") ;
+    }
+  }
+  if (method == maskOrderGiven) {
+    for (ptrdiff_t i = 0 ; i < maskIndicesLength ; ++i) { order.memory[i] = (int)i ; }
+    return vlSuccess ;
+  }
+  try {
+    mask_indices_order_cpu(order.memory, maskIndices.memory, maskIndicesLength,
+                           height, method == maskOrderMorton) ;
+  } catch (std::bad_alloc const &) {
+    return setError(vlErrorOutOfMemory, "Could not allocate the sort buffer.") ;
+  }
+  return vlSuccess ;
+}
+
+Error
+perfcnn::poolIndicesGeometry(TensorGeometry & geom,
+                             TensorGeometry const & data,
+                             PoolOptions const & options)
+{
+  if (options.strideX < 1 || options.strideY < 1) {
+    return setError(vlErrorInvalidArgument, "At least one element of STRIDE is smaller than one.") ;
+  }
+  if (options.poolHeight == 0 || options.poolWidth == 0) {
+    return setError(vlErrorInvalidArgument, "A dimension of the pooling SIZE is void.") ;
+  }
+  if (data.height < options.poolHeight || data.width < options.poolWidth) {
+    return setError(vlErrorInvalidArgument, "Pooling SIZE is larger than the DATA.") ;
+  }
+  if (options.padLeft < 0 ||
+      options.padRight < 0 ||
+      options.padTop < 0 ||
+      options.padBottom < 0) {
+    return setError(vlErrorInvalidArgument, "An element of PAD is negative.") ;
+  }
+  if (options.padLeft >= options.poolWidth ||
+      options.padRight >= options.poolWidth ||
+      options.padTop >= options.poolHeight  ||
+      options.padBottom >= options.poolHeight) {
+    return setError(vlErrorInvalidArgument, "A padding value is larger or equal than the size of the pooling window.") ;
+  }
+  if (options.method != NN_POOL_MAX && options.method != NN_POOL_AVG) {
+    return setError(vlErrorInvalidArgument, "METHOD is not a supported method.") ;
+  }
+
+  geom = TensorGeometry(options.poolHeight * options.poolWidth,
+                        (data.height + (options.padTop + options.padBottom) - options.poolHeight) / options.strideY + 1,
+                        (data.width + (options.padLeft + options.padRight) - options.poolWidth) / options.strideX + 1,
+                        1) ;
+  return vlSuccess ;
+}
+
+Error
+perfcnn::poolIndices(IndexTensor poolIndices,
+                     TensorGeometry const & data,
+                     PoolOptions const & options,
+                     int const * inIndices)
+{
+  TensorGeometry geom ;
+  Error error ;
+
+  if ((error = poolIndicesGeometry(geom, data, options)) != vlSuccess) {
+    return error ;
+  }
+  if (!sameGeometry(poolIndices.geom, geom)) {
+    return setError(vlErrorInvalidArgument, "POOLINDICES does not have the expected geometry.") ;
+  }
+
+  if (options.method == NN_POOL_MAX) {
+    max_pooling_indices_cpu(poolIndices.memory,
+                            inIndices,
+                            data.height, data.width,
+                            options.poolHeight, options.poolWidth,
+                            options.strideY, options.strideX,
+                            options.padTop, options.padBottom,
+                            options.padLeft, options.padRight) ;
+  } else {
+    avg_pooling_indices_cpu(poolIndices.memory,
+                            inIndices,
+                            data.height, data.width,
+                            options.poolHeight, options.poolWidth,
+                            options.strideY, options.strideX,
+                            options.padTop, options.padBottom,
+                            options.padLeft, options.padRight) ;
+  }
+  return vlSuccess ;
+}
+
+bool
+perfcnn::isRunLengthIndices(IndexTensor indices)
+{
+  return indices.memory != NULL && rle_is_encoded(indices.memory, indices.geom.getNumElements()) ;
+}
+
+bool
+perfcnn::isDeduplicatedIndices(IndexTensor indices)
+{
+  return indices.memory != NULL && dedup_is_encoded(indices.memory, indices.geom.getNumElements()) ;
+}
+
+TensorGeometry
+perfcnn::getIndicesGeometry(IndexTensor indices)
+{
+  if (isDeduplicatedIndices(indices)) {
+    return TensorGeometry(dedup_height(indices.memory),
+                          dedup_width(indices.memory),
+                          dedup_depth(indices.memory),
+                          1) ;
+  }
+  if (!isRunLengthIndices(indices)) {
+    return indices.geom ;
+  }
+  return TensorGeometry(rle_height(indices.memory),
+                        rle_width(indices.memory),
+                        rle_depth(indices.memory),
+                        1) ;
+}
+
+Error
+perfcnn::runLengthEncodeGeometry(TensorGeometry & geom,
+                                 IndexTensor indices,
+                                 ptrdiff_t listLength)
+{
+  if (isRunLengthIndices(indices) || isDeduplicatedIndices(indices)) {
+    return setError(vlErrorInvalidArgument, "INDICES are already encoded.") ;
+  }
+  if (indices.geom.size != 1) {
+    return setError(vlErrorInvalidArgument, "INDICES with more than one slice cannot be run-length encoded.") ;
+  }
+  if (listLength < 1 || indices.geom.getNumElements() % listLength != 0) {
+    return setError(vlErrorInvalidArgument, "The length of the index lists does not divide the number of INDICES.") ;
+  }
+  ptrdiff_t numLists = indices.geom.getNumElements() / listLength ;
+  ptrdiff_t numRuns = rle_count_runs(indices.memory, numLists, listLength) ;
+  geom = TensorGeometry(2, rle_encoded_size(numLists, numRuns) / 2, 1, 1) ;
+  return vlSuccess ;
+}
+
+Error
+perfcnn::runLengthEncode(IndexTensor encoded,
+                         IndexTensor indices,
+                         ptrdiff_t listLength)
+{
+  TensorGeometry geom ;
+  Error error ;
+
+  if ((error = runLengthEncodeGeometry(geom, indices, listLength)) != vlSuccess) {
+    return error ;
+  }
+  if (!sameGeometry(encoded.geom, geom)) {
+    return setError(vlErrorInvalidArgument, "ENCODED does not have the expected geometry.") ;
+  }
+  ptrdiff_t numLists = indices.geom.getNumElements() / listLength ;
+  rle_encode(encoded.memory, indices.memory,
+             indices.geom.height, indices.geom.width, indices.geom.depth,
+             listLength,
+             geom.getNumElements() / 2 - VL_RLE_HEADER_SIZE / 2 - numLists) ;
+  return vlSuccess ;
+}
+
+Error
+perfcnn::runLengthDecode(IndexTensor indices,
+                         IndexTensor encoded)
+{
+  Error error ;
+  if (!isRunLengthIndices(encoded)) {
+    return setError(vlErrorInvalidArgument, "ENCODED are not run-length encoded indices.") ;
+  }
+  if ((error = checkIndices(encoded, "ENCODED are not valid run-length encoded indices.")) != vlSuccess) {
+    return error ;
+  }
+  if (!sameGeometry(indices.geom, getIndicesGeometry(encoded))) {
+    return setError(vlErrorInvalidArgument, "INDICES do not have the expected geometry.") ;
+  }
+  rle_decode(indices.memory, encoded.memory) ;
+  return vlSuccess ;
+}
+
+Error
+perfcnn::deduplicateIndicesGeometry(TensorGeometry & geom,
+                                    IndexTensor indices,
+                                    ptrdiff_t windowSize,
+                                    PoolMethod method)
+{
+  if (isRunLengthIndices(indices) || isDeduplicatedIndices(indices)) {
+    return setError(vlErrorInvalidArgument, "INDICES are already encoded.") ;
+  }
+  if (indices.geom.size != 1) {
+    return setError(vlErrorInvalidArgument, "INDICES with more than one slice cannot be deduplicated.") ;
+  }
+  if (windowSize < 1 || indices.geom.getNumElements() % windowSize != 0) {
+    return setError(vlErrorInvalidArgument, "The window size does not divide the number of INDICES.") ;
+  }
+  ptrdiff_t numWindows = indices.geom.getNumElements() / windowSize ;
+  ptrdiff_t numEntries = dedup_count_entries(indices.memory, numWindows, windowSize) ;
+  geom = TensorGeometry(dedup_encoded_size(numWindows, numEntries, getDedupEntrySize(method)), 1, 1, 1) ;
+  return vlSuccess ;
+}
+
+Error
+perfcnn::deduplicateIndices(IndexTensor encoded,
+                            IndexTensor indices,
+                            ptrdiff_t windowSize,
+                            PoolMethod method)
+{
+  TensorGeometry geom ;
+  Error error ;
+
+  if ((error = deduplicateIndicesGeometry(geom, indices, windowSize, method)) != vlSuccess) {
+    return error ;
+  }
+  if (!sameGeometry(encoded.geom, geom)) {
+    return setError(vlErrorInvalidArgument, "ENCODED does not have the expected geometry.") ;
+  }
+  ptrdiff_t numWindows = indices.geom.getNumElements() / windowSize ;
+  int entrySize = getDedupEntrySize(method) ;
+  dedup_encode(encoded.memory, indices.memory,
+               indices.geom.height, indices.geom.width, indices.geom.depth,
+               windowSize,
+               (geom.getNumElements() - dedup_encoded_size(numWindows, 0, entrySize)) / entrySize,
+               entrySize) ;
+  return vlSuccess ;
+}
+
+/* ---------------------------------------------------------------- */
+/*                                                          Layouts */
+/* ---------------------------------------------------------------- */
+
+Error
+perfcnn::convertLayout(Tensor output,
+                       Tensor data)
+{
+  TensorGeometry const & geom = data.geom ;
+  if (!sameGeometry(output.geom, geom)) {
+    return setError(vlErrorInvalidArgument, "OUTPUT dimensions are incompatible with X.") ;
+  }
+  if (output.layout == data.layout) {
+    std::copy(data.memory, data.memory + geom.getNumElements(), output.memory) ;
+  } else if (data.layout == layoutDefault) {
+    /* (H * W) x C -> C x (H * W), for each image */
+    transpose12_cpu<float>(output.memory, data.memory,
+                           geom.height * geom.width, geom.depth, geom.size) ;
+  } else {
+    transpose12_cpu<float>(output.memory, data.memory,
+                           geom.depth, geom.height * geom.width, geom.size) ;
+  }
+  return vlSuccess ;
+}
+
+/* ---------------------------------------------------------------- */
+/*                                           Gather and scatter ops */
+/* ---------------------------------------------------------------- */
+
+Error
+perfcnn::im2colIndexed(float * stacked,
+                       Tensor data,
+                       IndexTensor convIndices,
+                       TensorGeometry const & filters)
+{
+  Error error ;
+  if ((error = checkIndices(convIndices, "CONVINDICES are not valid run-length encoded indices.")) != vlSuccess) {
+    return error ;
+  }
+  if (getIndicesGeometry(convIndices).depth != filters.height * filters.width) {
+    return setError(vlErrorInvalidArgument, "CONVINDICES depth is not compatible with filters.") ;
+  }
+  if (data.layout != layoutDefault) {
+    return setError(vlErrorInvalidArgument, "im2colIndexed does not support channel-last DATA.") ;
+  }
+  gatherColumns(stacked, data.memory, data.geom, data.geom.size, convIndices, filters) ;
+  return vlSuccess ;
+}
+
+Error
+perfcnn::col2imIndexed(Tensor data,
+                       float const * stacked,
+                       IndexTensor convIndices,
+                       TensorGeometry const & filters)
+{
+  Error error ;
+  if ((error = checkIndices(convIndices, "CONVINDICES are not valid run-length encoded indices.")) != vlSuccess) {
+    return error ;
+  }
+  if (getIndicesGeometry(convIndices).depth != filters.height * filters.width) {
+    return setError(vlErrorInvalidArgument, "CONVINDICES depth is not compatible with filters.") ;
+  }
+  if (data.layout != layoutDefault) {
+    return setError(vlErrorInvalidArgument, "col2imIndexed does not support channel-last DATA.") ;
+  }
+  scatterColumns(data.memory, stacked, data.geom, data.geom.size, convIndices, filters) ;
+  return vlSuccess ;
+}
+
+static Error
+checkInterpolate(Tensor const & output,
+                 Tensor const & data,
+                 IndexTensor const & interpolationIndices)
+{
+  Error error ;
+  if ((error = checkInterpolationIndices(interpolationIndices,
+                                         data.geom.height * data.geom.width,
+                                         data.geom.size)) != vlSuccess) {
+    return error ;
+  }
+  if (!sameGeometry(output.geom, TensorGeometry(interpolationIndices.geom.height,
+                                                interpolationIndices.geom.width,
+                                                data.geom.depth,
+                                                data.geom.size))) {
+    return setError(vlErrorInvalidArgument, "The output dimensions are incompatible with X and INTERPOLATIONINDICES.") ;
+  }
+  return checkLayout(data, output, "X and the output (or its derivative) do not have the same layout.") ;
+}
+
+Error
+perfcnn::interpolate(Tensor output,
+                     Tensor data,
+                     IndexTensor interpolationIndices)
+{
+  Error error ;
+  if ((error = checkInterpolate(output, data, interpolationIndices)) != vlSuccess) {
+    return error ;
+  }
+  ptrdiff_t m = data.geom.height * data.geom.width ;
+  ptrdiff_t numPixels = output.geom.height * output.geom.width ;
+  ptrdiff_t depth = data.geom.depth ;
+  int numImages = (int)data.geom.size ;
+#pragma omp parallel for num_threads(vl_get_num_threads()) if(numImages > 1)
+  for (int image = 0 ; image < numImages ; ++image) {
+    int const * indices = interpolationIndices.memory + ((interpolationIndices.geom.size == 1) ? 0 : numPixels * image) ;
+    if (data.layout == layoutChannelLast) {
+      interpolate_hwc_cpu<float>(output.memory + numPixels * depth * image,
+                                 data.memory + m * depth * image,
+                                 indices, numPixels, depth) ;
+    } else {
+      interpolate_cpu<float>(output.memory + numPixels * depth * image,
+                             data.memory + m * depth * image,
+                             indices, numPixels, m, depth) ;
+    }
+  }
+  return vlSuccess ;
+}
+
+Error
+perfcnn::interpolateBackward(Tensor derData,
+                             Tensor derOutput,
+                             IndexTensor interpolationIndices)
+{
+  Error error ;
+  if ((error = checkInterpolate(derOutput, derData, interpolationIndices)) != vlSuccess) {
+    return error ;
+  }
+  ptrdiff_t m = derData.geom.height * derData.geom.width ;
+  ptrdiff_t numPixels = derOutput.geom.height * derOutput.geom.width ;
+  ptrdiff_t depth = derData.geom.depth ;
+  int numImages = (int)derData.geom.size ;
+#pragma omp parallel for num_threads(vl_get_num_threads()) if(numImages > 1)
+  for (int image = 0 ; image < numImages ; ++image) {
+    int const * indices = interpolationIndices.memory + ((interpolationIndices.geom.size == 1) ? 0 : numPixels * image) ;
+    if (derData.layout == layoutChannelLast) {
+      interpolate_backward_hwc_cpu<float>(derData.memory + m * depth * image,
+                                          derOutput.memory + numPixels * depth * image,
+                                          indices, numPixels, m, depth) ;
+    } else {
+      interpolate_backward_cpu<float>(derData.memory + m * depth * image,
+                                      derOutput.memory + numPixels * depth * image,
+                                      indices, numPixels, m, depth) ;
+    }
+  }
+  return vlSuccess ;
+}
+
+/* ---------------------------------------------------------------- */
+/*                                           Indexed convolution */
+/* ---------------------------------------------------------------- */
+
+/*
+ The images are processed in microbatches of microbatchSize images,
+ whose columns are stacked in a single im2col matrix with layout
+ (pixels x images) x (filter volume), so that the indices are walked
+ once per microbatch. The rows of each image form a submatrix with
+ leading dimension numRows, and the GEMMs of the filter groups of an
+ image form a strided batch that reads and writes the image of OUTPUT
+ (DEROUTPUT) in place; the output never needs to be transposed. The
+ groups of a batch are independent, so grouped layers run them
+ concurrently (see vl_blas_sgemm_strided_batched).
+
+ Microbatches write to disjoint parts of the output (and of derData),
+ so up to vl_get_num_threads() of them are processed concurrently,
+ each worker using its own slice of temp. The
+ derivatives of the filters and biases are accumulated over all the
+ microbatches and are computed sequentially; there the parallelism
+ comes from im2col_indexed_cpu and the BLAS.
+
+ With channel-last data the im2col matrix is transposed: each of its
+ columns is made of the contiguous channel vectors of the pixels of a
+ window (im2col_indexed_hwc_cpu), the filters are permuted to the same
+ order, and a single GEMM per group directly produces the channel-last
+ (filters x pixels x images) output.
+
+ With 1 x 1 filters (and plain indices of one slice and the default
+ layout) the im2col matrix of an image is just the rows of DATA, seen
+ as a (pixels) x (channels) matrix, listed by CONVINDICES. The rows are
+ split into segments (getPointwiseSegment): a run of consecutive
+ pixels is multiplied in place, with the leading dimension of DATA,
+ and the rows between such runs are gathered into temp by a single
+ row gather. No window offsets are walked, and a dense or mostly dense
+ mask needs no copy at all.
+ */
+
+namespace {
+  struct ConvIndexedProblem
+  {
+    /* with INTERPOLATIONINDICES the output has full resolution */
+    ConvIndexedProblem(Tensor const & data,
+                       TensorGeometry const & filters,
+                       IndexTensor const & convIndices,
+                       int microbatchSize,
+                       IndexTensor const & interpolationIndices = IndexTensor())
+    : data(data), filters(filters), convIndices(convIndices),
+      interpolationIndices(interpolationIndices),
+      microbatchSize(microbatchSize)
+    {
+      channelLast = (data.layout == layoutChannelLast) ;
+      pointwise = (filters.height == 1 && filters.width == 1 && !channelLast &&
+                   !isRunLengthIndices(convIndices) && convIndices.geom.size == 1) ;
+      numGroups = data.geom.depth / filters.depth ;
+      m = getNumOutputPixels(convIndices) ;
+      n = filters.size / numGroups ;
+      k = filters.height * filters.width * filters.depth ;
+      dataVolume = data.geom.height * data.geom.width * data.geom.depth ;
+      numInterpolated = interpolationIndices.isEmpty() ? 0 : interpolationIndices.geom.height * interpolationIndices.geom.width ;
+      outputVolume = (numInterpolated > 0 ? numInterpolated : m) * filters.size ;
+      numMicrobatches = (data.geom.size + microbatchSize - 1) / microbatchSize ;
+      compactTempSize = getCompactTempSize(m, filters.size, microbatchSize, numInterpolated > 0, data.layout) ;
+      workerTempSize = m * k * numGroups * microbatchSize + compactTempSize ;
+    }
+
+    /* the computed pixels of an interpolated output: one image, or the microbatch for channel-last data */
+    static ptrdiff_t getCompactTempSize(ptrdiff_t m, ptrdiff_t numFilters, int microbatchSize,
+                                        bool interpolated, Layout layout) {
+      if (!interpolated) { return 0 ; }
+      return m * numFilters * ((layout == layoutChannelLast) ? microbatchSize : 1) ;
+    }
+
+    int getImage(int microbatchIdx) const {
+      return microbatchIdx * microbatchSize ;
+    }
+
+    int getNumImages(int microbatchIdx) const {
+      return (microbatchIdx != numMicrobatches - 1) ? microbatchSize : (data.geom.size - getImage(microbatchIdx)) ;
+    }
+
+    /* number of microbatches that can be processed concurrently */
+    int getNumWorkers(ConvIndexedWorkspace const & workspace) const {
+      if (workerTempSize == 0) { return 1 ; }
+      ptrdiff_t numWorkers = std::min(vl_get_num_threads(), numMicrobatches) ;
+      numWorkers = std::min(numWorkers, workspace.tempSize / workerTempSize) ;
+      return (int)std::max(numWorkers, (ptrdiff_t)1) ;
+    }
+
+    Tensor data ;
+    TensorGeometry filters ;
+    IndexTensor convIndices ;
+    IndexTensor interpolationIndices ;
+    int microbatchSize ;
+    bool channelLast ;
+    bool pointwise ; /* 1 x 1 filters, see getPointwiseSegment */
+
+    ptrdiff_t numGroups ;
+    ptrdiff_t m ; /* num output pixels */
+    ptrdiff_t n ; /* num filters per group */
+    ptrdiff_t k ; /* filter volume */
+    ptrdiff_t dataVolume ;
+    ptrdiff_t numInterpolated ; /* num pixels of the interpolated output, or 0 */
+    ptrdiff_t outputVolume ;
+    int numMicrobatches ;
+    ptrdiff_t compactTempSize ; /* at the end of the temp buffer of a worker */
+    ptrdiff_t workerTempSize ;
+  } ;
+}
+
+void
+perfcnn::convIndexedGetWorkspaceSize(ConvIndexedWorkspace & workspace,
+                                     TensorGeometry const & data,
+                                     TensorGeometry const & filters,
+                                     IndexTensor convIndices,
+                                     int microbatchSize,
+                                     Layout layout,
+                                     bool interpolated)
+{
+  ptrdiff_t m = getNumOutputPixels(convIndices) ;
+  ptrdiff_t numGroups = (filters.depth > 0) ? data.depth / filters.depth : 0 ;
+  ptrdiff_t numMicrobatches = (data.size + microbatchSize - 1) / microbatchSize ;
+  ptrdiff_t numWorkers = std::max(std::min((ptrdiff_t)vl_get_num_threads(), numMicrobatches), (ptrdiff_t)1) ;
+  ptrdiff_t workerTempSize = m * filters.height * filters.width * filters.depth * numGroups * microbatchSize ;
+  workerTempSize += ConvIndexedProblem::getCompactTempSize(m, filters.size, microbatchSize, interpolated, layout) ;
+  workspace.tempSize = workerTempSize * numWorkers ;
+}
+
+static Error
+checkWorkspace(ConvIndexedWorkspace const & workspace,
+               ConvIndexedProblem const & problem)
+{
+  if (workspace.temp == NULL || workspace.tempSize < problem.workerTempSize) {
+    return setError(vlErrorOutOfMemory, "The TEMP workspace buffer is too small.") ;
+  }
+  return vlSuccess ;
+}
+
+static int const *
+getInterpolationIndices(ConvIndexedProblem const & problem, int image)
+{
+  IndexTensor const & indices = problem.interpolationIndices ;
+  return indices.memory + ((indices.geom.size == 1) ? 0 : problem.numInterpolated * image) ;
+}
+
+/*
+ The channel-last im2col matrix lists the channels of each window
+ offset together; the filters are permuted to the same row order.
+ */
+static void
+filtersToChannelLast(float * permuted,
+                     float const * filters,
+                     TensorGeometry const & geom)
+{
+  ptrdiff_t depthCol = geom.height * geom.width ;
+  ptrdiff_t k = depthCol * geom.depth ;
+  for (ptrdiff_t f = 0 ; f < geom.size ; ++f) {
+    for (ptrdiff_t c = 0 ; c < geom.depth ; ++c) {
+      for (ptrdiff_t d = 0 ; d < depthCol ; ++d) {
+        permuted[f * k + d * geom.depth + c] = filters[f * k + c * depthCol + d] ;
+      }
+    }
+  }
+}
+
+static void
+filtersFromChannelLast(float * filters,
+                       float const * permuted,
+                       TensorGeometry const & geom,
+                       bool accumulate)
+{
+  ptrdiff_t depthCol = geom.height * geom.width ;
+  ptrdiff_t k = depthCol * geom.depth ;
+  for (ptrdiff_t f = 0 ; f < geom.size ; ++f) {
+    for (ptrdiff_t c = 0 ; c < geom.depth ; ++c) {
+      for (ptrdiff_t d = 0 ; d < depthCol ; ++d) {
+        float value = permuted[f * k + d * geom.depth + c] ;
+        filters[f * k + c * depthCol + d] = accumulate ? filters[f * k + c * depthCol + d] + value : value ;
+      }
+    }
+  }
+}
+
+static void
+gatherColumnsChannelLast(float * stacked,
+                         float const * data,
+                         ptrdiff_t numImages,
+                         ConvIndexedProblem const & problem)
+{
+  im2col_indexed_hwc_cpu<float>(stacked, data, problem.convIndices.memory,
+                                problem.m * problem.convIndices.geom.depth,
+                                problem.data.geom.height, problem.data.geom.width,
+                                problem.data.geom.depth, numImages,
+                                problem.filters.height, problem.filters.width,
+                                problem.numGroups) ;
+}
+
+/* FILTERS are permuted by filtersToChannelLast */
+static void
+convIndexedForwardMicrobatchChannelLast(ConvIndexedProblem const & problem,
+                                        int microbatchIdx,
+                                        float * output,
+                                        float const * filters,
+                                        float const * biases,
+                                        bool relu,
+                                        float * temp)
+{
+  int image = problem.getImage(microbatchIdx) ;
+  int numImages = problem.getNumImages(microbatchIdx) ;
+  ptrdiff_t numCols = problem.m * numImages ;
+  ptrdiff_t n = problem.n ;
+  ptrdiff_t k = problem.k ;
+  ptrdiff_t numFilters = problem.filters.size ;
+  float * curOutputMemory = output + problem.outputVolume * image ;
+  float * compact = temp + problem.workerTempSize - problem.compactTempSize ;
+  float * result = (problem.numInterpolated > 0) ? compact : curOutputMemory ;
+
+  gatherColumnsChannelLast(temp,
+                           problem.data.memory + problem.dataVolume * image,
+                           numImages, problem) ;
+  vl_blas_sgemm_strided_batched('t', 'n',
+                                n, numCols, k,
+                                1.0f,
+                                filters, k, k * n,
+                                temp, k, numCols * k,
+                                0.0f,
+                                result, numFilters, n,
+                                problem.numGroups) ;
+  if (biases || relu) {
+    bias_relu_rows_cpu<float>(result, numFilters, biases,
+                              numFilters, numCols, relu) ;
+  }
+  if (problem.numInterpolated > 0) {
+    for (int s = 0 ; s < numImages ; ++s) {
+      interpolate_hwc_cpu<float>(curOutputMemory + problem.outputVolume * s,
+                                 compact + problem.m * numFilters * s,
+                                 getInterpolationIndices(problem, image + s),
+                                 problem.numInterpolated, numFilters) ;
+    }
+  }
+}
+
+/* FILTERS and DERFILTERS are permuted by filtersToChannelLast */
+static void
+convIndexedBackwardMicrobatchChannelLast(ConvIndexedProblem const & problem,
+                                         int microbatchIdx,
+                                         float * derData,
+                                         float * derFilters,
+                                         float * derBiases,
+                                         float const * filters,
+                                         float const * derOutput,
+                                         bool accumulateDerFilters,
+                                         bool accumulateDerBiases,
+                                         float * temp)
+{
+  int image = problem.getImage(microbatchIdx) ;
+  int numImages = problem.getNumImages(microbatchIdx) ;
+  ptrdiff_t numCols = problem.m * numImages ;
+  ptrdiff_t n = problem.n ;
+  ptrdiff_t k = problem.k ;
+  ptrdiff_t numFilters = problem.filters.size ;
+  float const * curDerOutputMemory = derOutput + problem.outputVolume * image ;
+
+  /* compute derFilters dz/dF */
+  if (derFilters) {
+    gatherColumnsChannelLast(temp,
+                             problem.data.memory + problem.dataVolume * image,
+                             numImages, problem) ;
+    float beta = (image > 0 || accumulateDerFilters) ;
+    vl_blas_sgemm_strided_batched('n', 't',
+                                  k, n, numCols,
+                                  1.0f,
+                                  temp, k, numCols * k,
+                                  curDerOutputMemory, numFilters, n,
+                                  beta,
+                                  derFilters, k, k * n,
+                                  problem.numGroups) ;
+  }
+
+  /* compute derBiases dz/dbias */
+  if (derBiases) {
+    sum_rows_cpu<float>(derBiases, curDerOutputMemory, numFilters,
+                        numFilters, numCols,
+                        image > 0 || accumulateDerBiases) ;
+  }
+
+  /* compute derData dz/dx */
+  if (derData) {
+    vl_blas_sgemm_strided_batched('n', 'n',
+                                  k, numCols, n,
+                                  1.0f,
+                                  filters, k, k * n,
+                                  curDerOutputMemory, numFilters, n,
+                                  0.0f,
+                                  temp, k, numCols * k,
+                                  problem.numGroups) ;
+    col2im_indexed_hwc_cpu<float>(derData + problem.dataVolume * image,
+                                  temp, problem.convIndices.memory,
+                                  problem.m * problem.convIndices.geom.depth,
+                                  problem.data.geom.height, problem.data.geom.width,
+                                  problem.data.geom.depth, numImages,
+                                  problem.filters.height, problem.filters.width,
+                                  problem.numGroups) ;
+  }
+}
+
+/* runs of fewer pixels are gathered: a product of a few rows is slow */
+static ptrdiff_t const minPointwiseRun = 32 ;
+
+/*
+ Length of the segment of the M rows of a 1 x 1 convolution that
+ starts at row P: a run of at least minPointwiseRun consecutive
+ pixels (DIRECT), or the rows up to the next such run.
+ */
+static ptrdiff_t
+getPointwiseSegment(int const * rows, ptrdiff_t m, ptrdiff_t p, bool & direct)
+{
+  ptrdiff_t q = p ;
+  while (q < m) {
+    ptrdiff_t run = 1 ;
+    if (rows[q] >= 0) {
+      while (q + run < m && rows[q + run] == rows[q] + run) { ++run ; }
+    }
+    if (run >= minPointwiseRun) {
+      if (q == p) {
+        direct = true ;
+        return run ;
+      }
+      break ;
+    }
+    q += run ;
+  }
+  direct = false ;
+  return q - p ;
+}
+
+/* the LENGTH x DEPTH matrix of the listed ROWS of an image with DATASIZE pixels */
+static void
+gatherRows(float * stacked,
+           float const * data,
+           ptrdiff_t dataSize,
+           ptrdiff_t depth,
+           int const * rows,
+           ptrdiff_t length)
+{
+  for (ptrdiff_t c = 0 ; c < depth ; ++c) {
+    vl_indexed_gather(stacked + length * c, data + dataSize * c, rows, (int)length) ;
+  }
+}
+
+static void
+scatterAddRows(float * data,
+               float const * stacked,
+               ptrdiff_t dataSize,
+               ptrdiff_t depth,
+               int const * rows,
+               ptrdiff_t length)
+{
+  for (ptrdiff_t c = 0 ; c < depth ; ++c) {
+    vl_indexed_scatter_add(data + dataSize * c, stacked + length * c, rows, (int)length) ;
+  }
+}
+
+/* RESULT (m x num filters) of one image with 1 x 1 filters */
+static void
+convPointwiseForwardImage(ConvIndexedProblem const & problem,
+                          int image,
+                          float * result,
+                          float const * filters,
+                          float * temp)
+{
+  ptrdiff_t m = problem.m ;
+  ptrdiff_t n = problem.n ;
+  ptrdiff_t k = problem.k ;
+  ptrdiff_t dataSize = problem.data.geom.height * problem.data.geom.width ;
+  float const * data = problem.data.memory + problem.dataVolume * image ;
+  int const * rows = problem.convIndices.memory ;
+  ptrdiff_t length ;
+  bool direct ;
+
+  for (ptrdiff_t p = 0 ; p < m ; p += length) {
+    length = getPointwiseSegment(rows, m, p, direct) ;
+    float const * stacked = temp ;
+    ptrdiff_t ld = length ;
+    if (direct) {
+      stacked = data + rows[p] ;
+      ld = dataSize ;
+    } else {
+      gatherRows(temp, data, dataSize, problem.data.geom.depth, rows + p, length) ;
+    }
+    vl_blas_sgemm_strided_batched('n', 'n',
+                                  length, n, k,
+                                  1.0f,
+                                  stacked, ld, ld * k,
+                                  filters, k, k * n,
+                                  0.0f,
+                                  result + p, m, m * n,
+                                  problem.numGroups) ;
+  }
+}
+
+/* adds (or writes, if not ACCUMULATE) the derivative of the filters of one image */
+static void
+convPointwiseDerFiltersImage(ConvIndexedProblem const & problem,
+                             int image,
+                             float * derFilters,
+                             float const * derOutput,
+                             bool accumulate,
+                             float * temp)
+{
+  ptrdiff_t m = problem.m ;
+  ptrdiff_t n = problem.n ;
+  ptrdiff_t k = problem.k ;
+  ptrdiff_t dataSize = problem.data.geom.height * problem.data.geom.width ;
+  float const * data = problem.data.memory + problem.dataVolume * image ;
+  int const * rows = problem.convIndices.memory ;
+  ptrdiff_t length ;
+  bool direct ;
+
+  for (ptrdiff_t p = 0 ; p < m ; p += length) {
+    length = getPointwiseSegment(rows, m, p, direct) ;
+    float const * stacked = temp ;
+    ptrdiff_t ld = length ;
+    if (direct) {
+      stacked = data + rows[p] ;
+      ld = dataSize ;
+    } else {
+      gatherRows(temp, data, dataSize, problem.data.geom.depth, rows + p, length) ;
+    }
+    vl_blas_sgemm_strided_batched('t', 'n',
+                                  k, n, length,
+                                  1.0f,
+                                  stacked, ld, ld * k,
+                                  derOutput + p, m, m * n,
+                                  (accumulate || p > 0) ? 1.0f : 0.0f,
+                                  derFilters, k, k * n,
+                                  problem.numGroups) ;
+  }
+}
+
+/* DERDATA of one image with 1 x 1 filters */
+static void
+convPointwiseDerDataImage(ConvIndexedProblem const & problem,
+                          float * derData,
+                          float const * filters,
+                          float const * derOutput,
+                          float * temp)
+{
+  ptrdiff_t m = problem.m ;
+  ptrdiff_t n = problem.n ;
+  ptrdiff_t k = problem.k ;
+  ptrdiff_t dataSize = problem.data.geom.height * problem.data.geom.width ;
+  int const * rows = problem.convIndices.memory ;
+  ptrdiff_t length ;
+  bool direct ;
+
+  /* a pixel may be listed more than once, so the rows are added */
+  std::fill(derData, derData + problem.dataVolume, 0.0f) ;
+  for (ptrdiff_t p = 0 ; p < m ; p += length) {
+    length = getPointwiseSegment(rows, m, p, direct) ;
+    float * stacked = direct ? derData + rows[p] : temp ;
+    ptrdiff_t ld = direct ? dataSize : length ;
+    vl_blas_sgemm_strided_batched('n', 't',
+                                  length, k, n,
+                                  1.0f,
+                                  derOutput + p, m, m * n,
+                                  filters, k, k * n,
+                                  direct ? 1.0f : 0.0f,
+                                  stacked, ld, ld * k,
+                                  problem.numGroups) ;
+    if (!direct) {
+      scatterAddRows(derData, temp, dataSize, problem.data.geom.depth, rows + p, length) ;
+    }
+  }
+}
+
+static void
+convIndexedForwardMicrobatch(ConvIndexedProblem const & problem,
+                             int microbatchIdx,
+                             float * output,
+                             float const * filters,
+                             float const * biases,
+                             bool relu,
+                             float * temp)
+{
+  if (problem.channelLast) {
+    convIndexedForwardMicrobatchChannelLast(problem, microbatchIdx,
+                                            output, filters, biases,
+                                            relu, temp) ;
+    return ;
+  }
+  int image = problem.getImage(microbatchIdx) ;
+  int numImages = problem.getNumImages(microbatchIdx) ;
+  ptrdiff_t numRows = problem.m * numImages ;
+  ptrdiff_t m = problem.m ;
+  ptrdiff_t n = problem.n ;
+  ptrdiff_t k = problem.k ;
+  float * curOutputMemory = output + problem.outputVolume * image ;
+  float * compact = temp + problem.workerTempSize - problem.compactTempSize ;
+
+  if (!problem.pointwise) {
+    gatherColumns(temp,
+                  problem.data.memory + problem.dataVolume * image,
+                  problem.data.geom, numImages,
+                  problem.convIndices, problem.filters) ;
+  }
+  for (int s = 0 ; s < numImages ; ++s) {
+    /* an interpolated image is computed in COMPACT and then spread to the output */
+    float * result = (problem.numInterpolated > 0) ? compact : curOutputMemory + problem.outputVolume * s ;
+    if (problem.pointwise) {
+      convPointwiseForwardImage(problem, image + s, result, filters, temp) ;
+    } else {
+      vl_blas_sgemm_strided_batched('n', 'n',
+                                    m, n, k,
+                                    1.0f,
+                                    temp + m * s, numRows, numRows * k,
+                                    filters, k, k * n,
+                                    0.0f,
+                                    result, m, m * n,
+                                    problem.numGroups) ;
+    }
+    if (biases || relu) {
+      bias_relu_columns_cpu<float>(result, m, biases,
+                                   m, problem.filters.size, relu) ;
+    }
+    if (problem.numInterpolated > 0) {
+      interpolate_cpu<float>(curOutputMemory + problem.outputVolume * s,
+                             compact,
+                             getInterpolationIndices(problem, image + s),
+                             problem.numInterpolated, m, problem.filters.size) ;
+    }
+  }
+}
+
+/* checks the remaining arguments once DATA, FILTERS and CONVINDICES are consistent */
+static Error
+checkConvIndexedForward(Tensor const & output,
+                        Tensor const & data,
+                        Tensor const & filters,
+                        Tensor const & biases,
+                        IndexTensor const & convIndices,
+                        IndexTensor const & interpolationIndices = IndexTensor())
+{
+  Error error ;
+  if (interpolationIndices.memory != NULL) {
+    if ((error = checkInterpolationIndices(interpolationIndices, getNumOutputPixels(convIndices), data.geom.size)) != vlSuccess) {
+      return error ;
+    }
+    if (!sameGeometry(output.geom, TensorGeometry(interpolationIndices.geom.height,
+                                                  interpolationIndices.geom.width,
+                                                  filters.geom.size,
+                                                  data.geom.size))) {
+      return setError(vlErrorInvalidArgument, "OUTPUT dimensions are incompatible with DATA, FILTERS and INTERPOLATIONINDICES.") ;
+    }
+  } else if (!sameGeometry(output.geom, TensorGeometry(getIndicesGeometry(convIndices).height,
+                                                       getIndicesGeometry(convIndices).width,
+                                                       filters.geom.size,
+                                                       data.geom.size))) {
+    return setError(vlErrorInvalidArgument, "OUTPUT dimensions are incompatible with DATA, FILTERS and CONVINDICES.") ;
+  }
+  if (!biases.isEmpty() && biases.geom.getNumElements() != filters.geom.size) {
+    return setError(vlErrorInvalidArgument, "The number of elements of BIASES is not the same as the number of filters.") ;
+  }
+  return checkConvIndexedLayout(data, output, filters, convIndices) ;
+}
+
+/* FILTERSCHANNELLAST is scratch space for the permuted filters */
+static void
+runConvIndexedForward(ConvIndexedProblem const & problem,
+                      Tensor output,
+                      Tensor filters,
+                      Tensor biases,
+                      ConvIndexedWorkspace const & workspace,
+                      bool relu,
+                      std::vector<float> & filtersChannelLast)
+{
+  bool hasBiases = !biases.isEmpty() ;
+  float const * filtersMemory = filters.memory ;
+  if (problem.channelLast) {
+    filtersChannelLast.resize(filters.geom.getNumElements()) ;
+    filtersToChannelLast(&filtersChannelLast[0], filters.memory, filters.geom) ;
+    filtersMemory = &filtersChannelLast[0] ;
+  }
+
+  int numWorkers = problem.getNumWorkers(workspace) ;
+#pragma omp parallel for num_threads(numWorkers) schedule(static,1) if(numWorkers > 1)
+  for (int microbatchIdx = 0 ; microbatchIdx < problem.numMicrobatches ; ++microbatchIdx) {
+    int worker = (numWorkers > 1) ? vl_get_thread_id() : 0 ;
+    convIndexedForwardMicrobatch(problem, microbatchIdx,
+                                 output.memory,
+                                 filtersMemory,
+                                 hasBiases ? biases.memory : NULL,
+                                 relu,
+                                 workspace.temp + problem.workerTempSize * worker) ;
+  }
+}
+
+Error
+perfcnn::convIndexedForward(Tensor output,
+                            Tensor data,
+                            Tensor filters,
+                            Tensor biases,
+                            IndexTensor convIndices,
+                            int microbatchSize,
+                            ConvIndexedWorkspace const & workspace,
+                            bool relu)
+{
+  Error error ;
+
+  if (microbatchSize < 1) {
+    return setError(vlErrorInvalidArgument, "MICROBATCHSIZE is smaller than one.") ;
+  }
+  if ((error = checkConvIndexed(data, filters.geom, convIndices)) != vlSuccess) {
+    return error ;
+  }
+  if ((error = checkConvIndexedForward(output, data, filters, biases, convIndices)) != vlSuccess) {
+    return error ;
+  }
+
+  ConvIndexedProblem problem(data, filters.geom, convIndices, microbatchSize) ;
+  if ((error = checkWorkspace(workspace, problem)) != vlSuccess) {
+    return error ;
+  }
+
+  std::vector<float> filtersChannelLast ;
+  runConvIndexedForward(problem, output, filters, biases, workspace, relu, filtersChannelLast) ;
+  return vlSuccess ;
+}
+
+Error
+perfcnn::convIndexedForwardInterpolated(Tensor output,
+                                        Tensor data,
+                                        Tensor filters,
+                                        Tensor biases,
+                                        IndexTensor convIndices,
+                                        IndexTensor interpolationIndices,
+                                        int microbatchSize,
+                                        ConvIndexedWorkspace const & workspace,
+                                        bool relu)
+{
+  Error error ;
+
+  if (microbatchSize < 1) {
+    return setError(vlErrorInvalidArgument, "MICROBATCHSIZE is smaller than one.") ;
+  }
+  if (interpolationIndices.memory == NULL) {
+    return setError(vlErrorInvalidArgument, "INTERPOLATIONINDICES is empty.") ;
+  }
+  if ((error = checkConvIndexed(data, filters.geom, convIndices)) != vlSuccess) {
+    return error ;
+  }
+  if ((error = checkConvIndexedForward(output, data, filters, biases,
+                                       convIndices, interpolationIndices)) != vlSuccess) {
+    return error ;
+  }
+
+  ConvIndexedProblem problem(data, filters.geom, convIndices, microbatchSize, interpolationIndices) ;
+  if ((error = checkWorkspace(workspace, problem)) != vlSuccess) {
+    return error ;
+  }
+
+  std::vector<float> filtersChannelLast ;
+  runConvIndexedForward(problem, output, filters, biases, workspace, relu, filtersChannelLast) ;
+  return vlSuccess ;
+}
+
+Error
+perfcnn::convIndexedForwardGatherGemm(Tensor output,
+                                      Tensor data,
+                                      Tensor filters,
+                                      Tensor biases,
+                                      IndexTensor convIndices,
+                                      bool relu)
+{
+  Error error ;
+  bool hasBiases = !biases.isEmpty() ;
+
+  if ((error = checkConvIndexed(data, filters.geom, convIndices)) != vlSuccess) {
+    return error ;
+  }
+  if (!sameGeometry(output.geom, TensorGeometry(getIndicesGeometry(convIndices).height,
+                                                getIndicesGeometry(convIndices).width,
+                                                filters.geom.size,
+                                                data.geom.size))) {
+    return setError(vlErrorInvalidArgument, "OUTPUT dimensions are incompatible with DATA, FILTERS and CONVINDICES.") ;
+  }
+  if (hasBiases && biases.geom.getNumElements() != filters.geom.size) {
+    return setError(vlErrorInvalidArgument, "The number of elements of BIASES is not the same as the number of filters.") ;
+  }
+  if (isRunLengthIndices(convIndices)) {
+    return setError(vlErrorInvalidArgument, "The implicit GEMM does not support run-length encoded CONVINDICES.") ;
+  }
+  if (data.layout != layoutDefault || output.layout != layoutDefault) {
+    return setError(vlErrorInvalidArgument, "The implicit GEMM does not support channel-last DATA.") ;
+  }
+
+  conv_indexed_gather_gemm_cpu<float>(output.memory,
+                                      data.memory,
+                                      filters.memory,
+                                      hasBiases ? biases.memory : NULL,
+                                      convIndices.memory,
+                                      convIndices.geom.height * convIndices.geom.width * convIndices.geom.depth,
+                                      data.geom.height, data.geom.width, data.geom.depth, data.geom.size,
+                                      filters.geom.height, filters.geom.width,
+                                      filters.geom.size,
+                                      data.geom.depth / filters.geom.depth,
+                                      relu) ;
+  return vlSuccess ;
+}
+
+static void
+convIndexedBackwardMicrobatch(ConvIndexedProblem const & problem,
+                              int microbatchIdx,
+                              float * derData,
+                              float * derFilters,
+                              float * derBiases,
+                              float const * filters,
+                              float const * derOutput,
+                              bool accumulateDerFilters,
+                              bool accumulateDerBiases,
+                              float * temp)
+{
+  if (problem.channelLast) {
+    convIndexedBackwardMicrobatchChannelLast(problem, microbatchIdx,
+                                             derData, derFilters, derBiases,
+                                             filters, derOutput,
+                                             accumulateDerFilters, accumulateDerBiases,
+                                             temp) ;
+    return ;
+  }
+  int image = problem.getImage(microbatchIdx) ;
+  int numImages = problem.getNumImages(microbatchIdx) ;
+  ptrdiff_t numRows = problem.m * numImages ;
+  ptrdiff_t m = problem.m ;
+  ptrdiff_t n = problem.n ;
+  ptrdiff_t k = problem.k ;
+  float const * curDerOutputMemory = derOutput + problem.outputVolume * image ;
+
+  /* compute derFilters dz/dF */
+  if (derFilters && problem.pointwise) {
+    for (int s = 0 ; s < numImages ; ++s) {
+      convPointwiseDerFiltersImage(problem, image + s, derFilters,
+                                   curDerOutputMemory + problem.outputVolume * s,
+                                   image > 0 || s > 0 || accumulateDerFilters,
+                                   temp) ;
+    }
+  } else if (derFilters) {
+    gatherColumns(temp,
+                  problem.data.memory + problem.dataVolume * image,
+                  problem.data.geom, numImages,
+                  problem.convIndices, problem.filters) ;
+    for (int s = 0 ; s < numImages ; ++s) {
+      float beta = (image > 0 || s > 0 || accumulateDerFilters) ; /* this saves init. the output array with 0 */
+      vl_blas_sgemm_strided_batched('t', 'n',
+                                    k, n, m,
+                                    1.0f,
+                                    temp + m * s, numRows, numRows * k,
+                                    curDerOutputMemory + problem.outputVolume * s, m, m * n,
+                                    beta,
+                                    derFilters, k, k * n,
+                                    problem.numGroups) ;
+    }
+  }
+
+  /* compute derBiases dz/dbias */
+  if (derBiases) {
+    for (int s = 0 ; s < numImages ; ++s) {
+      sum_columns_cpu<float>(derBiases, curDerOutputMemory + problem.outputVolume * s, m,
+                             m, problem.filters.size,
+                             image > 0 || s > 0 || accumulateDerBiases) ;
+    }
+  }
+
+  /* compute derData dz/dx */
+  if (derData && problem.pointwise) {
+    for (int s = 0 ; s < numImages ; ++s) {
+      convPointwiseDerDataImage(problem,
+                                derData + problem.dataVolume * (image + s),
+                                filters,
+                                curDerOutputMemory + problem.outputVolume * s,
+                                temp) ;
+    }
+  } else if (derData) {
+    for (int s = 0 ; s < numImages ; ++s) {
+      vl_blas_sgemm_strided_batched('n', 't',
+                                    m, k, n,
+                                    1.0f,
+                                    curDerOutputMemory + problem.outputVolume * s, m, m * n,
+                                    filters, k, k * n,
+                                    0.0f,
+                                    temp + m * s, numRows, numRows * k,
+                                    problem.numGroups) ;
+    }
+    scatterColumns(derData + problem.dataVolume * image,
+                   temp,
+                   problem.data.geom, numImages,
+                   problem.convIndices, problem.filters) ;
+  }
+}
+
+static Error
+checkConvIndexedBackward(Tensor const & derData,
+                         Tensor const & derFilters,
+                         Tensor const & derBiases,
+                         Tensor const & data,
+                         Tensor const & filters,
+                         Tensor const & derOutput,
+                         IndexTensor const & convIndices)
+{
+  Error error ;
+  if (!sameGeometry(derOutput.geom, TensorGeometry(getIndicesGeometry(convIndices).height,
+                                                   getIndicesGeometry(convIndices).width,
+                                                   filters.geom.size,
+                                                   data.geom.size))) {
+    return setError(vlErrorInvalidArgument, "DEROUTPUT dimensions are incompatible with X and FILTERS.") ;
+  }
+  if (!derData.isEmpty() && !sameGeometry(derData.geom, data.geom)) {
+    return setError(vlErrorInvalidArgument, "DERDATA dimensions are incompatible with X.") ;
+  }
+  if (!derFilters.isEmpty() && !sameGeometry(derFilters.geom, filters.geom)) {
+    return setError(vlErrorInvalidArgument, "DERFILTERS dimensions are incompatible with FILTERS.") ;
+  }
+  if (!derBiases.isEmpty() && derBiases.geom.getNumElements() != filters.geom.size) {
+    return setError(vlErrorInvalidArgument, "The number of elements of DERBIASES is not the same as the number of filters.") ;
+  }
+  if ((error = checkConvIndexedLayout(data, derOutput, filters, convIndices)) != vlSuccess) {
+    return error ;
+  }
+  if ((error = checkLayout(data, derData, "X and DERDATA do not have the same layout.")) != vlSuccess) {
+    return error ;
+  }
+  if (!derFilters.isEmpty() && derFilters.layout != layoutDefault) {
+    return setError(vlErrorInvalidArgument, "DERFILTERS do not have the default layout.") ;
+  }
+  return vlSuccess ;
+}
+
+/* FILTERSCHANNELLAST and DERFILTERSCHANNELLAST are scratch space */
+static void
+runConvIndexedBackward(ConvIndexedProblem const & problem,
+                       Tensor derData,
+                       Tensor derFilters,
+                       Tensor derBiases,
+                       Tensor filters,
+                       Tensor derOutput,
+                       bool accumulateDerFilters,
+                       bool accumulateDerBiases,
+                       ConvIndexedWorkspace const & workspace,
+                       std::vector<float> & filtersChannelLast,
+                       std::vector<float> & derFiltersChannelLast)
+{
+  bool computeDerData = !derData.isEmpty() ;
+  bool computeDerFilters = !derFilters.isEmpty() ;
+  bool computeDerBiases = !derBiases.isEmpty() ;
+
+  /* with channel-last data, the filter derivatives are accumulated permuted */
+  float const * filtersMemory = filters.memory ;
+  float * derFiltersMemory = derFilters.memory ;
+  bool accumulateDerFiltersMemory = accumulateDerFilters ;
+  if (problem.channelLast) {
+    filtersChannelLast.resize(filters.geom.getNumElements()) ;
+    filtersToChannelLast(&filtersChannelLast[0], filters.memory, filters.geom) ;
+    filtersMemory = &filtersChannelLast[0] ;
+    if (computeDerFilters) {
+      derFiltersChannelLast.resize(filters.geom.getNumElements()) ;
+      derFiltersMemory = &derFiltersChannelLast[0] ;
+      accumulateDerFiltersMemory = false ;
+    }
+  }
+
+  int numWorkers = computeDerData ? problem.getNumWorkers(workspace) : 1 ;
+  if (numWorkers > 1) {
+    /* the accumulated derivatives first, then derData in parallel */
+    if (computeDerFilters || computeDerBiases) {
+      for (int microbatchIdx = 0 ; microbatchIdx < problem.numMicrobatches ; ++microbatchIdx) {
+        convIndexedBackwardMicrobatch(problem, microbatchIdx,
+                                      NULL,
+                                      computeDerFilters ? derFiltersMemory : NULL,
+                                      computeDerBiases ? derBiases.memory : NULL,
+                                      filtersMemory,
+                                      derOutput.memory,
+                                      accumulateDerFiltersMemory,
+                                      accumulateDerBiases,
+                                      workspace.temp) ;
+      }
+    }
+#pragma omp parallel for num_threads(numWorkers) schedule(static,1)
+    for (int microbatchIdx = 0 ; microbatchIdx < problem.numMicrobatches ; ++microbatchIdx) {
+      int worker = vl_get_thread_id() ;
+      convIndexedBackwardMicrobatch(problem, microbatchIdx,
+                                    derData.memory,
+                                    NULL,
+                                    NULL,
+                                    filtersMemory,
+                                    derOutput.memory,
+                                    false,
+                                    false,
+                                    workspace.temp + problem.workerTempSize * worker) ;
+    }
+  } else {
+    for (int microbatchIdx = 0 ; microbatchIdx < problem.numMicrobatches ; ++microbatchIdx) {
+      convIndexedBackwardMicrobatch(problem, microbatchIdx,
+                                    computeDerData ? derData.memory : NULL,
+                                    computeDerFilters ? derFiltersMemory : NULL,
+                                    computeDerBiases ? derBiases.memory : NULL,
+                                    filtersMemory,
+                                    derOutput.memory,
+                                    accumulateDerFiltersMemory,
+                                    accumulateDerBiases,
+                                    workspace.temp) ;
+    }
+  }
+  if (problem.channelLast && computeDerFilters) {
+    filtersFromChannelLast(derFilters.memory, &derFiltersChannelLast[0], filters.geom, accumulateDerFilters) ;
+  }
+}
+
+Error
+perfcnn::convIndexedBackward(Tensor derData,
+                             Tensor derFilters,
+                             Tensor derBiases,
+                             Tensor data,
+                             Tensor filters,
+                             Tensor derOutput,
+                             IndexTensor convIndices,
+                             int microbatchSize,
+                             bool accumulateDerFilters,
+                             bool accumulateDerBiases,
+                             ConvIndexedWorkspace const & workspace)
+{
+  Error error ;
+
+  if (microbatchSize < 1) {
+    return setError(vlErrorInvalidArgument, "MICROBATCHSIZE is smaller than one.") ;
+  }
+  if ((error = checkConvIndexed(data, filters.geom, convIndices)) != vlSuccess) {
+    return error ;
+  }
+  if ((error = checkConvIndexedBackward(derData, derFilters, derBiases,
+                                        data, filters, derOutput, convIndices)) != vlSuccess) {
+    return error ;
+  }
+
+  ConvIndexedProblem problem(data, filters.geom, convIndices, microbatchSize) ;
+  if ((error = checkWorkspace(workspace, problem)) != vlSuccess) {
+    return error ;
+  }
+
+  std::vector<float> filtersChannelLast ;
+  std::vector<float> derFiltersChannelLast ;
+  runConvIndexedBackward(problem, derData, derFilters, derBiases, filters, derOutput,
+                         accumulateDerFilters, accumulateDerBiases,
+                         workspace, filtersChannelLast, derFiltersChannelLast) ;
+  return vlSuccess ;
+}
+
+/* ---------------------------------------------------------------- */
+/*                                         Microbatch size selection */
+/* ---------------------------------------------------------------- */
+
+/*
+ Stacking more images makes the GEMMs taller, which helps as long as
+ the im2col matrices of the workers stay in the last level cache and
+ there are enough microbatches to keep the workers busy. The sizes
+ whose working set fits in the cache are timed once on synthetic data
+ (forward pass only) and the fastest one is remembered for the
+ geometry and the number of threads.
+ */
+
+enum {
+  maxAutoMicrobatchSize = 32,
+  autoMicrobatchRows = 16384 /* the GEMMs are tall enough beyond this */
+} ;
+
+static ptrdiff_t
+getCacheSize()
+{
+  ptrdiff_t size = 0 ;
+#if defined(__linux__) && defined(_SC_LEVEL3_CACHE_SIZE)
+  size = sysconf(_SC_LEVEL3_CACHE_SIZE) ;
+  if (size <= 0) { size = sysconf(_SC_LEVEL2_CACHE_SIZE) ; }
+#endif
+  return (size > 0) ? size : (ptrdiff_t)8 << 20 ;
+}
+
+/* seconds per image of the forward pass */
+static double
+timeConvIndexedForward(ConvIndexedProblem const & problem,
+                       Tensor output,
+                       Tensor filters,
+                       ConvIndexedWorkspace const & workspace)
+{
+  std::vector<float> filtersChannelLast ;
+  double best = 0 ;
+  for (int trial = 0 ; trial < 3 ; ++trial) {
+    double start = vl_get_time() ;
+    runConvIndexedForward(problem, output, filters, Tensor(), workspace, false, filtersChannelLast) ;
+    double elapsed = vl_get_time() - start ;
+    /* the first run warms up the caches and the thread pool */
+    if (trial == 1 || (trial > 1 && elapsed < best)) { best = elapsed ; }
+  }
+  return best / problem.data.geom.size ;
+}
+
+int
+perfcnn::convIndexedAutoMicrobatchSize(TensorGeometry const & data,
+                                       TensorGeometry const & filters,
+                                       IndexTensor convIndices,
+                                       Layout layout)
+{
+  typedef std::map<std::vector<ptrdiff_t>, int> Choices ;
+  static Choices choices ;
+
+  Tensor dataTensor(NULL, data, layout) ;
+  if (data.size <= 1 ||
+      checkConvIndexed(dataTensor, filters, convIndices) != vlSuccess ||
+      (layout == layoutChannelLast && isRunLengthIndices(convIndices))) {
+    return 1 ;
+  }
+
+  TensorGeometry indicesGeom = getIndicesGeometry(convIndices) ;
+  ptrdiff_t numThreads = vl_get_num_threads() ;
+  ptrdiff_t keyValues [] = {
+    data.height, data.width, data.depth, data.size,
+    filters.height, filters.width, filters.depth, filters.size,
+    indicesGeom.height, indicesGeom.width, indicesGeom.depth, indicesGeom.size,
+    isRunLengthIndices(convIndices), layout, numThreads} ;
+  std::vector<ptrdiff_t> key(keyValues, keyValues + sizeof(keyValues) / sizeof(keyValues[0])) ;
+  /* the cache is shared by all the callers; the benchmark runs unlocked */
+  int cached = 0 ;
+#pragma omp critical (convIndexedAutoMicrobatchChoices)
+  {
+    Choices::const_iterator choice = choices.find(key) ;
+    if (choice != choices.end()) { cached = choice->second ; }
+  }
+  if (cached > 0) {
+    return cached ;
+  }
+
+  /* the candidates whose working set fits in the cache */
+  std::vector<int> candidates ;
+  ptrdiff_t cacheSize = getCacheSize() ;
+  for (int size = 1 ; size <= std::min(data.size, (ptrdiff_t)maxAutoMicrobatchSize) ; size *= 2) {
+    ConvIndexedProblem problem(dataTensor, filters, convIndices, size) ;
+    ptrdiff_t numWorkers = std::min(numThreads, (ptrdiff_t)problem.numMicrobatches) ;
+    ptrdiff_t workingSet = problem.workerTempSize * sizeof(float) ;
+    if (size > 1 && numWorkers * workingSet > cacheSize) { break ; }
+    candidates.push_back(size) ;
+    if (problem.m * size >= autoMicrobatchRows) { break ; }
+  }
+
+  int best = 1 ;
+  if (candidates.size() > 1) {
+    /* all candidates process the same images: enough for the largest
+       one to keep all the workers busy (per-image CONVINDICES need all) */
+    ptrdiff_t numImages = std::min(data.size, candidates.back() * numThreads) ;
+    if (indicesGeom.size != 1) { numImages = data.size ; }
+    TensorGeometry benchData(data.height, data.width, data.depth, numImages) ;
+    TensorGeometry benchOutput(indicesGeom.height, indicesGeom.width, filters.size, numImages) ;
+    try {
+      std::vector<float> dataMemory(benchData.getNumElements(), 1.0f) ;
+      std::vector<float> filtersMemory(filters.getNumElements(), 1.0f) ;
+      std::vector<float> outputMemory(benchOutput.getNumElements()) ;
+      ConvIndexedWorkspace workspace ;
+      convIndexedGetWorkspaceSize(workspace, benchData, filters, convIndices, candidates.back(), layout) ;
+      std::vector<float> temp(workspace.tempSize) ;
+      workspace.temp = &temp[0] ;
+
+      double bestTime = 0 ;
+      for (size_t c = 0 ; c < candidates.size() ; ++c) {
+        ConvIndexedProblem problem(Tensor(&dataMemory[0], benchData, layout),
+                                   filters, convIndices, candidates[c]) ;
+        double time = timeConvIndexedForward(problem,
+                                             Tensor(&outputMemory[0], benchOutput, layout),
+                                             Tensor(&filtersMemory[0], filters),
+                                             workspace) ;
+        if (c == 0 || time < bestTime) {
+          best = candidates[c] ;
+          bestTime = time ;
+        }
+      }
+    } catch (std::bad_alloc const &) {
+      best = 1 ;
+    }
+  }
+#pragma omp critical (convIndexedAutoMicrobatchChoices)
+  choices[key] = best ;
+  return best ;
+}
+
+/* ---------------------------------------------------------------- */
+/*                                                 Convolution plans */
+/* ---------------------------------------------------------------- */
+
+struct perfcnn::ConvIndexedPlan
+{
+  ConvIndexedPlan(TensorGeometry const & data,
+                  TensorGeometry const & filters,
+                  IndexTensor const & convIndices,
+                  int microbatchSize,
+                  Layout layout)
+  : indices(convIndices.memory, convIndices.memory + convIndices.geom.getNumElements()),
+    convIndices(&indices[0], convIndices.geom),
+    filters(filters),
+    problem(Tensor(NULL, data, layout), filters, this->convIndices, microbatchSize)
+  { }
+
+  /* the problem for DATA, which may have a different number of images */
+  ConvIndexedProblem getProblem(Tensor const & data) const {
+    if (data.geom.size == problem.data.geom.size) {
+      ConvIndexedProblem dataProblem = problem ;
+      dataProblem.data.memory = data.memory ;
+      return dataProblem ;
+    }
+    return ConvIndexedProblem(data, filters, convIndices, problem.microbatchSize) ;
+  }
+
+  std::vector<int> indices ;
+  IndexTensor convIndices ;
+  TensorGeometry filters ;
+  ConvIndexedProblem problem ;
+
+  std::vector<float> temp ;
+  ConvIndexedWorkspace workspace ;
+  std::vector<float> filtersChannelLast ;
+  std::vector<float> derFiltersChannelLast ;
+} ;
+
+Error
+perfcnn::convIndexedPlanCreate(ConvIndexedPlan *& plan,
+                               TensorGeometry const & data,
+                               TensorGeometry const & filters,
+                               IndexTensor convIndices,
+                               int microbatchSize,
+                               Layout layout)
+{
+  Error error ;
+  Tensor dataTensor(NULL, data, layout) ;
+
+  plan = NULL ;
+  if (microbatchSize < 1) {
+    return setError(vlErrorInvalidArgument, "MICROBATCHSIZE is smaller than one.") ;
+  }
+  if (convIndices.isEmpty()) {
+    return setError(vlErrorInvalidArgument, "CONVINDICES is empty.") ;
+  }
+  if ((error = checkConvIndexed(dataTensor, filters, convIndices)) != vlSuccess) {
+    return error ;
+  }
+  if (layout == layoutChannelLast && isRunLengthIndices(convIndices)) {
+    return setError(vlErrorInvalidArgument, "Run-length encoded CONVINDICES do not support channel-last DATA.") ;
+  }
+
+  try {
+    plan = new ConvIndexedPlan(data, filters, convIndices, microbatchSize, layout) ;
+    ConvIndexedWorkspace & workspace = plan->workspace ;
+    convIndexedGetWorkspaceSize(workspace, data, filters, plan->convIndices, microbatchSize, layout) ;
+    plan->temp.resize(workspace.tempSize) ;
+    workspace.temp = plan->temp.empty() ? NULL : &plan->temp[0] ;
+  } catch (std::bad_alloc const &) {
+    delete plan ;
+    plan = NULL ;
+    return setError(vlErrorOutOfMemory, "Could not allocate the plan workspace.") ;
+  }
+  return vlSuccess ;
+}
+
+void
+perfcnn::convIndexedPlanDestroy(ConvIndexedPlan * plan)
+{
+  delete plan ;
+}
+
+TensorGeometry
+perfcnn::convIndexedPlanGetIndicesGeometry(ConvIndexedPlan const * plan)
+{
+  return getIndicesGeometry(plan->convIndices) ;
+}
+
+Layout
+perfcnn::convIndexedPlanGetLayout(ConvIndexedPlan const * plan)
+{
+  return plan->problem.data.layout ;
+}
+
+/* DATA and FILTERS must match the geometry of the plan */
+static Error
+checkConvIndexedPlan(ConvIndexedPlan const * plan,
+                     Tensor const & data,
+                     Tensor const & filters)
+{
+  TensorGeometry const & planData = plan->problem.data.geom ;
+  if (data.geom.height != planData.height ||
+      data.geom.width != planData.width ||
+      data.geom.depth != planData.depth ||
+      (data.geom.size != planData.size && getIndicesGeometry(plan->convIndices).size != 1)) {
+    return setError(vlErrorInvalidArgument, "DATA dimensions are incompatible with the PLAN.") ;
+  }
+  if (!sameGeometry(filters.geom, plan->filters)) {
+    return setError(vlErrorInvalidArgument, "FILTERS dimensions are incompatible with the PLAN.") ;
+  }
+  if (data.layout != plan->problem.data.layout) {
+    return setError(vlErrorInvalidArgument, "DATA does not have the layout of the PLAN.") ;
+  }
+  return vlSuccess ;
+}
+
+Error
+perfcnn::convIndexedPlanForward(ConvIndexedPlan * plan,
+                                Tensor output,
+                                Tensor data,
+                                Tensor filters,
+                                Tensor biases,
+                                bool relu)
+{
+  Error error ;
+  if ((error = checkConvIndexedPlan(plan, data, filters)) != vlSuccess) {
+    return error ;
+  }
+  if ((error = checkConvIndexedForward(output, data, filters, biases, plan->convIndices)) != vlSuccess) {
+    return error ;
+  }
+  runConvIndexedForward(plan->getProblem(data), output, filters, biases,
+                        plan->workspace, relu, plan->filtersChannelLast) ;
+  return vlSuccess ;
+}
+
+Error
+perfcnn::convIndexedPlanBackward(ConvIndexedPlan * plan,
+                                 Tensor derData,
+                                 Tensor derFilters,
+                                 Tensor derBiases,
+                                 Tensor data,
+                                 Tensor filters,
+                                 Tensor derOutput,
+                                 bool accumulateDerFilters,
+                                 bool accumulateDerBiases)
+{
+  Error error ;
+  if ((error = checkConvIndexedPlan(plan, data, filters)) != vlSuccess) {
+    return error ;
+  }
+  if ((error = checkConvIndexedBackward(derData, derFilters, derBiases,
+                                        data, filters, derOutput, plan->convIndices)) != vlSuccess) {
+    return error ;
+  }
+  runConvIndexedBackward(plan->getProblem(data), derData, derFilters, derBiases, filters, derOutput,
+                         accumulateDerFilters, accumulateDerBiases,
+                         plan->workspace, plan->filtersChannelLast, plan->derFiltersChannelLast) ;
+  return vlSuccess ;
+}
+
+/* ---------------------------------------------------------------- */
+/*                                             Winograd convolution */
+/* ---------------------------------------------------------------- */
+
+/*
+ The output is cut into 2 x 2 tiles. The tiles of an image are
+ processed in blocks of blockSize: the input patches of a block are
+ transformed, multiplied by the transformed filters (16 GEMMs per
+ filter group, issued as one strided batch) and transformed back into
+ the output. The blocks of all the images are independent and are
+ processed concurrently, each worker using its own scratch space.
+
+ With a mask, the tiles start at each computed row (column) not
+ covered by the previous tile, so that the consecutive computed rows of
+ a grid share their tiles, and only the tiles containing a computed
+ pixel are kept.
+ */
+
+namespace {
+  struct WinogradTiles
+  {
+    std::vector<int> tiles ; /* top-left input pixel, 2 per tile */
+    std::vector<int> outputs ; /* offsets in an output map, 4 per tile */
+    std::vector<std::pair<int,int> > duplicates ; /* repeated entries of MASKINDICES */
+  } ;
+}
+
+static void
+getWinogradLineStarts(std::vector<int> & starts, std::vector<char> const & used)
+{
+  for (ptrdiff_t i = 0 ; i < (ptrdiff_t)used.size() ; ) {
+    if (used[i]) {
+      starts.push_back((int)i) ;
+      i += 2 ;
+    } else {
+      ++i ;
+    }
+  }
+}
+
+static void
+getWinogradTiles(WinogradTiles & tiles,
+                 ptrdiff_t outputHeight,
+                 ptrdiff_t outputWidth,
+                 ConvOptions const & options,
+                 IndexTensor const & maskIndices)
+{
+  bool masked = !maskIndices.isEmpty() ;
+  ptrdiff_t maskSize = masked ? maskIndices.geom.getNumElements() : 0 ;
+  std::vector<int> position ;
+  std::vector<char> usedRows(outputHeight, !masked) ;
+  std::vector<char> usedColumns(outputWidth, !masked) ;
+  if (masked) {
+    position.assign(outputHeight * outputWidth, -1) ;
+    for (ptrdiff_t i = maskSize - 1 ; i >= 0 ; --i) {
+      int p = maskIndices.memory[i] ;
+      position[p] = (int)i ;
+      usedRows[p % outputHeight] = 1 ;
+      usedColumns[p / outputHeight] = 1 ;
+    }
+    for (ptrdiff_t i = 0 ; i < maskSize ; ++i) {
+      int first = position[maskIndices.memory[i]] ;
+      if (first != i) {
+        tiles.duplicates.push_back(std::make_pair((int)i, first)) ;
+      }
+    }
+  }
+
+  std::vector<int> rowStarts ;
+  std::vector<int> columnStarts ;
+  getWinogradLineStarts(rowStarts, usedRows) ;
+  getWinogradLineStarts(columnStarts, usedColumns) ;
+  for (size_t b = 0 ; b < columnStarts.size() ; ++b) {
+    for (size_t a = 0 ; a < rowStarts.size() ; ++a) {
+      int outputs [4] ;
+      bool any = false ;
+      for (int j = 0 ; j < 4 ; ++j) {
+        ptrdiff_t y = rowStarts[a] + (j % 2) ;
+        ptrdiff_t x = columnStarts[b] + (j / 2) ;
+        outputs[j] = -1 ;
+        if (y < outputHeight && x < outputWidth) {
+          outputs[j] = masked ? position[y + outputHeight * x] : (int)(y + outputHeight * x) ;
+        }
+        any |= (outputs[j] >= 0) ;
+      }
+      if (!any) { continue ; }
+      tiles.tiles.push_back(rowStarts[a] - options.padTop) ;
+      tiles.tiles.push_back(columnStarts[b] - options.padLeft) ;
+      tiles.outputs.insert(tiles.outputs.end(), outputs, outputs + 4) ;
+    }
+  }
+}
+
+/* the transforms of a block take about 512 KB */
+static ptrdiff_t
+getWinogradBlockSize(ptrdiff_t depth, ptrdiff_t numFilters, ptrdiff_t numTiles, ptrdiff_t numImages)
+{
+  ptrdiff_t const minBlockSize = 32 ;
+  ptrdiff_t blockSize = ((ptrdiff_t)1 << 15) / (depth + numFilters) ;
+  blockSize = std::min(blockSize, (ptrdiff_t)512) ;
+  /* enough blocks for all the threads */
+  ptrdiff_t numThreads = vl_get_num_threads() ;
+  ptrdiff_t numBlocksPerImage = (numThreads + numImages - 1) / numImages ;
+  blockSize = std::min(blockSize, (numTiles + numBlocksPerImage - 1) / numBlocksPerImage) ;
+  return std::max(blockSize, std::min(minBlockSize, numTiles)) ;
+}
+
+bool
+perfcnn::convWinogradIsSupported(TensorGeometry const & filters,
+                                 ConvOptions const & options)
+{
+  return (filters.height == 3 && filters.width == 3 &&
+          options.strideY == 1 && options.strideX == 1) ;
+}
+
+Error
+perfcnn::convWinogradForward(Tensor output,
+                             Tensor data,
+                             Tensor filters,
+                             Tensor biases,
+                             ConvOptions const & options,
+                             IndexTensor maskIndices,
+                             bool relu)
+{
+  TensorGeometry full ;
+  Error error ;
+
+  if (!convWinogradIsSupported(filters.geom, options)) {
+    return setError(vlErrorInvalidArgument, "The Winograd convolution requires 3 x 3 FILTERS and unit STRIDE.") ;
+  }
+  if (data.isEmpty() || filters.isEmpty()) {
+    return setError(vlErrorInvalidArgument, "DATA or FILTERS is empty.") ;
+  }
+  if ((error = convIndicesGeometry(full, data.geom, filters.geom, options, 0)) != vlSuccess) {
+    return error ;
+  }
+  if (data.layout != layoutDefault || output.layout != layoutDefault) {
+    return setError(vlErrorInvalidArgument, "The Winograd convolution does not support channel-last DATA.") ;
+  }
+  ptrdiff_t outputHeight = full.height ;
+  ptrdiff_t outputWidth = full.width ;
+  ptrdiff_t maskSize = maskIndices.isEmpty() ? 0 : maskIndices.geom.getNumElements() ;
+  for (ptrdiff_t i = 0 ; i < maskSize ; ++i) {
+    if (maskIndices.memory[i] < 0 || maskIndices.memory[i] >= outputHeight * outputWidth) {
+      return setError(vlErrorInvalidArgument, "MASKINDICES contains an index outside of the output.") ;
+    }
+  }
+  if (!sameGeometry(output.geom, TensorGeometry(maskSize > 0 ? maskSize : outputHeight,
+                                                maskSize > 0 ? 1 : outputWidth,
+                                                filters.geom.size,
+                                                data.geom.size))) {
+    return setError(vlErrorInvalidArgument, "OUTPUT dimensions are incompatible with DATA, FILTERS and MASKINDICES.") ;
+  }
+  if (!biases.isEmpty() && biases.geom.getNumElements() != filters.geom.size) {
+    return setError(vlErrorInvalidArgument, "The number of elements of BIASES is not the same as the number of filters.") ;
+  }
+
+  ptrdiff_t depth = filters.geom.depth ;
+  ptrdiff_t numFilters = filters.geom.size ;
+  ptrdiff_t numGroups = data.geom.depth / depth ;
+  ptrdiff_t n = numFilters / numGroups ; /* num filters per group */
+  ptrdiff_t numImages = data.geom.size ;
+  ptrdiff_t dataVolume = data.geom.height * data.geom.width * data.geom.depth ;
+  ptrdiff_t outputStride = output.geom.height * output.geom.width ;
+  ptrdiff_t outputVolume = outputStride * numFilters ;
+
+  try {
+    WinogradTiles tiles ;
+    getWinogradTiles(tiles, outputHeight, outputWidth, options, maskIndices) ;
+    ptrdiff_t numTiles = (ptrdiff_t)tiles.outputs.size() / 4 ;
+    ptrdiff_t blockSize = getWinogradBlockSize(data.geom.depth, numFilters, numTiles, numImages) ;
+    ptrdiff_t numBlocks = (numTiles + blockSize - 1) / blockSize ;
+    ptrdiff_t numUnits = numBlocks * numImages ;
+    /* the 16 transformed matrices are padded so that their strides are
+       not a power of two */
+    ptrdiff_t const padding = 16 ;
+    ptrdiff_t workerSize = 16 * (blockSize * (data.geom.depth + numFilters) + 2 * padding) ;
+    int numWorkers = (int)std::max(std::min((ptrdiff_t)vl_get_num_threads(), numUnits), (ptrdiff_t)1) ;
+
+    std::vector<float> u(16 * depth * numFilters) ;
+    std::vector<float> scratch(workerSize * numWorkers) ;
+    winograd_filters_cpu<float>(&u[0], filters.memory, depth, numFilters) ;
+
+#pragma omp parallel for num_threads(numWorkers) schedule(static,1) if(numWorkers > 1)
+    for (ptrdiff_t unit = 0 ; unit < numUnits ; ++unit) {
+      int worker = (numWorkers > 1) ? vl_get_thread_id() : 0 ;
+      ptrdiff_t image = unit / numBlocks ;
+      ptrdiff_t first = (unit % numBlocks) * blockSize ;
+      ptrdiff_t numBlockTiles = std::min(blockSize, numTiles - first) ;
+      ptrdiff_t vStride = numBlockTiles * data.geom.depth + padding ;
+      ptrdiff_t mStride = numBlockTiles * numFilters + padding ;
+      float * v = &scratch[0] + workerSize * worker ;
+      float * m = v + 16 * vStride ;
+
+      winograd_data_cpu<float>(v, vStride, data.memory + dataVolume * image,
+                               data.geom.height, data.geom.width, data.geom.depth,
+                               &tiles.tiles[2 * first], numBlockTiles) ;
+      for (ptrdiff_t g = 0 ; g < numGroups ; ++g) {
+        vl_blas_sgemm_strided_batched('n', 'n',
+                                      numBlockTiles, n, depth,
+                                      1.0f,
+                                      v + numBlockTiles * depth * g, numBlockTiles, vStride,
+                                      &u[0] + depth * n * g, depth, depth * numFilters,
+                                      0.0f,
+                                      m + numBlockTiles * n * g, numBlockTiles, mStride,
+                                      16) ;
+      }
+      winograd_output_cpu<float>(output.memory + outputVolume * image, m, mStride,
+                                 &tiles.outputs[4 * first], numBlockTiles,
+                                 numFilters, outputStride,
+                                 biases.isEmpty() ? NULL : biases.memory, relu) ;
+    }
+
+    for (size_t i = 0 ; i < tiles.duplicates.size() ; ++i) {
+      for (ptrdiff_t f = 0 ; f < numFilters * numImages ; ++f) {
+        output.memory[tiles.duplicates[i].first + outputStride * f] =
+          output.memory[tiles.duplicates[i].second + outputStride * f] ;
+      }
+    }
+  } catch (std::bad_alloc const &) {
+    return setError(vlErrorOutOfMemory, "Could not allocate the Winograd transform buffers.") ;
+  }
+  return vlSuccess ;
+}
+
+/* ---------------------------------------------------------------- */
+/*                                                  Pooling and LRN */
+/* ---------------------------------------------------------------- */
+
+static Error
+checkPoolingFast(Tensor const & output,
+                 Tensor const & data,
+                 IndexTensor const & poolIndices,
+                 PoolMethod method)
+{
+  TensorGeometry poolIndicesGeom = getIndicesGeometry(poolIndices) ;
+  Error error ;
+
+  if (method != NN_POOL_MAX && method != NN_POOL_AVG) {
+    return setError(vlErrorInvalidArgument, "METHOD is not a supported method.") ;
+  }
+  if (isDeduplicatedIndices(poolIndices)) {
+    error = checkDeduplicatedIndices(poolIndices, "INDICES are not valid deduplicated indices.") ;
+  } else {
+    error = checkIndices(poolIndices, "INDICES are not valid run-length encoded indices.") ;
+  }
+  if (error != vlSuccess) {
+    return error ;
+  }
+  if (poolIndicesGeom.height == 0) {
+    return setError(vlErrorInvalidArgument, "INDICES is empty.") ;
+  }
+  if (isRunLengthIndices(poolIndices) && rle_list_length(poolIndices.memory) != poolIndicesGeom.height) {
+    return setError(vlErrorInvalidArgument, "INDICES are not encoded as one list per output pixel.") ;
+  }
+  if (isDeduplicatedIndices(poolIndices) && dedup_window_size(poolIndices.memory) != poolIndicesGeom.height) {
+    return setError(vlErrorInvalidArgument, "INDICES are not deduplicated per output pixel.") ;
+  }
+  if (isDeduplicatedIndices(poolIndices) && dedup_entry_size(poolIndices.memory) != getDedupEntrySize(method)) {
+    return setError(vlErrorInvalidArgument, "INDICES were deduplicated for another pooling METHOD.") ;
+  }
+  /* poolIndices: [poolHeight * poolWidth, outputHeight, outputWidth, 1] */
+  if (!sameGeometry(output.geom, TensorGeometry(poolIndicesGeom.width,
+                                                poolIndicesGeom.depth,
+                                                data.geom.depth,
+                                                data.geom.size))) {
+    return setError(vlErrorInvalidArgument, "OUTPUT dimensions are incompatible with X and INDICES.") ;
+  }
+  if ((error = checkLayout(data, output, "X and the output (or its derivative) do not have the same layout.")) != vlSuccess) {
+    return error ;
+  }
+  if (data.layout == layoutChannelLast && isRunLengthIndices(poolIndices)) {
+    return setError(vlErrorInvalidArgument, "Run-length encoded INDICES do not support channel-last X.") ;
+  }
+  if (data.layout == layoutChannelLast && isDeduplicatedIndices(poolIndices)) {
+    return setError(vlErrorInvalidArgument, "Deduplicated INDICES do not support channel-last X.") ;
+  }
+  return vlSuccess ;
+}
+
+Error
+perfcnn::poolingFast(Tensor output,
+                     Tensor data,
+                     IndexTensor poolIndices,
+                     PoolMethod method)
+{
+  Error error = checkPoolingFast(output, data, poolIndices, method) ;
+  if (error != vlSuccess) { return error ; }
+  if (data.layout == layoutChannelLast) {
+    pooling_hwc_cpu_fast<float>(output.memory,
+                                data.memory,
+                                poolIndices.memory,
+                                method,
+                                data.geom.height * data.geom.width,
+                                data.geom.depth,
+                                data.geom.size,
+                                poolIndices.geom.height,
+                                output.geom.height * output.geom.width) ;
+    return vlSuccess ;
+  }
+  if (isDeduplicatedIndices(poolIndices)) {
+    pooling_dedup_cpu_fast<float>(output.memory,
+                                  data.memory,
+                                  poolIndices.memory,
+                                  method,
+                                  data.geom.height * data.geom.width,
+                                  data.geom.depth * data.geom.size) ;
+    return vlSuccess ;
+  }
+  if (isRunLengthIndices(poolIndices)) {
+    pooling_runs_cpu_fast<float>(output.memory,
+                                 data.memory,
+                                 poolIndices.memory,
+                                 method,
+                                 data.geom.height * data.geom.width,
+                                 data.geom.depth * data.geom.size) ;
+    return vlSuccess ;
+  }
+  pooling_cpu_fast<float>(output.memory,
+                          data.memory,
+                          poolIndices.memory,
+                          method,
+                          data.geom.height * data.geom.width,
+                          data.geom.depth * data.geom.size,
+                          poolIndices.geom.height,
+                          output.geom.height * output.geom.width) ;
+  return vlSuccess ;
+}
+
+Error
+perfcnn::poolingFastBackward(Tensor derData,
+                             Tensor data,
+                             Tensor derOutput,
+                             IndexTensor poolIndices,
+                             PoolMethod method)
+{
+  Error error = checkPoolingFast(derOutput, data, poolIndices, method) ;
+  if (error != vlSuccess) { return error ; }
+  if (!sameGeometry(derData.geom, data.geom)) {
+    return setError(vlErrorInvalidArgument, "DERDATA dimensions are incompatible with X.") ;
+  }
+  if ((error = checkLayout(data, derData, "X and DERDATA do not have the same layout.")) != vlSuccess) {
+    return error ;
+  }
+  if (data.layout == layoutChannelLast) {
+    pooling_backward_hwc_cpu_fast<float>(derData.memory,
+                                         data.memory,
+                                         derOutput.memory,
+                                         poolIndices.memory,
+                                         method,
+                                         data.geom.height * data.geom.width,
+                                         data.geom.depth,
+                                         data.geom.size,
+                                         poolIndices.geom.height,
+                                         derOutput.geom.height * derOutput.geom.width) ;
+    return vlSuccess ;
+  }
+  if (isDeduplicatedIndices(poolIndices)) {
+    pooling_backward_dedup_cpu_fast<float>(derData.memory,
+                                           data.memory,
+                                           derOutput.memory,
+                                           poolIndices.memory,
+                                           method,
+                                           data.geom.height * data.geom.width,
+                                           data.geom.depth * data.geom.size) ;
+    return vlSuccess ;
+  }
+  if (isRunLengthIndices(poolIndices)) {
+    pooling_backward_runs_cpu_fast<float>(derData.memory,
+                                          data.memory,
+                                          derOutput.memory,
+                                          poolIndices.memory,
+                                          method,
+                                          data.geom.height * data.geom.width,
+                                          data.geom.depth * data.geom.size) ;
+    return vlSuccess ;
+  }
+  pooling_backward_cpu_fast<float>(derData.memory,
+                                   data.memory,
+                                   derOutput.memory,
+                                   poolIndices.memory,
+                                   method,
+                                   data.geom.height * data.geom.width,
+                                   data.geom.depth * data.geom.size,
+                                   poolIndices.geom.height,
+                                   derOutput.geom.height * derOutput.geom.width) ;
+  return vlSuccess ;
+}
+
+Error
+perfcnn::poolingFastSwitches(Tensor output,
+                             IndexTensor switches,
+                             Tensor data,
+                             IndexTensor poolIndices)
+{
+  Error error = checkPoolingFast(output, data, poolIndices, NN_POOL_MAX) ;
+  if (error != vlSuccess) { return error ; }
+  if (!sameGeometry(switches.geom, output.geom)) {
+    return setError(vlErrorInvalidArgument, "SWITCHES dimensions are incompatible with OUTPUT.") ;
+  }
+  if (data.layout == layoutChannelLast) {
+    return setError(vlErrorInvalidArgument, "SWITCHES do not support channel-last X.") ;
+  }
+  if (isDeduplicatedIndices(poolIndices)) {
+    max_pooling_switches_dedup_cpu_fast<float>(output.memory,
+                                               switches.memory,
+                                               data.memory,
+                                               poolIndices.memory,
+                                               data.geom.height * data.geom.width,
+                                               data.geom.depth * data.geom.size) ;
+    return vlSuccess ;
+  }
+  if (isRunLengthIndices(poolIndices)) {
+    max_pooling_switches_runs_cpu_fast<float>(output.memory,
+                                              switches.memory,
+                                              data.memory,
+                                              poolIndices.memory,
+                                              data.geom.height * data.geom.width,
+                                              data.geom.depth * data.geom.size) ;
+    return vlSuccess ;
+  }
+  max_pooling_switches_cpu_fast<float>(output.memory,
+                                       switches.memory,
+                                       data.memory,
+                                       poolIndices.memory,
+                                       data.geom.height * data.geom.width,
+                                       data.geom.depth * data.geom.size,
+                                       poolIndices.geom.height,
+                                       output.geom.height * output.geom.width) ;
+  return vlSuccess ;
+}
+
+Error
+perfcnn::poolingSwitchesBackward(Tensor derData,
+                                 Tensor derOutput,
+                                 IndexTensor switches)
+{
+  ptrdiff_t dataSize = derData.geom.height * derData.geom.width ;
+
+  if (!sameGeometry(switches.geom, derOutput.geom)) {
+    return setError(vlErrorInvalidArgument, "SWITCHES dimensions are incompatible with the output derivative.") ;
+  }
+  if (derData.geom.depth != derOutput.geom.depth || derData.geom.size != derOutput.geom.size) {
+    return setError(vlErrorInvalidArgument, "DERDATA dimensions are incompatible with the output derivative.") ;
+  }
+  if (derData.layout == layoutChannelLast || derOutput.layout == layoutChannelLast) {
+    return setError(vlErrorInvalidArgument, "SWITCHES do not support channel-last data.") ;
+  }
+  ptrdiff_t numSwitches = switches.geom.getNumElements() ;
+  for (ptrdiff_t i = 0 ; i < numSwitches ; ++i) {
+    if (switches.memory[i] < -1 || switches.memory[i] >= dataSize) {
+      return setError(vlErrorInvalidArgument, "SWITCHES contains an index outside of X.") ;
+    }
+  }
+  max_pooling_backward_switches_cpu<float>(derData.memory,
+                                           derOutput.memory,
+                                           switches.memory,
+                                           dataSize,
+                                           derData.geom.depth * derData.geom.size,
+                                           derOutput.geom.height * derOutput.geom.width) ;
+  return vlSuccess ;
+}
+
+Error
+perfcnn::normalize(Tensor output,
+                   Tensor data,
+                   NormalizeOptions const & options)
+{
+  if (options.depth < 1) {
+    return setError(vlErrorInvalidArgument, "The normalization depth is smaller than 1.") ;
+  }
+  if (!sameGeometry(output.geom, data.geom)) {
+    return setError(vlErrorInvalidArgument, "OUTPUT dimensions are incompatible with X.") ;
+  }
+  if (output.layout != data.layout) {
+    return setError(vlErrorInvalidArgument, "X and OUTPUT do not have the same layout.") ;
+  }
+  if (data.layout == layoutChannelLast) {
+    normalize_hwc_cpu<float>(output.memory,
+                             data.memory,
+                             data.geom.height, data.geom.width, data.geom.depth, data.geom.size,
+                             options.depth, options.kappa, options.alpha, options.beta) ;
+    return vlSuccess ;
+  }
+  normalize_cpu<float>(output.memory,
+                       data.memory,
+                       data.geom.height, data.geom.width, data.geom.depth, data.geom.size,
+                       options.depth, options.kappa, options.alpha, options.beta) ;
+  return vlSuccess ;
+}
+
+Error
+perfcnn::normalizeBackward(Tensor derData,
+                           Tensor data,
+                           Tensor derOutput,
+                           NormalizeOptions const & options)
+{
+  if (options.depth < 1) {
+    return setError(vlErrorInvalidArgument, "The normalization depth is smaller than 1.") ;
+  }
+  if (!sameGeometry(derOutput.geom, data.geom)) {
+    return setError(vlErrorInvalidArgument, "DEROUTPUT dimensions are incompatible with X and POOL.") ;
+  }
+  if (!sameGeometry(derData.geom, data.geom)) {
+    return setError(vlErrorInvalidArgument, "DERDATA dimensions are incompatible with X.") ;
+  }
+  if (derOutput.layout != data.layout || derData.layout != data.layout) {
+    return setError(vlErrorInvalidArgument, "X, DEROUTPUT and DERDATA do not have the same layout.") ;
+  }
+  if (data.layout == layoutChannelLast) {
+    normalizeBackward_hwc_cpu<float>(derData.memory,
+                                     data.memory,
+                                     derOutput.memory,
+                                     data.geom.height, data.geom.width, data.geom.depth, data.geom.size,
+                                     options.depth, options.kappa, options.alpha, options.beta) ;
+    return vlSuccess ;
+  }
+  normalizeBackward_cpu<float>(derData.memory,
+                               data.memory,
+                               derOutput.memory,
+                               data.geom.height, data.geom.width, data.geom.depth, data.geom.size,
+                               options.depth, options.kappa, options.alpha, options.beta) ;
+  return vlSuccess ;
+}
+
+/* ---------------------------------------------------------------- */
+/*                                             Perforation filling */
+/* ---------------------------------------------------------------- */
+
+static Error
+checkPerforation(Tensor const & output,
+                 Tensor const & data,
+                 IndexTensor const & maskIndices)
+{
+  if (!sameGeometry(output.geom, data.geom)) {
+    return setError(vlErrorInvalidArgument, "The output (or its derivative) dimensions are incompatible with X.") ;
+  }
+  if (output.layout != data.layout) {
+    return setError(vlErrorInvalidArgument, "X and the output (or its derivative) do not have the same layout.") ;
+  }
+  if (maskIndices.isEmpty()) {
+    return setError(vlErrorInvalidArgument, "MASKINDICES is empty.") ;
+  }
+  ptrdiff_t dataSize = data.geom.height * data.geom.width ;
+  ptrdiff_t maskSize = maskIndices.geom.getNumElements() ;
+  for (ptrdiff_t i = 0 ; i < maskSize ; ++i) {
+    if (maskIndices.memory[i] < 0 || maskIndices.memory[i] >= dataSize) {
+      return setError(vlErrorInvalidArgument, "MASKINDICES are out of range.") ;
+    }
+  }
+  return vlSuccess ;
+}
+
+static Error
+checkPerforationKnn(Tensor const & output,
+                    Tensor const & data,
+                    IndexTensor const & maskIndices,
+                    IndexTensor const & outIndices,
+                    Tensor const & weights)
+{
+  Error error ;
+  if ((error = checkPerforation(output, data, maskIndices)) != vlSuccess) {
+    return error ;
+  }
+  if (outIndices.isEmpty() ||
+      outIndices.geom.height != data.geom.height ||
+      outIndices.geom.width != data.geom.width ||
+      outIndices.geom.size != 1) {
+    return setError(vlErrorInvalidArgument, "OUTINDICES dimensions are incompatible with X.") ;
+  }
+  ptrdiff_t maskSize = maskIndices.geom.getNumElements() ;
+  ptrdiff_t numElements = outIndices.geom.getNumElements() ;
+  for (ptrdiff_t i = 0 ; i < numElements ; ++i) {
+    if (outIndices.memory[i] < 0 || outIndices.memory[i] >= maskSize) {
+      return setError(vlErrorInvalidArgument, "OUTINDICES are out of range.") ;
+    }
+  }
+  if (weights.isEmpty() ||
+      (weights.geom.getNumElements() != 1 && weights.geom.getNumElements() != numElements)) {
+    return setError(vlErrorInvalidArgument, "WEIGHTS is neither a scalar nor of the same size as OUTINDICES.") ;
+  }
+  return vlSuccess ;
+}
+
+Error
+perfcnn::perforationKnn(Tensor output,
+                        Tensor data,
+                        IndexTensor maskIndices,
+                        IndexTensor outIndices,
+                        Tensor weights)
+{
+  Error error = checkPerforationKnn(output, data, maskIndices, outIndices, weights) ;
+  if (error != vlSuccess) { return error ; }
+  ptrdiff_t weightsStep = (weights.geom.getNumElements() == 1) ? 0 : 1 ;
+  if (data.layout == layoutChannelLast) {
+    perforation_knn_hwc_cpu<float>(output.memory,
+                                   data.memory,
+                                   maskIndices.memory,
+                                   outIndices.memory,
+                                   weights.memory,
+                                   weightsStep,
+                                   data.geom.height * data.geom.width,
+                                   data.geom.depth,
+                                   data.geom.size,
+                                   outIndices.geom.depth) ;
+    return vlSuccess ;
+  }
+  perforation_knn_cpu<float>(output.memory,
+                             data.memory,
+                             maskIndices.memory,
+                             outIndices.memory,
+                             weights.memory,
+                             weightsStep,
+                             data.geom.height * data.geom.width,
+                             data.geom.depth * data.geom.size,
+                             outIndices.geom.depth) ;
+  return vlSuccess ;
+}
+
+Error
+perfcnn::perforationKnnBackward(Tensor derData,
+                                Tensor derOutput,
+                                IndexTensor maskIndices,
+                                IndexTensor outIndices,
+                                Tensor weights)
+{
+  Error error = checkPerforationKnn(derOutput, derData, maskIndices, outIndices, weights) ;
+  if (error != vlSuccess) { return error ; }
+  ptrdiff_t weightsStep = (weights.geom.getNumElements() == 1) ? 0 : 1 ;
+  if (derData.layout == layoutChannelLast) {
+    perforation_knn_backward_hwc_cpu<float>(derData.memory,
+                                            derOutput.memory,
+                                            maskIndices.memory,
+                                            outIndices.memory,
+                                            weights.memory,
+                                            weightsStep,
+                                            derData.geom.height * derData.geom.width,
+                                            derData.geom.depth,
+                                            derData.geom.size,
+                                            outIndices.geom.depth) ;
+    return vlSuccess ;
+  }
+  perforation_knn_backward_cpu<float>(derData.memory,
+                                      derOutput.memory,
+                                      maskIndices.memory,
+                                      outIndices.memory,
+                                      weights.memory,
+                                      weightsStep,
+                                      derData.geom.height * derData.geom.width,
+                                      derData.geom.depth * derData.geom.size,
+                                      outIndices.geom.depth) ;
+  return vlSuccess ;
+}
+
+Error
+perfcnn::perforationZeros(Tensor output,
+                          Tensor data,
+                          IndexTensor maskIndices)
+{
+  Error error = checkPerforation(output, data, maskIndices) ;
+  if (error != vlSuccess) { return error ; }
+  if (data.layout == layoutChannelLast) {
+    perforation_zeros_hwc_cpu<float>(output.memory,
+                                     data.memory,
+                                     maskIndices.memory,
+                                     maskIndices.geom.getNumElements(),
+                                     data.geom.height * data.geom.width,
+                                     data.geom.depth,
+                                     data.geom.size) ;
+    return vlSuccess ;
+  }
+  perforation_zeros_cpu<float>(output.memory,
+                               data.memory,
+                               maskIndices.memory,
+                               maskIndices.geom.getNumElements(),
+                               data.geom.height * data.geom.width,
+                               data.geom.depth * data.geom.size) ;
+  return vlSuccess ;
+}
+
+Error
+perfcnn::nearestMaskIndices(IndexTensor outIndices,
+                            IndexTensor maskIndices,
+                            NearestTies ties,
+                            unsigned int seed)
+{
+  if (outIndices.isEmpty() ||
+      outIndices.geom.depth != 1 ||
+      outIndices.geom.size != 1) {
+    return setError(vlErrorInvalidArgument, "OUTINDICES is not a non-empty H x W array.") ;
+  }
+  if (maskIndices.isEmpty()) {
+    return setError(vlErrorInvalidArgument, "MASKINDICES is empty.") ;
+  }
+  ptrdiff_t height = outIndices.geom.height ;
+  ptrdiff_t width = outIndices.geom.width ;
+  ptrdiff_t maskSize = maskIndices.geom.getNumElements() ;
+  for (ptrdiff_t i = 0 ; i < maskSize ; ++i) {
+    if (maskIndices.memory[i] < 0 || maskIndices.memory[i] >= height * width) {
+      return setError(vlErrorInvalidArgument, "MASKINDICES are out of range.") ;
+    }
+  }
+  try {
+    std::vector<int> position(height * width) ;
+    std::vector<int> row(height * width) ;
+    std::vector<long long> envelope(3 * width + 2) ;
+    nearest_mask_indices_cpu(outIndices.memory,
+                             maskIndices.memory,
+                             maskSize,
+                             height, width,
+                             &position[0], &row[0], &envelope[0]) ;
+    if (ties != nearestTiesFirst) {
+      nearest_mask_indices_ties_cpu(outIndices.memory,
+                                    maskIndices.memory,
+                                    &position[0],
+                                    height, width,
+                                    ties == nearestTiesRandom,
+                                    seed) ;
+    }
+  } catch (std::bad_alloc const &) {
+    return setError(vlErrorOutOfMemory, "Could not allocate the distance transform buffers.") ;
+  }
+  return vlSuccess ;
+}
@@ -0,0 +1,575 @@
+/** @file perfcnn.hpp
+ ** @brief MATLAB-free interface to the perforated CNN kernels (libperfcnn)
+ ** @author Michael Figurnov
+ **/
+
+/*
+ Copyright (C) 2015 Michael Figurnov.
+ All rights reserved.
+
+ This file is part of the VLFeat library and is made available under
+ the terms of the BSD license (see the COPYING file).
+ */
+
+#ifndef VL_PERFCNN_H
+#define VL_PERFCNN_H
+
+#include "pooling.hpp"
+#include "threads.hpp"
+#include "blas.hpp"
+
+#include <stddef.h>
+
+/*
+ This header is the entry point of libperfcnn, the CPU core of the
+ perforated convolution toolbox. It does not depend on mex.h and can
+ be linked into any C++ program (see the `lib` target of the
+ Makefile). The MEX files are thin adapters over these functions.
+
+ All tensors use the MATLAB memory layout: column-major
+ HEIGHT x WIDTH x DEPTH x SIZE arrays of single precision values,
+ unless their layout is layoutChannelLast (see below).
+ Index tensors hold zero-based int32 offsets as produced by
+ vl_nnconvidx and vl_nnpoolidx, with -1 denoting padding, or their
+ run-length encoding.
+
+ The number of CPU threads is controlled by vl_set_num_threads()
+ (threads.hpp). The matrix products go through the BLAS backend of
+ blas.hpp, which also sets the threads of the BLAS.
+ */
+
+namespace perfcnn {
+
+  enum Error {
+    vlSuccess = 0,
+    vlErrorInvalidArgument,
+    vlErrorOutOfMemory
+  } ;
+
+  char const * getLastErrorMessage() ;
+
+  /*
+   The geometry of a tensor is always given as HEIGHT x WIDTH x DEPTH
+   x SIZE. With layoutChannelLast the DEPTH values of a pixel are
+   contiguous in memory, i.e. the tensor is stored as a column-major
+   DEPTH x HEIGHT x WIDTH x SIZE array (NHWC in row-major terms), so
+   that an index into CONVINDICES or POOLINDICES addresses a whole
+   vector of channels.
+   */
+  enum Layout {
+    layoutDefault = 0,
+    layoutChannelLast
+  } ;
+
+  struct TensorGeometry
+  {
+    TensorGeometry() ;
+    TensorGeometry(ptrdiff_t height, ptrdiff_t width, ptrdiff_t depth, ptrdiff_t size) ;
+    ptrdiff_t getNumElements() const ;
+
+    ptrdiff_t height ;
+    ptrdiff_t width ;
+    ptrdiff_t depth ;
+    ptrdiff_t size ;
+  } ;
+
+  template<typename T>
+  struct TensorT
+  {
+    TensorT() : memory(NULL), layout(layoutDefault) { }
+    TensorT(T * memory, TensorGeometry const & geom, Layout layout = layoutDefault)
+    : memory(memory), geom(geom), layout(layout) { }
+    bool isEmpty() const { return memory == NULL || geom.getNumElements() == 0 ; }
+
+    T * memory ;
+    TensorGeometry geom ;
+    Layout layout ;
+  } ;
+
+  typedef TensorT<float> Tensor ;
+  typedef TensorT<int> IndexTensor ;
+
+  struct ConvOptions
+  {
+    ConvOptions() ;
+
+    int strideY ;
+    int strideX ;
+    int padTop ;
+    int padBottom ;
+    int padLeft ;
+    int padRight ;
+  } ;
+
+  struct PoolOptions
+  {
+    PoolOptions() ;
+
+    int poolHeight ;
+    int poolWidth ;
+    int strideY ;
+    int strideX ;
+    int padTop ;
+    int padBottom ;
+    int padLeft ;
+    int padRight ;
+    PoolMethod method ;
+  } ;
+
+  struct NormalizeOptions
+  {
+    NormalizeOptions() ;
+
+    size_t depth ;
+    float kappa ;
+    float alpha ;
+    float beta ;
+  } ;
+
+  /*
+   Scratch memory of the indexed convolution. It is owned by the
+   caller, so that it can be kept alive across calls (the MEX file
+   uses persistent MATLAB arrays). The size is in number of floats.
+   */
+  struct ConvIndexedWorkspace
+  {
+    ConvIndexedWorkspace() ;
+
+    float * temp ;
+    ptrdiff_t tempSize ;
+  } ;
+
+  /* -------------------------------------------------------------- */
+  /*                                                        Indices */
+  /* -------------------------------------------------------------- */
+
+  /*
+   The geometry functions validate the options and compute the
+   geometry of the index tensor, which must be allocated by the
+   caller before computing the indices.
+   */
+  Error
+  convIndicesGeometry(TensorGeometry & geom,
+                      TensorGeometry const & data,
+                      TensorGeometry const & filters,
+                      ConvOptions const & options,
+                      ptrdiff_t maskIndicesLength) ;
+
+  Error
+  convIndices(IndexTensor convIndices,
+              TensorGeometry const & data,
+              TensorGeometry const & filters,
+              ConvOptions const & options,
+              int const * inIndices,
+              int const * maskIndices,
+              ptrdiff_t maskIndicesLength) ;
+
+  /*
+   maskIndicesOrder sets the M x 1 tensor ORDER to a permutation of
+   the first M = MASKINDICES.geom.height offsets of a HEIGHT x WIDTH
+   output map: the columns of CONVINDICES built from the permuted
+   offsets MASKINDICES[ORDER[i]] visit the output pixels in memory
+   order (maskOrderMemory) or along a Z-order curve (maskOrderMorton),
+   so that consecutive columns gather overlapping windows. The
+   computed outputs come out in the same order, and positions in the
+   original MASKINDICES must be mapped through the inverse of ORDER.
+   */
+  enum MaskOrder {
+    maskOrderGiven = 0,
+    maskOrderMemory,
+    maskOrderMorton
+  } ;
+
+  Error
+  maskIndicesOrder(IndexTensor order,
+                   IndexTensor maskIndices,
+                   ptrdiff_t height,
+                   ptrdiff_t width,
+                   MaskOrder method) ;
+
+  Error
+  poolIndicesGeometry(TensorGeometry & geom,
+                      TensorGeometry const & data,
+                      PoolOptions const & options) ;
+
+  Error
+  poolIndices(IndexTensor poolIndices,
+              TensorGeometry const & data,
+              PoolOptions const & options,
+              int const * inIndices) ;
+
+  /*
+   Run-length encoding of index tensors (see runlength.hpp). The
+   index tensor is split into lists of listLength consecutive indices
+   (the number of output pixels for CONVINDICES, the pooling window
+   size for POOLINDICES) and each list is stored as runs of
+   consecutive indices. The encoded tensor has geometry 2 x L and is
+   accepted by all the functions taking CONVINDICES or POOLINDICES,
+   except convIndexedForwardGatherGemm. getIndicesGeometry() returns
+   the geometry of the plain indices for both representations.
+   */
+  bool
+  isRunLengthIndices(IndexTensor indices) ;
+
+  TensorGeometry
+  getIndicesGeometry(IndexTensor indices) ;
+
+  Error
+  runLengthEncodeGeometry(TensorGeometry & geom,
+                          IndexTensor indices,
+                          ptrdiff_t listLength) ;
+
+  Error
+  runLengthEncode(IndexTensor encoded,
+                  IndexTensor indices,
+                  ptrdiff_t listLength) ;
+
+  Error
+  runLengthDecode(IndexTensor indices,
+                  IndexTensor encoded) ;
+
+  /*
+   Deduplication of pooling indices (see dedup.hpp). Every window of
+   windowSize POOLINDICES keeps each of its distinct indices once (with
+   the number of its occurrences for the average pooling), which saves
+   the repeated loads of the windows that read a perforated input
+   through InIndices. The result has geometry N x 1 and is accepted by
+   poolingFast() and poolingFastBackward() with the same METHOD, for
+   data in the default layout.
+   getIndicesGeometry() returns the geometry of the plain indices.
+   */
+  bool
+  isDeduplicatedIndices(IndexTensor indices) ;
+
+  Error
+  deduplicateIndicesGeometry(TensorGeometry & geom,
+                             IndexTensor indices,
+                             ptrdiff_t windowSize,
+                             PoolMethod method) ;
+
+  Error
+  deduplicateIndices(IndexTensor encoded,
+                     IndexTensor indices,
+                     ptrdiff_t windowSize,
+                     PoolMethod method) ;
+
+  /* -------------------------------------------------------------- */
+  /*                                                         Layouts */
+  /* -------------------------------------------------------------- */
+
+  /*
+   Copies DATA to OUTPUT converting from DATA.layout to OUTPUT.layout.
+   The two tensors must have the same geometry and must not overlap.
+   */
+  Error
+  convertLayout(Tensor output,
+                Tensor data) ;
+
+  /* -------------------------------------------------------------- */
+  /*                                          Gather and scatter ops */
+  /* -------------------------------------------------------------- */
+
+  Error
+  im2colIndexed(float * stacked,
+                Tensor data,
+                IndexTensor convIndices,
+                TensorGeometry const & filters) ;
+
+  Error
+  col2imIndexed(Tensor data,
+                float const * stacked,
+                IndexTensor convIndices,
+                TensorGeometry const & filters) ;
+
+  /*
+   Nearest-neighbour interpolation of a perforated output. DATA holds
+   the computed pixels of each image (HEIGHT * WIDTH of them, usually a
+   M x 1 column as returned with CONVINDICES built from MASKINDICES).
+   INTERPOLATIONINDICES is a H x W x 1 x (1 or SIZE) tensor of offsets
+   into these pixels, or -1 for a zero pixel; OUTPUT is H x W x DEPTH
+   x SIZE. interpolateBackward sums DEROUTPUT back into DERDATA.
+   */
+  Error
+  interpolate(Tensor output,
+              Tensor data,
+              IndexTensor interpolationIndices) ;
+
+  Error
+  interpolateBackward(Tensor derData,
+                      Tensor derOutput,
+                      IndexTensor interpolationIndices) ;
+
+  /* -------------------------------------------------------------- */
+  /*                                                         Layers */
+  /* -------------------------------------------------------------- */
+
+  /*
+   The layers accept channel-last DATA (and OUTPUT, DERDATA and
+   DEROUTPUT, which must have the same layout as DATA), except
+   convIndexedForwardGatherGemm. FILTERS always have the default
+   layout. Channel-last tensors cannot be combined with run-length
+   encoded indices.
+
+   The biases are added to each block of OUTPUT right after the matrix
+   product that computes it. If relu is true, the forward functions
+   also clamp OUTPUT at zero in the same pass, computing
+   max(conv(DATA) + BIASES, 0); the backward functions always compute
+   the derivatives of the convolution alone.
+   */
+
+  void
+  convIndexedGetWorkspaceSize(ConvIndexedWorkspace & workspace,
+                              TensorGeometry const & data,
+                              TensorGeometry const & filters,
+                              IndexTensor convIndices,
+                              int microbatchSize,
+                              Layout layout = layoutDefault,
+                              bool interpolated = false) ;
+
+  Error
+  convIndexedForward(Tensor output,
+                     Tensor data,
+                     Tensor filters,
+                     Tensor biases,
+                     IndexTensor convIndices,
+                     int microbatchSize,
+                     ConvIndexedWorkspace const & workspace,
+                     bool relu = false) ;
+
+  /*
+   Same as convIndexedForward, but the im2col matrix is never formed:
+   the pixels are gathered directly into the blocks of the matrix
+   product. No workspace is needed.
+   */
+  Error
+  convIndexedForwardGatherGemm(Tensor output,
+                               Tensor data,
+                               Tensor filters,
+                               Tensor biases,
+                               IndexTensor convIndices,
+                               bool relu = false) ;
+
+  /*
+   Same as convIndexedForward followed by interpolate: the computed
+   pixels of each image are spread to the H x W x K x N OUTPUT as soon
+   as they leave the matrix product, so the output at the resolution of
+   CONVINDICES is never written. The workspace must be sized with
+   interpolated set to true.
+   */
+  Error
+  convIndexedForwardInterpolated(Tensor output,
+                                 Tensor data,
+                                 Tensor filters,
+                                 Tensor biases,
+                                 IndexTensor convIndices,
+                                 IndexTensor interpolationIndices,
+                                 int microbatchSize,
+                                 ConvIndexedWorkspace const & workspace,
+                                 bool relu = false) ;
+
+  /*
+   Empty derData, derFilters or derBiases tensors are not computed.
+   If accumulateDerFilters (accumulateDerBiases) is true, the
+   derivatives are added to the current content of the tensor.
+   */
+  Error
+  convIndexedBackward(Tensor derData,
+                      Tensor derFilters,
+                      Tensor derBiases,
+                      Tensor data,
+                      Tensor filters,
+                      Tensor derOutput,
+                      IndexTensor convIndices,
+                      int microbatchSize,
+                      bool accumulateDerFilters,
+                      bool accumulateDerBiases,
+                      ConvIndexedWorkspace const & workspace) ;
+
+  /*
+   Chooses the microbatch size for DATA, FILTERS and CONVINDICES on
+   the current number of threads: among the sizes whose scratch memory
+   fits in the last level cache, the fastest one in a short benchmark
+   of the forward pass. The choice is remembered for the geometry, so
+   only the first call for a layer shape runs the benchmark; the cache
+   may be used by several threads at the same time. Returns one if the
+   arguments are not valid.
+   */
+  int
+  convIndexedAutoMicrobatchSize(TensorGeometry const & data,
+                                TensorGeometry const & filters,
+                                IndexTensor convIndices,
+                                Layout layout = layoutDefault) ;
+
+  /*
+   A plan holds what the indexed convolution of a layer needs apart
+   from the values of its inputs: a validated copy of CONVINDICES, the
+   partition of the images into microbatches and the workspace. It is
+   created once per layer and executed on inputs with the geometry
+   given at creation; only the number of images may change, and only
+   if CONVINDICES has a single slice. A plan must not be executed by
+   several threads at the same time.
+   */
+  struct ConvIndexedPlan ;
+
+  Error
+  convIndexedPlanCreate(ConvIndexedPlan *& plan,
+                        TensorGeometry const & data,
+                        TensorGeometry const & filters,
+                        IndexTensor convIndices,
+                        int microbatchSize,
+                        Layout layout = layoutDefault) ;
+
+  void
+  convIndexedPlanDestroy(ConvIndexedPlan * plan) ;
+
+  TensorGeometry
+  convIndexedPlanGetIndicesGeometry(ConvIndexedPlan const * plan) ;
+
+  Layout
+  convIndexedPlanGetLayout(ConvIndexedPlan const * plan) ;
+
+  Error
+  convIndexedPlanForward(ConvIndexedPlan * plan,
+                         Tensor output,
+                         Tensor data,
+                         Tensor filters,
+                         Tensor biases,
+                         bool relu = false) ;
+
+  Error
+  convIndexedPlanBackward(ConvIndexedPlan * plan,
+                          Tensor derData,
+                          Tensor derFilters,
+                          Tensor derBiases,
+                          Tensor data,
+                          Tensor filters,
+                          Tensor derOutput,
+                          bool accumulateDerFilters,
+                          bool accumulateDerBiases) ;
+
+  /*
+   Forward convolution of DATA with 3 x 3 FILTERS and unit stride by
+   the Winograd F(2x2, 3x3) algorithm (winograd.hpp), which needs 2.25
+   times fewer multiplications than the matrix product of im2col.
+   OPTIONS give the padding; convWinogradIsSupported() tells whether
+   FILTERS and OPTIONS can be used. DATA must have the default layout.
+
+   With empty MASKINDICES, OUTPUT is the full Ho x Wo x K x N output.
+   Otherwise MASKINDICES lists the M offsets of the computed pixels of
+   the Ho x Wo output map and OUTPUT is M x 1 x K x N, in the same
+   order, as with CONVINDICES built from MASKINDICES. Only the 2 x 2
+   output tiles that contain computed pixels are evaluated, and they
+   are aligned on the computed rows and columns, so that few outputs
+   are wasted when the mask is a grid (the product of a set of rows and
+   a set of columns, as in the Grid and FractionalStride perforations).
+   */
+  bool
+  convWinogradIsSupported(TensorGeometry const & filters,
+                          ConvOptions const & options) ;
+
+  Error
+  convWinogradForward(Tensor output,
+                      Tensor data,
+                      Tensor filters,
+                      Tensor biases,
+                      ConvOptions const & options,
+                      IndexTensor maskIndices = IndexTensor(),
+                      bool relu = false) ;
+
+  Error
+  poolingFast(Tensor output,
+              Tensor data,
+              IndexTensor poolIndices,
+              PoolMethod method) ;
+
+  /* derData must be cleared by the caller */
+  Error
+  poolingFastBackward(Tensor derData,
+                      Tensor data,
+                      Tensor derOutput,
+                      IndexTensor poolIndices,
+                      PoolMethod method) ;
+
+  /*
+   Max pooling that also stores in SWITCHES (same geometry as OUTPUT)
+   the offset of the maximum of each window in its H x W slice of
+   DATA, so that the backward pass needs neither DATA nor POOLINDICES.
+   Ties go to the same element as in poolingFastBackward(). POOLINDICES
+   may be encoded, but DATA must have the default layout. An empty
+   deduplicated window has switch -1 and no derivative.
+   */
+  Error
+  poolingFastSwitches(Tensor output,
+                      IndexTensor switches,
+                      Tensor data,
+                      IndexTensor poolIndices) ;
+
+  /* derData must be cleared by the caller */
+  Error
+  poolingSwitchesBackward(Tensor derData,
+                          Tensor derOutput,
+                          IndexTensor switches) ;
+
+  /*
+   The layers that fill the perforated positions of a H x W x DEPTH x
+   SIZE tensor. MASKINDICES lists the zero-based offsets of the M
+   computed pixels of a H x W map. OUTINDICES is a H x W x K tensor of
+   positions in MASKINDICES (the K nearest computed pixels) and
+   WEIGHTS is either a scalar or a H x W x K tensor: each pixel of
+   OUTPUT is the weighted sum of its K neighbours in DATA.
+   perforationZeros copies the computed pixels and clears the others;
+   since it is linear and symmetric, it also computes its derivative.
+   */
+  Error
+  perforationKnn(Tensor output,
+                 Tensor data,
+                 IndexTensor maskIndices,
+                 IndexTensor outIndices,
+                 Tensor weights) ;
+
+  Error
+  perforationKnnBackward(Tensor derData,
+                         Tensor derOutput,
+                         IndexTensor maskIndices,
+                         IndexTensor outIndices,
+                         Tensor weights) ;
+
+  Error
+  perforationZeros(Tensor output,
+                   Tensor data,
+                   IndexTensor maskIndices) ;
+
+  /*
+   nearestMaskIndices sets each pixel of the H x W tensor OUTINDICES
+   to the position in MASKINDICES of the nearest computed pixel, which
+   is the OUTINDICES argument of perforationKnn with K = 1. Equally
+   near computed pixels are chosen by TIES: the first one in memory
+   order, the one nearest in memory order to the pixel, or one drawn
+   from a hash of SEED and the pixel offset. All the rules give the
+   same result on every run and for any number of threads.
+   */
+  enum NearestTies {
+    nearestTiesFirst = 0,
+    nearestTiesMemory,
+    nearestTiesRandom
+  } ;
+
+  Error
+  nearestMaskIndices(IndexTensor outIndices,
+                     IndexTensor maskIndices,
+                     NearestTies ties = nearestTiesFirst,
+                     unsigned int seed = 0) ;
+
+  Error
+  normalize(Tensor output,
+            Tensor data,
+            NormalizeOptions const & options) ;
+
+  Error
+  normalizeBackward(Tensor derData,
+                    Tensor data,
+                    Tensor derOutput,
+                    NormalizeOptions const & options) ;
+}
+
+#endif /* defined(VL_PERFCNN_H) */
@@ -0,0 +1,388 @@
+/** @file perforation.cpp
+ ** @brief Filling of the perforated positions (perfknn and perfzeros layers)
+ ** @author Michael Figurnov
+ **/
+
+/*
+ Copyright (C) 2015 Michael Figurnov.
+ All rights reserved.
+
+ This file is part of the VLFeat library and is made available under
+ the terms of the BSD license (see the COPYING file).
+ */
+
+#pragma GCC optimize ("tree-vectorize")
+
+#include "perforation.hpp"
+#include "threads.hpp"
+
+#include <cstring>
+
+/* the maps are split across the threads only if there is enough work */
+static const ptrdiff_t minParallelVolume = 32768 ;
+
+template<typename T>
+void perforation_knn_cpu(T* y,
+                         T const* x,
+                         int const* maskIndices,
+                         int const* outIndices,
+                         T const* weights,
+                         ptrdiff_t weightsStep,
+                         size_t dataSize,
+                         size_t depth,
+                         size_t numNeighbours)
+{
+  ptrdiff_t n = (ptrdiff_t)dataSize ;
+#pragma omp parallel for num_threads(vl_get_num_threads()) if(depth > 1 && n * (ptrdiff_t)depth >= minParallelVolume)
+  for (ptrdiff_t z = 0 ; z < (ptrdiff_t)depth ; ++z) {
+    T* __restrict__ dst = y + z * n ;
+    T const* __restrict__ src = x + z * n ;
+    for (ptrdiff_t p = 0 ; p < n ; ++p) {
+      dst[p] = weights[p * weightsStep] * src[maskIndices[outIndices[p]]] ;
+    }
+    for (size_t k = 1 ; k < numNeighbours ; ++k) {
+      int const* out = outIndices + k * n ;
+      T const* w = weights + k * n * weightsStep ;
+      for (ptrdiff_t p = 0 ; p < n ; ++p) {
+        dst[p] += w[p * weightsStep] * src[maskIndices[out[p]]] ;
+      }
+    }
+  }
+}
+
+template<typename T>
+void perforation_knn_backward_cpu(T* derX,
+                                  T const* derY,
+                                  int const* maskIndices,
+                                  int const* outIndices,
+                                  T const* weights,
+                                  ptrdiff_t weightsStep,
+                                  size_t dataSize,
+                                  size_t depth,
+                                  size_t numNeighbours)
+{
+  ptrdiff_t n = (ptrdiff_t)dataSize ;
+#pragma omp parallel for num_threads(vl_get_num_threads()) if(depth > 1 && n * (ptrdiff_t)depth >= minParallelVolume)
+  for (ptrdiff_t z = 0 ; z < (ptrdiff_t)depth ; ++z) {
+    T* __restrict__ dst = derX + z * n ;
+    T const* __restrict__ src = derY + z * n ;
+    memset(dst, 0, sizeof(T) * n) ;
+    for (size_t k = 0 ; k < numNeighbours ; ++k) {
+      int const* out = outIndices + k * n ;
+      T const* w = weights + k * n * weightsStep ;
+      for (ptrdiff_t p = 0 ; p < n ; ++p) {
+        dst[maskIndices[out[p]]] += w[p * weightsStep] * src[p] ;
+      }
+    }
+  }
+}
+
+template<typename T>
+void perforation_knn_hwc_cpu(T* y,
+                             T const* x,
+                             int const* maskIndices,
+                             int const* outIndices,
+                             T const* weights,
+                             ptrdiff_t weightsStep,
+                             size_t dataSize,
+                             size_t depth,
+                             size_t size,
+                             size_t numNeighbours)
+{
+  ptrdiff_t n = (ptrdiff_t)dataSize ;
+  ptrdiff_t d = (ptrdiff_t)depth ;
+  ptrdiff_t numPixels = n * (ptrdiff_t)size ;
+#pragma omp parallel for num_threads(vl_get_num_threads()) if(numPixels * d >= minParallelVolume)
+  for (ptrdiff_t q = 0 ; q < numPixels ; ++q) {
+    ptrdiff_t p = q % n ;
+    T* __restrict__ dst = y + q * d ;
+    T const* image = x + (q - p) * d ;
+    T w = weights[p * weightsStep] ;
+    T const* __restrict__ src = image + (ptrdiff_t)maskIndices[outIndices[p]] * d ;
+    for (ptrdiff_t c = 0 ; c < d ; ++c) { dst[c] = w * src[c] ; }
+    for (size_t k = 1 ; k < numNeighbours ; ++k) {
+      w = weights[(p + k * n) * weightsStep] ;
+      src = image + (ptrdiff_t)maskIndices[outIndices[p + k * n]] * d ;
+      for (ptrdiff_t c = 0 ; c < d ; ++c) { dst[c] += w * src[c] ; }
+    }
+  }
+}
+
+/* the pixels of an image may add to the same pixel: one image per thread */
+template<typename T>
+void perforation_knn_backward_hwc_cpu(T* derX,
+                                      T const* derY,
+                                      int const* maskIndices,
+                                      int const* outIndices,
+                                      T const* weights,
+                                      ptrdiff_t weightsStep,
+                                      size_t dataSize,
+                                      size_t depth,
+                                      size_t size,
+                                      size_t numNeighbours)
+{
+  ptrdiff_t n = (ptrdiff_t)dataSize ;
+  ptrdiff_t d = (ptrdiff_t)depth ;
+#pragma omp parallel for num_threads(vl_get_num_threads()) if(size > 1 && n * d * (ptrdiff_t)size >= minParallelVolume)
+  for (ptrdiff_t image = 0 ; image < (ptrdiff_t)size ; ++image) {
+    T* derXImage = derX + image * n * d ;
+    T const* derYImage = derY + image * n * d ;
+    memset(derXImage, 0, sizeof(T) * n * d) ;
+    for (size_t k = 0 ; k < numNeighbours ; ++k) {
+      for (ptrdiff_t p = 0 ; p < n ; ++p) {
+        T w = weights[(p + k * n) * weightsStep] ;
+        T* __restrict__ dst = derXImage + (ptrdiff_t)maskIndices[outIndices[p + k * n]] * d ;
+        T const* __restrict__ src = derYImage + p * d ;
+        for (ptrdiff_t c = 0 ; c < d ; ++c) { dst[c] += w * src[c] ; }
+      }
+    }
+  }
+}
+
+template<typename T>
+void perforation_zeros_cpu(T* y,
+                           T const* x,
+                           int const* maskIndices,
+                           size_t maskSize,
+                           size_t dataSize,
+                           size_t depth)
+{
+  ptrdiff_t n = (ptrdiff_t)dataSize ;
+#pragma omp parallel for num_threads(vl_get_num_threads()) if(depth > 1 && n * (ptrdiff_t)depth >= minParallelVolume)
+  for (ptrdiff_t z = 0 ; z < (ptrdiff_t)depth ; ++z) {
+    T* __restrict__ dst = y + z * n ;
+    T const* __restrict__ src = x + z * n ;
+    memset(dst, 0, sizeof(T) * n) ;
+    for (size_t i = 0 ; i < maskSize ; ++i) {
+      dst[maskIndices[i]] = src[maskIndices[i]] ;
+    }
+  }
+}
+
+template<typename T>
+void perforation_zeros_hwc_cpu(T* y,
+                               T const* x,
+                               int const* maskIndices,
+                               size_t maskSize,
+                               size_t dataSize,
+                               size_t depth,
+                               size_t size)
+{
+  ptrdiff_t n = (ptrdiff_t)dataSize ;
+  ptrdiff_t d = (ptrdiff_t)depth ;
+#pragma omp parallel for num_threads(vl_get_num_threads()) if(size > 1 && n * d * (ptrdiff_t)size >= minParallelVolume)
+  for (ptrdiff_t image = 0 ; image < (ptrdiff_t)size ; ++image) {
+    T* yImage = y + image * n * d ;
+    T const* xImage = x + image * n * d ;
+    memset(yImage, 0, sizeof(T) * n * d) ;
+    for (size_t i = 0 ; i < maskSize ; ++i) {
+      ptrdiff_t offset = (ptrdiff_t)maskIndices[i] * d ;
+      memcpy(yImage + offset, xImage + offset, sizeof(T) * d) ;
+    }
+  }
+}
+
+void nearest_mask_indices_cpu(int* indices,
+                              int const* maskIndices,
+                              size_t maskSize,
+                              size_t height,
+                              size_t width,
+                              int* position,
+                              int* row,
+                              long long* envelope)
+{
+  ptrdiff_t h = (ptrdiff_t)height ;
+  ptrdiff_t w = (ptrdiff_t)width ;
+
+  /* position of each computed pixel in MASKINDICES, or -1 */
+  for (ptrdiff_t p = 0 ; p < h * w ; ++p) { position[p] = -1 ; }
+  for (size_t i = 0 ; i < maskSize ; ++i) {
+    if (position[maskIndices[i]] < 0) { position[maskIndices[i]] = (int)i ; }
+  }
+
+  /* nearest computed row in the same column, the upper one on a tie */
+  for (ptrdiff_t x = 0 ; x < w ; ++x) {
+    int const* pos = position + x * h ;
+    int* r = row + x * h ;
+    int last = -1 ;
+    for (ptrdiff_t y = 0 ; y < h ; ++y) {
+      if (pos[y] >= 0) { last = (int)y ; }
+      r[y] = last ;
+    }
+    int next = -1 ;
+    for (ptrdiff_t y = h - 1 ; y >= 0 ; --y) {
+      if (pos[y] >= 0) { next = (int)y ; }
+      if (next >= 0 && (r[y] < 0 || next - y < y - r[y])) { r[y] = next ; }
+    }
+  }
+
+  /*
+   Along each row, lower envelope of the parabolas (x - q)^2 + f(q),
+   f(q) = (y - row(y,q))^2, over the columns q that contain a computed
+   pixel. The boundaries between the parabolas are kept as exact
+   fractions, so that a tie at an integer position always goes to the
+   leftmost column.
+   */
+  long long* v = envelope ;
+  long long* zNum = envelope + w ;
+  long long* zDen = envelope + 2 * w + 1 ;
+  for (ptrdiff_t y = 0 ; y < h ; ++y) {
+    ptrdiff_t k = -1 ;
+    for (ptrdiff_t q = 0 ; q < w ; ++q) {
+      int rq = row[y + q * h] ;
+      if (rq < 0) { continue ; }
+      long long fq = (long long)(y - rq) * (y - rq) + (long long)q * q ;
+      long long num = 0, den = 1 ;
+      while (k >= 0) {
+        long long p = v[k] ;
+        long long rp = row[y + p * h] ;
+        num = fq - ((y - rp) * (y - rp) + p * p) ;
+        den = 2 * (q - p) ;
+        if (k > 0 && num * zDen[k] <= zNum[k] * den) {
+          --k ;
+        } else {
+          break ;
+        }
+      }
+      ++k ;
+      v[k] = q ;
+      zNum[k] = num ;
+      zDen[k] = den ;
+    }
+    ptrdiff_t last = k ;
+    k = 0 ;
+    for (ptrdiff_t x = 0 ; x < w ; ++x) {
+      while (k < last && zNum[k + 1] < (long long)x * zDen[k + 1]) { ++k ; }
+      ptrdiff_t q = (ptrdiff_t)v[k] ;
+      indices[y + x * h] = position[row[y + q * h] + q * h] ;
+    }
+  }
+}
+
+static inline unsigned int
+hash_pixel(unsigned int seed, unsigned int p)
+{
+  unsigned int h = seed * 0x9e3779b9u ^ p ;
+  h ^= h >> 16 ; h *= 0x85ebca6bu ;
+  h ^= h >> 13 ; h *= 0xc2b2ae35u ;
+  h ^= h >> 16 ;
+  return h ;
+}
+
+void nearest_mask_indices_ties_cpu(int* indices,
+                                   int const* maskIndices,
+                                   int const* position,
+                                   size_t height,
+                                   size_t width,
+                                   bool random,
+                                   unsigned int seed)
+{
+  ptrdiff_t h = (ptrdiff_t)height ;
+  ptrdiff_t w = (ptrdiff_t)width ;
+#pragma omp parallel for num_threads(vl_get_num_threads()) if(h * w >= minParallelVolume)
+  for (ptrdiff_t p = 0 ; p < h * w ; ++p) {
+    ptrdiff_t x = p / h ;
+    ptrdiff_t y = p - x * h ;
+    ptrdiff_t q = maskIndices[indices[p]] ;
+    ptrdiff_t qx = q / h ;
+    ptrdiff_t qy = q - qx * h ;
+    ptrdiff_t dist2 = (qx - x) * (qx - x) + (qy - y) * (qy - y) ;
+    if (dist2 == 0) { continue ; }
+
+    /* the computed pixels on the circle of radius sqrt(DIST2) */
+    ptrdiff_t radius = 0 ;
+    while ((radius + 1) * (radius + 1) <= dist2) { ++radius ; }
+    ptrdiff_t dy = radius ;
+    ptrdiff_t numTies = 0 ;
+    ptrdiff_t chosen = -1 ;
+    for (int pass = 0 ; pass < (random ? 2 : 1) ; ++pass) {
+      ptrdiff_t target = (pass == 1) ? (ptrdiff_t)(hash_pixel(seed, (unsigned int)p) % numTies) : -1 ;
+      ptrdiff_t count = 0 ;
+      dy = radius ;
+      for (ptrdiff_t dx = 0 ; dx <= radius ; ++dx) {
+        while (dx * dx + dy * dy > dist2) { --dy ; }
+        if (dx * dx + dy * dy != dist2) { continue ; }
+        for (int k = 0 ; k < 4 ; ++k) {
+          ptrdiff_t cx = x + ((k & 1) ? -dx : dx) ;
+          ptrdiff_t cy = y + ((k & 2) ? -dy : dy) ;
+          if (((k & 1) && dx == 0) || ((k & 2) && dy == 0)) { continue ; }
+          if (cx < 0 || cx >= w || cy < 0 || cy >= h) { continue ; }
+          ptrdiff_t c = cy + cx * h ;
+          if (position[c] < 0) { continue ; }
+          if (random) {
+            if (count++ == target) { chosen = c ; }
+          } else {
+            ptrdiff_t delta = (c > p) ? c - p : p - c ;
+            ptrdiff_t best = (chosen > p) ? chosen - p : p - chosen ;
+            if (chosen < 0 || delta < best || (delta == best && c < chosen)) { chosen = c ; }
+          }
+        }
+      }
+      numTies = count ;
+    }
+    indices[p] = position[chosen] ;
+  }
+}
+
+template
+void perforation_knn_cpu<float>(float* y,
+                                float const* x,
+                                int const* maskIndices,
+                                int const* outIndices,
+                                float const* weights,
+                                ptrdiff_t weightsStep,
+                                size_t dataSize,
+                                size_t depth,
+                                size_t numNeighbours) ;
+
+template
+void perforation_knn_backward_cpu<float>(float* derX,
+                                         float const* derY,
+                                         int const* maskIndices,
+                                         int const* outIndices,
+                                         float const* weights,
+                                         ptrdiff_t weightsStep,
+                                         size_t dataSize,
+                                         size_t depth,
+                                         size_t numNeighbours) ;
+
+template
+void perforation_knn_hwc_cpu<float>(float* y,
+                                    float const* x,
+                                    int const* maskIndices,
+                                    int const* outIndices,
+                                    float const* weights,
+                                    ptrdiff_t weightsStep,
+                                    size_t dataSize,
+                                    size_t depth,
+                                    size_t size,
+                                    size_t numNeighbours) ;
+
+template
+void perforation_knn_backward_hwc_cpu<float>(float* derX,
+                                             float const* derY,
+                                             int const* maskIndices,
+                                             int const* outIndices,
+                                             float const* weights,
+                                             ptrdiff_t weightsStep,
+                                             size_t dataSize,
+                                             size_t depth,
+                                             size_t size,
+                                             size_t numNeighbours) ;
+
+template
+void perforation_zeros_cpu<float>(float* y,
+                                  float const* x,
+                                  int const* maskIndices,
+                                  size_t maskSize,
+                                  size_t dataSize,
+                                  size_t depth) ;
+
+template
+void perforation_zeros_hwc_cpu<float>(float* y,
+                                      float const* x,
+                                      int const* maskIndices,
+                                      size_t maskSize,
+                                      size_t dataSize,
+                                      size_t depth,
+                                      size_t size) ;
@@ -0,0 +1,172 @@
+/** @file perforation.hpp
+ ** @brief Filling of the perforated positions (perfknn and perfzeros layers)
+ ** @author Michael Figurnov
+ **/
+
+/*
+ Copyright (C) 2015 Michael Figurnov.
+ All rights reserved.
+
+ This file is part of the VLFeat library and is made available under
+ the terms of the BSD license (see the COPYING file).
+ */
+
+#ifndef VL_NNPERFORATION_H
+#define VL_NNPERFORATION_H
+
+#include <cstddef>
+
+/*
+ X and Y are stacks of DEPTH maps of DATASIZE pixels each (DEPTH is
+ the number of channels times the number of images). MASKINDICES
+ lists MASKSIZE zero-based offsets of the computed pixels of a map.
+
+ perforation_knn_cpu() sets every pixel P of Y to the weighted sum of
+ its NUMNEIGHBOURS neighbours: Y[P] = sum_k WEIGHTS[P + DATASIZE*k] *
+ X[MASKINDICES[OUTINDICES[P + DATASIZE*k]]]. The neighbours are
+ positions in MASKINDICES, so the source pixels are read directly
+ without forming a table of them. With WEIGHTSSTEP equal to zero, the
+ same weight WEIGHTS[0] is used for all of them. The backward function
+ sets DERX to the transposed scatter of DERY.
+
+ perforation_zeros_cpu() copies the pixels listed in MASKINDICES from
+ X to Y and sets all the others to zero. It is its own derivative.
+
+ The _hwc variants take channel-last X and Y (DEPTH x DATASIZE x SIZE
+ in memory), where DEPTH is only the number of channels.
+ */
+
+template<typename T>
+void perforation_knn_cpu(T* y,
+                         T const* x,
+                         int const* maskIndices,
+                         int const* outIndices,
+                         T const* weights,
+                         ptrdiff_t weightsStep,
+                         size_t dataSize,
+                         size_t depth,
+                         size_t numNeighbours) ;
+
+template<typename T>
+void perforation_knn_backward_cpu(T* derX,
+                                  T const* derY,
+                                  int const* maskIndices,
+                                  int const* outIndices,
+                                  T const* weights,
+                                  ptrdiff_t weightsStep,
+                                  size_t dataSize,
+                                  size_t depth,
+                                  size_t numNeighbours) ;
+
+template<typename T>
+void perforation_knn_hwc_cpu(T* y,
+                             T const* x,
+                             int const* maskIndices,
+                             int const* outIndices,
+                             T const* weights,
+                             ptrdiff_t weightsStep,
+                             size_t dataSize,
+                             size_t depth,
+                             size_t size,
+                             size_t numNeighbours) ;
+
+template<typename T>
+void perforation_knn_backward_hwc_cpu(T* derX,
+                                      T const* derY,
+                                      int const* maskIndices,
+                                      int const* outIndices,
+                                      T const* weights,
+                                      ptrdiff_t weightsStep,
+                                      size_t dataSize,
+                                      size_t depth,
+                                      size_t size,
+                                      size_t numNeighbours) ;
+
+template<typename T>
+void perforation_zeros_cpu(T* y,
+                           T const* x,
+                           int const* maskIndices,
+                           size_t maskSize,
+                           size_t dataSize,
+                           size_t depth) ;
+
+template<typename T>
+void perforation_zeros_hwc_cpu(T* y,
+                               T const* x,
+                               int const* maskIndices,
+                               size_t maskSize,
+                               size_t dataSize,
+                               size_t depth,
+                               size_t size) ;
+
+/*
+ nearest_mask_indices_cpu() sets INDICES[P], for each pixel P of a
+ HEIGHT x WIDTH map, to the position in MASKINDICES of the computed
+ pixel nearest to P (Euclidean distance). Among equally near pixels
+ the first one in memory order is chosen. The exact distance transform
+ of Felzenszwalb and Huttenlocher is run once along the columns and
+ once along the rows, in O(HEIGHT * WIDTH) time. POSITION and ROW
+ are scratch buffers of HEIGHT * WIDTH integers, ENVELOPE one of
+ 3 * WIDTH + 2.
+ */
+void nearest_mask_indices_cpu(int* indices,
+                              int const* maskIndices,
+                              size_t maskSize,
+                              size_t height,
+                              size_t width,
+                              int* position,
+                              int* row,
+                              long long* envelope) ;
+
+/*
+ nearest_mask_indices_ties_cpu() revisits the pixels set by
+ nearest_mask_indices_cpu() that have several computed pixels at the
+ same distance and chooses among them: the one nearest in memory
+ order (the smallest offset if two are equally near), or, with RANDOM,
+ one chosen by a hash of SEED and the pixel offset, so that the result
+ does not depend on the number of threads. POSITION is the buffer
+ filled by nearest_mask_indices_cpu(). The cost grows with the
+ distance to the nearest computed pixel.
+ */
+void nearest_mask_indices_ties_cpu(int* indices,
+                                   int const* maskIndices,
+                                   int const* position,
+                                   size_t height,
+                                   size_t width,
+                                   bool random,
+                                   unsigned int seed) ;
+
+#ifdef ENABLE_GPU
+/* DERX and Y must be cleared by the caller */
+template<typename T>
+void perforation_knn_gpu(T* y,
+                         T const* x,
+                         int const* maskIndices,
+                         int const* outIndices,
+                         T const* weights,
+                         ptrdiff_t weightsStep,
+                         size_t dataSize,
+                         size_t depth,
+                         size_t numNeighbours) ;
+
+template<typename T>
+void perforation_knn_backward_gpu(T* derX,
+                                  T const* derY,
+                                  int const* maskIndices,
+                                  int const* outIndices,
+                                  T const* weights,
+                                  ptrdiff_t weightsStep,
+                                  size_t dataSize,
+                                  size_t depth,
+                                  size_t numNeighbours) ;
+
+template<typename T>
+void perforation_zeros_gpu(T* y,
+                           T const* x,
+                           int const* maskIndices,
+                           size_t maskSize,
+                           size_t dataSize,
+                           size_t depth) ;
+#endif
+
+#endif /* defined(VL_NNPERFORATION_H) */
@@ -0,0 +1,174 @@
+/** @file perforation_gpu.cu
+ ** @brief Filling of the perforated positions (perfknn and perfzeros layers)
+ ** @author Michael Figurnov
+ **/
+
+/*
+ Copyright (C) 2015 Michael Figurnov.
+ All rights reserved.
+
+ This file is part of the VLFeat library and is made available under
+ the terms of the BSD license (see the COPYING file).
+ */
+
+#include "gpu.hpp"
+#include "perforation.hpp"
+
+template<typename T>
+__global__ void perforation_knn_gpu_kernel
+(T* __restrict__ y,
+ const T* __restrict__ x,
+ const int* __restrict__ maskIndices,
+ const int* __restrict__ outIndices,
+ const T* __restrict__ weights,
+ const int weightsStep,
+ const int dataSize,
+ const int volume,
+ const int numNeighbours)
+{
+  int index = threadIdx.x + blockIdx.x * blockDim.x ;
+  if (index < volume) {
+    int p = index % dataSize ;
+    x += index - p ;
+    T accum = 0 ;
+    for (int k = 0 ; k < numNeighbours ; ++k) {
+      int q = p + k * dataSize ;
+      accum += weights[q * weightsStep] * x[maskIndices[outIndices[q]]] ;
+    }
+    y[index] = accum ;
+  }
+}
+
+template<typename T>
+__global__ void perforation_knn_backward_gpu_kernel
+(T* __restrict__ derX,
+ const T* __restrict__ derY,
+ const int* __restrict__ maskIndices,
+ const int* __restrict__ outIndices,
+ const T* __restrict__ weights,
+ const int weightsStep,
+ const int dataSize,
+ const int volume,
+ const int numNeighbours)
+{
+  int index = threadIdx.x + blockIdx.x * blockDim.x ;
+  if (index < volume) {
+    int p = index % dataSize ;
+    derX += index - p ;
+    T value = derY[index] ;
+    for (int k = 0 ; k < numNeighbours ; ++k) {
+      int q = p + k * dataSize ;
+      atomicAdd(derX + maskIndices[outIndices[q]], weights[q * weightsStep] * value) ;
+    }
+  }
+}
+
+template<typename T>
+__global__ void perforation_zeros_gpu_kernel
+(T* __restrict__ y,
+ const T* __restrict__ x,
+ const int* __restrict__ maskIndices,
+ const int maskSize,
+ const int dataSize,
+ const int volume)
+{
+  int index = threadIdx.x + blockIdx.x * blockDim.x ;
+  if (index < volume) {
+    int i = index % maskSize ;
+    int offset = (index - i) / maskSize * dataSize + maskIndices[i] ;
+    y[offset] = x[offset] ;
+  }
+}
+
+template<typename T>
+void perforation_knn_gpu(T* y,
+                         T const* x,
+                         int const* maskIndices,
+                         int const* outIndices,
+                         T const* weights,
+                         ptrdiff_t weightsStep,
+                         size_t dataSize,
+                         size_t depth,
+                         size_t numNeighbours)
+{
+  int volume = dataSize * depth ;
+  perforation_knn_gpu_kernel<T>
+  <<< divideUpwards(volume, VL_CUDA_NUM_THREADS), VL_CUDA_NUM_THREADS >>>
+  (y, x, maskIndices, outIndices, weights, weightsStep, dataSize, volume, numNeighbours) ;
+  if (cudaGetLastError() != cudaSuccess) {
+    std::cout
+    <<"perforation_knn_gpu_kernel error ("
+    <<cudaGetErrorString(cudaGetLastError())
+    <<")"<<std::endl ;
+  }
+}
+
+template<typename T>
+void perforation_knn_backward_gpu(T* derX,
+                                  T const* derY,
+                                  int const* maskIndices,
+                                  int const* outIndices,
+                                  T const* weights,
+                                  ptrdiff_t weightsStep,
+                                  size_t dataSize,
+                                  size_t depth,
+                                  size_t numNeighbours)
+{
+  int volume = dataSize * depth ;
+  perforation_knn_backward_gpu_kernel<T>
+  <<< divideUpwards(volume, VL_CUDA_NUM_THREADS), VL_CUDA_NUM_THREADS >>>
+  (derX, derY, maskIndices, outIndices, weights, weightsStep, dataSize, volume, numNeighbours) ;
+  if (cudaGetLastError() != cudaSuccess) {
+    std::cout
+    <<"perforation_knn_backward_gpu_kernel error ("
+    <<cudaGetErrorString(cudaGetLastError())
+    <<")"<<std::endl ;
+  }
+}
+
+template<typename T>
+void perforation_zeros_gpu(T* y,
+                           T const* x,
+                           int const* maskIndices,
+                           size_t maskSize,
+                           size_t dataSize,
+                           size_t depth)
+{
+  int volume = maskSize * depth ;
+  perforation_zeros_gpu_kernel<T>
+  <<< divideUpwards(volume, VL_CUDA_NUM_THREADS), VL_CUDA_NUM_THREADS >>>
+  (y, x, maskIndices, maskSize, dataSize, volume) ;
+  if (cudaGetLastError() != cudaSuccess) {
+    std::cout
+    <<"perforation_zeros_gpu_kernel error ("
+    <<cudaGetErrorString(cudaGetLastError())
+    <<")"<<std::endl ;
+  }
+}
+
+template void perforation_knn_gpu<float>(float* y,
+                                         float const* x,
+                                         int const* maskIndices,
+                                         int const* outIndices,
+                                         float const* weights,
+                                         ptrdiff_t weightsStep,
+                                         size_t dataSize,
+                                         size_t depth,
+                                         size_t numNeighbours) ;
+
+template void perforation_knn_backward_gpu<float>(float* derX,
+                                                  float const* derY,
+                                                  int const* maskIndices,
+                                                  int const* outIndices,
+                                                  float const* weights,
+                                                  ptrdiff_t weightsStep,
+                                                  size_t dataSize,
+                                                  size_t depth,
+                                                  size_t numNeighbours) ;
+
+template void perforation_zeros_gpu<float>(float* y,
+                                           float const* x,
+                                           int const* maskIndices,
+                                           size_t maskSize,
+                                           size_t dataSize,
+                                           size_t depth) ;
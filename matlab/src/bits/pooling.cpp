@@ -13,6 +13,10 @@ the terms of the BSD license (see the COPYING file).
 */
 
 #include "pooling.hpp"
+#include "runlength.hpp"
+#include "dedup.hpp"
+#include "pooling_separable.hpp"
+#include "threads.hpp"
 #include <algorithm>
 #include <iostream>
 #include <set>
@@ -23,29 +27,53 @@ the terms of the BSD license (see the COPYING file).
 #include <cmath>
 
 
+/*
+ The CPU kernels process DEPTH independent slices, a channel of an
+ image each. Each public function splits them into one contiguous
+ range per thread, with vl_get_num_threads_for() threads, and runs
+ the sequential kernel on every range. The channel-last kernels split
+ the channels of the pixels in the same way.
+ */
+
+static inline size_t
+slice_begin(size_t depth, int worker, int numWorkers)
+{
+  return depth * worker / numWorkers ;
+}
+
 /* ---------------------------------------------------------------- */
 /*                                                 maxPooling (CPU) */
 /* ---------------------------------------------------------------- */
 
 template<typename T>
-void pooling_cpu(T* pooled,
-                 T const* data,
-                 PoolMethod method,
-                 size_t width,
-                 size_t height,
-                 size_t depth,
-                 size_t windowWidth,
-                 size_t windowHeight,
-                 size_t strideX,
-                 size_t strideY,
-                 size_t padLeft,
-                 size_t padRight,
-                 size_t padTop,
-                 size_t padBottom)
+static void
+pooling_slices_cpu(T* pooled,
+                   T const* data,
+                   PoolMethod method,
+                   size_t width,
+                   size_t height,
+                   size_t depth,
+                   size_t windowWidth,
+                   size_t windowHeight,
+                   size_t strideX,
+                   size_t strideY,
+                   size_t padLeft,
+                   size_t padRight,
+                   size_t padTop,
+                   size_t padBottom)
 {
   int pooledWidth = (width + (padLeft + padRight) - windowWidth)/strideX + 1 ;
   int pooledHeight = (height + (padTop + padBottom) - windowHeight)/strideY + 1 ;
 
+  if (pooling_separable_is_faster(width, pooledWidth, windowWidth, windowHeight, strideX)) {
+    pooling_separable_cpu<T>(pooled, data, method,
+                             width, height, depth,
+                             windowWidth, windowHeight,
+                             strideX, strideY,
+                             padLeft, padRight, padTop, padBottom) ;
+    return ;
+  }
+
   switch (method) {
     case NN_POOL_MAX :
       for (int z = 0; z < depth; ++z) {
@@ -101,6 +129,42 @@ void pooling_cpu(T* pooled,
 
 }
 
+template<typename T>
+void pooling_cpu(T* pooled,
+                 T const* data,
+                 PoolMethod method,
+                 size_t width,
+                 size_t height,
+                 size_t depth,
+                 size_t windowWidth,
+                 size_t windowHeight,
+                 size_t strideX,
+                 size_t strideY,
+                 size_t padLeft,
+                 size_t padRight,
+                 size_t padTop,
+                 size_t padBottom)
+{
+  size_t pooledWidth = (width + (padLeft + padRight) - windowWidth)/strideX + 1 ;
+  size_t pooledHeight = (height + (padTop + padBottom) - windowHeight)/strideY + 1 ;
+  size_t sliceSize = width*height ;
+  size_t pooledSliceSize = pooledWidth*pooledHeight ;
+  int numWorkers = vl_get_num_threads_for(depth, depth * pooledSliceSize * windowWidth * windowHeight) ;
+
+#pragma omp parallel for num_threads(numWorkers) if(numWorkers > 1)
+  for (int t = 0 ; t < numWorkers ; ++t) {
+    size_t begin = slice_begin(depth, t, numWorkers) ;
+    size_t end = slice_begin(depth, t + 1, numWorkers) ;
+    pooling_slices_cpu<T>(pooled + begin * pooledSliceSize,
+                          data + begin * sliceSize,
+                          method,
+                          width, height, end - begin,
+                          windowWidth, windowHeight,
+                          strideX, strideY,
+                          padLeft, padRight, padTop, padBottom) ;
+  }
+}
+
 template
 void pooling_cpu<float>(float* pooled,
                         float const* data,
@@ -143,21 +207,22 @@ void pooling_cpu<double>(double* pooled,
  properly initialised: accumulates the derivative
  */
 template<typename T>
-void poolingBackward_cpu(T* dzdx,
-                         T const* data,
-                         T const* dzdy,
-                         PoolMethod method,
-                         size_t width,
-                         size_t height,
-                         size_t depth,
-                         size_t windowWidth,
-                         size_t windowHeight,
-                         size_t strideX,
-                         size_t strideY,
-                         size_t padLeft,
-                         size_t padRight,
-                         size_t padTop,
-                         size_t padBottom)
+static void
+pooling_backward_slices_cpu(T* dzdx,
+                            T const* data,
+                            T const* dzdy,
+                            PoolMethod method,
+                            size_t width,
+                            size_t height,
+                            size_t depth,
+                            size_t windowWidth,
+                            size_t windowHeight,
+                            size_t strideX,
+                            size_t strideY,
+                            size_t padLeft,
+                            size_t padRight,
+                            size_t padTop,
+                            size_t padBottom)
 {
   int pooledWidth = (width + (padLeft + padRight) - windowWidth)/strideX + 1 ;
   int pooledHeight = (height + (padTop + padBottom) - windowHeight)/strideY + 1 ;
@@ -221,6 +286,44 @@ void poolingBackward_cpu(T* dzdx,
   }
 }
 
+template<typename T>
+void poolingBackward_cpu(T* dzdx,
+                         T const* data,
+                         T const* dzdy,
+                         PoolMethod method,
+                         size_t width,
+                         size_t height,
+                         size_t depth,
+                         size_t windowWidth,
+                         size_t windowHeight,
+                         size_t strideX,
+                         size_t strideY,
+                         size_t padLeft,
+                         size_t padRight,
+                         size_t padTop,
+                         size_t padBottom)
+{
+  size_t pooledWidth = (width + (padLeft + padRight) - windowWidth)/strideX + 1 ;
+  size_t pooledHeight = (height + (padTop + padBottom) - windowHeight)/strideY + 1 ;
+  size_t sliceSize = width*height ;
+  size_t pooledSliceSize = pooledWidth*pooledHeight ;
+  int numWorkers = vl_get_num_threads_for(depth, depth * pooledSliceSize * windowWidth * windowHeight) ;
+
+#pragma omp parallel for num_threads(numWorkers) if(numWorkers > 1)
+  for (int t = 0 ; t < numWorkers ; ++t) {
+    size_t begin = slice_begin(depth, t, numWorkers) ;
+    size_t end = slice_begin(depth, t + 1, numWorkers) ;
+    pooling_backward_slices_cpu<T>(dzdx + begin * sliceSize,
+                                   data + begin * sliceSize,
+                                   dzdy + begin * pooledSliceSize,
+                                   method,
+                                   width, height, end - begin,
+                                   windowWidth, windowHeight,
+                                   strideX, strideY,
+                                   padLeft, padRight, padTop, padBottom) ;
+  }
+}
+
 template
 void poolingBackward_cpu<float>(float* dzdx,
                                 float const* data,
@@ -256,22 +359,58 @@ void poolingBackward_cpu<double>(double* dzdx,
                                  size_t padBottom) ;
 
 
-template<typename T, int windowSize>
-void max_pooling_cpu_fast_internal(T* __restrict__ pooled,
-                                   T const* __restrict__ data,
-                                   int const* __restrict__ indices,
-                                   size_t dataSize,
-                                   size_t depth,
-                                   size_t pooledSize)
+/* ---------------------------------------------------------------- */
+/*                                               Fast pooling (CPU) */
+/* ---------------------------------------------------------------- */
+
+/*
+ Each kernel is written once, for windows of WindowSize indices. With
+ WindowSize > 0 the size is known at compile time and the loops over
+ the window are unrolled; WindowSize = 0 reads it from windowSize at
+ run time. FastPoolingTable instantiates the unrolled kernels for the
+ areas of all the windows of up to MAX_UNROLLED_SIDE x
+ MAX_UNROLLED_SIDE pixels, square or not (1, 2, ..., 6, 8, 9, 10, 12,
+ ...), and the run-time kernel for the other sizes.
+ */
+
+namespace {
+  enum {
+    MAX_UNROLLED_SIDE = 7,
+    MAX_UNROLLED_WINDOW = MAX_UNROLLED_SIDE * MAX_UNROLLED_SIDE
+  } ;
+
+  /* whether n = h * w for some 1 <= h, w <= MAX_UNROLLED_SIDE */
+  template<int n, int h = MAX_UNROLLED_SIDE>
+  struct IsWindowArea
+  {
+    enum { value = (n % h == 0 && n / h <= MAX_UNROLLED_SIDE) || IsWindowArea<n, h - 1>::value } ;
+  } ;
+
+  template<int n>
+  struct IsWindowArea<n, 0>
+  {
+    enum { value = false } ;
+  } ;
+}
+
+template<typename T, int WindowSize>
+static void
+max_pooling_cpu_fast_kernel(T* __restrict__ pooled,
+                            T const* __restrict__ data,
+                            int const* __restrict__ indices,
+                            size_t dataSize,
+                            size_t depth,
+                            size_t windowSize,
+                            size_t pooledSize)
 {
+  int const n = WindowSize ? WindowSize : (int)windowSize;
   for (int z = 0; z < depth; ++z) {
     for (int x = 0; x < pooledSize; ++x) {
-      T bestValue;
-      #pragma unroll
-      for (int u = 0; u < windowSize; ++u) {
-        int index = indices[x * windowSize + u];
-        T value = data[index];
-        if (u == 0 || value > bestValue) {
+      int const* window = indices + x * n;
+      T bestValue = data[window[0]];
+      for (int u = 1; u < n; ++u) {
+        T value = data[window[u]];
+        if (value > bestValue) {
           bestValue = value;
         }
       }
@@ -282,85 +421,167 @@ void max_pooling_cpu_fast_internal(T* __restrict__ pooled,
   }
 }
 
-template<typename T>
-void max_pooling_cpu_fast_internal_2(T* __restrict__ pooled,
-                                     T const* __restrict__ data,
-                                     int const* __restrict__ indices,
-                                     size_t dataSize,
-                                     size_t depth,
-                                     size_t windowSize,
-                                     size_t pooledSize)
+template<typename T, int WindowSize>
+static void
+avg_pooling_cpu_fast_kernel(T* __restrict__ pooled,
+                            T const* __restrict__ data,
+                            int const* __restrict__ indices,
+                            size_t dataSize,
+                            size_t depth,
+                            size_t windowSize,
+                            size_t pooledSize)
 {
+  int const n = WindowSize ? WindowSize : (int)windowSize;
   for (int z = 0; z < depth; ++z) {
     for (int x = 0; x < pooledSize; ++x) {
-      T bestValue;
-      #pragma unroll
-      for (int u = 0; u < windowSize; ++u) {
-        int index = indices[x * windowSize + u];
-        T value = data[index];
-        if (u == 0 || value > bestValue) {
-          bestValue = value;
+      int const* window = indices + x * n;
+      T accum = 0;
+      T poolSize = 0;
+      for (int u = 0; u < n; ++u) {
+        int index = window[u];
+        if (index != -1) {
+          accum += data[index];
+          ++poolSize;
         }
       }
-      pooled[x] = bestValue;
+      pooled[x] = accum / poolSize;
     }
     data += dataSize;
     pooled += pooledSize;
   }
 }
 
-template<typename T, int windowSize>
-void avg_pooling_cpu_fast_internal(T* __restrict__ pooled,
-                                   T const* __restrict__ data,
-                                   int const* __restrict__ indices,
-                                   size_t dataSize,
-                                   size_t depth,
-                                   size_t pooledSize)
+template<typename T, int WindowSize>
+static void
+max_pooling_backward_cpu_fast_kernel(T* __restrict__ dzdx,
+                                     T const* __restrict__ data,
+                                     T const* __restrict__ dzdy,
+                                     int const* __restrict__ indices,
+                                     size_t dataSize,
+                                     size_t depth,
+                                     size_t windowSize,
+                                     size_t pooledSize)
 {
+  int const n = WindowSize ? WindowSize : (int)windowSize;
   for (int z = 0; z < depth; ++z) {
     for (int x = 0; x < pooledSize; ++x) {
-      T accum = 0;
-      T poolSize = 0;
-      #pragma unroll
-      for (int u = 0; u < windowSize; ++u) {
-        int index = indices[x * windowSize + u];
-        if (index != -1) {
-          accum += data[index];
-          ++poolSize;
+      int const* window = indices + x * n;
+      int bestIndex = window[0];
+      T bestValue = data[bestIndex];
+      for (int u = 1; u < n; ++u) {
+        int index = window[u];
+        T value = data[index];
+        if (value > bestValue) {
+          bestIndex = index;
+          bestValue = value;
         }
       }
-      pooled[x] = accum / poolSize;
+      dzdx[bestIndex] += dzdy[x];
     }
     data += dataSize;
-    pooled += pooledSize;
+    dzdx += dataSize;
+    dzdy += pooledSize;
   }
 }
 
-template<typename T>
-void avg_pooling_cpu_fast_internal_2(T* __restrict__ pooled,
+template<typename T, int WindowSize>
+static void
+avg_pooling_backward_cpu_fast_kernel(T* __restrict__ dzdx,
                                      T const* __restrict__ data,
+                                     T const* __restrict__ dzdy,
                                      int const* __restrict__ indices,
                                      size_t dataSize,
                                      size_t depth,
                                      size_t windowSize,
                                      size_t pooledSize)
 {
+  int const n = WindowSize ? WindowSize : (int)windowSize;
   for (int z = 0; z < depth; ++z) {
     for (int x = 0; x < pooledSize; ++x) {
-      T accum = 0;
+      int const* window = indices + x * n;
       T poolSize = 0;
-      #pragma unroll
-      for (int u = 0; u < windowSize; ++u) {
-        int index = indices[x * windowSize + u];
-        if (index != -1) {
-          accum += data[index];
+      for (int u = 0; u < n; ++u) {
+        if (window[u] != -1) {
           ++poolSize;
         }
       }
-      pooled[x] = accum / poolSize;
+      if (poolSize) {
+        T value = dzdy[x] / poolSize;
+        for (int u = 0; u < n; ++u) {
+          int index = window[u];
+          if (index != -1) {
+            dzdx[index] += value;
+          }
+        }
+      }
     }
     data += dataSize;
-    pooled += pooledSize;
+    dzdx += dataSize;
+    dzdy += pooledSize;
+  }
+}
+
+namespace {
+  template<typename T>
+  struct FastPoolingKernels
+  {
+    typedef void (*Forward)(T*, T const*, int const*, size_t, size_t, size_t, size_t) ;
+    typedef void (*Backward)(T*, T const*, T const*, int const*, size_t, size_t, size_t, size_t) ;
+    Forward forward [NN_POOL_METHODS_NUM] ;
+    Backward backward [NN_POOL_METHODS_NUM] ;
+  } ;
+
+  template<typename T, int WindowSize>
+  FastPoolingKernels<T> getFastPoolingKernels()
+  {
+    FastPoolingKernels<T> kernels ;
+    kernels.forward[NN_POOL_MAX] = max_pooling_cpu_fast_kernel<T, WindowSize> ;
+    kernels.forward[NN_POOL_AVG] = avg_pooling_cpu_fast_kernel<T, WindowSize> ;
+    kernels.backward[NN_POOL_MAX] = max_pooling_backward_cpu_fast_kernel<T, WindowSize> ;
+    kernels.backward[NN_POOL_AVG] = avg_pooling_backward_cpu_fast_kernel<T, WindowSize> ;
+    return kernels ;
+  }
+
+  /* fills table[1], ..., table[n] */
+  template<typename T, int n>
+  struct FillFastPoolingTable
+  {
+    static void fill(FastPoolingKernels<T>* table)
+    {
+      FillFastPoolingTable<T, n - 1>::fill(table) ;
+      table[n] = getFastPoolingKernels<T, IsWindowArea<n>::value ? n : 0>() ;
+    }
+  } ;
+
+  template<typename T>
+  struct FillFastPoolingTable<T, 0>
+  {
+    static void fill(FastPoolingKernels<T>*) { }
+  } ;
+
+  /* table[windowSize], or table[0] (the run-time kernels) for the larger windows */
+  template<typename T>
+  struct FastPoolingTable
+  {
+    FastPoolingKernels<T> table [MAX_UNROLLED_WINDOW + 1] ;
+
+    FastPoolingTable()
+    {
+      table[0] = getFastPoolingKernels<T, 0>() ;
+      FillFastPoolingTable<T, MAX_UNROLLED_WINDOW>::fill(table) ;
+    }
+
+    FastPoolingKernels<T> const & select(size_t windowSize) const
+    {
+      return table[(windowSize <= MAX_UNROLLED_WINDOW) ? windowSize : 0] ;
+    }
+  } ;
+
+  template<typename T>
+  FastPoolingKernels<T> const & selectFastPoolingKernels(size_t windowSize)
+  {
+    static FastPoolingTable<T> const fastPoolingTable ;
+    return fastPoolingTable.select(windowSize) ;
   }
 }
 
@@ -374,49 +595,17 @@ void pooling_cpu_fast(T* pooled,
                       size_t windowSize,
                       size_t pooledSize)
 {
-#define MAX_POOL_CPU(_windowSize) case _windowSize: \
-  max_pooling_cpu_fast_internal<T, _windowSize>\
-    (pooled, data, indices, dataSize, depth, pooledSize); break
-#define AVG_POOL_CPU(_windowSize) case _windowSize: \
-  avg_pooling_cpu_fast_internal<T, _windowSize>\
-    (pooled, data, indices, dataSize, depth, pooledSize); break
+  assert(method == NN_POOL_MAX || method == NN_POOL_AVG);
+  typename FastPoolingKernels<T>::Forward kernel = selectFastPoolingKernels<T>(windowSize).forward[method];
+  int numWorkers = vl_get_num_threads_for(depth, depth * pooledSize * windowSize);
 
-  switch (method) {
-    case NN_POOL_MAX :
-      switch (windowSize) {
-        MAX_POOL_CPU(1);
-        MAX_POOL_CPU(4);
-        MAX_POOL_CPU(9);
-        MAX_POOL_CPU(16);
-        MAX_POOL_CPU(25);
-        MAX_POOL_CPU(36);
-        MAX_POOL_CPU(49);
-        default:
-          max_pooling_cpu_fast_internal_2<T>
-            (pooled, data, indices, dataSize, depth, windowSize, pooledSize);
-          break;
-      }
-      break;
-    case NN_POOL_AVG:
-      switch (windowSize) {
-        AVG_POOL_CPU(1);
-        AVG_POOL_CPU(4);
-        AVG_POOL_CPU(9);
-        AVG_POOL_CPU(16);
-        AVG_POOL_CPU(25);
-        AVG_POOL_CPU(36);
-        AVG_POOL_CPU(49);
-        default:
-          avg_pooling_cpu_fast_internal_2<T>
-            (pooled, data, indices, dataSize, depth, windowSize, pooledSize);
-          break;
-      }
-      break;
-    default:
-      assert(false);
+#pragma omp parallel for num_threads(numWorkers) if(numWorkers > 1)
+  for (int t = 0; t < numWorkers; ++t) {
+    size_t begin = slice_begin(depth, t, numWorkers);
+    size_t end = slice_begin(depth, t + 1, numWorkers);
+    kernel(pooled + begin * pooledSize, data + begin * dataSize, indices,
+           dataSize, end - begin, windowSize, pooledSize);
   }
-#undef MAX_POOL_CPU
-#undef AVG_POOL_CPU
 }
 
 template
@@ -439,60 +628,185 @@ void pooling_cpu_fast<double>(double* pooled,
                               size_t windowSize,
                               size_t pooledSize);
 
-template<typename T, int windowSize>
-void max_pooling_backward_cpu_fast_internal(T* __restrict__ dzdx,
-                                            T const* __restrict__ data,
-                                            T const* __restrict__ dzdy,
-                                            int const* __restrict__ indices,
-                                            size_t dataSize,
-                                            size_t depth,
-                                            size_t pooledSize)
+template<typename T>
+void pooling_backward_cpu_fast(T* dzdx,
+                               T const* data,
+                               T const* dzdy,
+                               int const* indices,
+                               PoolMethod method,
+                               size_t dataSize,
+                               size_t depth,
+                               size_t windowSize,
+                               size_t pooledSize)
+{
+  assert(method == NN_POOL_MAX || method == NN_POOL_AVG);
+  typename FastPoolingKernels<T>::Backward kernel = selectFastPoolingKernels<T>(windowSize).backward[method];
+  int numWorkers = vl_get_num_threads_for(depth, depth * pooledSize * windowSize);
+
+#pragma omp parallel for num_threads(numWorkers) if(numWorkers > 1)
+  for (int t = 0; t < numWorkers; ++t) {
+    size_t begin = slice_begin(depth, t, numWorkers);
+    size_t end = slice_begin(depth, t + 1, numWorkers);
+    kernel(dzdx + begin * dataSize, data + begin * dataSize, dzdy + begin * pooledSize, indices,
+           dataSize, end - begin, windowSize, pooledSize);
+  }
+}
+
+template
+void pooling_backward_cpu_fast<float>(float* dzdx,
+                                      float const* data,
+                                      float const* dzdy,
+                                      int const* indices,
+                                      PoolMethod method,
+                                      size_t dataSize,
+                                      size_t depth,
+                                      size_t windowSize,
+                                      size_t pooledSize);
+
+template
+void pooling_backward_cpu_fast<double>(double* dzdx,
+                                       double const* data,
+                                       double const* dzdy,
+                                       int const* indices,
+                                       PoolMethod method,
+                                       size_t dataSize,
+                                       size_t depth,
+                                       size_t windowSize,
+                                       size_t pooledSize);
+
+/* ---------------------------------------------------------------- */
+/*                                Fast pooling with index runs (CPU) */
+/* ---------------------------------------------------------------- */
+
+/*
+ Every output pixel has its list of runs. The runs are visited in the
+ order of the plain indices, so that ties of the max pooling are
+ resolved in the same way.
+ */
+
+template<typename T>
+static void
+pooling_runs_slices_cpu_fast(T* pooled,
+                             T const* data,
+                             int const* encodedIndices,
+                             PoolMethod method,
+                             size_t dataSize,
+                             size_t depth)
 {
+  int pooledSize = rle_num_lists(encodedIndices);
+  int const* lists = rle_lists(encodedIndices);
+  int const* runs = rle_runs(encodedIndices);
+
   for (int z = 0; z < depth; ++z) {
     for (int x = 0; x < pooledSize; ++x) {
-      T bestValue;
-      int bestIndex;
-      #pragma unroll
-      for (int u = 0; u < windowSize; ++u) {
-        int index = indices[x * windowSize + u];
-        T value = data[index];
-        if (u == 0 || value > bestValue) {
-          bestIndex = index;
-          bestValue = value;
+      int const* curRuns = runs + 2 * (ptrdiff_t)lists[2*x];
+      int numRuns = lists[2*x + 1];
+      if (method == NN_POOL_MAX) {
+        /* the max pooling indices have no padding */
+        T bestValue = data[curRuns[0]];
+        for (int r = 0; r < numRuns; ++r) {
+          T const* span = data + curRuns[2*r];
+          for (int i = 0; i < curRuns[2*r + 1]; ++i) {
+            bestValue = std::max(bestValue, span[i]);
+          }
         }
+        pooled[x] = bestValue;
+      } else {
+        T accum = 0;
+        T poolSize = 0;
+        for (int r = 0; r < numRuns; ++r) {
+          if (curRuns[2*r] == -1) { continue; }
+          T const* span = data + curRuns[2*r];
+          for (int i = 0; i < curRuns[2*r + 1]; ++i) {
+            accum += span[i];
+          }
+          poolSize += curRuns[2*r + 1];
+        }
+        pooled[x] = accum / poolSize;
       }
-      dzdx[bestIndex] += dzdy[x];
     }
     data += dataSize;
-    dzdx += dataSize;
-    dzdy += pooledSize;
+    pooled += pooledSize;
   }
 }
 
 template<typename T>
-void max_pooling_backward_cpu_fast_internal_2(T* __restrict__ dzdx,
-                                              T const* __restrict__ data,
-                                              T const* __restrict__ dzdy,
-                                              int const* __restrict__ indices,
-                                              size_t dataSize,
-                                              size_t depth,
-                                              size_t windowSize,
-                                              size_t pooledSize)
+void pooling_runs_cpu_fast(T* pooled,
+                           T const* data,
+                           int const* encodedIndices,
+                           PoolMethod method,
+                           size_t dataSize,
+                           size_t depth)
+{
+  size_t pooledSize = rle_num_lists(encodedIndices) ;
+  int numWorkers = vl_get_num_threads_for(depth, depth * pooledSize * rle_list_length(encodedIndices)) ;
+
+#pragma omp parallel for num_threads(numWorkers) if(numWorkers > 1)
+  for (int t = 0 ; t < numWorkers ; ++t) {
+    size_t begin = slice_begin(depth, t, numWorkers) ;
+    size_t end = slice_begin(depth, t + 1, numWorkers) ;
+    pooling_runs_slices_cpu_fast<T>(pooled + begin * pooledSize,
+                                    data + begin * dataSize,
+                                    encodedIndices, method,
+                                    dataSize, end - begin) ;
+  }
+}
+
+template
+void pooling_runs_cpu_fast<float>(float* pooled,
+                                  float const* data,
+                                  int const* encodedIndices,
+                                  PoolMethod method,
+                                  size_t dataSize,
+                                  size_t depth);
+
+template<typename T>
+static void
+pooling_backward_runs_slices_cpu_fast(T* dzdx,
+                                      T const* data,
+                                      T const* dzdy,
+                                      int const* encodedIndices,
+                                      PoolMethod method,
+                                      size_t dataSize,
+                                      size_t depth)
 {
+  int pooledSize = rle_num_lists(encodedIndices);
+  int const* lists = rle_lists(encodedIndices);
+  int const* runs = rle_runs(encodedIndices);
+
   for (int z = 0; z < depth; ++z) {
     for (int x = 0; x < pooledSize; ++x) {
-      T bestValue;
-      int bestIndex;
-      #pragma unroll
-      for (int u = 0; u < windowSize; ++u) {
-        int index = indices[x * windowSize + u];
-        T value = data[index];
-        if (u == 0 || value > bestValue) {
-          bestIndex = index;
-          bestValue = value;
+      int const* curRuns = runs + 2 * (ptrdiff_t)lists[2*x];
+      int numRuns = lists[2*x + 1];
+      if (method == NN_POOL_MAX) {
+        int bestIndex = curRuns[0];
+        T bestValue = data[bestIndex];
+        for (int r = 0; r < numRuns; ++r) {
+          for (int i = 0; i < curRuns[2*r + 1]; ++i) {
+            int index = curRuns[2*r] + i;
+            if (data[index] > bestValue) {
+              bestIndex = index;
+              bestValue = data[index];
+            }
+          }
+        }
+        dzdx[bestIndex] += dzdy[x];
+      } else {
+        T poolSize = 0;
+        for (int r = 0; r < numRuns; ++r) {
+          if (curRuns[2*r] != -1) { poolSize += curRuns[2*r + 1]; }
+        }
+        if (poolSize) {
+          T value = dzdy[x] / poolSize;
+          for (int r = 0; r < numRuns; ++r) {
+            if (curRuns[2*r] == -1) { continue; }
+            T* span = dzdx + curRuns[2*r];
+            for (int i = 0; i < curRuns[2*r + 1]; ++i) {
+              span[i] += value;
+            }
+          }
         }
       }
-      dzdx[bestIndex] += dzdy[x];
     }
     data += dataSize;
     dzdx += dataSize;
@@ -500,34 +814,158 @@ void max_pooling_backward_cpu_fast_internal_2(T* __restrict__ dzdx,
   }
 }
 
-template<typename T, int windowSize>
-void avg_pooling_backward_cpu_fast_internal(T* __restrict__ dzdx,
-                                            T const* __restrict__ data,
-                                            T const* __restrict__ dzdy,
-                                            int const* __restrict__ indices,
-                                            size_t dataSize,
-                                            size_t depth,
-                                            size_t pooledSize)
+template<typename T>
+void pooling_backward_runs_cpu_fast(T* dzdx,
+                                    T const* data,
+                                    T const* dzdy,
+                                    int const* encodedIndices,
+                                    PoolMethod method,
+                                    size_t dataSize,
+                                    size_t depth)
+{
+  size_t pooledSize = rle_num_lists(encodedIndices) ;
+  int numWorkers = vl_get_num_threads_for(depth, depth * pooledSize * rle_list_length(encodedIndices)) ;
+
+#pragma omp parallel for num_threads(numWorkers) if(numWorkers > 1)
+  for (int t = 0 ; t < numWorkers ; ++t) {
+    size_t begin = slice_begin(depth, t, numWorkers) ;
+    size_t end = slice_begin(depth, t + 1, numWorkers) ;
+    pooling_backward_runs_slices_cpu_fast<T>(dzdx + begin * dataSize,
+                                             data + begin * dataSize,
+                                             dzdy + begin * pooledSize,
+                                             encodedIndices, method,
+                                             dataSize, end - begin) ;
+  }
+}
+
+template
+void pooling_backward_runs_cpu_fast<float>(float* dzdx,
+                                           float const* data,
+                                           float const* dzdy,
+                                           int const* encodedIndices,
+                                           PoolMethod method,
+                                           size_t dataSize,
+                                           size_t depth);
+
+/* ---------------------------------------------------------------- */
+/*                    Fast pooling with deduplicated windows (CPU) */
+/* ---------------------------------------------------------------- */
+
+/*
+ Every distinct source of a window is read once; the average pooling
+ weighs it by its count (the max pooling indices have no counts). An
+ empty window (only padding) gives 0 / 0 for the average, as with the
+ plain indices.
+ */
+
+template<typename T>
+static void
+pooling_dedup_slices_cpu_fast(T* pooled,
+                              T const* data,
+                              int const* encodedIndices,
+                              PoolMethod method,
+                              size_t dataSize,
+                              size_t depth)
 {
+  int pooledSize = dedup_num_windows(encodedIndices);
+  int const* offsets = dedup_offsets(encodedIndices);
+  int const* entries = dedup_entries(encodedIndices);
+
   for (int z = 0; z < depth; ++z) {
     for (int x = 0; x < pooledSize; ++x) {
-      T poolSize = 0;
-      #pragma unroll
-      for (int u = 0; u < windowSize; ++u) {
-        int index = indices[x * windowSize + u];
-        if (index != -1) {
-          ++poolSize;
+      int begin = offsets[x];
+      int end = offsets[x + 1];
+      if (method == NN_POOL_MAX) {
+        T bestValue = (begin < end) ? data[entries[begin]] : 0;
+        for (int e = begin + 1; e < end; ++e) {
+          bestValue = std::max(bestValue, data[entries[e]]);
+        }
+        pooled[x] = bestValue;
+      } else {
+        T accum = 0;
+        T poolSize = 0;
+        for (int e = begin; e < end; ++e) {
+          accum += entries[2*e + 1] * data[entries[2*e]];
+          poolSize += entries[2*e + 1];
         }
+        pooled[x] = accum / poolSize;
       }
+    }
+    data += dataSize;
+    pooled += pooledSize;
+  }
+}
 
-      if (poolSize) {
-        #pragma unroll
-        for (int u = 0; u < windowSize; ++u) {
-          int index = indices[x * windowSize + u];
-          if (index != -1) {
-            dzdx[index] += dzdy[x] / poolSize;
+template<typename T>
+void pooling_dedup_cpu_fast(T* pooled,
+                            T const* data,
+                            int const* encodedIndices,
+                            PoolMethod method,
+                            size_t dataSize,
+                            size_t depth)
+{
+  size_t pooledSize = dedup_num_windows(encodedIndices) ;
+  size_t work = depth * (pooledSize + dedup_num_entries(encodedIndices)) ;
+  int numWorkers = vl_get_num_threads_for(depth, work) ;
+
+#pragma omp parallel for num_threads(numWorkers) if(numWorkers > 1)
+  for (int t = 0 ; t < numWorkers ; ++t) {
+    size_t begin = slice_begin(depth, t, numWorkers) ;
+    size_t end = slice_begin(depth, t + 1, numWorkers) ;
+    pooling_dedup_slices_cpu_fast<T>(pooled + begin * pooledSize,
+                                     data + begin * dataSize,
+                                     encodedIndices, method,
+                                     dataSize, end - begin) ;
+  }
+}
+
+template
+void pooling_dedup_cpu_fast<float>(float* pooled,
+                                   float const* data,
+                                   int const* encodedIndices,
+                                   PoolMethod method,
+                                   size_t dataSize,
+                                   size_t depth);
+
+template<typename T>
+static void
+pooling_backward_dedup_slices_cpu_fast(T* dzdx,
+                                       T const* data,
+                                       T const* dzdy,
+                                       int const* encodedIndices,
+                                       PoolMethod method,
+                                       size_t dataSize,
+                                       size_t depth)
+{
+  int pooledSize = dedup_num_windows(encodedIndices);
+  int const* offsets = dedup_offsets(encodedIndices);
+  int const* entries = dedup_entries(encodedIndices);
+
+  for (int z = 0; z < depth; ++z) {
+    for (int x = 0; x < pooledSize; ++x) {
+      int begin = offsets[x];
+      int end = offsets[x + 1];
+      if (begin == end) { continue; }
+      if (method == NN_POOL_MAX) {
+        int bestIndex = entries[begin];
+        T bestValue = data[bestIndex];
+        for (int e = begin + 1; e < end; ++e) {
+          int index = entries[e];
+          if (data[index] > bestValue) {
+            bestIndex = index;
+            bestValue = data[index];
           }
         }
+        dzdx[bestIndex] += dzdy[x];
+      } else {
+        T poolSize = 0;
+        for (int e = begin; e < end; ++e) {
+          poolSize += entries[2*e + 1];
+        }
+        T value = dzdy[x] / poolSize;
+        for (int e = begin; e < end; ++e) {
+          dzdx[entries[2*e]] += entries[2*e + 1] * value;
+        }
       }
     }
     data += dataSize;
@@ -537,119 +975,600 @@ void avg_pooling_backward_cpu_fast_internal(T* __restrict__ dzdx,
 }
 
 template<typename T>
-void avg_pooling_backward_cpu_fast_internal_2(T* __restrict__ dzdx,
-                                              T const* __restrict__ data,
-                                              T const* __restrict__ dzdy,
-                                              int const* __restrict__ indices,
-                                              size_t dataSize,
-                                              size_t depth,
-                                              size_t windowSize,
-                                              size_t pooledSize)
+void pooling_backward_dedup_cpu_fast(T* dzdx,
+                                     T const* data,
+                                     T const* dzdy,
+                                     int const* encodedIndices,
+                                     PoolMethod method,
+                                     size_t dataSize,
+                                     size_t depth)
+{
+  size_t pooledSize = dedup_num_windows(encodedIndices) ;
+  size_t work = depth * (pooledSize + dedup_num_entries(encodedIndices)) ;
+  int numWorkers = vl_get_num_threads_for(depth, work) ;
+
+#pragma omp parallel for num_threads(numWorkers) if(numWorkers > 1)
+  for (int t = 0 ; t < numWorkers ; ++t) {
+    size_t begin = slice_begin(depth, t, numWorkers) ;
+    size_t end = slice_begin(depth, t + 1, numWorkers) ;
+    pooling_backward_dedup_slices_cpu_fast<T>(dzdx + begin * dataSize,
+                                              data + begin * dataSize,
+                                              dzdy + begin * pooledSize,
+                                              encodedIndices, method,
+                                              dataSize, end - begin) ;
+  }
+}
+
+template
+void pooling_backward_dedup_cpu_fast<float>(float* dzdx,
+                                            float const* data,
+                                            float const* dzdy,
+                                            int const* encodedIndices,
+                                            PoolMethod method,
+                                            size_t dataSize,
+                                            size_t depth);
+
+/* ---------------------------------------------------------------- */
+/*                                 Max pooling with switches (CPU) */
+/* ---------------------------------------------------------------- */
+
+/*
+ The forward pass also stores for every output the offset of its
+ maximum in the input slice (one channel of one image), chosen as the
+ backward passes above choose it (the first strictly largest value),
+ so that the backward pass scatters the derivatives without reading
+ the data.
+ */
+
+template<typename T>
+static void
+max_pooling_switches_slices_cpu(T* pooled,
+                                int* switches,
+                                T const* data,
+                                size_t width,
+                                size_t height,
+                                size_t depth,
+                                size_t windowWidth,
+                                size_t windowHeight,
+                                size_t strideX,
+                                size_t strideY,
+                                size_t padLeft,
+                                size_t padRight,
+                                size_t padTop,
+                                size_t padBottom)
 {
+  int pooledWidth = (width + (padLeft + padRight) - windowWidth)/strideX + 1 ;
+  int pooledHeight = (height + (padTop + padBottom) - windowHeight)/strideY + 1 ;
+
   for (int z = 0; z < depth; ++z) {
-    for (int x = 0; x < pooledSize; ++x) {
-      T poolSize = 0;
-      #pragma unroll
-      for (int u = 0; u < windowSize; ++u) {
-        int index = indices[x * windowSize + u];
-        if (index != -1) {
-          ++poolSize;
+    for (int py = 0; py < pooledHeight; ++py) {
+      for (int px = 0; px < pooledWidth; ++px) {
+        int x1 = px * (int)strideX - (int)padLeft ;
+        int y1 = py * (int)strideY - (int)padTop ;
+        int x2 = std::min(x1 + windowWidth, width) ;
+        int y2 = std::min(y1 + windowHeight, height) ;
+        x1 = std::max(x1, 0) ;
+        y1 = std::max(y1, 0) ;
+        int bestIndex = y1 * width + x1 ;
+        T bestValue = data[bestIndex] ;
+        for (int y = y1 ; y < y2 ; ++y) {
+          for (int x = x1 ; x < x2 ; ++x) {
+            int index = y * width + x ;
+            T value = data[index] ;
+            if (value > bestValue) {
+              bestValue = value ;
+              bestIndex = index ;
+            }
+          }
         }
+        pooled[py * pooledWidth + px] = bestValue ;
+        switches[py * pooledWidth + px] = bestIndex ;
       }
+    }
+    data += width*height ;
+    pooled += pooledWidth*pooledHeight ;
+    switches += pooledWidth*pooledHeight ;
+  }
+}
 
-      if (poolSize) {
-        #pragma unroll
-        for (int u = 0; u < windowSize; ++u) {
-          int index = indices[x * windowSize + u];
-          if (index != -1) {
-            dzdx[index] += dzdy[x] / poolSize;
-          }
+template<typename T>
+void max_pooling_switches_cpu(T* pooled,
+                              int* switches,
+                              T const* data,
+                              size_t width,
+                              size_t height,
+                              size_t depth,
+                              size_t windowWidth,
+                              size_t windowHeight,
+                              size_t strideX,
+                              size_t strideY,
+                              size_t padLeft,
+                              size_t padRight,
+                              size_t padTop,
+                              size_t padBottom)
+{
+  size_t pooledWidth = (width + (padLeft + padRight) - windowWidth)/strideX + 1 ;
+  size_t pooledHeight = (height + (padTop + padBottom) - windowHeight)/strideY + 1 ;
+  size_t sliceSize = width*height ;
+  size_t pooledSliceSize = pooledWidth*pooledHeight ;
+  int numWorkers = vl_get_num_threads_for(depth, depth * pooledSliceSize * windowWidth * windowHeight) ;
+
+#pragma omp parallel for num_threads(numWorkers) if(numWorkers > 1)
+  for (int t = 0 ; t < numWorkers ; ++t) {
+    size_t begin = slice_begin(depth, t, numWorkers) ;
+    size_t end = slice_begin(depth, t + 1, numWorkers) ;
+    max_pooling_switches_slices_cpu<T>(pooled + begin * pooledSliceSize,
+                                       switches + begin * pooledSliceSize,
+                                       data + begin * sliceSize,
+                                       width, height, end - begin,
+                                       windowWidth, windowHeight,
+                                       strideX, strideY,
+                                       padLeft, padRight, padTop, padBottom) ;
+  }
+}
+
+template
+void max_pooling_switches_cpu<float>(float* pooled,
+                                     int* switches,
+                                     float const* data,
+                                     size_t width,
+                                     size_t height,
+                                     size_t depth,
+                                     size_t windowWidth,
+                                     size_t windowHeight,
+                                     size_t strideX,
+                                     size_t strideY,
+                                     size_t padLeft,
+                                     size_t padRight,
+                                     size_t padTop,
+                                     size_t padBottom) ;
+
+template<typename T>
+static void
+max_pooling_switches_slices_cpu_fast(T* pooled,
+                                     int* switches,
+                                     T const* data,
+                                     int const* indices,
+                                     size_t dataSize,
+                                     size_t depth,
+                                     size_t windowSize,
+                                     size_t pooledSize)
+{
+  for (int z = 0; z < depth; ++z) {
+    for (int x = 0; x < pooledSize; ++x) {
+      int const* window = indices + x * windowSize;
+      int bestIndex = window[0];
+      T bestValue = data[bestIndex];
+      for (int u = 1; u < windowSize; ++u) {
+        T value = data[window[u]];
+        if (value > bestValue) {
+          bestIndex = window[u];
+          bestValue = value;
         }
       }
+      pooled[x] = bestValue;
+      switches[x] = bestIndex;
     }
     data += dataSize;
-    dzdx += dataSize;
-    dzdy += pooledSize;
+    pooled += pooledSize;
+    switches += pooledSize;
   }
 }
 
 template<typename T>
-void pooling_backward_cpu_fast(T* dzdx,
+void max_pooling_switches_cpu_fast(T* pooled,
+                                   int* switches,
                                    T const* data,
-                                   T const* dzdy,
                                    int const* indices,
-                                   PoolMethod method,
                                    size_t dataSize,
                                    size_t depth,
                                    size_t windowSize,
                                    size_t pooledSize)
 {
-#define MAX_POOL_BACK_CPU(_windowSize) case _windowSize: \
-  max_pooling_backward_cpu_fast_internal<T, _windowSize>\
-    (dzdx, data, dzdy, indices, dataSize, depth, pooledSize); break
-#define AVG_POOL_BACK_CPU(_windowSize) case _windowSize: \
-  avg_pooling_backward_cpu_fast_internal<T, _windowSize>\
-    (dzdx, data, dzdy, indices, dataSize, depth, pooledSize); break
+  int numWorkers = vl_get_num_threads_for(depth, depth * pooledSize * windowSize) ;
 
-  switch (method) {
-    case NN_POOL_MAX:
-      switch (windowSize) {
-        MAX_POOL_BACK_CPU(1);
-        MAX_POOL_BACK_CPU(4);
-        MAX_POOL_BACK_CPU(9);
-        MAX_POOL_BACK_CPU(16);
-        MAX_POOL_BACK_CPU(25);
-        MAX_POOL_BACK_CPU(36);
-        MAX_POOL_BACK_CPU(49);
-        default:
-          max_pooling_backward_cpu_fast_internal_2<T>
-            (dzdx, data, dzdy, indices, dataSize, depth, windowSize, pooledSize);
-          break;
+#pragma omp parallel for num_threads(numWorkers) if(numWorkers > 1)
+  for (int t = 0 ; t < numWorkers ; ++t) {
+    size_t begin = slice_begin(depth, t, numWorkers) ;
+    size_t end = slice_begin(depth, t + 1, numWorkers) ;
+    max_pooling_switches_slices_cpu_fast<T>(pooled + begin * pooledSize,
+                                            switches + begin * pooledSize,
+                                            data + begin * dataSize,
+                                            indices, dataSize, end - begin,
+                                            windowSize, pooledSize) ;
+  }
+}
+
+template
+void max_pooling_switches_cpu_fast<float>(float* pooled,
+                                          int* switches,
+                                          float const* data,
+                                          int const* indices,
+                                          size_t dataSize,
+                                          size_t depth,
+                                          size_t windowSize,
+                                          size_t pooledSize);
+
+template<typename T>
+static void
+max_pooling_switches_runs_slices_cpu_fast(T* pooled,
+                                          int* switches,
+                                          T const* data,
+                                          int const* encodedIndices,
+                                          size_t dataSize,
+                                          size_t depth)
+{
+  int pooledSize = rle_num_lists(encodedIndices);
+  int const* lists = rle_lists(encodedIndices);
+  int const* runs = rle_runs(encodedIndices);
+
+  for (int z = 0; z < depth; ++z) {
+    for (int x = 0; x < pooledSize; ++x) {
+      int const* curRuns = runs + 2 * (ptrdiff_t)lists[2*x];
+      int numRuns = lists[2*x + 1];
+      int bestIndex = curRuns[0];
+      T bestValue = data[bestIndex];
+      for (int r = 0; r < numRuns; ++r) {
+        for (int i = 0; i < curRuns[2*r + 1]; ++i) {
+          int index = curRuns[2*r] + i;
+          if (data[index] > bestValue) {
+            bestIndex = index;
+            bestValue = data[index];
+          }
+        }
       }
-      break;
-    case NN_POOL_AVG:
-      switch (windowSize) {
-        AVG_POOL_BACK_CPU(1);
-        AVG_POOL_BACK_CPU(4);
-        AVG_POOL_BACK_CPU(9);
-        AVG_POOL_BACK_CPU(16);
-        AVG_POOL_BACK_CPU(25);
-        AVG_POOL_BACK_CPU(36);
-        AVG_POOL_BACK_CPU(49);
-        default:
-          avg_pooling_backward_cpu_fast_internal_2<T>
-            (dzdx, data, dzdy, indices, dataSize, depth, windowSize, pooledSize);
-          break;
+      pooled[x] = bestValue;
+      switches[x] = bestIndex;
+    }
+    data += dataSize;
+    pooled += pooledSize;
+    switches += pooledSize;
+  }
+}
+
+template<typename T>
+void max_pooling_switches_runs_cpu_fast(T* pooled,
+                                        int* switches,
+                                        T const* data,
+                                        int const* encodedIndices,
+                                        size_t dataSize,
+                                        size_t depth)
+{
+  size_t pooledSize = rle_num_lists(encodedIndices) ;
+  int numWorkers = vl_get_num_threads_for(depth, depth * pooledSize * rle_list_length(encodedIndices)) ;
+
+#pragma omp parallel for num_threads(numWorkers) if(numWorkers > 1)
+  for (int t = 0 ; t < numWorkers ; ++t) {
+    size_t begin = slice_begin(depth, t, numWorkers) ;
+    size_t end = slice_begin(depth, t + 1, numWorkers) ;
+    max_pooling_switches_runs_slices_cpu_fast<T>(pooled + begin * pooledSize,
+                                                 switches + begin * pooledSize,
+                                                 data + begin * dataSize,
+                                                 encodedIndices,
+                                                 dataSize, end - begin) ;
+  }
+}
+
+template
+void max_pooling_switches_runs_cpu_fast<float>(float* pooled,
+                                               int* switches,
+                                               float const* data,
+                                               int const* encodedIndices,
+                                               size_t dataSize,
+                                               size_t depth);
+
+template<typename T>
+static void
+max_pooling_switches_dedup_slices_cpu_fast(T* pooled,
+                                           int* switches,
+                                           T const* data,
+                                           int const* encodedIndices,
+                                           size_t dataSize,
+                                           size_t depth)
+{
+  int pooledSize = dedup_num_windows(encodedIndices);
+  int const* offsets = dedup_offsets(encodedIndices);
+  int const* entries = dedup_entries(encodedIndices);
+
+  for (int z = 0; z < depth; ++z) {
+    for (int x = 0; x < pooledSize; ++x) {
+      int begin = offsets[x];
+      int end = offsets[x + 1];
+      /* an empty window has no maximum: its derivative is dropped */
+      int bestIndex = (begin < end) ? entries[begin] : -1;
+      T bestValue = (begin < end) ? data[bestIndex] : 0;
+      for (int e = begin + 1; e < end; ++e) {
+        int index = entries[e];
+        if (data[index] > bestValue) {
+          bestIndex = index;
+          bestValue = data[index];
+        }
       }
-      break;
-    default:
-      assert(false);
+      pooled[x] = bestValue;
+      switches[x] = bestIndex;
+    }
+    data += dataSize;
+    pooled += pooledSize;
+    switches += pooledSize;
+  }
+}
+
+template<typename T>
+void max_pooling_switches_dedup_cpu_fast(T* pooled,
+                                         int* switches,
+                                         T const* data,
+                                         int const* encodedIndices,
+                                         size_t dataSize,
+                                         size_t depth)
+{
+  size_t pooledSize = dedup_num_windows(encodedIndices) ;
+  size_t work = depth * (pooledSize + dedup_num_entries(encodedIndices)) ;
+  int numWorkers = vl_get_num_threads_for(depth, work) ;
+
+#pragma omp parallel for num_threads(numWorkers) if(numWorkers > 1)
+  for (int t = 0 ; t < numWorkers ; ++t) {
+    size_t begin = slice_begin(depth, t, numWorkers) ;
+    size_t end = slice_begin(depth, t + 1, numWorkers) ;
+    max_pooling_switches_dedup_slices_cpu_fast<T>(pooled + begin * pooledSize,
+                                                  switches + begin * pooledSize,
+                                                  data + begin * dataSize,
+                                                  encodedIndices,
+                                                  dataSize, end - begin) ;
   }
-#undef MAX_POOL_BACK_CPU
-#undef AVG_POOL_BACK_CPU
 }
 
 template
-void pooling_backward_cpu_fast<float>(float* dzdx,
-                                      float const* data,
-                                      float const* dzdy,
-                                      int const* indices,
-                                      PoolMethod method,
-                                      size_t dataSize,
-                                      size_t depth,
-                                      size_t windowSize,
-                                      size_t pooledSize);
+void max_pooling_switches_dedup_cpu_fast<float>(float* pooled,
+                                                int* switches,
+                                                float const* data,
+                                                int const* encodedIndices,
+                                                size_t dataSize,
+                                                size_t depth);
+
+template<typename T>
+static void
+max_pooling_backward_switches_slices_cpu(T* dzdx,
+                                         T const* dzdy,
+                                         int const* switches,
+                                         size_t dataSize,
+                                         size_t depth,
+                                         size_t pooledSize)
+{
+  for (int z = 0; z < depth; ++z) {
+    for (int x = 0; x < pooledSize; ++x) {
+      if (switches[x] >= 0) {
+        dzdx[switches[x]] += dzdy[x];
+      }
+    }
+    dzdx += dataSize;
+    dzdy += pooledSize;
+    switches += pooledSize;
+  }
+}
+
+template<typename T>
+void max_pooling_backward_switches_cpu(T* dzdx,
+                                       T const* dzdy,
+                                       int const* switches,
+                                       size_t dataSize,
+                                       size_t depth,
+                                       size_t pooledSize)
+{
+  int numWorkers = vl_get_num_threads_for(depth, depth * pooledSize) ;
+
+#pragma omp parallel for num_threads(numWorkers) if(numWorkers > 1)
+  for (int t = 0 ; t < numWorkers ; ++t) {
+    size_t begin = slice_begin(depth, t, numWorkers) ;
+    size_t end = slice_begin(depth, t + 1, numWorkers) ;
+    max_pooling_backward_switches_slices_cpu<T>(dzdx + begin * dataSize,
+                                                dzdy + begin * pooledSize,
+                                                switches + begin * pooledSize,
+                                                dataSize, end - begin, pooledSize) ;
+  }
+}
 
 template
-void pooling_backward_cpu_fast<double>(double* dzdx,
-                                       double const* data,
-                                       double const* dzdy,
+void max_pooling_backward_switches_cpu<float>(float* dzdx,
+                                              float const* dzdy,
+                                              int const* switches,
+                                              size_t dataSize,
+                                              size_t depth,
+                                              size_t pooledSize);
+
+/* ---------------------------------------------------------------- */
+/*                           Fast pooling, channel-last data (CPU) */
+/* ---------------------------------------------------------------- */
+
+/*
+ The data is DEPTH x dataSize x SIZE in memory, hence every index of
+ a pooling window addresses a contiguous vector of channels and the
+ inner loops run over the channels.
+ */
+
+template<typename T>
+static void
+pooling_hwc_channels_cpu_fast(T* pooled,
+                              T const* data,
+                              int const* indices,
+                              PoolMethod method,
+                              size_t dataSize,
+                              size_t depth,
+                              size_t zBegin,
+                              size_t zEnd,
+                              size_t size,
+                              size_t windowSize,
+                              size_t pooledSize)
+{
+  for (int s = 0; s < size; ++s) {
+    for (int x = 0; x < pooledSize; ++x) {
+      int const* window = indices + x * windowSize;
+      T* __restrict__ out = pooled + x * depth;
+      if (method == NN_POOL_MAX) {
+        /* the max pooling indices have no padding */
+        T const* first = data + (ptrdiff_t)window[0] * depth;
+        for (int z = zBegin; z < zEnd; ++z) {
+          out[z] = first[z];
+        }
+        for (int u = 1; u < windowSize; ++u) {
+          T const* __restrict__ in = data + (ptrdiff_t)window[u] * depth;
+          for (int z = zBegin; z < zEnd; ++z) {
+            out[z] = std::max(out[z], in[z]);
+          }
+        }
+      } else {
+        T poolSize = 0;
+        for (int z = zBegin; z < zEnd; ++z) {
+          out[z] = 0;
+        }
+        for (int u = 0; u < windowSize; ++u) {
+          if (window[u] == -1) { continue; }
+          T const* __restrict__ in = data + (ptrdiff_t)window[u] * depth;
+          for (int z = zBegin; z < zEnd; ++z) {
+            out[z] += in[z];
+          }
+          ++poolSize;
+        }
+        for (int z = zBegin; z < zEnd; ++z) {
+          out[z] /= poolSize;
+        }
+      }
+    }
+    data += dataSize * depth;
+    pooled += pooledSize * depth;
+  }
+}
+
+template<typename T>
+void pooling_hwc_cpu_fast(T* pooled,
+                          T const* data,
+                          int const* indices,
+                          PoolMethod method,
+                          size_t dataSize,
+                          size_t depth,
+                          size_t size,
+                          size_t windowSize,
+                          size_t pooledSize)
+{
+  /* the channels of a pixel are contiguous, so the threads split them */
+  int numWorkers = vl_get_num_threads_for(depth, depth * size * pooledSize * windowSize);
+
+#pragma omp parallel for num_threads(numWorkers) if(numWorkers > 1)
+  for (int t = 0; t < numWorkers; ++t) {
+    pooling_hwc_channels_cpu_fast<T>(pooled, data, indices, method, dataSize, depth,
+                                     slice_begin(depth, t, numWorkers),
+                                     slice_begin(depth, t + 1, numWorkers),
+                                     size, windowSize, pooledSize);
+  }
+}
+
+template
+void pooling_hwc_cpu_fast<float>(float* pooled,
+                                 float const* data,
+                                 int const* indices,
+                                 PoolMethod method,
+                                 size_t dataSize,
+                                 size_t depth,
+                                 size_t size,
+                                 size_t windowSize,
+                                 size_t pooledSize);
+
+template<typename T>
+static void
+pooling_backward_hwc_channels_cpu_fast(T* dzdx,
+                                       T const* data,
+                                       T const* dzdy,
                                        int const* indices,
                                        PoolMethod method,
                                        size_t dataSize,
                                        size_t depth,
+                                       size_t zBegin,
+                                       size_t zEnd,
+                                       size_t size,
                                        size_t windowSize,
-                                       size_t pooledSize);
+                                       size_t pooledSize)
+{
+  /* argmax of the current window, one per channel */
+  std::vector<int> bestIndex(depth);
+  std::vector<T> bestValue(depth);
+
+  for (int s = 0; s < size; ++s) {
+    for (int x = 0; x < pooledSize; ++x) {
+      int const* window = indices + x * windowSize;
+      T const* der = dzdy + x * depth;
+      if (method == NN_POOL_MAX) {
+        /* the first maximum wins, as in pooling_backward_cpu_fast */
+        for (int z = zBegin; z < zEnd; ++z) {
+          bestIndex[z] = window[0];
+          bestValue[z] = data[(ptrdiff_t)window[0] * depth + z];
+        }
+        for (int u = 1; u < windowSize; ++u) {
+          T const* in = data + (ptrdiff_t)window[u] * depth;
+          for (int z = zBegin; z < zEnd; ++z) {
+            if (in[z] > bestValue[z]) {
+              bestIndex[z] = window[u];
+              bestValue[z] = in[z];
+            }
+          }
+        }
+        for (int z = zBegin; z < zEnd; ++z) {
+          dzdx[(ptrdiff_t)bestIndex[z] * depth + z] += der[z];
+        }
+      } else {
+        T poolSize = 0;
+        for (int u = 0; u < windowSize; ++u) {
+          if (window[u] != -1) { ++poolSize; }
+        }
+        if (poolSize) {
+          for (int u = 0; u < windowSize; ++u) {
+            if (window[u] == -1) { continue; }
+            T* __restrict__ out = dzdx + (ptrdiff_t)window[u] * depth;
+            for (int z = zBegin; z < zEnd; ++z) {
+              out[z] += der[z] / poolSize;
+            }
+          }
+        }
+      }
+    }
+    data += dataSize * depth;
+    dzdx += dataSize * depth;
+    dzdy += pooledSize * depth;
+  }
+}
+
+template<typename T>
+void pooling_backward_hwc_cpu_fast(T* dzdx,
+                                   T const* data,
+                                   T const* dzdy,
+                                   int const* indices,
+                                   PoolMethod method,
+                                   size_t dataSize,
+                                   size_t depth,
+                                   size_t size,
+                                   size_t windowSize,
+                                   size_t pooledSize)
+{
+  int numWorkers = vl_get_num_threads_for(depth, depth * size * pooledSize * windowSize);
+
+#pragma omp parallel for num_threads(numWorkers) if(numWorkers > 1)
+  for (int t = 0; t < numWorkers; ++t) {
+    pooling_backward_hwc_channels_cpu_fast<T>(dzdx, data, dzdy, indices, method, dataSize, depth,
+                                              slice_begin(depth, t, numWorkers),
+                                              slice_begin(depth, t + 1, numWorkers),
+                                              size, windowSize, pooledSize);
+  }
+}
+
+template
+void pooling_backward_hwc_cpu_fast<float>(float* dzdx,
+                                          float const* data,
+                                          float const* dzdy,
+                                          int const* indices,
+                                          PoolMethod method,
+                                          size_t dataSize,
+                                          size_t depth,
+                                          size_t size,
+                                          size_t windowSize,
+                                          size_t pooledSize);
 
 void max_pooling_indices_cpu(int* indices,
                              int const* inindices,
@@ -75,6 +75,124 @@ void pooling_backward_cpu_fast(T* dzdx,
                                size_t windowSize,
                                size_t pooledSize) ;
 
+/* the same, with run-length encoded indices (see runlength.hpp) */
+template<typename T>
+void pooling_runs_cpu_fast(T* pooled,
+                           T const* data,
+                           int const* encodedIndices,
+                           PoolMethod method,
+                           size_t dataSize,
+                           size_t depth) ;
+
+template<typename T>
+void pooling_backward_runs_cpu_fast(T* dzdx,
+                                    T const* data,
+                                    T const* dzdy,
+                                    int const* encodedIndices,
+                                    PoolMethod method,
+                                    size_t dataSize,
+                                    size_t depth) ;
+
+/* the same, with deduplicated windows (see dedup.hpp) */
+template<typename T>
+void pooling_dedup_cpu_fast(T* pooled,
+                            T const* data,
+                            int const* encodedIndices,
+                            PoolMethod method,
+                            size_t dataSize,
+                            size_t depth) ;
+
+template<typename T>
+void pooling_backward_dedup_cpu_fast(T* dzdx,
+                                     T const* data,
+                                     T const* dzdy,
+                                     int const* encodedIndices,
+                                     PoolMethod method,
+                                     size_t dataSize,
+                                     size_t depth) ;
+
+/*
+ max pooling that also returns the SWITCHES, the offsets of the
+ maxima in their input slices (of dataSize = width * height
+ elements), and the backward pass that only scatters DZDY to them
+ */
+template<typename T>
+void max_pooling_switches_cpu(T* pooled,
+                              int* switches,
+                              T const* data,
+                              size_t width,
+                              size_t height,
+                              size_t depth,
+                              size_t windowWidth,
+                              size_t windowHeight,
+                              size_t strideX,
+                              size_t strideY,
+                              size_t padLeft,
+                              size_t padRight,
+                              size_t padTop,
+                              size_t padBottom) ;
+
+template<typename T>
+void max_pooling_switches_cpu_fast(T* pooled,
+                                   int* switches,
+                                   T const* data,
+                                   int const* indices,
+                                   size_t dataSize,
+                                   size_t depth,
+                                   size_t windowSize,
+                                   size_t pooledSize) ;
+
+template<typename T>
+void max_pooling_switches_runs_cpu_fast(T* pooled,
+                                        int* switches,
+                                        T const* data,
+                                        int const* encodedIndices,
+                                        size_t dataSize,
+                                        size_t depth) ;
+
+template<typename T>
+void max_pooling_switches_dedup_cpu_fast(T* pooled,
+                                         int* switches,
+                                         T const* data,
+                                         int const* encodedIndices,
+                                         size_t dataSize,
+                                         size_t depth) ;
+
+template<typename T>
+void max_pooling_backward_switches_cpu(T* dzdx,
+                                       T const* dzdy,
+                                       int const* switches,
+                                       size_t dataSize,
+                                       size_t depth,
+                                       size_t pooledSize) ;
+
+/*
+ the same, for channel-last data (DEPTH x dataSize x SIZE in memory);
+ the channels and the images are no longer interchangeable
+ */
+template<typename T>
+void pooling_hwc_cpu_fast(T* pooled,
+                          T const* data,
+                          int const* indices,
+                          PoolMethod method,
+                          size_t dataSize,
+                          size_t depth,
+                          size_t size,
+                          size_t windowSize,
+                          size_t pooledSize) ;
+
+template<typename T>
+void pooling_backward_hwc_cpu_fast(T* dzdx,
+                                   T const* data,
+                                   T const* dzdy,
+                                   int const* indices,
+                                   PoolMethod method,
+                                   size_t dataSize,
+                                   size_t depth,
+                                   size_t size,
+                                   size_t windowSize,
+                                   size_t pooledSize) ;
+
 void max_pooling_indices_cpu(int* indices,
                              int const* inindices,
                              size_t width,
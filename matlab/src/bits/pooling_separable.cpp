@@ -0,0 +1,268 @@
+/** @file pooling_separable.cpp
+ ** @brief Separable max and average pooling (CPU)
+ ** @author Michael Figurnov
+ **/
+
+/*
+ Copyright (C) 2015 Michael Figurnov.
+ All rights reserved.
+
+ This file is part of the VLFeat library and is made available under
+ the terms of the BSD license (see the COPYING file).
+ */
+
+#include "pooling_separable.hpp"
+
+#include <algorithm>
+#include <limits>
+#include <vector>
+
+#ifndef _MSC_VER
+#pragma GCC optimize ("tree-vectorize")
+#endif
+
+namespace {
+  enum {
+    /* smallest unit-stride window for which the van Herk/Gil-Werman
+       max and the prefix sums beat the direct reduction of the buffer */
+    MIN_RUNNING_WINDOW = 5,
+    /* assumed speed-up of the vectorized reduction of the rows */
+    ROW_SPEEDUP = 4
+  } ;
+}
+
+bool
+pooling_separable_is_faster(size_t width,
+                            size_t pooledWidth,
+                            size_t windowWidth,
+                            size_t windowHeight,
+                            size_t strideX)
+{
+  /* operations per output row */
+  size_t perWindow = (strideX == 1 && windowWidth >= MIN_RUNNING_WINDOW) ? 3 : windowWidth ;
+  size_t direct = pooledWidth * windowWidth * windowHeight ;
+  size_t separable = width * windowHeight / ROW_SPEEDUP + pooledWidth * perWindow ;
+  return separable < direct ;
+}
+
+/* ---------------------------------------------------------------- */
+/*                                                  Rows (vertical) */
+/* ---------------------------------------------------------------- */
+
+/* buffer[x] = max or sum of rows[v * width + x], v = 0, ..., numRows - 1 */
+
+template<typename T>
+static void
+max_rows(T* buffer, T const* rows, int width, int numRows)
+{
+  std::copy(rows, rows + width, buffer) ;
+  for (int v = 1 ; v < numRows ; ++v) {
+    T const* row = rows + (ptrdiff_t)v * width ;
+    for (int x = 0 ; x < width ; ++x) {
+      buffer[x] = std::max(buffer[x], row[x]) ;
+    }
+  }
+}
+
+template<typename T>
+static void
+sum_rows(T* buffer, T const* rows, int width, int numRows)
+{
+  std::copy(rows, rows + width, buffer) ;
+  for (int v = 1 ; v < numRows ; ++v) {
+    T const* row = rows + (ptrdiff_t)v * width ;
+    for (int x = 0 ; x < width ; ++x) {
+      buffer[x] += row[x] ;
+    }
+  }
+}
+
+/* ---------------------------------------------------------------- */
+/*                                             Windows (horizontal) */
+/* ---------------------------------------------------------------- */
+
+/*
+ The windows of the buffer are [x1, x2) with x1 = px * strideX -
+ padLeft, clipped to [0, width). Only the average needs the clipped
+ size, the padding never wins the max.
+ */
+
+template<typename T>
+static void
+max_windows(T* pooled, T const* buffer,
+            int width, int pooledWidth, int windowWidth, int strideX, int padLeft)
+{
+  for (int px = 0 ; px < pooledWidth ; ++px) {
+    int x1 = px * strideX - padLeft ;
+    int x2 = std::min(x1 + windowWidth, width) ;
+    x1 = std::max(x1, 0) ;
+    T bestValue = buffer[x1] ;
+    for (int x = x1 + 1 ; x < x2 ; ++x) {
+      bestValue = std::max(bestValue, buffer[x]) ;
+    }
+    pooled[px] = bestValue ;
+  }
+}
+
+/*
+ van Herk/Gil-Werman, for unit stride: the padded buffer is cut into
+ blocks of windowWidth values, g is the running max from the start of
+ each block and h the running max to its end. Every window spans at
+ most two blocks, so its max is max(h[start], g[end]).
+ */
+
+template<typename T>
+static void
+max_windows_running(T* pooled, T const* buffer, T* g, T* h,
+                    int width, int pooledWidth, int windowWidth, int padLeft)
+{
+  int length = pooledWidth + windowWidth - 1 ;
+  T const lowest = -std::numeric_limits<T>::infinity() ;
+  for (int i = 0 ; i < length ; ++i) {
+    int x = i - padLeft ;
+    g[i] = (x >= 0 && x < width) ? buffer[x] : lowest ;
+    h[i] = g[i] ;
+  }
+  for (int begin = 0 ; begin < length ; begin += windowWidth) {
+    int end = std::min(begin + windowWidth, length) ;
+    for (int i = begin + 1 ; i < end ; ++i) {
+      g[i] = std::max(g[i - 1], g[i]) ;
+    }
+    for (int i = end - 2 ; i >= begin ; --i) {
+      h[i] = std::max(h[i + 1], h[i]) ;
+    }
+  }
+  for (int px = 0 ; px < pooledWidth ; ++px) {
+    pooled[px] = std::max(h[px], g[px + windowWidth - 1]) ;
+  }
+}
+
+template<typename T>
+static void
+avg_windows(T* pooled, T const* buffer, int numRows,
+            int width, int pooledWidth, int windowWidth, int strideX, int padLeft)
+{
+  for (int px = 0 ; px < pooledWidth ; ++px) {
+    int x1 = px * strideX - padLeft ;
+    int x2 = std::min(x1 + windowWidth, width) ;
+    x1 = std::max(x1, 0) ;
+    T accum = 0 ;
+    for (int x = x1 ; x < x2 ; ++x) {
+      accum += buffer[x] ;
+    }
+    pooled[px] = accum / (T)(numRows * (x2 - x1)) ;
+  }
+}
+
+/* prefix[x] is the sum of buffer[0], ..., buffer[x - 1] */
+
+template<typename T>
+static void
+avg_windows_running(T* pooled, T const* buffer, T* prefix, int numRows,
+                    int width, int pooledWidth, int windowWidth, int padLeft)
+{
+  prefix[0] = 0 ;
+  for (int x = 0 ; x < width ; ++x) {
+    prefix[x + 1] = prefix[x] + buffer[x] ;
+  }
+  for (int px = 0 ; px < pooledWidth ; ++px) {
+    int x1 = px - padLeft ;
+    int x2 = std::min(x1 + windowWidth, width) ;
+    x1 = std::max(x1, 0) ;
+    pooled[px] = (prefix[x2] - prefix[x1]) / (T)(numRows * (x2 - x1)) ;
+  }
+}
+
+/* ---------------------------------------------------------------- */
+/*                                                          Driver */
+/* ---------------------------------------------------------------- */
+
+template<typename T>
+void pooling_separable_cpu(T* pooled,
+                           T const* data,
+                           PoolMethod method,
+                           size_t width,
+                           size_t height,
+                           size_t depth,
+                           size_t windowWidth,
+                           size_t windowHeight,
+                           size_t strideX,
+                           size_t strideY,
+                           size_t padLeft,
+                           size_t padRight,
+                           size_t padTop,
+                           size_t padBottom)
+{
+  int pooledWidth = (width + (padLeft + padRight) - windowWidth)/strideX + 1 ;
+  int pooledHeight = (height + (padTop + padBottom) - windowHeight)/strideY + 1 ;
+  bool running = (strideX == 1 && windowWidth >= MIN_RUNNING_WINDOW) ;
+
+  /* the buffer, then g and h or the prefix sums */
+  std::vector<T> scratch(width + 2 * (pooledWidth + windowWidth)) ;
+  T* buffer = &scratch[0] ;
+  T* g = buffer + width ;
+  T* h = g + pooledWidth + windowWidth ;
+
+  for (int z = 0; z < depth; ++z) {
+    for (int py = 0; py < pooledHeight; ++py) {
+      int y1 = py * (int)strideY - (int)padTop ;
+      int y2 = std::min(y1 + windowHeight, height) ;
+      y1 = std::max(y1, 0) ;
+      T const* rows = data + (ptrdiff_t)y1 * width ;
+      T* pooledRow = pooled + (ptrdiff_t)py * pooledWidth ;
+      if (method == NN_POOL_MAX) {
+        max_rows(buffer, rows, width, y2 - y1) ;
+        if (running) {
+          max_windows_running(pooledRow, buffer, g, h,
+                              width, pooledWidth, windowWidth, padLeft) ;
+        } else {
+          max_windows(pooledRow, buffer,
+                      width, pooledWidth, windowWidth, strideX, padLeft) ;
+        }
+      } else {
+        sum_rows(buffer, rows, width, y2 - y1) ;
+        if (running) {
+          avg_windows_running(pooledRow, buffer, g, y2 - y1,
+                              width, pooledWidth, windowWidth, padLeft) ;
+        } else {
+          avg_windows(pooledRow, buffer, y2 - y1,
+                      width, pooledWidth, windowWidth, strideX, padLeft) ;
+        }
+      }
+    }
+    data += width*height ;
+    pooled += pooledWidth*pooledHeight ;
+  }
+}
+
+template
+void pooling_separable_cpu<float>(float* pooled,
+                                  float const* data,
+                                  PoolMethod method,
+                                  size_t width,
+                                  size_t height,
+                                  size_t depth,
+                                  size_t windowWidth,
+                                  size_t windowHeight,
+                                  size_t strideX,
+                                  size_t strideY,
+                                  size_t padLeft,
+                                  size_t padRight,
+                                  size_t padTop,
+                                  size_t padBottom) ;
+
+template
+void pooling_separable_cpu<double>(double* pooled,
+                                   double const* data,
+                                   PoolMethod method,
+                                   size_t width,
+                                   size_t height,
+                                   size_t depth,
+                                   size_t windowWidth,
+                                   size_t windowHeight,
+                                   size_t strideX,
+                                   size_t strideY,
+                                   size_t padLeft,
+                                   size_t padRight,
+                                   size_t padTop,
+                                   size_t padBottom) ;
@@ -0,0 +1,61 @@
+/** @file pooling_separable.hpp
+ ** @brief Separable max and average pooling (CPU)
+ ** @author Michael Figurnov
+ **/
+
+/*
+ Copyright (C) 2015 Michael Figurnov.
+ All rights reserved.
+
+ This file is part of the VLFeat library and is made available under
+ the terms of the BSD license (see the COPYING file).
+ */
+
+#ifndef VL_NNPOOLING_SEPARABLE_H
+#define VL_NNPOOLING_SEPARABLE_H
+
+#include "pooling.hpp"
+
+#include <cstddef>
+
+/*
+ The max and the sum over a rectangular window are separable: the
+ forward pass of pooling_cpu() can first reduce, for every output
+ row, the windowHeight input rows of its windows into one buffer of
+ width values (an element-wise operation on contiguous rows, which
+ the compiler vectorizes), then reduce the windowWidth values of
+ every window within this buffer. With unit strideX and a large
+ window, the second step takes a constant number of operations per
+ output, by the van Herk/Gil-Werman algorithm for the max and by
+ prefix sums for the average.
+
+ The arguments are those of pooling_cpu(). The result is the same,
+ up to the rounding of the sums of the average pooling.
+ pooling_separable_is_faster() compares the estimated costs of the
+ two methods; pooling_cpu() uses it to pick one.
+ */
+
+bool
+pooling_separable_is_faster(size_t width,
+                            size_t pooledWidth,
+                            size_t windowWidth,
+                            size_t windowHeight,
+                            size_t strideX) ;
+
+template<typename T>
+void pooling_separable_cpu(T* pooled,
+                           T const* data,
+                           PoolMethod method,
+                           size_t width,
+                           size_t height,
+                           size_t depth,
+                           size_t windowWidth,
+                           size_t windowHeight,
+                           size_t strideX,
+                           size_t strideY,
+                           size_t padLeft,
+                           size_t padRight,
+                           size_t padTop,
+                           size_t padBottom) ;
+
+#endif /* defined(VL_NNPOOLING_SEPARABLE_H) */
@@ -0,0 +1,88 @@
+/** @file runlength.cpp
+ ** @brief Run-length encoded index lists
+ ** @author Michael Figurnov
+ **/
+
+/*
+ Copyright (C) 2015 Michael Figurnov.
+ All rights reserved.
+
+ This file is part of the VLFeat library and is made available under
+ the terms of the BSD license (see the COPYING file).
+ */
+
+#include "runlength.hpp"
+
+/* a run continues if the next index is the next pixel, or more padding */
+static inline bool continues_run(int previous, int next)
+{
+  return (previous == -1) ? (next == -1) : (next == previous + 1) ;
+}
+
+int rle_count_runs(int const* indices,
+                   int numLists,
+                   int listLength)
+{
+  int numRuns = 0 ;
+  for (int l = 0 ; l < numLists ; ++l) {
+    int const* list = indices + (ptrdiff_t)l * listLength ;
+    for (int x = 0 ; x < listLength ; ++x) {
+      if (x == 0 || !continues_run(list[x - 1], list[x])) {
+        ++ numRuns ;
+      }
+    }
+  }
+  return numRuns ;
+}
+
+void rle_encode(int* encoded,
+                int const* indices,
+                int height,
+                int width,
+                int depth,
+                int listLength,
+                int numRuns)
+{
+  encoded[0] = VL_RLE_MAGIC ;
+  encoded[1] = listLength ;
+  encoded[2] = height ;
+  encoded[3] = width ;
+  encoded[4] = depth ;
+  encoded[5] = numRuns ;
+
+  int numLists = rle_num_lists(encoded) ;
+  int* lists = encoded + VL_RLE_HEADER_SIZE ;
+  int* runs = lists + 2 * (ptrdiff_t)numLists ;
+  int run = 0 ;
+  for (int l = 0 ; l < numLists ; ++l) {
+    int const* list = indices + (ptrdiff_t)l * listLength ;
+    lists[2*l] = run ;
+    for (int x = 0 ; x < listLength ; ++x) {
+      if (x == 0 || !continues_run(list[x - 1], list[x])) {
+        runs[2*run] = list[x] ;
+        runs[2*run + 1] = 0 ;
+        ++ run ;
+      }
+      ++ runs[2*(run - 1) + 1] ;
+    }
+    lists[2*l + 1] = run - lists[2*l] ;
+  }
+}
+
+void rle_decode(int* indices,
+                int const* encoded)
+{
+  int numLists = rle_num_lists(encoded) ;
+  int const* lists = rle_lists(encoded) ;
+  int const* runs = rle_runs(encoded) ;
+  for (int l = 0 ; l < numLists ; ++l) {
+    int const* listRuns = runs + 2 * (ptrdiff_t)lists[2*l] ;
+    for (int r = 0 ; r < lists[2*l + 1] ; ++r) {
+      int start = listRuns[2*r] ;
+      int length = listRuns[2*r + 1] ;
+      for (int i = 0 ; i < length ; ++i) {
+        *indices++ = (start == -1) ? -1 : start + i ;
+      }
+    }
+  }
+}
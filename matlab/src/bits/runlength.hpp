@@ -0,0 +1,80 @@
+/** @file runlength.hpp
+ ** @brief Run-length encoded index lists
+ ** @author Michael Figurnov
+ **/
+
+/*
+ Copyright (C) 2015 Michael Figurnov.
+ All rights reserved.
+
+ This file is part of the VLFeat library and is made available under
+ the terms of the BSD license (see the COPYING file).
+ */
+
+#ifndef VL_NNRUNLENGTH_H
+#define VL_NNRUNLENGTH_H
+
+#include <stddef.h>
+
+/*
+ CONVINDICES and (CPU) POOLINDICES are made of numLists contiguous
+ lists of listLength int32 indices each: one list per window offset
+ for the convolution, one list per output pixel for the pooling. Most
+ lists consist of a few spans of consecutive indices, so they are
+ stored compactly as
+
+   header  [VL_RLE_MAGIC, listLength, height, width, depth, numRuns]
+   lists   numLists pairs [firstRun, numListRuns]
+   runs    numRuns pairs [start, length]
+
+ where HEIGHT x WIDTH x DEPTH is the geometry of the plain index array
+ (numLists = height * width * depth / listLength). A run stands for
+ the indices start, start + 1, ..., start + length - 1, or for LENGTH
+ padding entries if start is -1. The encoding is lossless.
+
+ VL_RLE_MAGIC is smaller than -1, hence it never starts a plain index
+ array and identifies the encoded arrays.
+ */
+
+enum {
+  VL_RLE_MAGIC = -0x524c45,
+  VL_RLE_HEADER_SIZE = 6
+} ;
+
+inline bool rle_is_encoded(int const* indices, ptrdiff_t numElements) {
+  return numElements >= VL_RLE_HEADER_SIZE && indices[0] == VL_RLE_MAGIC ;
+}
+inline int rle_list_length(int const* encoded) { return encoded[1] ; }
+inline int rle_height(int const* encoded) { return encoded[2] ; }
+inline int rle_width(int const* encoded) { return encoded[3] ; }
+inline int rle_depth(int const* encoded) { return encoded[4] ; }
+inline int rle_num_runs(int const* encoded) { return encoded[5] ; }
+inline int rle_num_lists(int const* encoded) {
+  return encoded[1] ? (int)((ptrdiff_t)encoded[2] * encoded[3] * encoded[4] / encoded[1]) : 0 ;
+}
+inline int const* rle_lists(int const* encoded) { return encoded + VL_RLE_HEADER_SIZE ; }
+inline int const* rle_runs(int const* encoded) {
+  return encoded + VL_RLE_HEADER_SIZE + 2 * (ptrdiff_t)rle_num_lists(encoded) ;
+}
+
+/* number of int32 values of the encoding of an array with these many lists and runs */
+inline ptrdiff_t rle_encoded_size(ptrdiff_t numLists, ptrdiff_t numRuns) {
+  return VL_RLE_HEADER_SIZE + 2 * (numLists + numRuns) ;
+}
+
+int rle_count_runs(int const* indices,
+                   int numLists,
+                   int listLength) ;
+
+void rle_encode(int* encoded,
+                int const* indices,
+                int height,
+                int width,
+                int depth,
+                int listLength,
+                int numRuns) ;
+
+void rle_decode(int* indices,
+                int const* encoded) ;
+
+#endif /* defined(VL_NNRUNLENGTH_H) */
@@ -0,0 +1,65 @@
+/** @file threads.cpp
+ ** @brief CPU thread pool settings
+ ** @author Michael Figurnov
+ **/
+
+/*
+ Copyright (C) 2015 Michael Figurnov.
+ All rights reserved.
+
+ This file is part of the VLFeat library and is made available under
+ the terms of the BSD license (see the COPYING file).
+ */
+
+#include "threads.hpp"
+
+#ifdef _OPENMP
+#include <omp.h>
+#else
+#include <time.h>
+#endif
+
+/* zero means the OpenMP default */
+static int numThreadsSetting = 0 ;
+
+int vl_get_num_threads()
+{
+#ifdef _OPENMP
+  return (numThreadsSetting > 0) ? numThreadsSetting : omp_get_max_threads() ;
+#else
+  return 1 ;
+#endif
+}
+
+int vl_set_num_threads(int numThreads)
+{
+  int previous = numThreadsSetting ;
+  numThreadsSetting = (numThreads > 0) ? numThreads : 0 ;
+  return previous ;
+}
+
+int vl_get_num_threads_for(ptrdiff_t numTasks, ptrdiff_t work)
+{
+  ptrdiff_t numThreads = vl_get_num_threads() ;
+  if (numThreads > numTasks) { numThreads = numTasks ; }
+  if (numThreads > work / VL_MIN_THREAD_WORK) { numThreads = work / VL_MIN_THREAD_WORK ; }
+  return (numThreads > 1) ? (int)numThreads : 1 ;
+}
+
+int vl_get_thread_id()
+{
+#ifdef _OPENMP
+  return omp_get_thread_num() ;
+#else
+  return 0 ;
+#endif
+}
+
+double vl_get_time()
+{
+#ifdef _OPENMP
+  return omp_get_wtime() ;
+#else
+  return (double)clock() / CLOCKS_PER_SEC ;
+#endif
+}
@@ -0,0 +1,45 @@
+/** @file threads.hpp
+ ** @brief CPU thread pool settings
+ ** @author Michael Figurnov
+ **/
+
+/*
+ Copyright (C) 2015 Michael Figurnov.
+ All rights reserved.
+
+ This file is part of the VLFeat library and is made available under
+ the terms of the BSD license (see the COPYING file).
+ */
+
+#ifndef VL_NNTHREADS_H
+#define VL_NNTHREADS_H
+
+#include <stddef.h>
+
+/*
+ The CPU kernels run on the OpenMP thread pool. vl_get_num_threads()
+ returns the number of threads the kernels use; by default this is
+ the OpenMP maximum (usually the number of cores). Passing zero to
+ vl_set_num_threads() restores the default; the function returns the
+ previous setting so that it can be restored. Without OpenMP support
+ the kernels are sequential and vl_get_num_threads() returns one.
+ */
+
+int vl_get_num_threads() ;
+int vl_set_num_threads(int numThreads) ;
+int vl_get_thread_id() ;
+
+/*
+ The number of threads for NUMTASKS independent tasks of WORK
+ operations in total: at most vl_get_num_threads() and NUMTASKS, and
+ at least VL_MIN_THREAD_WORK operations per thread, as short loops are
+ faster sequentially. It is at least one.
+ */
+enum { VL_MIN_THREAD_WORK = 1 << 16 } ;
+
+int vl_get_num_threads_for(ptrdiff_t numTasks, ptrdiff_t work) ;
+
+/* wall-clock time in seconds, for timing the kernels */
+double vl_get_time() ;
+
+#endif /* defined(VL_NNTHREADS_H) */
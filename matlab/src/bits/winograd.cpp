@@ -0,0 +1,184 @@
+/** @file winograd.cpp
+ ** @brief Winograd F(2x2, 3x3) transforms
+ ** @author Michael Figurnov
+ **/
+
+/*
+ Copyright (C) 2015 Michael Figurnov.
+ All rights reserved.
+
+ This file is part of the VLFeat library and is made available under
+ the terms of the BSD license (see the COPYING file).
+ */
+
+#include "winograd.hpp"
+
+/*
+ The transforms use the matrices of Lavin and Gray:
+
+   B' = [1  0 -1  0 ;   G = [ 1    0    0  ;   A' = [1  1  1  0 ;
+         0  1  1  0 ;         1/2  1/2  1/2 ;         0  1 -1 -1]
+         0 -1  1  0 ;         1/2 -1/2  1/2 ;
+         0  1  0 -1]          0    0    1  ]
+
+ Each 2D transform is applied as a 1D transform of the columns followed
+ by one of the rows. The transforms of the kernels below are called per
+ block of tiles by workers that run on separate threads, so they are
+ not parallelized themselves.
+ */
+
+template<typename T>
+void winograd_filters_cpu(T* u,
+                          T const* filters,
+                          ptrdiff_t depth,
+                          ptrdiff_t numFilters)
+{
+  ptrdiff_t const xiStride = depth * numFilters ;
+  for (ptrdiff_t f = 0 ; f < numFilters ; ++f) {
+    for (ptrdiff_t c = 0 ; c < depth ; ++c) {
+      T const* g = filters + 9 * (c + depth * f) ;
+      T h [4][3] ;
+      /* G g: g[r + 3 x] is row r, column x */
+      for (int x = 0 ; x < 3 ; ++x) {
+        T g0 = g[0 + 3 * x] ;
+        T g1 = g[1 + 3 * x] ;
+        T g2 = g[2 + 3 * x] ;
+        h[0][x] = g0 ;
+        h[1][x] = (T)0.5 * (g0 + g1 + g2) ;
+        h[2][x] = (T)0.5 * (g0 - g1 + g2) ;
+        h[3][x] = g2 ;
+      }
+      /* (G g) G' */
+      T* uc = u + c + depth * f ;
+      for (int i = 0 ; i < 4 ; ++i) {
+        uc[(i + 4 * 0) * xiStride] = h[i][0] ;
+        uc[(i + 4 * 1) * xiStride] = (T)0.5 * (h[i][0] + h[i][1] + h[i][2]) ;
+        uc[(i + 4 * 2) * xiStride] = (T)0.5 * (h[i][0] - h[i][1] + h[i][2]) ;
+        uc[(i + 4 * 3) * xiStride] = h[i][2] ;
+      }
+    }
+  }
+}
+
+template<typename T>
+void winograd_data_cpu(T* v,
+                       ptrdiff_t vStride,
+                       T const* data,
+                       ptrdiff_t height,
+                       ptrdiff_t width,
+                       ptrdiff_t depth,
+                       int const* tiles,
+                       ptrdiff_t numTiles)
+{
+  ptrdiff_t const xiStride = vStride ;
+  for (ptrdiff_t c = 0 ; c < depth ; ++c) {
+    T const* channel = data + height * width * c ;
+    for (ptrdiff_t t = 0 ; t < numTiles ; ++t) {
+      int y0 = tiles[2 * t] ;
+      int x0 = tiles[2 * t + 1] ;
+      T d [4][4] ;
+      if (y0 >= 0 && y0 + 4 <= height && x0 >= 0 && x0 + 4 <= width) {
+        T const* patch = channel + y0 + height * x0 ;
+        for (int x = 0 ; x < 4 ; ++x) {
+          for (int y = 0 ; y < 4 ; ++y) {
+            d[y][x] = patch[y + height * x] ;
+          }
+        }
+      } else {
+        for (int x = 0 ; x < 4 ; ++x) {
+          for (int y = 0 ; y < 4 ; ++y) {
+            ptrdiff_t py = y0 + y ;
+            ptrdiff_t px = x0 + x ;
+            d[y][x] = (py >= 0 && py < height && px >= 0 && px < width) ? channel[py + height * px] : (T)0 ;
+          }
+        }
+      }
+      /* B' d */
+      T s [4][4] ;
+      for (int x = 0 ; x < 4 ; ++x) {
+        s[0][x] = d[0][x] - d[2][x] ;
+        s[1][x] = d[1][x] + d[2][x] ;
+        s[2][x] = d[2][x] - d[1][x] ;
+        s[3][x] = d[1][x] - d[3][x] ;
+      }
+      /* (B' d) B */
+      T* vt = v + t + numTiles * c ;
+      for (int i = 0 ; i < 4 ; ++i) {
+        vt[(i + 4 * 0) * xiStride] = s[i][0] - s[i][2] ;
+        vt[(i + 4 * 1) * xiStride] = s[i][1] + s[i][2] ;
+        vt[(i + 4 * 2) * xiStride] = s[i][2] - s[i][1] ;
+        vt[(i + 4 * 3) * xiStride] = s[i][1] - s[i][3] ;
+      }
+    }
+  }
+}
+
+template<typename T>
+void winograd_output_cpu(T* y,
+                         T const* m,
+                         ptrdiff_t mStride,
+                         int const* outputs,
+                         ptrdiff_t numTiles,
+                         ptrdiff_t numFilters,
+                         ptrdiff_t outputStride,
+                         T const* biases,
+                         bool relu)
+{
+  ptrdiff_t const xiStride = mStride ;
+  for (ptrdiff_t f = 0 ; f < numFilters ; ++f) {
+    T const bias = biases ? biases[f] : (T)0 ;
+    T* yf = y + outputStride * f ;
+    for (ptrdiff_t t = 0 ; t < numTiles ; ++t) {
+      T const* mt = m + t + numTiles * f ;
+      T s [2][4] ;
+      /* A' m */
+      for (int j = 0 ; j < 4 ; ++j) {
+        T m0 = mt[(0 + 4 * j) * xiStride] ;
+        T m1 = mt[(1 + 4 * j) * xiStride] ;
+        T m2 = mt[(2 + 4 * j) * xiStride] ;
+        T m3 = mt[(3 + 4 * j) * xiStride] ;
+        s[0][j] = m0 + m1 + m2 ;
+        s[1][j] = m1 - m2 - m3 ;
+      }
+      /* (A' m) A */
+      T r [4] ;
+      r[0] = s[0][0] + s[0][1] + s[0][2] ;
+      r[1] = s[1][0] + s[1][1] + s[1][2] ;
+      r[2] = s[0][1] - s[0][2] - s[0][3] ;
+      r[3] = s[1][1] - s[1][2] - s[1][3] ;
+      int const* to = outputs + 4 * t ;
+      for (int j = 0 ; j < 4 ; ++j) {
+        if (to[j] < 0) { continue ; }
+        T value = r[j] + bias ;
+        yf[to[j]] = (relu && value < 0) ? (T)0 : value ;
+      }
+    }
+  }
+}
+
+template
+void winograd_filters_cpu<float>(float* u,
+                                 float const* filters,
+                                 ptrdiff_t depth,
+                                 ptrdiff_t numFilters) ;
+
+template
+void winograd_data_cpu<float>(float* v,
+                              ptrdiff_t vStride,
+                              float const* data,
+                              ptrdiff_t height,
+                              ptrdiff_t width,
+                              ptrdiff_t depth,
+                              int const* tiles,
+                              ptrdiff_t numTiles) ;
+
+template
+void winograd_output_cpu<float>(float* y,
+                                float const* m,
+                                ptrdiff_t mStride,
+                                int const* outputs,
+                                ptrdiff_t numTiles,
+                                ptrdiff_t numFilters,
+                                ptrdiff_t outputStride,
+                                float const* biases,
+                                bool relu) ;
@@ -0,0 +1,75 @@
+/** @file winograd.hpp
+ ** @brief Winograd F(2x2, 3x3) transforms
+ ** @author Michael Figurnov
+ **/
+
+/*
+ Copyright (C) 2015 Michael Figurnov.
+ All rights reserved.
+
+ This file is part of the VLFeat library and is made available under
+ the terms of the BSD license (see the COPYING file).
+ */
+
+#ifndef VL_NNWINOGRAD_H
+#define VL_NNWINOGRAD_H
+
+#include <cstddef>
+
+/*
+ The minimal filtering algorithm F(2x2, 3x3) of Lavin and Gray (2015)
+ computes a 2 x 2 tile of the output of a 3 x 3 filter from the 4 x 4
+ input patch D as A' [(G F G') .* (B' D B)] A, using 16 products
+ instead of 36. Summed over the channels, the 16 element-wise products
+ become 16 independent matrix products, one per transformed position
+ XI = i + 4 j (i indexes the rows of the 4 x 4 transforms).
+
+ winograd_filters_cpu() transforms the 3 x 3 x DEPTH x NUMFILTERS
+ FILTERS into U[c + DEPTH * (f + NUMFILTERS * XI)], i.e. 16 DEPTH x
+ NUMFILTERS matrices.
+
+ winograd_data_cpu() transforms the input patches of NUMTILES tiles
+ of the HEIGHT x WIDTH x DEPTH image DATA. The patch of tile t covers
+ the rows TILES[2t] to TILES[2t] + 3 and the columns TILES[2t+1] to
+ TILES[2t+1] + 3, and is zero outside of the image (padding). The
+ result is V[t + NUMTILES * c + VSTRIDE * XI], i.e. 16 NUMTILES x
+ DEPTH matrices. VSTRIDE (at least NUMTILES * DEPTH) should not be a
+ large power of two, or the 16 rows written for a patch compete for
+ the same cache sets.
+
+ The products M_XI = V_XI U_XI are computed by the caller. Then
+ winograd_output_cpu() transforms M[t + NUMTILES * f + MSTRIDE * XI]
+ back to the outputs of the tiles: output j = dy + 2 dx of tile t
+ is written to Y[OUTPUTS[4t + j] + OUTPUTSTRIDE * f], unless
+ OUTPUTS[4t + j] is negative. BIASES may be NULL; if RELU is true, the
+ outputs are clamped at zero.
+ */
+
+template<typename T>
+void winograd_filters_cpu(T* u,
+                          T const* filters,
+                          ptrdiff_t depth,
+                          ptrdiff_t numFilters) ;
+
+template<typename T>
+void winograd_data_cpu(T* v,
+                       ptrdiff_t vStride,
+                       T const* data,
+                       ptrdiff_t height,
+                       ptrdiff_t width,
+                       ptrdiff_t depth,
+                       int const* tiles,
+                       ptrdiff_t numTiles) ;
+
+template<typename T>
+void winograd_output_cpu(T* y,
+                         T const* m,
+                         ptrdiff_t mStride,
+                         int const* outputs,
+                         ptrdiff_t numTiles,
+                         ptrdiff_t numFilters,
+                         ptrdiff_t outputStride,
+                         T const* biases,
+                         bool relu) ;
+
+#endif /* defined(VL_NNWINOGRAD_H) */
@@ -16,11 +16,15 @@
 #include "bits/nnhelper.h"
 #include "bits/im2col.hpp"
 #include "bits/subsample.hpp"
+#include "bits/epilogue.hpp"
+#include "bits/threads.hpp"
+#include "bits/im2col_simd.hpp"
+#include "bits/blas.hpp"
 
 #include <assert.h>
 #include <algorithm>
+#include <vector>
 
-#include <blas.h>
 #ifdef ENABLE_GPU
 #include "bits/gpu.hpp"
 #include <cublas_v2.h>
@@ -32,6 +36,17 @@ enum {
   opt_pad,
   opt_conv_indices,
   opt_microbatch_size,
+  opt_num_threads,
+  opt_blas,
+  opt_simd,
+  opt_implicit_gemm,
+  opt_layout,
+  opt_plan,
+  opt_create_plan,
+  opt_relu,
+  opt_interpolation_indices,
+  opt_winograd,
+  opt_mask_indices,
   opt_der_filters,
   opt_der_biases,
   opt_verbose,
@@ -46,6 +61,17 @@ vlmxOption  options [] = {
   {"Pad",              1,   opt_pad                },
   {"ConvIndices",      1,   opt_conv_indices       },
   {"MicrobatchSize",   1,   opt_microbatch_size    },
+  {"NumThreads",       1,   opt_num_threads        },
+  {"Blas",             1,   opt_blas               },
+  {"Simd",             1,   opt_simd               },
+  {"ImplicitGemm",     0,   opt_implicit_gemm      },
+  {"Layout",           1,   opt_layout             },
+  {"Plan",             1,   opt_plan               },
+  {"CreatePlan",       0,   opt_create_plan        },
+  {"ReLU",             0,   opt_relu               },
+  {"InterpolationIndices", 1, opt_interpolation_indices },
+  {"Winograd",         1,   opt_winograd           },
+  {"MaskIndices",      1,   opt_mask_indices       },
   {"DerFilters",       1,   opt_der_filters        },
   {"DerBiases",        1,   opt_der_biases         },
   {"Verbose",          0,   opt_verbose            },
@@ -55,6 +81,30 @@ vlmxOption  options [] = {
   {0,                  0,   0                      }
 } ;
 
+VlEnumerator nnLayoutTypes [] =
+{
+  {"Default",  (vl_index)perfcnn::layoutDefault     },
+  {"NHWC",     (vl_index)perfcnn::layoutChannelLast },
+  {0,          0                                    }
+} ;
+
+VlEnumerator nnBlasBackendTypes [] =
+{
+  {"Linked",    (vl_index)vlBlasLinked    },
+  {"Reference", (vl_index)vlBlasReference },
+  {0,           0                         }
+} ;
+
+/* named as in vl_indexed_simd_force(), matched ignoring the case */
+VlEnumerator nnSimdTypes [] =
+{
+  {"auto",      0 },
+  {"scalar",    1 },
+  {"avx2",      2 },
+  {"avx512",    3 },
+  {0,           0 }
+} ;
+
 /* ---------------------------------------------------------------- */
 /*                                                            Cache */
 /* ---------------------------------------------------------------- */
@@ -67,18 +117,50 @@ cublasHandle_t thisCublasHandle ;
 bool persistentDataInitialized = false ;
 PackedData temp ;
 PackedData derOutputMasked;
-PackedData outputMasked;
 PackedData allOnes ;
 
+/*
+ Plans created by 'CreatePlan'. A handle is a UINT32 scalar equal to
+ the position of the plan in this table plus one; the entries of the
+ freed plans are not reused, so that stale handles are detected.
+ */
+std::vector<perfcnn::ConvIndexedPlan*> plans ;
+
+static mxArray *
+plan_create_handle(perfcnn::ConvIndexedPlan * plan)
+{
+  mxArray * handle = mxCreateNumericMatrix(1, 1, mxUINT32_CLASS, mxREAL) ;
+  plans.push_back(plan) ;
+  *(unsigned int*)mxGetData(handle) = (unsigned int)plans.size() ;
+  return handle ;
+}
+
+/* returns the position of the plan in the table, or -1 if the handle is not valid */
+static ptrdiff_t
+plan_find(mxArray const * handle)
+{
+  if (!vlmxIsOfClass(handle, mxUINT32_CLASS) || mxGetNumberOfElements(handle) != 1) {
+    return -1 ;
+  }
+  ptrdiff_t index = (ptrdiff_t)*(unsigned int const*)mxGetData(handle) - 1 ;
+  if (index < 0 || index >= (ptrdiff_t)plans.size() || plans[index] == NULL) {
+    return -1 ;
+  }
+  return index ;
+}
+
 void atExit()
 {
   if (persistentDataInitialized) {
     packed_data_deinit (&temp)  ;
     packed_data_deinit (&derOutputMasked)  ;
-    packed_data_deinit (&outputMasked)  ;
     packed_data_deinit (&allOnes)  ;
     persistentDataInitialized = false ;
   }
+  for (size_t i = 0 ; i < plans.size() ; ++i) {
+    perfcnn::convIndexedPlanDestroy(plans[i]) ;
+  }
+  plans.clear() ;
 #ifdef ENABLE_GPU
   if (cublasInitialized) {
     cublasDestroy(thisCublasHandle) ;
@@ -87,6 +169,24 @@ void atExit()
 #endif
 }
 
+/* NumThreads, Blas and Simd apply to a single call */
+static void
+restore_call_settings(int numThreads,
+                      int previousNumThreads,
+                      int previousBlasNumThreads,
+                      VlBlasBackend previousBlasBackend,
+                      char const * previousSimd)
+{
+  if (numThreads > 0) {
+    vl_set_num_threads(previousNumThreads) ;
+    vl_blas_set_num_threads(previousBlasNumThreads) ;
+  }
+  vl_blas_set_backend(previousBlasBackend) ;
+  if (previousSimd) {
+    vl_indexed_simd_force(previousSimd) ;
+  }
+}
+
 /* ---------------------------------------------------------------- */
 /*                                                  Dispatcher func */
 /* ---------------------------------------------------------------- */
@@ -102,12 +202,12 @@ sgemv_dispatch(bool gpuMode,
                float * y, ptrdiff_t incy)
 {
   if (!gpuMode) {
-    sgemv(&op,
-          &m, &n, &alpha,
-          (float*)a, &lda,
-          (float*)x, &incx,
-          &beta,
-          y, &incy) ;
+    vl_blas_sgemv(op,
+                  m, n, alpha,
+                  a, lda,
+                  x, incx,
+                  beta,
+                  y, incy) ;
   } else {
 #ifdef ENABLE_GPU
     cublasSgemv(thisCublasHandle,
@@ -133,13 +233,13 @@ sgemm_dispatch(bool gpuMode,
                float * c, ptrdiff_t ldc)
 {
   if (!gpuMode) {
-    sgemm(&op1, &op2,
-          &m, &n, &k,
-          &alpha,
-          (float*)a, &lda,
-          (float*)b, &ldb,
-          &beta,
-          c, &ldc) ;
+    vl_blas_sgemm(op1, op2,
+                  m, n, k,
+                  alpha,
+                  a, lda,
+                  b, ldb,
+                  beta,
+                  c, ldc) ;
   } else {
 #ifdef ENABLE_GPU
     cublasSgemm(thisCublasHandle,
@@ -155,6 +255,40 @@ sgemm_dispatch(bool gpuMode,
   }
 }
 
+/* the products of the filter groups; on the CPU they may run concurrently */
+static void
+sgemm_batched_dispatch(bool gpuMode,
+                       char op1, char op2,
+                       ptrdiff_t m, ptrdiff_t n, ptrdiff_t k,
+                       float alpha,
+                       float const * a, ptrdiff_t lda, ptrdiff_t strideA,
+                       float const * b, ptrdiff_t ldb, ptrdiff_t strideB,
+                       float beta,
+                       float * c, ptrdiff_t ldc, ptrdiff_t strideC,
+                       ptrdiff_t batchSize)
+{
+  if (!gpuMode) {
+    vl_blas_sgemm_strided_batched(op1, op2,
+                                  m, n, k,
+                                  alpha,
+                                  a, lda, strideA,
+                                  b, ldb, strideB,
+                                  beta,
+                                  c, ldc, strideC,
+                                  batchSize) ;
+  } else {
+    for (ptrdiff_t s = 0 ; s < batchSize ; ++s) {
+      sgemm_dispatch(gpuMode, op1, op2,
+                     m, n, k,
+                     alpha,
+                     a + s * strideA, lda,
+                     b + s * strideB, ldb,
+                     beta,
+                     c + s * strideC, ldc) ;
+    }
+  }
+}
+
 static void
 copy_dispatch(bool gpuMode,
               float * dest,
@@ -434,23 +568,6 @@ col2im_indexed_dispatch(bool gpuMode,
   }
 }
 
-static void
-transpose23_dispatch(bool gpuMode,
-                     float* transposed,
-                     float const* data,
-                     size_t d1,
-                     size_t d2,
-                     size_t d3)
-{
-  if (!gpuMode) {
-    transpose23_cpu(transposed, data, d1, d2, d3);
-  } else {
-#ifdef ENABLE_GPU
-    transpose23_gpu(transposed, data, d1, d2, d3) ;
-#endif
-  }
-}
-
 /* ---------------------------------------------------------------- */
 /*                                                       MEX driver */
 /* ---------------------------------------------------------------- */
@@ -472,6 +589,8 @@ void mexFunction(int nout, mxArray *out[],
   PackedData biases ;
   PackedData derOutput ;
   PackedData convIndices ;
+  PackedData interpolationIndices ;
+  PackedData maskIndices ;
   PackedData derFiltersInit ;
   PackedData derBiasesInit ;
 
@@ -487,8 +606,9 @@ void mexFunction(int nout, mxArray *out[],
   PackedDataGeometry derBiasesGeom ;
   PackedDataGeometry tempGeom ;
   PackedDataGeometry derOutputMaskedGeom ;
-  PackedDataGeometry outputMaskedGeom ;
   PackedDataGeometry allOnesGeom ;
+  PackedDataGeometry compactGeom ;
+  perfcnn::TensorGeometry convIndicesGeom ;
 
   int strideX = 1 ;
   int strideY = 1 ;
@@ -498,6 +618,15 @@ void mexFunction(int nout, mxArray *out[],
   int padBottom = 0 ;
   int numGroups = 1 ;
   int microbatchSize = 1 ;
+  int numThreads = 0 ;
+  int previousNumThreads = 0 ;
+  int previousBlasNumThreads = 0 ;
+  VlBlasBackend blasBackend = vl_blas_get_backend() ;
+  VlBlasBackend previousBlasBackend ;
+  char const * simd = NULL ;
+  char const * previousSimd = NULL ;
+  perfcnn::ConvIndexedPlan * plan = NULL ;
+  ptrdiff_t planIndex ;
 
 #if ENABLE_GPU
   cublasStatus_t stat;
@@ -514,19 +643,35 @@ void mexFunction(int nout, mxArray *out[],
   bool computeDerFilters = true ;
   bool computeDerBiases = true ;
   bool convIndicesMode = false;
+  bool implicitGemm = false ;
   bool derFiltersInitialized = false ;
   bool derBiasesInitialized = false ;
+  bool createPlan = false ;
+  bool autoMicrobatchSize = false ;
+  bool relu = false ;
+  bool interpolationMode = false ;
+  bool layoutSpecified = false ;
+  bool maskMode = false ;
+  bool winogradMode = false ;
+  bool winogradSupported = false ;
+  int winograd = -1 ; /* -1: automatic */
+
+  perfcnn::Layout layout = perfcnn::layoutDefault ;
+  bool channelLast = false ;
 
   int verbosity = 0 ;
   int opt ;
   int next = IN_END ;
   mxArray const *optarg ;
+  VlEnumerator *pair ;
 
   packed_data_init_empty(&data) ;
   packed_data_init_empty(&filters) ;
   packed_data_init_empty(&biases) ;
   packed_data_init_empty(&derOutput) ;
   packed_data_init_empty(&convIndices) ;
+  packed_data_init_empty(&interpolationIndices) ;
+  packed_data_init_empty(&maskIndices) ;
   packed_data_init_empty(&output) ;
   packed_data_init_empty(&derData) ;
   packed_data_init_empty(&derFilters) ;
@@ -535,7 +680,6 @@ void mexFunction(int nout, mxArray *out[],
   packed_data_init_empty(&derBiasesInit) ;
   if (!persistentDataInitialized) {
     packed_data_init_empty(&temp) ;
-    packed_data_init_empty(&outputMasked) ;
     packed_data_init_empty(&allOnes) ;
     persistentDataInitialized = true ;
   }
@@ -546,6 +690,19 @@ void mexFunction(int nout, mxArray *out[],
 
   mexAtExit(atExit) ;
 
+  /* VL_NNCONV('FreePlan', PLAN) */
+  if (nin >= 1 && vlmxIsString(in[0],-1)) {
+    if (nin != 2 || !vlmxIsEqualToStringI(in[0], "FreePlan")) {
+      mexErrMsgTxt("The only command is VL_NNCONV('FreePlan', PLAN).") ;
+    }
+    if ((planIndex = plan_find(in[1])) < 0) {
+      mexErrMsgTxt("PLAN is not a valid plan.") ;
+    }
+    perfcnn::convIndexedPlanDestroy(plans[planIndex]) ;
+    plans[planIndex] = NULL ;
+    return ;
+  }
+
   if (nin < 3) {
     mexErrMsgTxt("There are less than three arguments.") ;
   }
@@ -611,11 +768,44 @@ void mexFunction(int nout, mxArray *out[],
         break;
 
       case opt_microbatch_size :
-        if (mxGetNumberOfElements(optarg) == 1) {
+        if (vlmxIsString(optarg,-1)) {
+          if (!vlmxIsEqualToStringI(optarg, "auto")) {
+            mexErrMsgTxt("MICROBATCHSIZE is neither a number nor 'auto'.") ;
+          }
+          autoMicrobatchSize = true ;
+          microbatchSize = 1 ;
+        } else if (mxGetNumberOfElements(optarg) == 1) {
+          autoMicrobatchSize = false ;
           microbatchSize = (int)mxGetPr(optarg)[0] ;
         }
         break;
 
+      case opt_num_threads :
+        if (!vlmxIsPlainMatrix(optarg,1,1) || mxGetPr(optarg)[0] < 0) {
+          mexErrMsgTxt("NUMTHREADS is not a non-negative scalar.") ;
+        }
+        numThreads = (int)mxGetPr(optarg)[0] ;
+        break ;
+
+      case opt_blas :
+        pair = vlmxDecodeEnumeration(optarg, nnBlasBackendTypes, VL_TRUE) ;
+        if (pair == NULL) {
+          vlmxError(vlmxErrInvalidArgument, "BLAS is not a supported backend.") ;
+        }
+        blasBackend = (VlBlasBackend)pair->value ;
+        break ;
+
+      case opt_simd :
+        pair = vlmxDecodeEnumeration(optarg, nnSimdTypes, VL_TRUE) ;
+        if (pair == NULL) {
+          vlmxError(vlmxErrInvalidArgument, "SIMD is not a supported implementation.") ;
+        }
+        if (pair->value != 0 && !vl_indexed_simd_supported(pair->name)) {
+          mexErrMsgTxt("SIMD is not supported by this CPU.") ;
+        }
+        simd = pair->name ;
+        break ;
+
       case opt_der_filters :
         if (mxGetNumberOfElements(optarg) != 0) {
           derFiltersInitialized = true;
@@ -630,6 +820,56 @@ void mexFunction(int nout, mxArray *out[],
         }
         break;
 
+      case opt_implicit_gemm :
+        implicitGemm = true ;
+        break ;
+
+      case opt_layout :
+        pair = vlmxDecodeEnumeration(optarg, nnLayoutTypes, VL_TRUE) ;
+        if (pair == NULL) {
+          mexErrMsgTxt("LAYOUT is not a supported layout.") ;
+        }
+        layout = (perfcnn::Layout)pair->value ;
+        channelLast = (layout == perfcnn::layoutChannelLast) ;
+        layoutSpecified = true ;
+        break ;
+
+      case opt_plan :
+        if ((planIndex = plan_find(optarg)) < 0) {
+          mexErrMsgTxt("PLAN is not a valid plan.") ;
+        }
+        plan = plans[planIndex] ;
+        break ;
+
+      case opt_create_plan :
+        createPlan = true ;
+        break ;
+
+      case opt_relu :
+        relu = true ;
+        break ;
+
+      case opt_interpolation_indices :
+        if (mxGetNumberOfElements(optarg) != 0) {
+          interpolationMode = true ;
+          packed_data_init_with_array_int(&interpolationIndices, optarg) ;
+        }
+        break ;
+
+      case opt_winograd :
+        if (!vlmxIsScalar(optarg)) {
+          mexErrMsgTxt("WINOGRAD is not a logical scalar.") ;
+        }
+        winograd = (mxGetScalar(optarg) != 0) ;
+        break ;
+
+      case opt_mask_indices :
+        if (mxGetNumberOfElements(optarg) != 0) {
+          maskMode = true ;
+          packed_data_init_with_array_int(&maskIndices, optarg) ;
+        }
+        break ;
+
       case opt_no_der_data :
         computeDerData = VL_FALSE ;
         break ;
@@ -713,11 +953,109 @@ void mexFunction(int nout, mxArray *out[],
     mexErrMsgTxt("CONVINDICES is not of class INT32.");
   }
 
+  /* a plan stands for CONVINDICES, MICROBATCHSIZE and LAYOUT */
+  if (plan) {
+    if (gpuMode || convIndicesMode || !hasFilters || implicitGemm || createPlan) {
+      mexErrMsgTxt("PLAN requires CPU arrays and FILTERS, and does not support CONVINDICES, IMPLICITGEMM and CREATEPLAN.") ;
+    }
+    if (layoutSpecified && layout != perfcnn::convIndexedPlanGetLayout(plan)) {
+      mexErrMsgTxt("LAYOUT is not the layout of PLAN.") ;
+    }
+    layout = perfcnn::convIndexedPlanGetLayout(plan) ;
+    channelLast = (layout == perfcnn::layoutChannelLast) ;
+    convIndicesMode = true ;
+  }
+  if (createPlan && (gpuMode || !convIndicesMode || !hasFilters || implicitGemm || backMode)) {
+    mexErrMsgTxt("CREATEPLAN requires CPU arrays, CONVINDICES and FILTERS, and does not support IMPLICITGEMM and DEROUTPUT.") ;
+  }
+
+  /* the interpolated output is computed by the CPU indexed convolution */
+  if (interpolationMode) {
+    if (gpuMode || !convIndicesMode || !hasFilters || implicitGemm || plan || createPlan) {
+      mexErrMsgTxt("INTERPOLATIONINDICES requires CPU arrays, CONVINDICES and FILTERS, and does not support IMPLICITGEMM, PLAN and CREATEPLAN.") ;
+    }
+    if (!packed_data_are_compatible(&data, &interpolationIndices)) {
+      mexErrMsgTxt("DATA and INTERPOLATIONINDICES are not both CPU or GPU arrays.") ;
+    }
+    if (interpolationIndices.geom.classID != mxINT32_CLASS) {
+      mexErrMsgTxt("INTERPOLATIONINDICES is not of class INT32.") ;
+    }
+  }
+
+  /*
+   The Winograd convolution computes the CPU forward pass of 3 x 3
+   filters with unit stride. It is chosen automatically when the layer
+   is large enough to amortize the transforms. MASKINDICES restricts it
+   to some of the outputs, as CONVINDICES does for the im2col path.
+   */
+  if (maskMode) {
+    if (winograd == 0) {
+      mexErrMsgTxt("MASKINDICES requires WINOGRAD.") ;
+    }
+    if (!packed_data_are_compatible(&data, &maskIndices)) {
+      mexErrMsgTxt("DATA and MASKINDICES are not both CPU or GPU arrays.") ;
+    }
+    if (maskIndices.geom.classID != mxINT32_CLASS) {
+      mexErrMsgTxt("MASKINDICES is not of class INT32.") ;
+    }
+    winograd = 1 ;
+  }
+  if (winograd != 0) {
+    winogradSupported = (!gpuMode && !backMode && hasFilters && !convIndicesMode && !channelLast &&
+                         !implicitGemm && !createPlan &&
+                         filters.geom.height == 3 && filters.geom.width == 3 &&
+                         strideY == 1 && strideX == 1) ;
+    if (winograd > 0 && !winogradSupported) {
+      mexErrMsgTxt("WINOGRAD requires CPU arrays, 3 x 3 FILTERS and unit STRIDE, and does not support DEROUTPUT, CONVINDICES, PLAN, IMPLICITGEMM and the NHWC LAYOUT.") ;
+    }
+  }
+
+  /* the ReLU is fused in the CPU forward pass only */
+  if (relu && (gpuMode || backMode)) {
+    mexErrMsgTxt("RELU requires CPU arrays and does not support DEROUTPUT.") ;
+  }
+
+  /* from here on, DATA and DEROUTPUT have their logical geometry */
+  if (channelLast) {
+    if (gpuMode || !convIndicesMode || !hasFilters || implicitGemm) {
+      mexErrMsgTxt("The NHWC LAYOUT requires CPU arrays, CONVINDICES and FILTERS, and does not support IMPLICITGEMM.") ;
+    }
+    data.geom = packed_data_geom_from_channel_last(data.geom) ;
+    if (backMode) { derOutput.geom = packed_data_geom_from_channel_last(derOutput.geom) ; }
+  }
+
+  /* on the CPU, CONVINDICES may be run-length encoded */
+  if (plan) {
+    convIndicesGeom = perfcnn::convIndexedPlanGetIndicesGeometry(plan) ;
+  } else if (convIndicesMode && !gpuMode) {
+    convIndicesGeom = perfcnn::getIndicesGeometry(packed_data_get_index_tensor(&convIndices)) ;
+  } else if (convIndicesMode) {
+    convIndicesGeom = perfcnn::TensorGeometry(convIndices.geom.height, convIndices.geom.width,
+                                              convIndices.geom.depth, convIndices.geom.size) ;
+  }
+
   if (convIndicesMode) {
     packed_data_geom_init(&outputGeom,
                           mxSINGLE_CLASS,
-                          convIndices.geom.height,
-                          convIndices.geom.width,
+                          convIndicesGeom.height,
+                          convIndicesGeom.width,
+                          filters.geom.size,
+                          data.geom.size) ;
+    /* the output is then interpolated to the size of INTERPOLATIONINDICES */
+    if (interpolationMode) {
+      compactGeom = outputGeom ;
+      packed_data_geom_init(&outputGeom,
+                            mxSINGLE_CLASS,
+                            interpolationIndices.geom.height,
+                            interpolationIndices.geom.width,
+                            filters.geom.size,
+                            data.geom.size) ;
+    }
+  } else if (maskMode) {
+    packed_data_geom_init(&outputGeom,
+                          mxSINGLE_CLASS,
+                          maskIndices.geom.numElements,
+                          1,
                           filters.geom.size,
                           data.geom.size) ;
   } else {
@@ -736,6 +1074,7 @@ void mexFunction(int nout, mxArray *out[],
    call im2col as it does not do anything
    */
   fullyConnectedMode = (!convIndicesMode &&
+                        !maskMode &&
                         outputGeom.height == 1 &&
                         outputGeom.width == 1 &&
                         padTop == 0 &&
@@ -753,13 +1092,19 @@ void mexFunction(int nout, mxArray *out[],
             padBottom == 0 &&
             padLeft == 0 &&
             padRight == 0);
+  /* automatically for deep layers with many filters per group; an
+     invalid number of groups (zero) is reported below */
+  winogradMode = (winogradSupported && !fullyConnectedMode &&
+                  (winograd > 0 ||
+                   (numGroups > 0 && filters.geom.depth >= 32 &&
+                    filters.geom.size / numGroups >= 32))) ;
 
   if (convIndicesMode) {
-    if (convIndices.geom.depth != filters.geom.height*filters.geom.width) {
+    if (convIndicesGeom.depth != filters.geom.height*filters.geom.width) {
       mexErrMsgTxt("CONVINDICES depth is not compatible with filters.");
     }
 
-    if (convIndices.geom.size != 1 && convIndices.geom.size != data.geom.size) {
+    if (convIndicesGeom.size != 1 && convIndicesGeom.size != data.geom.size) {
       mexErrMsgTxt("CONVINDICES size should be equal either one, or the number of input images.");
     }
   }
@@ -776,24 +1121,9 @@ void mexFunction(int nout, mxArray *out[],
                            0, 0, 0, 0) ;
   }
 
-  if (convIndicesMode) {
-    packed_data_geom_init
-    (&outputMaskedGeom, mxSINGLE_CLASS,
-     outputGeom.height,
-     outputGeom.width,
-     filters.geom.size,
-     microbatchSize) ;
-  } else {
-    packed_data_geom_init (&outputMaskedGeom, mxSINGLE_CLASS,
-                           0, 0, 0, 0) ;
-  }
-
-  if (false) {
-    packed_data_geom_init (&derOutputMaskedGeom, mxSINGLE_CLASS,
-                           outputGeom.height,
-                           outputGeom.width,
-                           filters.geom.size,
-                           microbatchSize) ;
+  /* the derivative of the interpolated output is summed back to CONVINDICES resolution */
+  if (backMode && interpolationMode) {
+    derOutputMaskedGeom = compactGeom ;
   } else {
     packed_data_geom_init (&derOutputMaskedGeom, mxSINGLE_CLASS,
                            0, 0, 0, 0) ;
@@ -802,6 +1132,10 @@ void mexFunction(int nout, mxArray *out[],
   derDataGeom = data.geom ;
   derFiltersGeom = filters.geom ;
   if (hasBiases) {
+    derBiasesGeom = biases.geom ;
+  }
+  /* on the CPU, the biases are added by the GEMM epilogues (bits/epilogue.hpp) */
+  if (hasBiases && gpuMode) {
     if (fullyConnectedMode) {
       packed_data_geom_init (&allOnesGeom, mxSINGLE_CLASS,
                              1, 1,
@@ -810,9 +1144,8 @@ void mexFunction(int nout, mxArray *out[],
       packed_data_geom_init (&allOnesGeom, mxSINGLE_CLASS,
                              outputGeom.height,
                              outputGeom.width,
-                             1, microbatchSize) ;
+                             1, 1) ;
     }
-    derBiasesGeom = biases.geom ;
   } else {
     packed_data_geom_init (&allOnesGeom, mxSINGLE_CLASS,
                            0, 0, 0, 0) ;
@@ -820,11 +1153,25 @@ void mexFunction(int nout, mxArray *out[],
 
   if (verbosity > 0) {
     mexPrintf("vl_nnconv: mode %s; %s\n", gpuMode?"gpu":"cpu", backMode?"backward":"forward") ;
-    mexPrintf("vl_nnconv: stride: [%d %d], pad: [%d %d %d %d], numGroups: %d, has bias: %d, fully connected: %d, 1x1: %d, conv indices: %d, microbatchSize: %d\n",
+    if (!gpuMode && convIndicesMode) {
+      previousSimd = vl_indexed_simd_name() ;
+      vl_indexed_simd_force(simd ? simd : previousSimd) ;
+      mexPrintf("vl_nnconv: indexed gather/scatter kernels: %s\n", vl_indexed_simd_name()) ;
+      vl_indexed_simd_force(previousSimd) ;
+      previousSimd = NULL ;
+    }
+    if (!gpuMode) {
+      previousBlasBackend = vl_blas_set_backend(blasBackend) ;
+      mexPrintf("vl_nnconv: BLAS: %s\n", vl_blas_get_backend_name()) ;
+      vl_blas_set_backend(previousBlasBackend) ;
+    }
+    mexPrintf("vl_nnconv: stride: [%d %d], pad: [%d %d %d %d], numGroups: %d, has bias: %d, relu: %d, fully connected: %d, 1x1: %d, conv indices: %d, winograd: %d, microbatchSize: %d, numThreads: %d, implicit GEMM: %d, layout: %s, plan: %d\n",
               strideY, strideX,
               padTop, padBottom, padLeft, padRight,
-              numGroups, hasBiases, fullyConnectedMode, is_1x1, convIndicesMode,
-              microbatchSize) ;
+              numGroups, hasBiases, relu, fullyConnectedMode, is_1x1, convIndicesMode, winogradMode,
+              microbatchSize, numThreads, implicitGemm,
+              vl_enumeration_get_by_value(nnLayoutTypes, layout)->name,
+              (plan != NULL) ? (int)planIndex + 1 : 0) ;
     packed_data_geom_display(&data.geom, "vl_nnconv: data") ;
     if (hasFilters) { packed_data_geom_display(&filters.geom, "vl_nnconv: filters") ; }
     if (hasBiases) { packed_data_geom_display(&biases.geom, "vl_nnconv: biases") ; }
@@ -840,13 +1187,17 @@ void mexFunction(int nout, mxArray *out[],
     }
     packed_data_geom_display(&tempGeom, "vl_nnconv: temp") ;
     packed_data_geom_display(&temp.geom, "vl_nnconv: temp (cached)") ;
-    packed_data_geom_display(&outputMaskedGeom, "vl_nnconv: outputMasked") ;
-    packed_data_geom_display(&outputMasked.geom, "vl_nnconv: outputMasked (cached)") ;
     packed_data_geom_display(&allOnesGeom, "vl_nnconv: allOnes") ;
     packed_data_geom_display(&allOnes.geom, "vl_nnconv: allOnes (cached)") ;
     if (convIndicesMode) {
       packed_data_geom_display(&convIndices.geom, "vl_nnconv: convIndices") ;
     }
+    if (interpolationMode) {
+      packed_data_geom_display(&interpolationIndices.geom, "vl_nnconv: interpolationIndices") ;
+    }
+    if (maskMode) {
+      packed_data_geom_display(&maskIndices.geom, "vl_nnconv: maskIndices") ;
+    }
   }
 
   if (backMode) {
@@ -892,8 +1243,70 @@ void mexFunction(int nout, mxArray *out[],
   /*                                                    Do the work */
   /* -------------------------------------------------------------- */
 
+  /* a non-zero NumThreads, Blas and Simd apply to this call only */
+  if (numThreads > 0) {
+    previousNumThreads = vl_set_num_threads(numThreads) ;
+    previousBlasNumThreads = vl_blas_set_num_threads(numThreads) ;
+  }
+  previousBlasBackend = vl_blas_set_backend(blasBackend) ;
+  if (simd) {
+    previousSimd = vl_indexed_simd_name() ;
+    vl_indexed_simd_force(simd) ;
+  }
+
+  /* 'auto' is resolved by timing the CPU code (on the GPU it means one) */
+  if (autoMicrobatchSize && convIndicesMode && hasFilters && !gpuMode && !plan && !implicitGemm) {
+    microbatchSize = perfcnn::convIndexedAutoMicrobatchSize(packed_data_get_tensor(&data).geom,
+                                                            packed_data_get_tensor(&filters).geom,
+                                                            packed_data_get_index_tensor(&convIndices),
+                                                            layout) ;
+    if (verbosity > 0) {
+      mexPrintf("vl_nnconv: automatic microbatchSize: %d\n", microbatchSize) ;
+    }
+  }
+
+  /* the plan workspace is sized for the threads available at its creation */
+  if (createPlan) {
+    perfcnn::ConvIndexedPlan * newPlan ;
+    if (perfcnn::convIndexedPlanCreate(newPlan,
+                                       packed_data_get_tensor(&data).geom,
+                                       packed_data_get_tensor(&filters).geom,
+                                       packed_data_get_index_tensor(&convIndices),
+                                       microbatchSize,
+                                       layout) != perfcnn::vlSuccess) {
+      restore_call_settings(numThreads, previousNumThreads, previousBlasNumThreads, previousBlasBackend, previousSimd) ;
+      mexErrMsgTxt(perfcnn::getLastErrorMessage()) ;
+    }
+    restore_call_settings(numThreads, previousNumThreads, previousBlasNumThreads, previousBlasBackend, previousSimd) ;
+    packed_data_deinit(&data) ;
+    packed_data_deinit(&filters) ;
+    packed_data_deinit(&biases) ;
+    packed_data_deinit(&convIndices) ;
+    packed_data_deinit(&derFiltersInit) ;
+    packed_data_deinit(&derBiasesInit) ;
+    out[OUT_RESULT] = plan_create_handle(newPlan) ;
+    return ;
+  }
+
+  /* the CPU indexed convolution needs a temp buffer per thread,
+     except for the implicit GEMM forward pass which needs none;
+     a plan and the Winograd convolution have their own buffers */
+  if (plan || winogradMode || (convIndicesMode && hasFilters && !gpuMode && implicitGemm && !backMode)) {
+    packed_data_geom_init(&tempGeom, mxSINGLE_CLASS, 0, 0, 0, 0) ;
+  } else if (convIndicesMode && hasFilters && !gpuMode) {
+    perfcnn::ConvIndexedWorkspace workspace ;
+    perfcnn::convIndexedGetWorkspaceSize(workspace,
+                                         packed_data_get_tensor(&data).geom,
+                                         packed_data_get_tensor(&filters).geom,
+                                         packed_data_get_index_tensor(&convIndices),
+                                         microbatchSize,
+                                         layout,
+                                         interpolationMode && !backMode) ;
+    packed_data_geom_init(&tempGeom, mxSINGLE_CLASS, workspace.tempSize, 1, 1, 1) ;
+  }
+
   /* auxiliary buffers */
-  if (hasBiases) {
+  if (hasBiases && gpuMode) {
     if (allOnes.memorySize < allOnesGeom.numElements * sizeof(float) ||
         (allOnes.mode == matlabGpuArray || allOnes.mode == matlabGpuArrayWrapper) != gpuMode) {
       packed_data_deinit (&allOnes) ;
@@ -912,15 +1325,18 @@ void mexFunction(int nout, mxArray *out[],
     packed_data_deinit (&derOutputMasked) ;
     packed_data_init_with_geom (&derOutputMasked, gpuMode, derOutputMaskedGeom, true, false, 0);
   }
-  if (outputMasked.memorySize < outputMaskedGeom.numElements * sizeof(float) ||
-      (outputMasked.mode == matlabGpuArray || outputMasked.mode == matlabGpuArrayWrapper) != gpuMode) {
-    packed_data_deinit (&outputMasked) ;
-    packed_data_init_with_geom (&outputMasked, gpuMode, outputMaskedGeom, true, false, 0);
-  }
   if (!backMode) {
-    packed_data_init_with_geom(&output, gpuMode, outputGeom, false, false, 0) ;
+    if (channelLast) {
+      packed_data_init_with_geom(&output, gpuMode, packed_data_geom_to_channel_last(outputGeom), false, false, 0) ;
+      output.geom = outputGeom ;
+    } else {
+      packed_data_init_with_geom(&output, gpuMode, outputGeom, false, false, 0) ;
+    }
   } else {
-    if (computeDerData) {
+    if (computeDerData && channelLast) {
+      packed_data_init_with_geom(&derData, gpuMode, packed_data_geom_to_channel_last(derDataGeom), false, false, 0) ;
+      derData.geom = derDataGeom ;
+    } else if (computeDerData) {
       packed_data_init_with_geom(&derData, gpuMode, derDataGeom, false, false, 0) ;
     }
     if (computeDerFilters) {
@@ -972,7 +1388,11 @@ void mexFunction(int nout, mxArray *out[],
                       output.memory, data.memory,
                       filtersVolume * data.geom.size) ;
       }
-      if (hasBiases) {
+      if (!gpuMode && (hasBiases || relu)) {
+        bias_relu_rows_cpu<float>(output.memory, filters.geom.size,
+                                  hasBiases ? biases.memory : NULL,
+                                  filters.geom.size, data.geom.size, relu) ;
+      } else if (hasBiases) {
         float beta = 1 ;
         ptrdiff_t q = 1 ;
         sgemm_dispatch(gpuMode, 'n', 'n',
@@ -994,7 +1414,11 @@ void mexFunction(int nout, mxArray *out[],
                        (float)(derFiltersInitialized > 0),
                        derFilters.memory, filtersVolume) ;
       }
-      if (computeDerBiases && hasBiases) {
+      if (computeDerBiases && hasBiases && !gpuMode) {
+        sum_rows_cpu<float>(derBiases.memory, derOutput.memory, filters.geom.size,
+                            filters.geom.size, data.geom.size,
+                            derBiasesInitialized) ;
+      } else if (computeDerBiases && hasBiases) {
         ptrdiff_t q = 1 ;
         sgemm_dispatch(gpuMode, 'n', 't',
                        q, filters.geom.size, data.geom.size,
@@ -1021,32 +1445,124 @@ void mexFunction(int nout, mxArray *out[],
         }
       }
     }
+  } else if (winogradMode) {
+    perfcnn::ConvOptions convOptions ;
+    convOptions.padTop = padTop ;
+    convOptions.padBottom = padBottom ;
+    convOptions.padLeft = padLeft ;
+    convOptions.padRight = padRight ;
+    if (perfcnn::convWinogradForward(packed_data_get_tensor(&output),
+                                     packed_data_get_tensor(&data),
+                                     packed_data_get_tensor(&filters),
+                                     hasBiases ? packed_data_get_tensor(&biases) : perfcnn::Tensor(),
+                                     convOptions,
+                                     maskMode ? packed_data_get_index_tensor(&maskIndices) : perfcnn::IndexTensor(),
+                                     relu) != perfcnn::vlSuccess) {
+      restore_call_settings(numThreads, previousNumThreads, previousBlasNumThreads, previousBlasBackend, previousSimd) ;
+      mexErrMsgTxt(perfcnn::getLastErrorMessage()) ;
+    }
+  } else if (convIndicesMode && hasFilters && !gpuMode) {
+    // The CPU implementation lives in libperfcnn (bits/perfcnn.cpp)
+    perfcnn::ConvIndexedWorkspace workspace ;
+    perfcnn::Error error ;
+    workspace.temp = temp.memory ;
+    workspace.tempSize = temp.memorySize / sizeof(float) ;
+    if (plan && !backMode) {
+      error = perfcnn::convIndexedPlanForward(plan,
+                                              packed_data_get_tensor(&output, layout),
+                                              packed_data_get_tensor(&data, layout),
+                                              packed_data_get_tensor(&filters),
+                                              hasBiases ? packed_data_get_tensor(&biases) : perfcnn::Tensor(),
+                                              relu) ;
+    } else if (plan) {
+      error = perfcnn::convIndexedPlanBackward(plan,
+                                               computeDerData ? packed_data_get_tensor(&derData, layout) : perfcnn::Tensor(),
+                                               computeDerFilters ? packed_data_get_tensor(&derFilters) : perfcnn::Tensor(),
+                                               (computeDerBiases && hasBiases) ? packed_data_get_tensor(&derBiases) : perfcnn::Tensor(),
+                                               packed_data_get_tensor(&data, layout),
+                                               packed_data_get_tensor(&filters),
+                                               packed_data_get_tensor(&derOutput, layout),
+                                               derFiltersInitialized,
+                                               derBiasesInitialized) ;
+    } else if (!backMode && implicitGemm) {
+      error = perfcnn::convIndexedForwardGatherGemm(packed_data_get_tensor(&output),
+                                                    packed_data_get_tensor(&data),
+                                                    packed_data_get_tensor(&filters),
+                                                    hasBiases ? packed_data_get_tensor(&biases) : perfcnn::Tensor(),
+                                                    packed_data_get_index_tensor(&convIndices),
+                                                    relu) ;
+    } else if (!backMode && interpolationMode) {
+      error = perfcnn::convIndexedForwardInterpolated(packed_data_get_tensor(&output, layout),
+                                                      packed_data_get_tensor(&data, layout),
+                                                      packed_data_get_tensor(&filters),
+                                                      hasBiases ? packed_data_get_tensor(&biases) : perfcnn::Tensor(),
+                                                      packed_data_get_index_tensor(&convIndices),
+                                                      packed_data_get_index_tensor(&interpolationIndices),
+                                                      microbatchSize,
+                                                      workspace,
+                                                      relu) ;
+    } else if (!backMode) {
+      error = perfcnn::convIndexedForward(packed_data_get_tensor(&output, layout),
+                                          packed_data_get_tensor(&data, layout),
+                                          packed_data_get_tensor(&filters),
+                                          hasBiases ? packed_data_get_tensor(&biases) : perfcnn::Tensor(),
+                                          packed_data_get_index_tensor(&convIndices),
+                                          microbatchSize,
+                                          workspace,
+                                          relu) ;
+    } else {
+      // with interpolation, the derivative is first summed back to the computed pixels
+      perfcnn::Tensor derOutputTensor = packed_data_get_tensor(&derOutput, layout) ;
+      if (interpolationMode) {
+        perfcnn::Tensor derOutputCompact(derOutputMasked.memory,
+                                         perfcnn::TensorGeometry(compactGeom.height,
+                                                                 compactGeom.width,
+                                                                 compactGeom.depth,
+                                                                 compactGeom.size),
+                                         layout) ;
+        error = perfcnn::interpolateBackward(derOutputCompact,
+                                             derOutputTensor,
+                                             packed_data_get_index_tensor(&interpolationIndices)) ;
+        if (error != perfcnn::vlSuccess) {
+          restore_call_settings(numThreads, previousNumThreads, previousBlasNumThreads, previousBlasBackend, previousSimd) ;
+          mexErrMsgTxt(perfcnn::getLastErrorMessage()) ;
+        }
+        derOutputTensor = derOutputCompact ;
+      }
+      error = perfcnn::convIndexedBackward(computeDerData ? packed_data_get_tensor(&derData, layout) : perfcnn::Tensor(),
+                                           computeDerFilters ? packed_data_get_tensor(&derFilters) : perfcnn::Tensor(),
+                                           (computeDerBiases && hasBiases) ? packed_data_get_tensor(&derBiases) : perfcnn::Tensor(),
+                                           packed_data_get_tensor(&data, layout),
+                                           packed_data_get_tensor(&filters),
+                                           derOutputTensor,
+                                           packed_data_get_index_tensor(&convIndices),
+                                           microbatchSize,
+                                           derFiltersInitialized,
+                                           derBiasesInitialized,
+                                           workspace) ;
+    }
+    if (error != perfcnn::vlSuccess) {
+      restore_call_settings(numThreads, previousNumThreads, previousBlasNumThreads, previousBlasBackend, previousSimd) ;
+      mexErrMsgTxt(perfcnn::getLastErrorMessage()) ;
+    }
   } else if (convIndicesMode && hasFilters) {
-    // microbatchSize specifies the number of images to stack for GEMM
+    // microbatchSize specifies the number of images to stack for im2col; the rows of
+    // each image form a submatrix of temp, so the GEMMs are done image by image
+    // directly on output and derOutput (see bits/perfcnn.cpp)
     const int numMicrobatches = (data.geom.size + microbatchSize - 1) / microbatchSize;
     for (int microbatchIdx = 0; microbatchIdx < numMicrobatches; ++microbatchIdx) {
       int image = microbatchIdx * microbatchSize;
       int numImages = (microbatchIdx != numMicrobatches - 1) ? microbatchSize : (data.geom.size - image);
 
       ptrdiff_t dataOffset = (data.geom.height*data.geom.width*data.geom.depth) * image ;
-      ptrdiff_t outputOffset = (output.geom.height*output.geom.width*output.geom.depth) * image ;
+      ptrdiff_t outputVolume = outputGeom.height*outputGeom.width*outputGeom.depth ;
       ptrdiff_t derDataOffset = (derData.geom.height*derData.geom.width*derData.geom.depth) * image ;
-      ptrdiff_t derOutputOffset = (derOutput.geom.height*derOutput.geom.width*derOutput.geom.depth) * image ;
       ptrdiff_t m = outputGeom.height * outputGeom.width ; /* num output pixels */
       ptrdiff_t numRows = m * numImages ;
       ptrdiff_t n = filters.geom.size/numGroups ; /* num filters per group */
       ptrdiff_t k = filters.geom.height*filters.geom.width*filters.geom.depth ; /* filter volume */
 
       if (backMode) {
-        if (numImages > 1) {
-          transpose23_dispatch(gpuMode,
-                               outputMasked.memory,
-                               derOutput.memory + derOutputOffset,
-                               m, derOutput.geom.depth, numImages) ;
-        }
-
-        float *curDerOutputMemory = numImages > 1 ? outputMasked.memory : derOutput.memory + derOutputOffset;
-
         /* compute derFilters dz/dF */
         if (computeDerFilters) {
           im2col_indexed_dispatch(gpuMode,
@@ -1057,48 +1573,54 @@ void mexFunction(int nout, mxArray *out[],
                                   data.geom.height, data.geom.width, data.geom.depth, numImages,
                                   filters.geom.height, filters.geom.width) ;
           for (int g = 0 ; g < numGroups ; ++ g) {
-            ptrdiff_t filterGrpOffset = k * n * g ;
-            ptrdiff_t tempGrpOffset = numRows * k * g ;
-            ptrdiff_t derOutputGrpOffset = numRows * n * g ;
-            float alpha = 1 ;
-            float beta = (image > 0 || derFiltersInitialized) ; /* this saves init. the output array with 0 */
-            sgemm_dispatch(gpuMode, 't', 'n',
-                           k, n, numRows,
-                           alpha,
-                           temp.memory + tempGrpOffset, numRows,
-                           curDerOutputMemory + derOutputGrpOffset, numRows,
-                           beta,
-                           derFilters.memory + filterGrpOffset, k) ;
+            for (int s = 0 ; s < numImages ; ++ s) {
+              ptrdiff_t filterGrpOffset = k * n * g ;
+              ptrdiff_t tempGrpOffset = numRows * k * g + m * s ;
+              ptrdiff_t derOutputGrpOffset = outputVolume * (image + s) + m * n * g ;
+              float alpha = 1 ;
+              float beta = (image > 0 || s > 0 || derFiltersInitialized) ; /* this saves init. the output array with 0 */
+              sgemm_dispatch(gpuMode, 't', 'n',
+                             k, n, m,
+                             alpha,
+                             temp.memory + tempGrpOffset, numRows,
+                             derOutput.memory + derOutputGrpOffset, m,
+                             beta,
+                             derFilters.memory + filterGrpOffset, k) ;
+            }
           }
         }
 
         /* compute derData dz/dbias */
         if (computeDerBiases & hasBiases) {
-          sgemv_dispatch(gpuMode, 't',
-                         numRows, filters.geom.size,
-                         1, /* alpha */
-                         curDerOutputMemory, numRows,
-                         allOnes.memory, 1,
-                         (float)(image > 0 || derBiasesInitialized), /* beta */
-                         derBiases.memory, 1) ;
+          for (int s = 0 ; s < numImages ; ++ s) {
+            sgemv_dispatch(gpuMode, 't',
+                           m, filters.geom.size,
+                           1, /* alpha */
+                           derOutput.memory + outputVolume * (image + s), m,
+                           allOnes.memory, 1,
+                           (float)(image > 0 || s > 0 || derBiasesInitialized), /* beta */
+                           derBiases.memory, 1) ;
+          }
         }
 
         /* compute derData dz/dx */
         if (computeDerData) {
           for (int g = 0 ; g < numGroups ; ++ g) {
-            ptrdiff_t filterGrpOffset = k * n * g ;
-            ptrdiff_t tempGrpOffset = numRows * k * g ;
-            ptrdiff_t derOutputGrpOffset = numRows * n * g ;
-            float alpha = 1 ;
-            float beta = 0 ;
-            sgemm_dispatch(gpuMode, 'n', 't',
-                           numRows, k, n,
-                           alpha,
-                           curDerOutputMemory + derOutputGrpOffset, numRows,
-                           filters.memory + filterGrpOffset, k,
-                           beta,
-                           temp.memory + tempGrpOffset,
-                           numRows) ;
+            for (int s = 0 ; s < numImages ; ++ s) {
+              ptrdiff_t filterGrpOffset = k * n * g ;
+              ptrdiff_t tempGrpOffset = numRows * k * g + m * s ;
+              ptrdiff_t derOutputGrpOffset = outputVolume * (image + s) + m * n * g ;
+              float alpha = 1 ;
+              float beta = 0 ;
+              sgemm_dispatch(gpuMode, 'n', 't',
+                             m, k, n,
+                             alpha,
+                             derOutput.memory + derOutputGrpOffset, m,
+                             filters.memory + filterGrpOffset, k,
+                             beta,
+                             temp.memory + tempGrpOffset,
+                             numRows) ;
+            }
           }
           col2im_indexed_dispatch(gpuMode,
                                   derData.memory + derDataOffset,
@@ -1109,8 +1631,6 @@ void mexFunction(int nout, mxArray *out[],
                                   filters.geom.height, filters.geom.width);
         }
       } else {
-        float *curOutputMemory = numImages > 1 ? outputMasked.memory : output.memory + outputOffset;
-
         im2col_indexed_dispatch(gpuMode,
                                 temp.memory,
                                 data.memory + dataOffset,
@@ -1119,39 +1639,36 @@ void mexFunction(int nout, mxArray *out[],
                                 data.geom.height, data.geom.width, data.geom.depth, numImages,
                                 filters.geom.height, filters.geom.width) ;
         for (int g = 0 ; g < numGroups ; ++ g) {
-          ptrdiff_t filterGrpOffset = k * n * g ;
-          ptrdiff_t tempGrpOffset = numRows * k * g ;
-          ptrdiff_t outputGrpOffset = numRows * n * g  ;
-          float alpha = 1 ;
-          float beta = 0 ;
-          sgemm_dispatch(gpuMode, 'n', 'n',
-                         numRows, n, k,
-                         alpha,
-                         temp.memory + tempGrpOffset, numRows,
-                         filters.memory + filterGrpOffset, k,
-                         beta,
-                         curOutputMemory + outputGrpOffset,
-                         numRows) ;
+          for (int s = 0 ; s < numImages ; ++ s) {
+            ptrdiff_t filterGrpOffset = k * n * g ;
+            ptrdiff_t tempGrpOffset = numRows * k * g + m * s ;
+            ptrdiff_t outputGrpOffset = outputVolume * (image + s) + m * n * g ;
+            float alpha = 1 ;
+            float beta = 0 ;
+            sgemm_dispatch(gpuMode, 'n', 'n',
+                           m, n, k,
+                           alpha,
+                           temp.memory + tempGrpOffset, numRows,
+                           filters.memory + filterGrpOffset, k,
+                           beta,
+                           output.memory + outputGrpOffset,
+                           m) ;
+          }
         }
         if (hasBiases) {
-          float alpha = 1 ;
-          float beta = 1 ;
-          ptrdiff_t q = 1 ;
-          sgemm_dispatch(gpuMode, 'n', 'n',
-                         numRows, biases.geom.numElements, q,
-                         alpha,
-                         allOnes.memory, numRows,
-                         biases.memory, q,
-                         beta,
-                         curOutputMemory,
-                         numRows) ;
-        }
-
-        if (numImages > 1) {
-          transpose23_dispatch(gpuMode,
-                               output.memory + outputOffset,
-                               outputMasked.memory,
-                               m, numImages, output.geom.depth) ;
+          for (int s = 0 ; s < numImages ; ++ s) {
+            float alpha = 1 ;
+            float beta = 1 ;
+            ptrdiff_t q = 1 ;
+            sgemm_dispatch(gpuMode, 'n', 'n',
+                           m, biases.geom.numElements, q,
+                           alpha,
+                           allOnes.memory, m,
+                           biases.memory, q,
+                           beta,
+                           output.memory + outputVolume * (image + s),
+                           m) ;
+          }
         }
       }
     }
@@ -1196,24 +1713,26 @@ void mexFunction(int nout, mxArray *out[],
           } else {
             tempMemory = data.memory + dataOffset;
           }
-          for (int g = 0 ; g < numGroups ; ++ g) {
-            ptrdiff_t filterGrpOffset = k * n * g ;
-            ptrdiff_t tempGrpOffset = m * k * g ;
-            ptrdiff_t derOutputGrpOffset = m * n * g ;
+          {
             float alpha = 1 ;
             float beta = (image > 0 || derFiltersInitialized) ; /* this saves init. the output array with 0 */
-            sgemm_dispatch(gpuMode, 't', 'n',
-                           k, n, m,
-                           alpha,
-                           tempMemory + tempGrpOffset, m,
-                           derOutput.memory + derOutputOffset + derOutputGrpOffset, m,
-                           beta,
-                           derFilters.memory + filterGrpOffset, k) ;
+            sgemm_batched_dispatch(gpuMode, 't', 'n',
+                                   k, n, m,
+                                   alpha,
+                                   tempMemory, m, m * k,
+                                   derOutput.memory + derOutputOffset, m, m * n,
+                                   beta,
+                                   derFilters.memory, k, k * n,
+                                   numGroups) ;
           }
         }
 
         /* compute derBiases dz/dbias */
-        if (computeDerBiases & hasBiases) {
+        if ((computeDerBiases & hasBiases) && !gpuMode) {
+          sum_columns_cpu<float>(derBiases.memory, derOutput.memory + derOutputOffset, m,
+                                 m, filters.geom.size,
+                                 image > 0 || derBiasesInitialized) ;
+        } else if (computeDerBiases & hasBiases) {
           sgemv_dispatch(gpuMode, 't',
                          m, filters.geom.size,
                          1, /* alpha */
@@ -1232,21 +1751,14 @@ void mexFunction(int nout, mxArray *out[],
               tempMemory = derData.memory + derDataOffset;
             }
 
-            for (int g = 0 ; g < numGroups ; ++ g) {
-              ptrdiff_t filterGrpOffset = k * n * g ;
-              ptrdiff_t tempGrpOffset = m * k * g ;
-              ptrdiff_t derOutputGrpOffset = m * n * g ;
-              float alpha = 1 ;
-              float beta = 0 ;
-              sgemm_dispatch(gpuMode, 'n', 't',
-                             m, k, n,
-                             alpha,
-                             derOutput.memory + derOutputOffset + derOutputGrpOffset, m,
-                             filters.memory + filterGrpOffset, k,
-                             beta,
-                             tempMemory + tempGrpOffset,
-                             m) ;
-            }
+            sgemm_batched_dispatch(gpuMode, 'n', 't',
+                                   m, k, n,
+                                   1.0f, /* alpha */
+                                   derOutput.memory + derOutputOffset, m, m * n,
+                                   filters.memory, k, k * n,
+                                   0.0f, /* beta */
+                                   tempMemory, m, m * k,
+                                   numGroups) ;
             if (!is_1x1) {
               col2im_dispatch(gpuMode,
                               derData.memory + derDataOffset,
@@ -1282,19 +1794,19 @@ void mexFunction(int nout, mxArray *out[],
           } else {
             tempMemory = data.memory + dataOffset;
           }
-          for (int g = 0 ; g < numGroups ; ++ g) {
-            ptrdiff_t filterGrpOffset = k * n * g ;
-            ptrdiff_t tempGrpOffset = m * k * g ;
-            ptrdiff_t outputGrpOffset = m * n * g  ;
-            float alpha = 1 ;
-            float beta = 0 ;
-            sgemm_dispatch(gpuMode, 'n', 'n',
-                           m, n, k,
-                           alpha,
-                           tempMemory + tempGrpOffset, m,
-                           filters.memory + filterGrpOffset, k,
-                           beta,
-                           output.memory + outputOffset + outputGrpOffset, m) ;
+          sgemm_batched_dispatch(gpuMode, 'n', 'n',
+                                 m, n, k,
+                                 1.0f, /* alpha */
+                                 tempMemory, m, m * k,
+                                 filters.memory, k, k * n,
+                                 0.0f, /* beta */
+                                 output.memory + outputOffset, m, m * n,
+                                 numGroups) ;
+          /* on the CPU, finish the image while it is in the cache */
+          if (!gpuMode && (hasBiases || relu)) {
+            bias_relu_columns_cpu<float>(output.memory + outputOffset, m,
+                                         hasBiases ? biases.memory : NULL,
+                                         m, filters.geom.size, relu) ;
           }
         } else {
           /* no filters: identity */
@@ -1304,9 +1816,14 @@ void mexFunction(int nout, mxArray *out[],
                              data.geom.height, data.geom.width, data.geom.depth,
                              strideY, strideX,
                              padTop, padBottom, padLeft, padRight) ;
+          if (!gpuMode && (hasBiases || relu)) {
+            bias_relu_columns_cpu<float>(output.memory + outputOffset, m,
+                                         hasBiases ? biases.memory : NULL,
+                                         m, filters.geom.size, relu) ;
+          }
         }
 
-        if (hasBiases) {
+        if (hasBiases && gpuMode) {
           float alpha = 1 ;
           float beta = 1 ;
           ptrdiff_t q = 1 ;
@@ -1326,12 +1843,20 @@ void mexFunction(int nout, mxArray *out[],
   /*                                                        Cleanup */
   /* -------------------------------------------------------------- */
 
+  restore_call_settings(numThreads, previousNumThreads, previousBlasNumThreads, previousBlasBackend, previousSimd) ;
+
   packed_data_deinit(&data) ;
   packed_data_deinit(&filters) ;
   packed_data_deinit(&biases) ;
   if (convIndicesMode) {
     packed_data_deinit(&convIndices);
   }
+  if (interpolationMode) {
+    packed_data_deinit(&interpolationIndices) ;
+  }
+  if (maskMode) {
+    packed_data_deinit(&maskIndices) ;
+  }
   if (backMode) {
     packed_data_deinit(&derOutput) ;
     out[OUT_RESULT] = (computeDerData) ? packed_data_deinit_extracting_array(&derData) : mxCreateDoubleMatrix(0,0,mxREAL) ;
@@ -13,12 +13,12 @@
 
 #include "bits/mexutils.h"
 #include "bits/nnhelper.h"
-#include "bits/im2col.hpp"
+#include "bits/perfcnn.hpp"
 
 #include <assert.h>
 #include <algorithm>
+#include <vector>
 
-#include <blas.h>
 
 /* option codes */
 enum {
@@ -26,6 +26,8 @@ enum {
   opt_pad,
   opt_in_indices,
   opt_mask_indices,
+  opt_run_length,
+  opt_order,
   opt_verbose,
 } ;
 
@@ -35,10 +37,20 @@ vlmxOption  options [] = {
   {"Pad",              1,   opt_pad                },
   {"InIndices",        1,   opt_in_indices         },
   {"MaskIndices",      1,   opt_mask_indices       },
+  {"RunLength",        0,   opt_run_length         },
+  {"Order",            1,   opt_order              },
   {"Verbose",          0,   opt_verbose            },
   {0,                  0,   0                      }
 } ;
 
+VlEnumerator nnMaskOrderTypes [] =
+{
+  {"Given",    (vl_index)perfcnn::maskOrderGiven  },
+  {"Memory",   (vl_index)perfcnn::maskOrderMemory },
+  {"Morton",   (vl_index)perfcnn::maskOrderMorton },
+  {0,          0                                  }
+} ;
+
 /* ---------------------------------------------------------------- */
 /*                                                       MEX driver */
 /* ---------------------------------------------------------------- */
@@ -48,7 +60,7 @@ enum {
 } ;
 
 enum {
-  OUT_RESULT = 0, OUT_END
+  OUT_RESULT = 0, OUT_ORDER, OUT_END
 } ;
 
 void mexFunction(int nout, mxArray *out[],
@@ -60,8 +72,20 @@ void mexFunction(int nout, mxArray *out[],
 
   /* outputs */
   PackedData convIndices ;
+  PackedData encodedIndices ;
+  PackedData order ;
 
   PackedDataGeometry convIndicesGeom ;
+  PackedDataGeometry orderGeom ;
+
+  perfcnn::TensorGeometry dataGeom ;
+  perfcnn::TensorGeometry filtersGeom ;
+  perfcnn::TensorGeometry geom ;
+  perfcnn::TensorGeometry outputGeom ;
+  perfcnn::ConvOptions convOptions ;
+  perfcnn::MaskOrder orderMethod = perfcnn::maskOrderGiven ;
+  std::vector<int> orderedMaskIndices ;
+  perfcnn::Error error ;
 
   int dataWidth, dataHeight, dataDepth, dataSize ;
   int filtersWidth, filtersHeight, filtersDepth, filtersSize ;
@@ -77,15 +101,19 @@ void mexFunction(int nout, mxArray *out[],
 
   bool inMaskMode = false;
   bool maskMode = false;
+  bool runLengthMode = false ;
 
   int verbosity = 0 ;
   int opt ;
   int next = IN_END ;
   mxArray const *optarg ;
+  VlEnumerator *pair ;
 
   packed_data_init_empty(&inIndices) ;
   packed_data_init_empty(&maskIndices) ;
   packed_data_init_empty(&convIndices) ;
+  packed_data_init_empty(&encodedIndices) ;
+  packed_data_init_empty(&order) ;
 
   /* -------------------------------------------------------------- */
   /*                                            Check the arguments */
@@ -157,6 +185,18 @@ void mexFunction(int nout, mxArray *out[],
         }
         break;
 
+      case opt_run_length :
+        runLengthMode = true ;
+        break ;
+
+      case opt_order :
+        pair = vlmxDecodeEnumeration(optarg, nnMaskOrderTypes, VL_TRUE) ;
+        if (pair == NULL) {
+          vlmxError(vlmxErrInvalidArgument, "ORDER is not a supported order.") ;
+        }
+        orderMethod = (perfcnn::MaskOrder)pair->value ;
+        break ;
+
       default: break ;
     }
   }
@@ -183,10 +223,6 @@ void mexFunction(int nout, mxArray *out[],
   filtersDepth = (int)mxGetPr(in[IN_FILTERS_SIZE])[2];
   filtersSize = (int)mxGetPr(in[IN_FILTERS_SIZE])[3];
 
-  if (strideX < 1 || strideY < 1) {
-    mexErrMsgTxt("At least one element of STRIDE is smaller than one.") ;
-  }
-
   if (inMaskMode && (inIndices.geom.classID != mxINT32_CLASS)) {
     mexErrMsgTxt("ININDICES is not of class INT32.");
   }
@@ -195,12 +231,6 @@ void mexFunction(int nout, mxArray *out[],
     mexErrMsgTxt("MASKINDICES is not of class INT32.");
   }
 
-  int outputGeomHeight = (dataHeight + (padTop+padBottom) - filtersHeight)/strideY + 1;
-  int outputGeomWidth = (dataWidth + (padLeft+padRight) - filtersWidth)/strideX + 1;
-
-  /* grouped filters */
-  numGroups = dataDepth / filtersDepth ;
-
   if (inMaskMode) {
     if (inIndices.geom.height != dataHeight ||
         inIndices.geom.width != dataWidth) {
@@ -229,18 +259,41 @@ void mexFunction(int nout, mxArray *out[],
     maskIndicesLength = maskIndices.geom.height;
   }
 
+  if (!maskMode && (orderMethod != perfcnn::maskOrderGiven || nout > 1)) {
+    mexErrMsgTxt("ORDER requires MASKINDICES.") ;
+  }
+
+  dataGeom = perfcnn::TensorGeometry(dataHeight, dataWidth, dataDepth, dataSize) ;
+  filtersGeom = perfcnn::TensorGeometry(filtersHeight, filtersWidth, filtersDepth, filtersSize) ;
+  convOptions.strideY = strideY ;
+  convOptions.strideX = strideX ;
+  convOptions.padTop = padTop ;
+  convOptions.padBottom = padBottom ;
+  convOptions.padLeft = padLeft ;
+  convOptions.padRight = padRight ;
+
+  error = perfcnn::convIndicesGeometry(geom, dataGeom, filtersGeom, convOptions,
+                                       maskMode ? maskIndicesLength : 0) ;
+  if (error != perfcnn::vlSuccess) {
+    mexErrMsgTxt(perfcnn::getLastErrorMessage()) ;
+  }
+
+  /* grouped filters */
+  numGroups = dataDepth / filtersDepth ;
+
   packed_data_geom_init(&convIndicesGeom,
                         mxINT32_CLASS,
-                        maskMode ? maskIndicesLength : outputGeomHeight,
-                        maskMode ? 1 : outputGeomWidth,
-                        filtersHeight * filtersWidth,
-                        1) ;
+                        geom.height,
+                        geom.width,
+                        geom.depth,
+                        geom.size) ;
 
   if (verbosity > 0) {
-    mexPrintf("vl_nnconvidx: stride: [%d %d], pad: [%d %d %d %d], numGroups: %d, has input mask: %d, has mask: %d\n",
+    mexPrintf("vl_nnconvidx: stride: [%d %d], pad: [%d %d %d %d], numGroups: %d, has input mask: %d, has mask: %d, run-length: %d, order: %s\n",
               strideY, strideX,
               padTop, padBottom, padLeft, padRight,
-              numGroups, inMaskMode, maskMode) ;
+              numGroups, inMaskMode, maskMode, runLengthMode,
+              vl_enumeration_get_by_value(nnMaskOrderTypes, orderMethod)->name) ;
     mexPrintf("vl_nnconvidx: data: [%d %d %d %d], filters: [%d %d %d %d]\n",
               dataHeight, dataWidth, dataSize, dataDepth,
               filtersHeight, filtersWidth, filtersSize, filtersDepth);
@@ -253,45 +306,65 @@ void mexFunction(int nout, mxArray *out[],
     }
   }
 
-  if (numGroups * filtersDepth != dataDepth) {
-    mexErrMsgTxt("The filter depth does not divide the image depth.") ;
-  }
+  /* -------------------------------------------------------------- */
+  /*                                                    Do the work */
+  /* -------------------------------------------------------------- */
 
-  if (filtersSize % numGroups != 0) {
-    mexErrMsgTxt("The number of filter groups does not divide the total number of filters.") ;
+  /* the columns of CONVINDICES follow MASKINDICES(ORDER + 1) */
+  if (maskMode) {
+    error = perfcnn::convIndicesGeometry(outputGeom, dataGeom, filtersGeom, convOptions, 0) ;
+    if (error != perfcnn::vlSuccess) {
+      mexErrMsgTxt(perfcnn::getLastErrorMessage()) ;
+    }
+    packed_data_geom_init(&orderGeom, mxINT32_CLASS, maskIndicesLength, 1, 1, 1) ;
+    packed_data_init_with_geom_int(&order, false, orderGeom, false, false, 0) ;
+    error = perfcnn::maskIndicesOrder(packed_data_get_index_tensor(&order),
+                                      packed_data_get_index_tensor(&maskIndices),
+                                      outputGeom.height, outputGeom.width,
+                                      orderMethod) ;
+    if (error != perfcnn::vlSuccess) {
+      mexErrMsgTxt(perfcnn::getLastErrorMessage()) ;
+    }
+    orderedMaskIndices.resize(maskIndicesLength) ;
+    for (int i = 0 ; i < maskIndicesLength ; ++i) {
+      orderedMaskIndices[i] = maskIndices.memoryInt[order.memoryInt[i]] ;
+    }
   }
 
-  if (padLeft < 0 ||
-      padRight < 0 ||
-      padTop < 0 ||
-      padBottom < 0) {
-    mexErrMsgTxt("An element of PAD is negative.") ;
-  }
+  packed_data_init_with_geom_int(&convIndices, false, convIndicesGeom, false, false, 0) ;
 
-  if (dataHeight + (padTop+padBottom) < filtersHeight ||
-      dataWidth + (padLeft+padRight) < filtersWidth) {
-    mexErrMsgTxt("FILTERS are larger than the DATA (including padding).") ;
+  error = perfcnn::convIndices(packed_data_get_index_tensor(&convIndices),
+                               dataGeom, filtersGeom, convOptions,
+                               inMaskMode ? inIndices.memoryInt : NULL,
+                               maskMode ? &orderedMaskIndices[0] : NULL,
+                               maskMode ? maskIndicesLength : 0) ;
+  if (error != perfcnn::vlSuccess) {
+    mexErrMsgTxt(perfcnn::getLastErrorMessage()) ;
   }
 
-  if (filtersHeight == 0 || filtersWidth == 0 || filtersDepth == 0) {
-    mexErrMsgTxt("A dimension of FILTERS is void.") ;
+  /* one list of runs per window offset */
+  if (runLengthMode) {
+    PackedDataGeometry encodedGeom ;
+    error = perfcnn::runLengthEncodeGeometry(geom,
+                                             packed_data_get_index_tensor(&convIndices),
+                                             convIndicesGeom.height * convIndicesGeom.width) ;
+    if (error != perfcnn::vlSuccess) {
+      mexErrMsgTxt(perfcnn::getLastErrorMessage()) ;
+    }
+    packed_data_geom_init(&encodedGeom, mxINT32_CLASS, geom.height, geom.width, geom.depth, geom.size) ;
+    packed_data_init_with_geom_int(&encodedIndices, false, encodedGeom, false, false, 0) ;
+    error = perfcnn::runLengthEncode(packed_data_get_index_tensor(&encodedIndices),
+                                     packed_data_get_index_tensor(&convIndices),
+                                     convIndicesGeom.height * convIndicesGeom.width) ;
+    if (error != perfcnn::vlSuccess) {
+      mexErrMsgTxt(perfcnn::getLastErrorMessage()) ;
+    }
+    if (verbosity > 0) {
+      packed_data_geom_display(&encodedGeom, "vl_nnconvidx: convIndices (run-length)") ;
+    }
+    packed_data_deinit(&convIndices) ;
   }
 
-  /* -------------------------------------------------------------- */
-  /*                                                    Do the work */
-  /* -------------------------------------------------------------- */
-
-  packed_data_init_with_geom_int(&convIndices, false, convIndicesGeom, false, false, 0) ;
-
-  conv_indices_cpu(convIndices.memoryInt, convIndices.geom.numElements,
-    inMaskMode ? inIndices.memoryInt : NULL,
-    maskMode ? maskIndices.memoryInt : NULL,
-    maskMode ? maskIndicesLength : outputGeomHeight * outputGeomWidth,
-    dataHeight, dataWidth, dataDepth,
-    filtersHeight, filtersWidth,
-    strideY, strideX,
-    padTop, padBottom, padLeft, padRight);
-
   /* -------------------------------------------------------------- */
   /*                                                        Cleanup */
   /* -------------------------------------------------------------- */
@@ -301,6 +374,15 @@ void mexFunction(int nout, mxArray *out[],
   }
   if (maskMode) {
     packed_data_deinit(&maskIndices);
+    if (nout > 1) {
+      out[OUT_ORDER] = packed_data_deinit_extracting_array(&order) ;
+    } else {
+      packed_data_deinit(&order) ;
+    }
+  }
+  if (runLengthMode) {
+    out[OUT_RESULT] = packed_data_deinit_extracting_array(&encodedIndices) ;
+  } else {
+    out[OUT_RESULT] = packed_data_deinit_extracting_array(&convIndices) ;
   }
-  out[OUT_RESULT] = packed_data_deinit_extracting_array(&convIndices) ;
 }
@@ -0,0 +1,5 @@
+/** @file vl_nninterpidx.cpp
+ ** @brief A non-CUDA wrapper
+ **/
+
+#include "vl_nninterpidx.cu"
\ No newline at end of file
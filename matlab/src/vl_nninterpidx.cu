@@ -0,0 +1,160 @@
+/** @file vl_nninterpidx.cu
+ ** @brief Nearest-neighbour interpolation indices of a perforation mask
+ ** @author Michael Figurnov
+ **/
+
+/*
+Copyright (C) 2015 Michael Figurnov.
+All rights reserved.
+
+This file is part of the VLFeat library and is made available under
+the terms of the BSD license (see the COPYING file).
+*/
+
+#include "bits/mexutils.h"
+#include "bits/nnhelper.h"
+#include "bits/perfcnn.hpp"
+
+#include <assert.h>
+
+/* option codes */
+enum {
+  opt_ties = 0,
+  opt_seed,
+  opt_verbose
+} ;
+
+/* options */
+vlmxOption  options [] = {
+  {"Ties",             1,   opt_ties              },
+  {"Seed",             1,   opt_seed              },
+  {"Verbose",          0,   opt_verbose           },
+  {0,                  0,   0                     }
+} ;
+
+VlEnumerator nnTiesTypes [] =
+{
+  {"First",    (vl_index)perfcnn::nearestTiesFirst  },
+  {"Nearest",  (vl_index)perfcnn::nearestTiesMemory },
+  {"Random",   (vl_index)perfcnn::nearestTiesRandom },
+  {0,          0                                    }
+} ;
+
+enum {
+  IN_MASKINDICES = 0, IN_SIZE, IN_END
+} ;
+
+enum {
+  OUT_RESULT = 0, OUT_END
+} ;
+
+void mexFunction(int nout, mxArray *out[],
+                 int nin, mxArray const *in[])
+{
+  /* inputs */
+  PackedData maskIndices ;
+
+  /* outputs */
+  PackedData outIndices ;
+  PackedDataGeometry outIndicesGeom ;
+
+  perfcnn::Error error ;
+  perfcnn::NearestTies ties = perfcnn::nearestTiesFirst ;
+  unsigned int seed = 0 ;
+  int height, width ;
+
+  int verbosity = 0 ;
+  int opt ;
+  int next = IN_END ;
+  mxArray const *optarg ;
+  VlEnumerator *pair ;
+
+  packed_data_init_empty(&maskIndices) ;
+  packed_data_init_empty(&outIndices) ;
+
+  /* -------------------------------------------------------------- */
+  /*                                            Check the arguments */
+  /* -------------------------------------------------------------- */
+
+  if (nin < 2) {
+    mexErrMsgTxt("The arguments are less than two.") ;
+  }
+
+  while ((opt = vlmxNextOption (in, nin, options, &next, &optarg)) >= 0) {
+    switch (opt) {
+      case opt_verbose :
+        ++ verbosity ;
+        break ;
+
+      case opt_ties :
+        pair = vlmxDecodeEnumeration(optarg, nnTiesTypes, VL_TRUE) ;
+        if (pair == NULL) {
+          vlmxError(vlmxErrInvalidArgument, "TIES is not a supported rule.") ;
+        }
+        ties = (perfcnn::NearestTies)pair->value ;
+        break ;
+
+      case opt_seed :
+        if (!vlmxIsPlainMatrix(optarg,1,1) || mxGetPr(optarg)[0] < 0) {
+          mexErrMsgTxt("SEED is not a non-negative scalar.") ;
+        }
+        seed = (unsigned int)mxGetPr(optarg)[0] ;
+        break ;
+
+      default: break ;
+    }
+  }
+
+  packed_data_init_with_array_int(&maskIndices, in[IN_MASKINDICES]) ;
+
+  if (maskIndices.mode == matlabGpuArrayWrapper) {
+    mexErrMsgTxt("MASKINDICES should be a CPU array.") ;
+  }
+  if (maskIndices.geom.classID != mxINT32_CLASS) {
+    mexErrMsgTxt("MASKINDICES is not of class INT32.") ;
+  }
+  if (maskIndices.geom.numElements == 0) {
+    mexErrMsgTxt("MASKINDICES is empty.") ;
+  }
+
+  if (!vlmxIsPlainMatrix(in[IN_SIZE],-1,-1)) {
+    mexErrMsgTxt("SIZE is not a plain matrix.") ;
+  }
+  if (mxGetNumberOfElements(in[IN_SIZE]) < 2) {
+    mexErrMsgTxt("SIZE has less than two elements.") ;
+  }
+  height = (int)mxGetPr(in[IN_SIZE])[0] ;
+  width = (int)mxGetPr(in[IN_SIZE])[1] ;
+  if (height < 1 || width < 1) {
+    mexErrMsgTxt("SIZE is not positive.") ;
+  }
+
+  packed_data_geom_init(&outIndicesGeom, mxINT32_CLASS, height, width, 1, 1) ;
+
+  if (verbosity > 0) {
+    mexPrintf("vl_nninterpidx: map: %d x %d, ties: %s, seed: %u\n", height, width,
+              vl_enumeration_get_by_value(nnTiesTypes, ties)->name, seed) ;
+    packed_data_geom_display(&maskIndices.geom, "vl_nninterpidx: maskIndices") ;
+    packed_data_geom_display(&outIndicesGeom, "vl_nninterpidx: outIndices") ;
+  }
+
+  /* -------------------------------------------------------------- */
+  /*                                                    Do the work */
+  /* -------------------------------------------------------------- */
+
+  packed_data_init_with_geom_int(&outIndices, false, outIndicesGeom, false, false, 0) ;
+
+  error = perfcnn::nearestMaskIndices(packed_data_get_index_tensor(&outIndices),
+                                      packed_data_get_index_tensor(&maskIndices),
+                                      ties, seed) ;
+  if (error != perfcnn::vlSuccess) {
+    mexErrMsgTxt(perfcnn::getLastErrorMessage()) ;
+  }
+
+  /* -------------------------------------------------------------- */
+  /*                                                        Cleanup */
+  /* -------------------------------------------------------------- */
+
+  packed_data_deinit(&maskIndices) ;
+  out[OUT_RESULT] = packed_data_deinit_extracting_array(&outIndices) ;
+}
@@ -14,20 +14,33 @@ the terms of the BSD license (see the COPYING file).
 #include "bits/mexutils.h"
 #include "bits/nnhelper.h"
 #include "bits/normalize.hpp"
+#include "bits/perfcnn.hpp"
+#include "bits/threads.hpp"
 
 #include <assert.h>
 
 /* option codes */
 enum {
-  opt_verbose = 0
+  opt_verbose = 0,
+  opt_layout,
+  opt_num_threads
 } ;
 
 /* options */
 vlmxOption  options [] = {
   {"Verbose",          0,   opt_verbose           },
+  {"Layout",           1,   opt_layout            },
+  {"NumThreads",       1,   opt_num_threads       },
   {0,                  0,   0                     }
 } ;
 
+VlEnumerator nnLayoutTypes [] =
+{
+  {"Default",  (vl_index)perfcnn::layoutDefault     },
+  {"NHWC",     (vl_index)perfcnn::layoutChannelLast },
+  {0,          0                                    }
+} ;
+
 enum {
   IN_DATA = 0, IN_PARAM, IN_DEROUTPUT, IN_END
 } ;
@@ -53,6 +66,9 @@ void mexFunction(int nout, mxArray *out[],
   double normAlpha ;
   double normKappa ;
   double normBeta ;
+  perfcnn::NormalizeOptions normOptions ;
+  perfcnn::Layout layout = perfcnn::layoutDefault ;
+  perfcnn::Error error = perfcnn::vlSuccess ;
 
 #ifdef ENABLE_GPU
   bool gpuMode = false ;
@@ -62,9 +78,12 @@ void mexFunction(int nout, mxArray *out[],
   bool backMode = false ;
 
   int verbosity = 0 ;
+  int numThreads = 0 ;
+  int previousNumThreads = 0 ;
   int opt ;
   int next = IN_END ;
   mxArray const *optarg ;
+  VlEnumerator *pair ;
 
   packed_data_init_empty(&data) ;
   packed_data_init_empty(&derOutput) ;
@@ -91,6 +110,19 @@ void mexFunction(int nout, mxArray *out[],
       case opt_verbose :
         ++ verbosity ;
         break ;
+      case opt_layout :
+        pair = vlmxDecodeEnumeration(optarg, nnLayoutTypes, VL_TRUE) ;
+        if (pair == NULL) {
+          mexErrMsgTxt("LAYOUT is not a supported layout.") ;
+        }
+        layout = (perfcnn::Layout)pair->value ;
+        break ;
+      case opt_num_threads :
+        if (!vlmxIsPlainMatrix(optarg,1,1) || mxGetPr(optarg)[0] < 0) {
+          mexErrMsgTxt("NUMTHREADS is not a non-negative scalar.") ;
+        }
+        numThreads = (int)mxGetPr(optarg)[0] ;
+        break ;
       default: break ;
     }
   }
@@ -116,6 +148,15 @@ void mexFunction(int nout, mxArray *out[],
     mexErrMsgTxt("DEROUTPUT is not of class SINGLE.");
   }
 
+  /* from here on, DATA and DEROUTPUT have their logical geometry */
+  if (layout == perfcnn::layoutChannelLast) {
+    if (gpuMode) {
+      mexErrMsgTxt("The NHWC LAYOUT is not supported for GPU arrays.") ;
+    }
+    data.geom = packed_data_geom_from_channel_last(data.geom) ;
+    if (backMode) { derOutput.geom = packed_data_geom_from_channel_last(derOutput.geom) ; }
+  }
+
   if (!mxIsNumeric(in[IN_PARAM]) ||
        mxGetClassID(in[IN_PARAM]) != mxDOUBLE_CLASS ||
        mxIsComplex(in[IN_PARAM]) ||
@@ -139,8 +180,9 @@ void mexFunction(int nout, mxArray *out[],
 
   if (verbosity > 0) {
     mexPrintf("vl_nnnormalize: mode %s; %s\n", gpuMode?"gpu":"cpu", backMode?"backward":"forward") ;
-    mexPrintf("vl_nnnormalize: (depth,kappa,alpha,beta): (%d,%g,%g,%g)\n",
-              normDepth, normKappa, normAlpha, normBeta) ;
+    mexPrintf("vl_nnnormalize: (depth,kappa,alpha,beta): (%d,%g,%g,%g), layout: %s\n",
+              normDepth, normKappa, normAlpha, normBeta,
+              vl_enumeration_get_by_value(nnLayoutTypes, layout)->name) ;
     packed_data_geom_display(&data.geom, "vl_nnnormalize: data") ;
 
     if (backMode) {
@@ -169,13 +211,31 @@ void mexFunction(int nout, mxArray *out[],
   /*                                                    Do the work */
   /* -------------------------------------------------------------- */
 
-  if (!backMode) {
+  /* a non-zero NumThreads applies to this call only */
+  if (numThreads > 0) {
+    previousNumThreads = vl_set_num_threads(numThreads) ;
+  }
+
+  if (layout == perfcnn::layoutChannelLast) {
+    if (!backMode) {
+      packed_data_init_with_geom(&output, gpuMode, packed_data_geom_to_channel_last(outputGeom), false, true, 0) ;
+      output.geom = outputGeom ;
+    } else {
+      packed_data_init_with_geom(&derData, gpuMode, packed_data_geom_to_channel_last(derDataGeom), false, true, 0) ;
+      derData.geom = derDataGeom ;
+    }
+  } else if (!backMode) {
     packed_data_init_with_geom(&output, gpuMode, outputGeom, false, true, 0) ;
     //packed_data_init_with_geom(&output, gpuMode, outputGeom, false, false, 0) ;
   } else {
     packed_data_init_with_geom(&derData, gpuMode, derDataGeom, false, true, 0) ;
   }
 
+  normOptions.depth = normDepth ;
+  normOptions.kappa = normKappa ;
+  normOptions.alpha = normAlpha ;
+  normOptions.beta = normBeta ;
+
   if (!backMode) {
     /* forward */
     if (gpuMode) {
@@ -188,10 +248,9 @@ void mexFunction(int nout, mxArray *out[],
       assert(false) ;
 #endif
     } else {
-      normalize_cpu<float>(output.memory,
-                           data.memory,
-                           data.geom.height, data.geom.width, data.geom.depth, data.geom.size,
-                           normDepth, normKappa, normAlpha, normBeta) ;
+      error = perfcnn::normalize(packed_data_get_tensor(&output, layout),
+                                 packed_data_get_tensor(&data, layout),
+                                 normOptions) ;
     }
   } else {
     /* backward */
@@ -206,13 +265,19 @@ void mexFunction(int nout, mxArray *out[],
       assert(false) ;
 #endif
     } else {
-      normalizeBackward_cpu<float>(derData.memory,
-                                   data.memory,
-                                   derOutput.memory,
-                                   data.geom.height, data.geom.width, data.geom.depth, data.geom.size,
-                                   normDepth, normKappa, normAlpha, normBeta) ;
+      error = perfcnn::normalizeBackward(packed_data_get_tensor(&derData, layout),
+                                         packed_data_get_tensor(&data, layout),
+                                         packed_data_get_tensor(&derOutput, layout),
+                                         normOptions) ;
     }
   }
+  if (numThreads > 0) {
+    vl_set_num_threads(previousNumThreads) ;
+  }
+
+  if (error != perfcnn::vlSuccess) {
+    mexErrMsgTxt(perfcnn::getLastErrorMessage()) ;
+  }
 
   /* -------------------------------------------------------------- */
   /*                                                        Cleanup */
@@ -0,0 +1,5 @@
+/** @file vl_nnperf_knn.cpp
+ ** @brief A non-CUDA wrapper
+ **/
+
+#include "vl_nnperf_knn.cu"
\ No newline at end of file
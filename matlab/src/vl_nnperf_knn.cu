@@ -0,0 +1,297 @@
+/** @file vl_nnperf_knn.cu
+ ** @brief Nearest-neighbour filling of the perforated positions
+ ** @author Michael Figurnov
+ **/
+
+/*
+Copyright (C) 2015 Michael Figurnov.
+All rights reserved.
+
+This file is part of the VLFeat library and is made available under
+the terms of the BSD license (see the COPYING file).
+*/
+
+#include "bits/mexutils.h"
+#include "bits/nnhelper.h"
+#include "bits/perfcnn.hpp"
+#include "bits/perforation.hpp"
+
+#ifdef ENABLE_GPU
+#include "bits/gpu.hpp"
+#endif
+
+#include <vector>
+#include <assert.h>
+
+/* option codes */
+enum {
+  opt_layout = 0,
+  opt_verbose
+} ;
+
+/* options */
+vlmxOption  options [] = {
+  {"Layout",           1,   opt_layout            },
+  {"Verbose",          0,   opt_verbose           },
+  {0,                  0,   0                     }
+} ;
+
+VlEnumerator nnLayoutTypes [] =
+{
+  {"Default",  (vl_index)perfcnn::layoutDefault     },
+  {"NHWC",     (vl_index)perfcnn::layoutChannelLast },
+  {0,          0                                    }
+} ;
+
+enum {
+  IN_DATA = 0, IN_MASKINDICES, IN_OUTINDICES, IN_WEIGHTS, IN_DEROUTPUT, IN_END
+} ;
+
+enum {
+  OUT_RESULT = 0, OUT_END
+} ;
+
+void mexFunction(int nout, mxArray *out[],
+                 int nin, mxArray const *in[])
+{
+  /* inputs */
+  PackedData data ;
+  PackedData maskIndices ;
+  PackedData outIndices ;
+  PackedData weights ;
+  PackedData derOutput ;
+
+  /* outputs */
+  PackedData output ;
+  PackedData derData  ;
+
+  perfcnn::Layout layout = perfcnn::layoutDefault ;
+  perfcnn::Error error = perfcnn::vlSuccess ;
+  std::vector<float> weightsSingle ;
+#ifdef ENABLE_GPU
+  ptrdiff_t weightsStep ;
+#endif
+
+#ifdef ENABLE_GPU
+  bool gpuMode = false ;
+#else
+  bool const gpuMode = false ;
+#endif
+  bool backMode = false ;
+
+  int verbosity = 0 ;
+  int opt ;
+  int next = IN_END ;
+  mxArray const *optarg ;
+  VlEnumerator *pair ;
+
+  packed_data_init_empty(&data) ;
+  packed_data_init_empty(&maskIndices) ;
+  packed_data_init_empty(&outIndices) ;
+  packed_data_init_empty(&weights) ;
+  packed_data_init_empty(&derOutput) ;
+  packed_data_init_empty(&output) ;
+  packed_data_init_empty(&derData) ;
+
+  /* -------------------------------------------------------------- */
+  /*                                            Check the arguments */
+  /* -------------------------------------------------------------- */
+
+  if (nin < 4) {
+    mexErrMsgTxt("The arguments are less than four.") ;
+  }
+  if (nin > 4 && vlmxIsString(in[4],-1)) {
+    next = 4 ;
+    backMode = 0 ;
+  } else {
+    backMode = (nin >= 5) ;
+  }
+
+  while ((opt = vlmxNextOption (in, nin, options, &next, &optarg)) >= 0) {
+    switch (opt) {
+      case opt_verbose :
+        ++ verbosity ;
+        break ;
+
+      case opt_layout :
+        pair = vlmxDecodeEnumeration(optarg, nnLayoutTypes, VL_TRUE) ;
+        if (pair == NULL) {
+          vlmxError(vlmxErrInvalidArgument, "LAYOUT is not a supported layout.") ;
+        }
+        layout = (perfcnn::Layout)pair->value ;
+        break;
+      default: break ;
+    }
+  }
+
+  packed_data_init_with_array(&data, in[IN_DATA]) ;
+  packed_data_init_with_array_int(&maskIndices, in[IN_MASKINDICES]) ;
+  packed_data_init_with_array_int(&outIndices, in[IN_OUTINDICES]) ;
+  packed_data_init_with_array(&weights, in[IN_WEIGHTS]) ;
+  if (backMode) { packed_data_init_with_array(&derOutput, in[IN_DEROUTPUT]) ; }
+
+#if ENABLE_GPU
+  gpuMode = (data.mode == matlabGpuArrayWrapper) ;
+  if (gpuMode) {
+    mxInitGPU() ;
+  }
+#endif
+
+  /* check GPU/data class consistency */
+  if (gpuMode && (derOutput.mode != matlabGpuArrayWrapper && backMode)) {
+    mexErrMsgTxt("DATA is a GPU array but DEROUTPUT is not.") ;
+  }
+  if (! packed_data_are_compatible(&data, &maskIndices) ||
+      ! packed_data_are_compatible(&data, &outIndices) ||
+      ! packed_data_are_compatible(&data, &weights)) {
+    mexErrMsgTxt("DATA, MASKINDICES, OUTINDICES and WEIGHTS are not all CPU or GPU arrays.") ;
+  }
+  if (data.geom.classID != mxSINGLE_CLASS) {
+    mexErrMsgTxt("DATA is not of class SINGLE.");
+  }
+  if (maskIndices.geom.classID != mxINT32_CLASS) {
+    mexErrMsgTxt("MASKINDICES is not of class INT32.");
+  }
+  if (outIndices.geom.classID != mxINT32_CLASS) {
+    mexErrMsgTxt("OUTINDICES is not of class INT32.");
+  }
+  if (backMode && (derOutput.geom.classID != mxSINGLE_CLASS)) {
+    mexErrMsgTxt("DEROUTPUT is not of class SINGLE.");
+  }
+
+  /* the weights are small: a CPU DOUBLE array is converted */
+  if (weights.geom.classID == mxDOUBLE_CLASS && !gpuMode) {
+    double const * values = (double const *) mxGetData(weights.array) ;
+    weightsSingle.assign(values, values + weights.geom.numElements) ;
+    weights.memory = &weightsSingle[0] ;
+  } else if (weights.geom.classID != mxSINGLE_CLASS) {
+    mexErrMsgTxt("WEIGHTS is not of class SINGLE.");
+  }
+
+  /* from here on, DATA and DEROUTPUT have their logical geometry */
+  if (layout == perfcnn::layoutChannelLast) {
+    if (gpuMode) {
+      mexErrMsgTxt("The NHWC LAYOUT is not supported for GPU arrays.") ;
+    }
+    data.geom = packed_data_geom_from_channel_last(data.geom) ;
+    if (backMode) { derOutput.geom = packed_data_geom_from_channel_last(derOutput.geom) ; }
+  }
+
+  if (verbosity > 0) {
+    mexPrintf("vl_nnperf_knn: mode %s; %s; layout %s\n", gpuMode?"gpu":"cpu", backMode?"backward":"forward",
+              vl_enumeration_get_by_value(nnLayoutTypes, layout)->name) ;
+    packed_data_geom_display(&data.geom, "vl_nnperf_knn: data") ;
+    packed_data_geom_display(&maskIndices.geom, "vl_nnperf_knn: maskIndices") ;
+    packed_data_geom_display(&outIndices.geom, "vl_nnperf_knn: outIndices") ;
+    packed_data_geom_display(&weights.geom, "vl_nnperf_knn: weights") ;
+    if (backMode) {
+      packed_data_geom_display(&derOutput.geom, "vl_nnperf_knn: derOutput") ;
+    }
+  }
+
+  if (outIndices.geom.height != data.geom.height ||
+      outIndices.geom.width != data.geom.width ||
+      outIndices.geom.size != 1 ||
+      outIndices.geom.numElements == 0) {
+    mexErrMsgTxt("OUTINDICES dimensions are incompatible with X.") ;
+  }
+  if (weights.geom.numElements != 1 &&
+      weights.geom.numElements != outIndices.geom.numElements) {
+    mexErrMsgTxt("WEIGHTS is neither a scalar nor of the same size as OUTINDICES.") ;
+  }
+  if (maskIndices.geom.numElements == 0) {
+    mexErrMsgTxt("MASKINDICES is empty.") ;
+  }
+  if (backMode) {
+    if (derOutput.geom.height != data.geom.height ||
+        derOutput.geom.width != data.geom.width ||
+        derOutput.geom.depth != data.geom.depth ||
+        derOutput.geom.size != data.geom.size)
+    {
+      mexErrMsgTxt("DEROUTPUT dimensions are incompatible with X.") ;
+    }
+  }
+#ifdef ENABLE_GPU
+  /* the GPU kernels take the stride of WEIGHTS (zero for a scalar) */
+  weightsStep = (weights.geom.numElements == 1) ? 0 : 1 ;
+#endif
+
+  /* -------------------------------------------------------------- */
+  /*                                                    Do the work */
+  /* -------------------------------------------------------------- */
+
+  if (layout == perfcnn::layoutChannelLast) {
+    if (!backMode) {
+      packed_data_init_with_geom(&output, gpuMode, packed_data_geom_to_channel_last(data.geom), false, false, 0) ;
+      output.geom = data.geom ;
+    } else {
+      packed_data_init_with_geom(&derData, gpuMode, packed_data_geom_to_channel_last(data.geom), false, false, 0) ;
+      derData.geom = data.geom ;
+    }
+  } else if (!backMode) {
+    packed_data_init_with_geom(&output, gpuMode, data.geom, false, false, 0) ;
+  } else {
+    /* the GPU kernel accumulates into DERDATA */
+    packed_data_init_with_geom(&derData, gpuMode, data.geom, false, gpuMode, 0) ;
+  }
+
+  if (backMode) {
+    if (gpuMode) {
+#ifdef ENABLE_GPU
+      perforation_knn_backward_gpu<float>(derData.memory,
+                                          derOutput.memory,
+                                          maskIndices.memoryInt,
+                                          outIndices.memoryInt,
+                                          weights.memory,
+                                          weightsStep,
+                                          data.geom.height * data.geom.width,
+                                          data.geom.depth * data.geom.size,
+                                          outIndices.geom.depth) ;
+#endif
+    } else {
+      error = perfcnn::perforationKnnBackward(packed_data_get_tensor(&derData, layout),
+                                              packed_data_get_tensor(&derOutput, layout),
+                                              packed_data_get_index_tensor(&maskIndices),
+                                              packed_data_get_index_tensor(&outIndices),
+                                              packed_data_get_tensor(&weights)) ;
+    }
+  } else {
+    if (gpuMode) {
+#ifdef ENABLE_GPU
+      perforation_knn_gpu<float>(output.memory,
+                                 data.memory,
+                                 maskIndices.memoryInt,
+                                 outIndices.memoryInt,
+                                 weights.memory,
+                                 weightsStep,
+                                 data.geom.height * data.geom.width,
+                                 data.geom.depth * data.geom.size,
+                                 outIndices.geom.depth) ;
+#endif
+    } else {
+      error = perfcnn::perforationKnn(packed_data_get_tensor(&output, layout),
+                                      packed_data_get_tensor(&data, layout),
+                                      packed_data_get_index_tensor(&maskIndices),
+                                      packed_data_get_index_tensor(&outIndices),
+                                      packed_data_get_tensor(&weights)) ;
+    }
+  }
+  if (error != perfcnn::vlSuccess) {
+    mexErrMsgTxt(perfcnn::getLastErrorMessage()) ;
+  }
+
+  /* -------------------------------------------------------------- */
+  /*                                                        Cleanup */
+  /* -------------------------------------------------------------- */
+
+  packed_data_deinit(&data) ;
+  packed_data_deinit(&maskIndices) ;
+  packed_data_deinit(&outIndices) ;
+  packed_data_deinit(&weights) ;
+  if (backMode) {
+    packed_data_deinit(&derOutput) ;
+    out[OUT_RESULT] = packed_data_deinit_extracting_array(&derData) ;
+  } else {
+    out[OUT_RESULT] = packed_data_deinit_extracting_array(&output) ;
+  }
+}
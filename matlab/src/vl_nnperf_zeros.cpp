@@ -0,0 +1,5 @@
+/** @file vl_nnperf_zeros.cpp
+ ** @brief A non-CUDA wrapper
+ **/
+
+#include "vl_nnperf_zeros.cu"
\ No newline at end of file
@@ -0,0 +1,221 @@
+/** @file vl_nnperf_zeros.cu
+ ** @brief Zeroing of the perforated positions
+ ** @author Michael Figurnov
+ **/
+
+/*
+Copyright (C) 2015 Michael Figurnov.
+All rights reserved.
+
+This file is part of the VLFeat library and is made available under
+the terms of the BSD license (see the COPYING file).
+*/
+
+#include "bits/mexutils.h"
+#include "bits/nnhelper.h"
+#include "bits/perfcnn.hpp"
+#include "bits/perforation.hpp"
+
+#ifdef ENABLE_GPU
+#include "bits/gpu.hpp"
+#endif
+
+#include <assert.h>
+
+/* option codes */
+enum {
+  opt_layout = 0,
+  opt_verbose
+} ;
+
+/* options */
+vlmxOption  options [] = {
+  {"Layout",           1,   opt_layout            },
+  {"Verbose",          0,   opt_verbose           },
+  {0,                  0,   0                     }
+} ;
+
+VlEnumerator nnLayoutTypes [] =
+{
+  {"Default",  (vl_index)perfcnn::layoutDefault     },
+  {"NHWC",     (vl_index)perfcnn::layoutChannelLast },
+  {0,          0                                    }
+} ;
+
+enum {
+  IN_DATA = 0, IN_MASKINDICES, IN_DEROUTPUT, IN_END
+} ;
+
+enum {
+  OUT_RESULT = 0, OUT_END
+} ;
+
+void mexFunction(int nout, mxArray *out[],
+                 int nin, mxArray const *in[])
+{
+  /* inputs */
+  PackedData data ;
+  PackedData maskIndices ;
+  PackedData derOutput ;
+
+  /* outputs */
+  PackedData output ;
+  PackedDataGeometry outputGeom ;
+
+  perfcnn::Layout layout = perfcnn::layoutDefault ;
+  perfcnn::Error error = perfcnn::vlSuccess ;
+
+#ifdef ENABLE_GPU
+  bool gpuMode = false ;
+#else
+  bool const gpuMode = false ;
+#endif
+  bool backMode = false ;
+
+  int verbosity = 0 ;
+  int opt ;
+  int next = IN_END ;
+  mxArray const *optarg ;
+  VlEnumerator *pair ;
+
+  packed_data_init_empty(&data) ;
+  packed_data_init_empty(&maskIndices) ;
+  packed_data_init_empty(&derOutput) ;
+  packed_data_init_empty(&output) ;
+
+  /* -------------------------------------------------------------- */
+  /*                                            Check the arguments */
+  /* -------------------------------------------------------------- */
+
+  if (nin < 2) {
+    mexErrMsgTxt("The arguments are less than two.") ;
+  }
+  if (nin > 2 && vlmxIsString(in[2],-1)) {
+    next = 2 ;
+    backMode = 0 ;
+  } else {
+    backMode = (nin >= 3) ;
+  }
+
+  while ((opt = vlmxNextOption (in, nin, options, &next, &optarg)) >= 0) {
+    switch (opt) {
+      case opt_verbose :
+        ++ verbosity ;
+        break ;
+
+      case opt_layout :
+        pair = vlmxDecodeEnumeration(optarg, nnLayoutTypes, VL_TRUE) ;
+        if (pair == NULL) {
+          vlmxError(vlmxErrInvalidArgument, "LAYOUT is not a supported layout.") ;
+        }
+        layout = (perfcnn::Layout)pair->value ;
+        break;
+      default: break ;
+    }
+  }
+
+  packed_data_init_with_array(&data, in[IN_DATA]) ;
+  packed_data_init_with_array_int(&maskIndices, in[IN_MASKINDICES]) ;
+  if (backMode) { packed_data_init_with_array(&derOutput, in[IN_DEROUTPUT]) ; }
+
+#if ENABLE_GPU
+  gpuMode = (data.mode == matlabGpuArrayWrapper) ;
+  if (gpuMode) {
+    mxInitGPU() ;
+  }
+#endif
+
+  /* check GPU/data class consistency */
+  if (gpuMode && (derOutput.mode != matlabGpuArrayWrapper && backMode)) {
+    mexErrMsgTxt("DATA is a GPU array but DEROUTPUT is not.") ;
+  }
+  if (! packed_data_are_compatible(&data, &maskIndices)) {
+    mexErrMsgTxt("DATA and MASKINDICES are not both CPU or GPU arrays.") ;
+  }
+  if (data.geom.classID != mxSINGLE_CLASS) {
+    mexErrMsgTxt("DATA is not of class SINGLE.");
+  }
+  if (maskIndices.geom.classID != mxINT32_CLASS) {
+    mexErrMsgTxt("MASKINDICES is not of class INT32.");
+  }
+  if (backMode && (derOutput.geom.classID != mxSINGLE_CLASS)) {
+    mexErrMsgTxt("DEROUTPUT is not of class SINGLE.");
+  }
+
+  /* from here on, DATA and DEROUTPUT have their logical geometry */
+  if (layout == perfcnn::layoutChannelLast) {
+    if (gpuMode) {
+      mexErrMsgTxt("The NHWC LAYOUT is not supported for GPU arrays.") ;
+    }
+    data.geom = packed_data_geom_from_channel_last(data.geom) ;
+    if (backMode) { derOutput.geom = packed_data_geom_from_channel_last(derOutput.geom) ; }
+  }
+
+  if (verbosity > 0) {
+    mexPrintf("vl_nnperf_zeros: mode %s; %s; layout %s\n", gpuMode?"gpu":"cpu", backMode?"backward":"forward",
+              vl_enumeration_get_by_value(nnLayoutTypes, layout)->name) ;
+    packed_data_geom_display(&data.geom, "vl_nnperf_zeros: data") ;
+    packed_data_geom_display(&maskIndices.geom, "vl_nnperf_zeros: maskIndices") ;
+    if (backMode) {
+      packed_data_geom_display(&derOutput.geom, "vl_nnperf_zeros: derOutput") ;
+    }
+  }
+
+  if (maskIndices.geom.numElements == 0) {
+    mexErrMsgTxt("MASKINDICES is empty.") ;
+  }
+  if (backMode) {
+    if (derOutput.geom.height != data.geom.height ||
+        derOutput.geom.width != data.geom.width ||
+        derOutput.geom.depth != data.geom.depth ||
+        derOutput.geom.size != data.geom.size)
+    {
+      mexErrMsgTxt("DEROUTPUT dimensions are incompatible with X.") ;
+    }
+  }
+
+  /* -------------------------------------------------------------- */
+  /*                                                    Do the work */
+  /* -------------------------------------------------------------- */
+
+  /* the layer is its own derivative: the backward pass masks DEROUTPUT */
+  PackedData * input = backMode ? &derOutput : &data ;
+  outputGeom = data.geom ;
+
+  /* the GPU kernel only writes the computed pixels */
+  if (layout == perfcnn::layoutChannelLast) {
+    packed_data_init_with_geom(&output, gpuMode, packed_data_geom_to_channel_last(outputGeom), false, gpuMode, 0) ;
+    output.geom = outputGeom ;
+  } else {
+    packed_data_init_with_geom(&output, gpuMode, outputGeom, false, gpuMode, 0) ;
+  }
+
+  if (gpuMode) {
+#ifdef ENABLE_GPU
+    perforation_zeros_gpu<float>(output.memory,
+                                 input->memory,
+                                 maskIndices.memoryInt,
+                                 maskIndices.geom.numElements,
+                                 data.geom.height * data.geom.width,
+                                 data.geom.depth * data.geom.size) ;
+#endif
+  } else {
+    error = perfcnn::perforationZeros(packed_data_get_tensor(&output, layout),
+                                      packed_data_get_tensor(input, layout),
+                                      packed_data_get_index_tensor(&maskIndices)) ;
+  }
+  if (error != perfcnn::vlSuccess) {
+    mexErrMsgTxt(perfcnn::getLastErrorMessage()) ;
+  }
+
+  /* -------------------------------------------------------------- */
+  /*                                                        Cleanup */
+  /* -------------------------------------------------------------- */
+
+  packed_data_deinit(&data) ;
+  packed_data_deinit(&maskIndices) ;
+  if (backMode) {
+    packed_data_deinit(&derOutput) ;
+  }
+  out[OUT_RESULT] = packed_data_deinit_extracting_array(&output) ;
+}
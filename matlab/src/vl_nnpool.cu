@@ -15,6 +15,8 @@ the terms of the BSD license (see the COPYING file).
 #include "bits/mexutils.h"
 #include "bits/nnhelper.h"
 #include "bits/pooling.hpp"
+#include "bits/perfcnn.hpp"
+#include "bits/threads.hpp"
 
 #include <assert.h>
 
@@ -23,7 +25,9 @@ enum {
   opt_stride = 0,
   opt_pad,
   opt_method,
-  opt_verbose
+  opt_switches,
+  opt_verbose,
+  opt_num_threads
 } ;
 
 /* options */
@@ -31,7 +35,9 @@ vlmxOption  options [] = {
   {"Stride",           1,   opt_stride            },
   {"Pad",              1,   opt_pad               },
   {"Method",           1,   opt_method            },
+  {"Switches",         1,   opt_switches          },
   {"Verbose",          0,   opt_verbose           },
+  {"NumThreads",       1,   opt_num_threads       },
   {0,                  0,   0                     }
 } ;
 
@@ -46,7 +52,7 @@ enum {
 } ;
 
 enum {
-  OUT_RESULT = 0, OUT_END
+  OUT_RESULT = 0, OUT_SWITCHES, OUT_END
 } ;
 
 void mexFunction(int nout, mxArray *out[],
@@ -55,12 +61,16 @@ void mexFunction(int nout, mxArray *out[],
   /* inputs */
   PackedData data ;
   PackedData derOutput ;
+  PackedData switches ;
+  mxArray const *switchesArray = NULL ;
 
   /* outputs */
   PackedData output ;
   PackedData derData  ;
   PackedDataGeometry outputGeom ;
   PackedDataGeometry derDataGeom  ;
+  PackedDataGeometry switchesGeom ;
+  perfcnn::Error error = perfcnn::vlSuccess ;
 
   int poolWidth ;
   int poolHeight ;
@@ -80,6 +90,8 @@ void mexFunction(int nout, mxArray *out[],
   bool backMode = false ;
 
   int verbosity = 0 ;
+  int numThreads = 0 ;
+  int previousNumThreads = 0 ;
   int opt ;
   int next = IN_END ;
   mxArray const *optarg ;
@@ -87,6 +99,7 @@ void mexFunction(int nout, mxArray *out[],
 
   packed_data_init_empty(&data) ;
   packed_data_init_empty(&derOutput) ;
+  packed_data_init_empty(&switches) ;
   packed_data_init_empty(&output) ;
   packed_data_init_empty(&derData) ;
 
@@ -159,12 +172,25 @@ void mexFunction(int nout, mxArray *out[],
         }
         method = (PoolMethod)pair->value ;
         break;
+
+      case opt_switches :
+        switchesArray = optarg ;
+        break ;
+
+      case opt_num_threads :
+        if (!vlmxIsPlainMatrix(optarg,1,1) || mxGetPr(optarg)[0] < 0) {
+          mexErrMsgTxt("NUMTHREADS is not a non-negative scalar.") ;
+        }
+        numThreads = (int)mxGetPr(optarg)[0] ;
+        break ;
+
       default: break ;
     }
   }
 
   packed_data_init_with_array(&data, in[IN_DATA]) ;
   if (backMode) { packed_data_init_with_array(&derOutput, in[IN_DEROUTPUT]) ; }
+  if (switchesArray) { packed_data_init_with_array_int(&switches, switchesArray) ; }
 
 #if ENABLE_GPU
   gpuMode = (data.mode == matlabGpuArrayWrapper) ;
@@ -184,6 +210,28 @@ void mexFunction(int nout, mxArray *out[],
     mexErrMsgTxt("DEROUTPUT is not of class SINGLE.");
   }
 
+  /* the switches are computed and used on the CPU only */
+  if (nout > 1 || switchesArray) {
+    if (method != NN_POOL_MAX) {
+      mexErrMsgTxt("SWITCHES are only supported by the max pooling.") ;
+    }
+    if (gpuMode) {
+      mexErrMsgTxt("SWITCHES are not supported for GPU arrays.") ;
+    }
+  }
+  if (nout > 1 && backMode) {
+    mexErrMsgTxt("SWITCHES are only returned by the forward pass.") ;
+  }
+  if (switchesArray && !backMode) {
+    mexErrMsgTxt("SWITCHES are only used by the backward pass.") ;
+  }
+  if (switchesArray && ! packed_data_are_compatible(&data, &switches)) {
+    mexErrMsgTxt("DATA and SWITCHES are not both CPU or GPU arrays.") ;
+  }
+  if (switchesArray && switches.geom.classID != mxINT32_CLASS) {
+    mexErrMsgTxt("SWITCHES is not of class INT32.") ;
+  }
+
   if (!vlmxIsPlainMatrix(in[IN_SIZE],-1,-1)) {
     mexErrMsgTxt("SIZE is not a plain matrix.") ;
   }
@@ -213,6 +261,13 @@ void mexFunction(int nout, mxArray *out[],
 
   derDataGeom = data.geom ;
 
+  packed_data_geom_init(&switchesGeom,
+                        mxINT32_CLASS,
+                        outputGeom.height,
+                        outputGeom.width,
+                        outputGeom.depth,
+                        outputGeom.size) ;
+
   if (verbosity > 0) {
     mexPrintf("vl_nnpool: mode %s; %s\n", gpuMode?"gpu":"cpu", backMode?"backward":"forward") ;
     mexPrintf("vl_nnpool: stride: [%d %d], pad: [%d %d %d %d]\n",
@@ -270,8 +325,16 @@ void mexFunction(int nout, mxArray *out[],
   /*                                                    Do the work */
   /* -------------------------------------------------------------- */
 
+  /* a non-zero NumThreads applies to this call only */
+  if (numThreads > 0) {
+    previousNumThreads = vl_set_num_threads(numThreads) ;
+  }
+
   if (!backMode) {
     packed_data_init_with_geom(&output, gpuMode, outputGeom, false, true, 0) ;
+    if (nout > 1) {
+      packed_data_init_with_geom_int(&switches, false, switchesGeom, false, false, 0) ;
+    }
   } else {
     packed_data_init_with_geom(&derData, gpuMode, derDataGeom, false, true, 0) ;
   }
@@ -299,6 +362,10 @@ void mexFunction(int nout, mxArray *out[],
 #else
       assert(false) ;
 #endif
+    } else if (switchesArray) {
+      error = perfcnn::poolingSwitchesBackward(packed_data_get_tensor(&derData),
+                                               packed_data_get_tensor(&derOutput),
+                                               packed_data_get_index_tensor(&switches)) ;
     } else {
       poolingBackward_cpu<float>(derData.memory,
                                  data.memory,
@@ -337,6 +404,20 @@ void mexFunction(int nout, mxArray *out[],
 #else
       assert(false) ;
 #endif
+    } else if (nout > 1) {
+      max_pooling_switches_cpu<float>(output.memory,
+                                      switches.memoryInt,
+                                      data.memory,
+                                      data.geom.height, data.geom.width,
+                                      data.geom.depth * data.geom.size,
+                                      poolHeight,
+                                      poolWidth,
+                                      strideY,
+                                      strideX,
+                                      padTop,
+                                      padBottom,
+                                      padLeft,
+                                      padRight) ;
     } else {
       pooling_cpu<float>(output.memory,
                          data.memory,
@@ -354,6 +435,14 @@ void mexFunction(int nout, mxArray *out[],
     }
   }
 
+  if (numThreads > 0) {
+    vl_set_num_threads(previousNumThreads) ;
+  }
+
+  if (error != perfcnn::vlSuccess) {
+    mexErrMsgTxt(perfcnn::getLastErrorMessage()) ;
+  }
+
   /* -------------------------------------------------------------- */
   /*                                                        Cleanup */
   /* -------------------------------------------------------------- */
@@ -361,8 +450,12 @@ void mexFunction(int nout, mxArray *out[],
   packed_data_deinit(&data) ;
   if (backMode) {
     packed_data_deinit(&derOutput) ;
+    if (switchesArray) { packed_data_deinit(&switches) ; }
     out[OUT_RESULT] = packed_data_deinit_extracting_array(&derData) ;
   } else {
     out[OUT_RESULT] = packed_data_deinit_extracting_array(&output) ;
+    if (nout > 1) {
+      out[OUT_SWITCHES] = packed_data_deinit_extracting_array(&switches) ;
+    }
   }
 }
@@ -14,7 +14,8 @@ the terms of the BSD license (see the COPYING file).
 
 #include "bits/mexutils.h"
 #include "bits/nnhelper.h"
-#include "bits/pooling.hpp"
+#include "bits/perfcnn.hpp"
+#include "bits/threads.hpp"
 
 #ifdef ENABLE_GPU
 #include "bits/gpu.hpp"
@@ -26,13 +27,19 @@ the terms of the BSD license (see the COPYING file).
 /* option codes */
 enum {
   opt_method = 0,
-  opt_verbose
+  opt_layout,
+  opt_switches,
+  opt_verbose,
+  opt_num_threads
 } ;
 
 /* options */
 vlmxOption  options [] = {
   {"Method",           1,   opt_method            },
+  {"Layout",           1,   opt_layout            },
+  {"Switches",         1,   opt_switches          },
   {"Verbose",          0,   opt_verbose           },
+  {"NumThreads",       1,   opt_num_threads       },
   {0,                  0,   0                     }
 } ;
 
@@ -42,12 +49,19 @@ VlEnumerator nnPoolMethodTypes [NN_POOL_METHODS_NUM] =
   {"Avg",     (vl_index)NN_POOL_AVG     },
 } ;
 
+VlEnumerator nnLayoutTypes [] =
+{
+  {"Default",  (vl_index)perfcnn::layoutDefault     },
+  {"NHWC",     (vl_index)perfcnn::layoutChannelLast },
+  {0,          0                                    }
+} ;
+
 enum {
   IN_DATA = 0, IN_INDICES, IN_DEROUTPUT, IN_END
 } ;
 
 enum {
-  OUT_RESULT = 0, OUT_END
+  OUT_RESULT = 0, OUT_SWITCHES, OUT_END
 } ;
 
 #ifdef ENABLE_GPU
@@ -61,16 +75,20 @@ void mexFunction(int nout, mxArray *out[],
   PackedData data ;
   PackedData indices ;
   PackedData derOutput ;
+  PackedData switches ;
+  mxArray const *switchesArray = NULL ;
 
   /* outputs */
   PackedData output ;
   PackedData derData  ;
   PackedDataGeometry outputGeom ;
   PackedDataGeometry derDataGeom  ;
+  PackedDataGeometry switchesGeom ;
 
   PoolMethod method = NN_POOL_MAX;
+  perfcnn::Layout layout = perfcnn::layoutDefault ;
+  perfcnn::Error error = perfcnn::vlSuccess ;
 
-  int poolSize;
   int outputHeight;
   int outputWidth;
 
@@ -82,6 +100,8 @@ void mexFunction(int nout, mxArray *out[],
   bool backMode = false ;
 
   int verbosity = 0 ;
+  int numThreads = 0 ;
+  int previousNumThreads = 0 ;
   int opt ;
   int next = IN_END ;
   mxArray const *optarg ;
@@ -90,6 +110,7 @@ void mexFunction(int nout, mxArray *out[],
   packed_data_init_empty(&data) ;
   packed_data_init_empty(&indices) ;
   packed_data_init_empty(&derOutput) ;
+  packed_data_init_empty(&switches) ;
   packed_data_init_empty(&output) ;
   packed_data_init_empty(&derData) ;
 
@@ -121,6 +142,22 @@ void mexFunction(int nout, mxArray *out[],
         }
         method = (PoolMethod)pair->value ;
         break;
+      case opt_layout :
+        pair = vlmxDecodeEnumeration(optarg, nnLayoutTypes, VL_TRUE) ;
+        if (pair == NULL) {
+          vlmxError(vlmxErrInvalidArgument, "LAYOUT is not a supported layout.") ;
+        }
+        layout = (perfcnn::Layout)pair->value ;
+        break;
+      case opt_switches :
+        switchesArray = optarg ;
+        break ;
+      case opt_num_threads :
+        if (!vlmxIsPlainMatrix(optarg,1,1) || mxGetPr(optarg)[0] < 0) {
+          mexErrMsgTxt("NUMTHREADS is not a non-negative scalar.") ;
+        }
+        numThreads = (int)mxGetPr(optarg)[0] ;
+        break ;
       default: break ;
     }
   }
@@ -128,6 +165,7 @@ void mexFunction(int nout, mxArray *out[],
   packed_data_init_with_array(&data, in[IN_DATA]) ;
   packed_data_init_with_array_int(&indices, in[IN_INDICES]) ;
   if (backMode) { packed_data_init_with_array(&derOutput, in[IN_DEROUTPUT]) ; }
+  if (switchesArray) { packed_data_init_with_array_int(&switches, switchesArray) ; }
 
 #if ENABLE_GPU
   gpuMode = (data.mode == matlabGpuArrayWrapper) ;
@@ -153,16 +191,50 @@ void mexFunction(int nout, mxArray *out[],
     mexErrMsgTxt("DEROUTPUT is not of class SINGLE.");
   }
 
+  /* the switches are computed and used on the CPU only */
+  if (nout > 1 || switchesArray) {
+    if (method != NN_POOL_MAX) {
+      mexErrMsgTxt("SWITCHES are only supported by the max pooling.") ;
+    }
+    if (gpuMode) {
+      mexErrMsgTxt("SWITCHES are not supported for GPU arrays.") ;
+    }
+    if (layout == perfcnn::layoutChannelLast) {
+      mexErrMsgTxt("SWITCHES are not supported with the NHWC LAYOUT.") ;
+    }
+  }
+  if (nout > 1 && backMode) {
+    mexErrMsgTxt("SWITCHES are only returned by the forward pass.") ;
+  }
+  if (switchesArray && !backMode) {
+    mexErrMsgTxt("SWITCHES are only used by the backward pass.") ;
+  }
+  if (switchesArray && ! packed_data_are_compatible(&data, &switches)) {
+    mexErrMsgTxt("DATA and SWITCHES are not both CPU or GPU arrays.") ;
+  }
+  if (switchesArray && switches.geom.classID != mxINT32_CLASS) {
+    mexErrMsgTxt("SWITCHES is not of class INT32.") ;
+  }
+
+  /* from here on, DATA and DEROUTPUT have their logical geometry */
+  if (layout == perfcnn::layoutChannelLast) {
+    if (gpuMode) {
+      mexErrMsgTxt("The NHWC LAYOUT is not supported for GPU arrays.") ;
+    }
+    data.geom = packed_data_geom_from_channel_last(data.geom) ;
+    if (backMode) { derOutput.geom = packed_data_geom_from_channel_last(derOutput.geom) ; }
+  }
+
   if (gpuMode) {
     // indices.geom: [outputHeight, outputWidth, poolHeight * poolWidth, 1]
     outputHeight = indices.geom.height;
     outputWidth = indices.geom.width;
-    poolSize = indices.geom.depth;
   } else {
-    // indices.geom: [poolHeight * poolWidth, outputHeight, outputWidth, 1]
-    poolSize = indices.geom.height;
-    outputHeight = indices.geom.width;
-    outputWidth = indices.geom.depth;
+    // indices.geom: [poolHeight * poolWidth, outputHeight, outputWidth, 1],
+    // or that of the run-length encoded indices
+    perfcnn::TensorGeometry indicesGeom = perfcnn::getIndicesGeometry(packed_data_get_index_tensor(&indices)) ;
+    outputHeight = indicesGeom.width;
+    outputWidth = indicesGeom.depth;
   }
 
   packed_data_geom_init(&outputGeom,
@@ -174,12 +246,20 @@ void mexFunction(int nout, mxArray *out[],
 
   derDataGeom = data.geom ;
 
+  packed_data_geom_init(&switchesGeom,
+                        mxINT32_CLASS,
+                        outputGeom.height,
+                        outputGeom.width,
+                        outputGeom.depth,
+                        outputGeom.size) ;
+
   if (verbosity > 0) {
     mexPrintf("vl_nnpoolfast: mode %s; %s\n", gpuMode?"gpu":"cpu", backMode?"backward":"forward") ;
     packed_data_geom_display(&data.geom, "vl_nnpoolfast: data") ;
     packed_data_geom_display(&indices.geom, "vl_nnpoolfast: indices") ;
-    mexPrintf("vl_nnpoolfast: method: %s\n",
-              vl_enumeration_get_by_value(nnPoolMethodTypes, method)->name);
+    mexPrintf("vl_nnpoolfast: method: %s, layout: %s\n",
+              vl_enumeration_get_by_value(nnPoolMethodTypes, method)->name,
+              vl_enumeration_get_by_value(nnLayoutTypes, layout)->name);
     if (backMode) {
       packed_data_geom_display(&derOutput.geom, "vl_nnpoolfast: derOutput") ;
       packed_data_geom_display(&derDataGeom, "vl_nnpoolfast: derData") ;
@@ -202,8 +282,24 @@ void mexFunction(int nout, mxArray *out[],
   /*                                                    Do the work */
   /* -------------------------------------------------------------- */
 
-  if (!backMode) {
+  /* a non-zero NumThreads applies to this call only */
+  if (numThreads > 0) {
+    previousNumThreads = vl_set_num_threads(numThreads) ;
+  }
+
+  if (layout == perfcnn::layoutChannelLast) {
+    if (!backMode) {
+      packed_data_init_with_geom(&output, gpuMode, packed_data_geom_to_channel_last(outputGeom), false, false, 0) ;
+      output.geom = outputGeom ;
+    } else {
+      packed_data_init_with_geom(&derData, gpuMode, packed_data_geom_to_channel_last(derDataGeom), false, true, 0) ;
+      derData.geom = derDataGeom ;
+    }
+  } else if (!backMode) {
     packed_data_init_with_geom(&output, gpuMode, outputGeom, false, false, 0) ;
+    if (nout > 1) {
+      packed_data_init_with_geom_int(&switches, false, switchesGeom, false, false, 0) ;
+    }
   } else {
     packed_data_init_with_geom(&derData, gpuMode, derDataGeom, false, true, 0) ;
   }
@@ -221,19 +317,19 @@ void mexFunction(int nout, mxArray *out[],
                                        method,
                                        data.geom.height * data.geom.width,
                                        data.geom.depth * data.geom.size,
-                                       poolSize,
+                                       indices.geom.depth,
                                        derOutput.geom.height * derOutput.geom.width);
 #endif
+    } else if (switchesArray) {
+      error = perfcnn::poolingSwitchesBackward(packed_data_get_tensor(&derData, layout),
+                                               packed_data_get_tensor(&derOutput, layout),
+                                               packed_data_get_index_tensor(&switches)) ;
     } else {
-      pooling_backward_cpu_fast<float>(derData.memory,
-                                       data.memory,
-                                       derOutput.memory,
-                                       indices.memoryInt,
-                                       method,
-                                       data.geom.height * data.geom.width,
-                                       data.geom.depth * data.geom.size,
-                                       poolSize,
-                                       derOutput.geom.height * derOutput.geom.width);
+      error = perfcnn::poolingFastBackward(packed_data_get_tensor(&derData, layout),
+                                           packed_data_get_tensor(&data, layout),
+                                           packed_data_get_tensor(&derOutput, layout),
+                                           packed_data_get_index_tensor(&indices),
+                                           method) ;
     }
   } else {
     if (gpuMode) {
@@ -244,20 +340,28 @@ void mexFunction(int nout, mxArray *out[],
                               method,
                               data.geom.height * data.geom.width,
                               data.geom.depth * data.geom.size,
-                              poolSize,
+                              indices.geom.depth,
                               output.geom.height * output.geom.width);
 #endif
+    } else if (nout > 1) {
+      error = perfcnn::poolingFastSwitches(packed_data_get_tensor(&output, layout),
+                                           packed_data_get_index_tensor(&switches),
+                                           packed_data_get_tensor(&data, layout),
+                                           packed_data_get_index_tensor(&indices)) ;
     } else {
-      pooling_cpu_fast<float>(output.memory,
-                              data.memory,
-                              indices.memoryInt,
-                              method,
-                              data.geom.height * data.geom.width,
-                              data.geom.depth * data.geom.size,
-                              poolSize,
-                              output.geom.height * output.geom.width);
+      error = perfcnn::poolingFast(packed_data_get_tensor(&output, layout),
+                                   packed_data_get_tensor(&data, layout),
+                                   packed_data_get_index_tensor(&indices),
+                                   method) ;
     }
   }
+  if (numThreads > 0) {
+    vl_set_num_threads(previousNumThreads) ;
+  }
+
+  if (error != perfcnn::vlSuccess) {
+    mexErrMsgTxt(perfcnn::getLastErrorMessage()) ;
+  }
 
   /* -------------------------------------------------------------- */
   /*                                                        Cleanup */
@@ -267,8 +371,12 @@ void mexFunction(int nout, mxArray *out[],
   packed_data_deinit(&indices);
   if (backMode) {
     packed_data_deinit(&derOutput) ;
+    if (switchesArray) { packed_data_deinit(&switches) ; }
     out[OUT_RESULT] = packed_data_deinit_extracting_array(&derData) ;
   } else {
     out[OUT_RESULT] = packed_data_deinit_extracting_array(&output) ;
+    if (nout > 1) {
+      out[OUT_SWITCHES] = packed_data_deinit_extracting_array(&switches) ;
+    }
   }
 }
@@ -14,7 +14,7 @@ the terms of the BSD license (see the COPYING file).
 
 #include "bits/mexutils.h"
 #include "bits/nnhelper.h"
-#include "bits/pooling.hpp"
+#include "bits/perfcnn.hpp"
 
 #include <assert.h>
 
@@ -24,7 +24,9 @@ enum {
   opt_stride,
   opt_pad,
   opt_verbose,
-  opt_in_indices
+  opt_in_indices,
+  opt_run_length,
+  opt_deduplicate
 } ;
 
 /* options */
@@ -33,6 +35,8 @@ vlmxOption  options [] = {
   {"Stride",           1,   opt_stride            },
   {"Pad",              1,   opt_pad               },
   {"InIndices",        1,   opt_in_indices        },
+  {"RunLength",        0,   opt_run_length        },
+  {"Deduplicate",      0,   opt_deduplicate       },
   {"Verbose",          0,   opt_verbose           },
   {0,                  0,   0                     }
 } ;
@@ -59,8 +63,14 @@ void mexFunction(int nout, mxArray *out[],
 
   /* outputs */
   PackedData poolIndices ;
+  PackedData encodedIndices ;
   PackedDataGeometry poolIndicesGeom ;
 
+  perfcnn::TensorGeometry dataGeom ;
+  perfcnn::TensorGeometry geom ;
+  perfcnn::PoolOptions poolOptions ;
+  perfcnn::Error error ;
+
   PoolMethod method = NN_POOL_MAX;
 
   int dataWidth, dataHeight, dataDepth, dataSize ;
@@ -74,6 +84,8 @@ void mexFunction(int nout, mxArray *out[],
   int padBottom = 0 ;
 
   int inIndicesMode = 0 ;
+  bool runLengthMode = false ;
+  bool deduplicateMode = false ;
 
   int verbosity = 0 ;
   int opt ;
@@ -83,6 +95,7 @@ void mexFunction(int nout, mxArray *out[],
 
   packed_data_init_empty(&inIndices) ;
   packed_data_init_empty(&poolIndices) ;
+  packed_data_init_empty(&encodedIndices) ;
 
   /* -------------------------------------------------------------- */
   /*                                            Check the arguments */
@@ -154,6 +167,14 @@ void mexFunction(int nout, mxArray *out[],
         }
         break;
 
+      case opt_run_length :
+        runLengthMode = true ;
+        break ;
+
+      case opt_deduplicate :
+        deduplicateMode = true ;
+        break ;
+
       default: break ;
     }
   }
@@ -161,6 +182,9 @@ void mexFunction(int nout, mxArray *out[],
   if (!vlmxIsPlainMatrix(in[IN_DATA_SIZE],-1,-1)) {
     mexErrMsgTxt("DATA_SIZE is not a plain matrix.") ;
   }
+  if (runLengthMode && deduplicateMode) {
+    mexErrMsgTxt("RUNLENGTH and DEDUPLICATE cannot be combined.") ;
+  }
   if (mxGetNumberOfElements(in[IN_DATA_SIZE]) != 4) {
     mexErrMsgTxt("DATA_SIZE does not have four elements.") ;
   }
@@ -185,25 +209,35 @@ void mexFunction(int nout, mxArray *out[],
       mexErrMsgTxt("POOL_SIZE has neither one nor two elements.") ;
   }
 
-  if (strideX < 1 || strideY < 1) {
-    mexErrMsgTxt("At least one element of STRIDE is smaller than one.") ;
+  dataGeom = perfcnn::TensorGeometry(dataHeight, dataWidth, dataDepth, dataSize) ;
+  poolOptions.poolHeight = poolHeight ;
+  poolOptions.poolWidth = poolWidth ;
+  poolOptions.strideY = strideY ;
+  poolOptions.strideX = strideX ;
+  poolOptions.padTop = padTop ;
+  poolOptions.padBottom = padBottom ;
+  poolOptions.padLeft = padLeft ;
+  poolOptions.padRight = padRight ;
+  poolOptions.method = method ;
+
+  error = perfcnn::poolIndicesGeometry(geom, dataGeom, poolOptions) ;
+  if (error != perfcnn::vlSuccess) {
+    mexErrMsgTxt(perfcnn::getLastErrorMessage()) ;
   }
 
-  int outputHeight = (dataHeight + (padTop+padBottom) - poolHeight)/strideY + 1;
-  int outputWidth = (dataWidth + (padLeft+padRight) - poolWidth)/strideX + 1;
   packed_data_geom_init(&poolIndicesGeom,
                         mxINT32_CLASS,
-                        poolHeight * poolWidth,
-                        outputHeight,
-                        outputWidth,
-                        1) ;
+                        geom.height,
+                        geom.width,
+                        geom.depth,
+                        geom.size) ;
 
   if (verbosity > 0) {
-    mexPrintf("vl_nnpoolidx: data: [%d %d %d %d], stride: [%d %d], pad: [%d %d %d %d], inIndicesMode: %d\n",
+    mexPrintf("vl_nnpoolidx: data: [%d %d %d %d], stride: [%d %d], pad: [%d %d %d %d], inIndicesMode: %d, run-length: %d, deduplicate: %d\n",
               dataHeight, dataWidth, dataSize, dataDepth,
               strideY, strideX,
               padTop, padBottom, padLeft, padRight,
-              inIndicesMode) ;
+              inIndicesMode, runLengthMode, deduplicateMode) ;
     mexPrintf("vl_nnpoolidx: method: %s\n",
               vl_enumeration_get_by_value(nnPoolMethodTypes, method)->name);
     mexPrintf("vl_nnpoolidx: pooling: %d x %d\n", poolHeight, poolWidth);
@@ -213,32 +247,6 @@ void mexFunction(int nout, mxArray *out[],
     }
   }
 
-  if (dataHeight < poolHeight || dataWidth < poolWidth) {
-    mexErrMsgTxt("Pooling SIZE is larger than the DATA.") ;
-  }
-
-  if (poolHeight == 0 || poolWidth == 0) {
-    mexErrMsgTxt("A dimension of the pooling SIZE is void.") ;
-  }
-
-  if (strideX == 0 || strideY == 0) {
-    mexErrMsgTxt("An element of STRIDE is zero.") ;
-  }
-
-  if (padLeft < 0 ||
-      padRight < 0 ||
-      padTop < 0 ||
-      padBottom < 0) {
-    mexErrMsgTxt("An element of PAD is negative.") ;
-  }
-
-  if (padLeft >= poolWidth ||
-      padRight >= poolWidth ||
-      padTop >= poolHeight  ||
-      padBottom >= poolHeight) {
-    mexErrMsgTxt("A padding value is larger or equal than the size of the pooling window.") ;
-  }
-
   if (inIndicesMode) {
     if (inIndices.mode == matlabGpuArrayWrapper) {
       mexErrMsgTxt("ININDICES should be a CPU array.") ;
@@ -251,40 +259,68 @@ void mexFunction(int nout, mxArray *out[],
 
   packed_data_init_with_geom_int(&poolIndices, false, poolIndicesGeom, false, false, 0) ;
 
-  switch(method) {
-    case NN_POOL_MAX:
-      max_pooling_indices_cpu(poolIndices.memoryInt,
-                              inIndicesMode ? inIndices.memoryInt : NULL,
-                              dataHeight, dataWidth,
-                              poolHeight,
-                              poolWidth,
-                              strideY,
-                              strideX,
-                              padTop,
-                              padBottom,
-                              padLeft,
-                              padRight) ;
-      break;
-    case NN_POOL_AVG:
-      avg_pooling_indices_cpu(poolIndices.memoryInt,
-                              inIndicesMode ? inIndices.memoryInt : NULL,
-                              dataHeight, dataWidth,
-                              poolHeight,
-                              poolWidth,
-                              strideY,
-                              strideX,
-                              padTop,
-                              padBottom,
-                              padLeft,
-                              padRight) ;
-      break;
-    default:
-      assert(false);
+  error = perfcnn::poolIndices(packed_data_get_index_tensor(&poolIndices),
+                               dataGeom, poolOptions,
+                               inIndicesMode ? inIndices.memoryInt : NULL) ;
+  if (error != perfcnn::vlSuccess) {
+    mexErrMsgTxt(perfcnn::getLastErrorMessage()) ;
+  }
+
+  /* one list of runs per output pixel */
+  if (runLengthMode) {
+    PackedDataGeometry encodedGeom ;
+    error = perfcnn::runLengthEncodeGeometry(geom,
+                                             packed_data_get_index_tensor(&poolIndices),
+                                             poolIndicesGeom.height) ;
+    if (error != perfcnn::vlSuccess) {
+      mexErrMsgTxt(perfcnn::getLastErrorMessage()) ;
+    }
+    packed_data_geom_init(&encodedGeom, mxINT32_CLASS, geom.height, geom.width, geom.depth, geom.size) ;
+    packed_data_init_with_geom_int(&encodedIndices, false, encodedGeom, false, false, 0) ;
+    error = perfcnn::runLengthEncode(packed_data_get_index_tensor(&encodedIndices),
+                                     packed_data_get_index_tensor(&poolIndices),
+                                     poolIndicesGeom.height) ;
+    if (error != perfcnn::vlSuccess) {
+      mexErrMsgTxt(perfcnn::getLastErrorMessage()) ;
+    }
+    if (verbosity > 0) {
+      packed_data_geom_display(&encodedGeom, "vl_nnpoolidx: poolIndices (run-length)") ;
+    }
+    packed_data_deinit(&poolIndices) ;
+  }
+
+  /* the distinct indices of every pooling window, with their counts */
+  if (deduplicateMode) {
+    PackedDataGeometry encodedGeom ;
+    error = perfcnn::deduplicateIndicesGeometry(geom,
+                                                packed_data_get_index_tensor(&poolIndices),
+                                                poolIndicesGeom.height,
+                                                method) ;
+    if (error != perfcnn::vlSuccess) {
+      mexErrMsgTxt(perfcnn::getLastErrorMessage()) ;
+    }
+    packed_data_geom_init(&encodedGeom, mxINT32_CLASS, geom.height, geom.width, geom.depth, geom.size) ;
+    packed_data_init_with_geom_int(&encodedIndices, false, encodedGeom, false, false, 0) ;
+    error = perfcnn::deduplicateIndices(packed_data_get_index_tensor(&encodedIndices),
+                                        packed_data_get_index_tensor(&poolIndices),
+                                        poolIndicesGeom.height,
+                                        method) ;
+    if (error != perfcnn::vlSuccess) {
+      mexErrMsgTxt(perfcnn::getLastErrorMessage()) ;
+    }
+    if (verbosity > 0) {
+      packed_data_geom_display(&encodedGeom, "vl_nnpoolidx: poolIndices (deduplicated)") ;
+    }
+    packed_data_deinit(&poolIndices) ;
   }
 
   /* -------------------------------------------------------------- */
   /*                                                        Cleanup */
   /* -------------------------------------------------------------- */
 
-  out[OUT_RESULT] = packed_data_deinit_extracting_array(&poolIndices) ;
+  if (runLengthMode || deduplicateMode) {
+    out[OUT_RESULT] = packed_data_deinit_extracting_array(&encodedIndices) ;
+  } else {
+    out[OUT_RESULT] = packed_data_deinit_extracting_array(&poolIndices) ;
+  }
 }
@@ -52,6 +52,14 @@ function vl_compilenn( varargin )
 %       Specify additional flags to compile `vl_imreadjpeg`. This
 %       function currently requires libjpeg.
 %
+%    `Blas`:: `'matlab'`
+%       The BLAS used by the CPU code: `'matlab'` (MATLAB's own),
+%       `'openblas'`, `'mkl'`, `'blis'` or `'none'`. The libraries
+%       must be in the linker search path and use 32-bit integers;
+%       their number of threads is then set by the `NumThreads` option
+%       of `vl_nnconv()`. With `'none'`, only the slower built-in
+%       reference code is compiled in.
+%
 %    ## Compiling the CPU code
 %
 %    By default, the `EnableGpu` option is switched to off, such that
@@ -133,6 +141,7 @@ opts.enableImreadJpeg = false;
 opts.imreadJpegFlags  = {'-ljpeg'};
 opts.verbose          = 0;
 opts.debug            = false;
+opts.blas             = 'matlab';
 opts.cudaMethod       = [] ;
 opts.cudaRoot         = [] ;
 opts.cudaArch         = [] ;
@@ -147,28 +156,46 @@ opts = vl_argparse(opts, varargin);
 
 cpp_src={...
   fullfile(root, 'matlab', 'src', 'bits', 'im2col.cpp'), ...
+  fullfile(root, 'matlab', 'src', 'bits', 'blas.cpp'), ...
   fullfile(root, 'matlab', 'src', 'bits', 'pooling.cpp'), ...
+  fullfile(root, 'matlab', 'src', 'bits', 'pooling_separable.cpp'), ...
   fullfile(root, 'matlab', 'src', 'bits', 'normalize.cpp'), ...
-  fullfile(root, 'matlab', 'src', 'bits', 'subsample.cpp')} ;
+  fullfile(root, 'matlab', 'src', 'bits', 'subsample.cpp'), ...
+  fullfile(root, 'matlab', 'src', 'bits', 'perfcnn.cpp'), ...
+  fullfile(root, 'matlab', 'src', 'bits', 'threads.cpp'), ...
+  fullfile(root, 'matlab', 'src', 'bits', 'gather_gemm.cpp'), ...
+  fullfile(root, 'matlab', 'src', 'bits', 'im2col_simd.cpp'), ...
+  fullfile(root, 'matlab', 'src', 'bits', 'runlength.cpp'), ...
+  fullfile(root, 'matlab', 'src', 'bits', 'epilogue.cpp'), ...
+  fullfile(root, 'matlab', 'src', 'bits', 'perforation.cpp'), ...
+  fullfile(root, 'matlab', 'src', 'bits', 'winograd.cpp'), ...
+  fullfile(root, 'matlab', 'src', 'bits', 'dedup.cpp')} ;
 mex_src={...
   fullfile(root, 'matlab', 'src', 'vl_nnconv.cpp'), ...
   fullfile(root, 'matlab', 'src', 'vl_nnconvidx.cpp'), ...
   fullfile(root, 'matlab', 'src', 'vl_nnpool.cpp'), ...
   fullfile(root, 'matlab', 'src', 'vl_nnpoolidx.cpp'), ...
   fullfile(root, 'matlab', 'src', 'vl_nnpoolfast.cpp'), ...
-  fullfile(root, 'matlab', 'src', 'vl_nnnormalize.cpp')} ;
+  fullfile(root, 'matlab', 'src', 'vl_nnnormalize.cpp'), ...
+  fullfile(root, 'matlab', 'src', 'vl_nnperf_knn.cpp'), ...
+  fullfile(root, 'matlab', 'src', 'vl_nnperf_zeros.cpp'), ...
+  fullfile(root, 'matlab', 'src', 'vl_nninterpidx.cpp')} ;
 cu_src={...
   fullfile(root, 'matlab', 'src', 'bits', 'im2col_gpu.cu'), ...
   fullfile(root, 'matlab', 'src', 'bits', 'pooling_gpu.cu'), ...
   fullfile(root, 'matlab', 'src', 'bits', 'normalize_gpu.cu'), ...
-  fullfile(root, 'matlab', 'src', 'bits', 'subsample_gpu.cu')} ;
+  fullfile(root, 'matlab', 'src', 'bits', 'subsample_gpu.cu'), ...
+  fullfile(root, 'matlab', 'src', 'bits', 'perforation_gpu.cu')} ;
 mex_cu_src={...
   fullfile(root, 'matlab', 'src', 'vl_nnconv.cu'), ...
   fullfile(root, 'matlab', 'src', 'vl_nnconvidx.cu'), ...
   fullfile(root, 'matlab', 'src', 'vl_nnpool.cu'), ...
   fullfile(root, 'matlab', 'src', 'vl_nnpoolidx.cu'), ...
   fullfile(root, 'matlab', 'src', 'vl_nnpoolfast.cu'), ...
-  fullfile(root, 'matlab', 'src', 'vl_nnnormalize.cu')} ;
+  fullfile(root, 'matlab', 'src', 'vl_nnnormalize.cu'), ...
+  fullfile(root, 'matlab', 'src', 'vl_nnperf_knn.cu'), ...
+  fullfile(root, 'matlab', 'src', 'vl_nnperf_zeros.cu'), ...
+  fullfile(root, 'matlab', 'src', 'vl_nninterpidx.cu')} ;
 
 % --------------------------------------------------------------------
 %                                                     Compiler options
@@ -181,10 +208,27 @@ if ~exist(bld_dir, 'dir'), mkdir(bld_dir); end
 
 % MEX arguments
 arch = computer('arch') ;
-mex_libs = {'-lmwblas'};
 mex_opts = {'-largeArrayDims'};
+switch lower(opts.blas)
+  case 'matlab', mex_libs = {'-lmwblas'} ;
+  case 'openblas', mex_libs = {'-lopenblas'} ;
+    mex_opts(end+1:end+2) = {'-DVL_BLAS_OPENBLAS', '-DVL_BLAS_INT=int'} ;
+  case 'mkl', mex_libs = {'-lmkl_rt'} ;
+    mex_opts(end+1:end+2) = {'-DVL_BLAS_MKL', '-DVL_BLAS_INT=int'} ;
+  case 'blis', mex_libs = {'-lblis'} ;
+    mex_opts(end+1:end+2) = {'-DVL_BLAS_BLIS', '-DVL_BLAS_INT=int'} ;
+  case 'none', mex_libs = {} ;
+    mex_opts{end+1} = '-DVL_BLAS_NONE' ;
+  otherwise
+    error('Unknown BLAS ''%s''.', opts.blas) ;
+end
 if opts.verbose > 1, mex_opts{end+1} = '-v'; end
 if opts.debug, mex_opts{end+1} = '-g' ; end
+% OpenMP runs the CPU kernels on multiple threads
+if strcmp(arch, 'glnxa64')
+  mex_opts{end+1} = 'CXXFLAGS=$CXXFLAGS -fopenmp' ;
+  mex_opts{end+1} = 'LDFLAGS=$LDFLAGS -fopenmp' ;
+end
 
 if opts.verbose
   fprintf('%s: intermediate build products: %s\n', mfilename, bld_dir) ;
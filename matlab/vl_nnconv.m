@@ -38,6 +38,111 @@
 %      different padding amounts for the top, bottom, left, and right
 %      sides respectively.
 %
+%    ConvIndices:: []
+%      INT32 indices computed by VL_NNCONVIDX(). The convolution is
+%      then evaluated only in the output positions listed in the
+%      indices (perforated convolution). On the CPU, the indices can
+%      also be run-length encoded (VL_NNCONVIDX(..., 'RunLength')),
+%      which stores the spans of consecutive pixels compactly and
+%      copies them as a whole. With 1 x 1 filters (and plain indices
+%      of a single slice), the CPU code multiplies the runs of
+%      consecutive pixels of the mask in place and gathers only the
+%      remaining rows.
+%
+%    MicrobatchSize:: [1]
+%      With ConvIndices, the number of images whose columns are
+%      stacked into a single matrix multiplication.
+%      'auto' chooses it on the CPU: the sizes whose scratch memory
+%      fits in the processor cache are timed on the first call for a
+%      layer shape (and number of threads) and the fastest one is
+%      remembered. On the GPU, 'auto' uses one image.
+%
+%    NumThreads:: [0]
+%      With ConvIndices, the number of CPU threads used for this
+%      call. Zero uses the default (the number of cores). The
+%      microbatches are processed concurrently, so the scratch memory
+%      grows with the number of threads. With OpenBLAS, MKL or BLIS
+%      (see VL_COMPILENN()), the threads of the BLAS are set as well.
+%
+%    Blas:: ['Linked']
+%      The BLAS used on the CPU for this call: 'Linked' (the library
+%      the MEX file was compiled against) or 'Reference' (the slower
+%      built-in code, e.g. to check the results of a BLAS).
+%
+%    Simd:: ['auto']
+%      With ConvIndices on the CPU, the gather and scatter kernels
+%      used for this call: 'auto' (the fastest one the processor
+%      supports), 'avx512', 'avx2' or 'scalar'. An implementation the
+%      processor (or the build) does not support is an error. The
+%      results are the same; this is meant for testing.
+%
+%    ImplicitGemm:: [false]
+%      With ConvIndices on the CPU, the forward pass gathers the input
+%      pixels directly into the blocks of the matrix multiplication
+%      instead of forming the full im2col matrix, so no scratch memory
+%      is needed. MicrobatchSize is ignored. The backward pass is not
+%      affected.
+%
+%    Layout:: ['Default']
+%      With ConvIndices on the CPU, 'NHWC' stores X, Y and their
+%      derivatives channel-last, i.e. as D x H x W x N arrays
+%      (PERMUTE(X, [3 1 2 4])), so that the channels of a pixel are
+%      contiguous. F keeps the default layout. Not compatible with
+%      run-length encoded indices nor with ImplicitGemm.
+%
+%    CreatePlan:: [false]
+%      With ConvIndices on the CPU, PLAN = VL_NNCONV(X, F, B,
+%      'ConvIndices', CONVINDICES, ..., 'CreatePlan') does not compute
+%      the convolution, but returns a handle to a plan that stores a
+%      copy of CONVINDICES, the MicrobatchSize, the Layout and the
+%      scratch memory for inputs with the size of X and F.
+%
+%    Plan:: []
+%      Evaluates the convolution (or its derivatives) with a plan
+%      returned by CreatePlan instead of ConvIndices. Calls with a plan
+%      skip the validation of the indices and the allocation of the
+%      scratch memory. X and F must have the size given at creation,
+%      except for the number of images if CONVINDICES has a single
+%      slice. VL_NNCONV('FreePlan', PLAN) releases a plan; CLEAR MEX
+%      releases all of them.
+%
+%    ReLU:: [false]
+%      On the CPU, the forward pass returns MAX(Y, 0), the output of
+%      VL_NNRELU(), computed while the biases are added to each block
+%      of the output instead of in a separate pass. The option is not
+%      accepted with DZDY: the derivatives are those of the
+%      convolution alone, so pass VL_NNRELU(Y, DZDY) as DZDY.
+%
+%    InterpolationIndices:: []
+%      With ConvIndices on the CPU, an INT32 array of size YH x YW
+%      (x N) that fills the full-resolution output from the perforated
+%      one: each pixel of Y copies the channels of the computed output
+%      pixel whose zero-based index (in the order of the CONVINDICES
+%      columns) it lists, or is zero where the index is -1. The copy is
+%      done image by image while the computed outputs are still in
+%      cache, after the biases and ReLU. With DZDY of size YH x YW x K x
+%      N, the derivative is summed back to the computed pixels. Not
+%      compatible with ImplicitGemm, CreatePlan and Plan.
+%
+%    Winograd:: [automatic]
+%      On the CPU, the forward pass of 3 x 3 filters with unit stride
+%      (without ConvIndices) is computed with the Winograd F(2x2, 3x3)
+%      algorithm, which needs 16 instead of 36 multiplications per
+%      2 x 2 output tile. By default it is used when the filters have
+%      at least 32 channels and there are at least 32 filters per
+%      group, where it is faster than IM2COL; true or false forces the
+%      choice. The results differ from those of IM2COL by rounding
+%      only. The backward pass always uses IM2COL.
+%
+%    MaskIndices:: []
+%      With Winograd, INT32 zero-based indices of the output pixels of
+%      a YH x YW map to compute (e.g. the NONPERFORATEDINDICES of a
+%      perforated layer). Y is then of size M x 1 x K x N, where M is
+%      the number of indices, as with the ConvIndices of a mask. Only
+%      the 2 x 2 tiles that contain a listed pixel are evaluated, so
+%      this pays off when the pixels form a regular grid of rows and
+%      columns (the Grid and FractionalStride perforations).
+%
 %    The filter size must be not larger than the padded image, i.e.
 %
 %      1 <= FH <= H + 2*(PADTOP+PADBOTTOM),
@@ -0,0 +1,38 @@
+% VL_NNINTERPIDX  Nearest-neighbour interpolation indices of a mask
+%   OUTINDICES = VL_NNINTERPIDX(MASKINDICES, SIZE) returns the SIZE(1)
+%   x SIZE(2) INT32 array of the zero-based positions in MASKINDICES
+%   of the computed pixel nearest (in Euclidean distance) to each
+%   pixel of the map. MASKINDICES is an INT32 vector of the zero-based
+%   offsets of the computed pixels in the map. A computed pixel is its
+%   own nearest neighbour. Among equally near computed pixels, the one
+%   with the smallest offset is chosen (see the Ties option).
+%
+%   OUTINDICES is the OUTINDICES argument of VL_NNPERF_KNN() with one
+%   neighbour, and the InterpolationIndices option of VL_NNCONV() for
+%   a convolution perforated with MASKINDICES.
+%
+%   The indices are obtained from the exact Euclidean distance
+%   transform of the mask, in time linear in the number of pixels.
+%
+%   VL_NNINTERPIDX(..., 'OPT', VALUE, ...) accepts the following
+%   options:
+%
+%   Ties:: 'First'
+%     The rule choosing among equally near computed pixels. 'First'
+%     takes the one with the smallest offset. 'Nearest' takes the one
+%     whose offset is closest to that of the pixel, so that the pixels
+%     copied by VL_NNPERF_KNN() are close in memory. 'Random' takes one
+%     at random, as a function of Seed and of the pixel only. All the
+%     rules give the same indices on every run.
+%
+%   Seed:: 0
+%     The non-negative integer seed of the 'Random' rule.
+%
+%   Verbose::
+%     Prints the sizes of the arrays.
+
+% Copyright (C) 2015 Michael Figurnov.
+% All rights reserved.
+%
+% This file is part of the VLFeat library and is made available under
+% the terms of the BSD license (see the COPYING file).
@@ -20,6 +20,15 @@
 %   DZDX = VL_NNORMALIZE(X, PARAM, DZDY) computes the derivative of
 %   the network output DZDX with respect to the block input X given
 %   the derivative DZDY with respect to the block output Y.
+%
+%   VL_NNNORMALIZE(..., 'Layout', 'NHWC') takes (on the CPU) X and DZDY
+%   as D x H x W x N arrays with the feature channels first
+%   (PERMUTE(X, [3 1 2 4])) and returns Y and DZDX in the same layout.
+%
+%   VL_NNNORMALIZE(..., 'NumThreads', N) uses N CPU threads for this
+%   call, splitting the images (and the pixels of an image when there
+%   are fewer images than threads). Zero uses the default (the number
+%   of cores).
 
 % Copyright (C) 2014 Andrea Vedaldi.
 % All rights reserved.
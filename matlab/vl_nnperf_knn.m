@@ -1,16 +1,28 @@
-function y = vl_nnperf_knn(x,maskindices,outindices,weights)
+% VL_NNPERF_KNN  Fill the perforated positions with their nearest neighbours
+%   Y = VL_NNPERF_KNN(X, MASKINDICES, OUTINDICES, WEIGHTS) sets every
+%   pixel of the H x W x D x N array X to a weighted sum of the values
+%   of its K nearest computed pixels. MASKINDICES is an INT32 vector
+%   of the zero-based offsets of the computed pixels in a H x W map,
+%   OUTINDICES is a H x W x K INT32 array of zero-based positions in
+%   MASKINDICES (see VL_MASKINDICES_TO_OUTINDICES()) and WEIGHTS is
+%   either a scalar or a H x W x K array:
+%
+%     Y(i,j,:,:) = sum_k WEIGHTS(i,j,k) * X(u,v,:,:)
+%
+%   where (u,v) is the pixel at offset MASKINDICES(OUTINDICES(i,j,k)+1).
+%   WEIGHTS is SINGLE (a DOUBLE array is also accepted on the CPU).
+%
+%   DZDX = VL_NNPERF_KNN(X, MASKINDICES, OUTINDICES, WEIGHTS, DZDY)
+%   computes the derivative of the network output with respect to X
+%   given the derivative DZDY with respect to Y. DZDX has the size of
+%   X.
+%
+%   VL_NNPERF_KNN(..., 'Layout', 'NHWC') takes (on the CPU) X and DZDY
+%   as D x H x W x N arrays with the feature channels first
+%   (PERMUTE(X, [3 1 2 4])) and returns Y and DZDX in the same layout.
 
-sz = size(x);
-
-idx = maskindices(outindices + 1) + 1;
-y = zeros(sz, 'like', x);
-x = reshape(x, sz(1)*sz(2), sz(3), sz(4));
-for i = 1:size(idx, 3)
-  tmp = x(idx(:, :, i), :, :);
-  tmp = reshape(tmp, sz);
-  if numel(weights) ~= 1
-    y = y + bsxfun(@times, tmp, weights(:, :, i));
-  else
-    y = y + weights .* tmp;
-  end
-end
+% Copyright (C) 2015 Michael Figurnov.
+% All rights reserved.
+%
+% This file is part of the VLFeat library and is made available under
+% the terms of the BSD license (see the COPYING file).
@@ -1,18 +1,19 @@
-function y = vl_nnperf_zeros(x,maskindices,varargin)
+% VL_NNPERF_ZEROS  Set the perforated positions to zero
+%   Y = VL_NNPERF_ZEROS(X, MASKINDICES) copies the pixels of the H x W
+%   x D x N array X listed in the INT32 vector MASKINDICES (zero-based
+%   offsets in a H x W map) and sets all the other pixels to zero.
+%
+%   DZDX = VL_NNPERF_ZEROS(X, MASKINDICES, DZDY) computes the
+%   derivative of the network output with respect to X given the
+%   derivative DZDY with respect to Y, i.e. DZDY masked in the same
+%   way. X is only used for its size.
+%
+%   VL_NNPERF_ZEROS(..., 'Layout', 'NHWC') takes (on the CPU) X and
+%   DZDY as D x H x W x N arrays with the feature channels first
+%   (PERMUTE(X, [3 1 2 4])) and returns Y and DZDX in the same layout.
 
-backMode = numel(varargin) > 0 ;
-if backMode
-  dzdy = varargin{1} ;
-end
-
-sz = size(x);
-
-mask = false(sz(1), sz(2));
-mask(maskindices + 1) = true;
-
-% do job
-if ~backMode
-  y = bsxfun(@times, x, mask) ;
-else
-  y = bsxfun(@times, dzdy, mask) ;
-end
+% Copyright (C) 2015 Michael Figurnov.
+% All rights reserved.
+%
+% This file is part of the VLFeat library and is made available under
+% the terms of the BSD license (see the COPYING file).
@@ -12,6 +12,14 @@
 %    the nework output Z w.r.t. the data X given the derivative DZDY
 %    w.r.t the max-pooling output Y.
 %
+%    [Y, SWITCHES] = VL_NNPOOL(X, POOL, ...) also returns, for the max
+%    pooling, an INT32 array of the size of Y with the zero-based
+%    offset in its H x W map of X of the maximum of each window. Then
+%    DZDX = VL_NNPOOL(X, POOL, DZDY, 'Switches', SWITCHES, ...)
+%    distributes DZDY to these elements without searching the windows
+%    of X again. VL_NNPOOLFAST() accepts the same arguments. The
+%    switches are computed on the CPU only.
+%
 %    VL_NNCONV(..., 'option', value, ...) takes the following options:
 %
 %    Stride:: [1]
@@ -31,6 +39,11 @@
 %      over the pooling region per channel) or 'avg' (compute the average
 %      value over the poolling region per channel).
 %
+%    NumThreads:: [0]
+%      The number of CPU threads used for this call. The channels of
+%      the images are pooled concurrently. Zero uses the default (the
+%      number of cores). VL_NNPOOLFAST() takes the same option.
+%
 %    The pooling window must be not larger than the padded image, i.e.
 %
 %      1 <= POOLY <= HEIGHT + (PADTOP + PADBOTTOM),
@@ -63,6 +63,10 @@ function res = vl_simplenn(net, x, dzdy, res, varargin)
 %     - layer.stride: the sampling stride (usually 1).
 %     - layer.padding: the padding (usually 0).
 %
+%     When the derivatives are computed on the CPU, the forward pass
+%     of a max pooling layer also stores the argmax of every window
+%     (see VL_NNPOOL()) and the backward pass reuses it.
+%
 %   Normalization layer::
 %     The normalization layer wraps VL_NNNORMALIZE(). It has fields
 %
@@ -109,6 +113,20 @@ function res = vl_simplenn(net, x, dzdy, res, varargin)
 %     where res() is the struct array specified before. The second function is
 %     called as res(i) = backward(layer, res(i), res(i+1)). Note that the
 %     `layer` structure can contain additional fields if needed.
+%
+%   Perforated layers::
+%     A convolutional or pooling layer with layer.opindices (see
+%     NET_SET_OPINDICES()) computes only the pixels listed by its
+%     mask and outputs them as an M x 1 x K x N array. The ReLU,
+%     normalization, dropout, softmax and 1x1 convolutional layers
+%     that follow treat every pixel separately and run on this compact
+%     array as is. The full map is never formed: the opindices of the
+%     next convolutional or pooling layer read the compact array
+%     through its interpolation indices.
+%
+%   VL_SIMPLENN(..., 'NumThreads', N) runs the convolution, pooling and
+%   normalization layers on N CPU threads. Zero (the default) uses the
+%   number of cores.
 
 
 % Copyright (C) 2014 Andrea Vedaldi.
@@ -123,6 +141,7 @@ opts.sync = false ;
 opts.disableDropout = false ;
 opts.freezeDropout = false ;
 opts.accumulateGradients = false ;
+opts.numThreads = 0 ;
 opts = vl_argparse(opts, varargin);
 
 n = numel(net.layers) ;
@@ -146,6 +165,9 @@ if nargin <= 3 || isempty(res)
 end
 res(1).x = x ;
 
+% the argmax switches of the max pooling layers, for the backward pass
+switches = cell(1,n) ;
+
 for i=1:n
   l = net.layers{i} ;
   res(i).time = tic ;
@@ -158,8 +180,16 @@ for i=1:n
       else
         microbatchsize = 1;
       end
-      res(i+1).x = vl_nnconv(res(i).x, l.filters, l.biases, 'pad', l.pad, 'stride', l.stride, ...
-        'convindices', res(i+1).aux, 'microbatchsize', microbatchsize) ;
+      if ~gpuMode && isequal(vl_getfielddefault(l, 'winograd'), true)
+        % the opindices are kept for the backward pass
+        res(i+1).x = vl_nnconv(res(i).x, l.filters, l.biases, 'pad', l.pad, 'stride', l.stride, ...
+          'maskindices', vl_getfielddefault(l, 'nonPerforatedIndices'), 'winograd', true, ...
+          'numThreads', opts.numThreads) ;
+      else
+        res(i+1).x = vl_nnconv(res(i).x, l.filters, l.biases, 'pad', l.pad, 'stride', l.stride, ...
+          'convindices', res(i+1).aux, 'microbatchsize', microbatchsize, ...
+          'numThreads', opts.numThreads) ;
+      end
 
       % This code is used in fractional stride: reshape first two dimensions from n^2 x 1 to n x n
       outputShape = vl_getfielddefault(l, 'outputShape');
@@ -169,13 +199,23 @@ for i=1:n
       end
     case 'pool'
       res(i+1).aux = vl_getfielddefault(l, 'opindices');
-      if ~isempty(res(i+1).aux)
-        res(i+1).x = vl_nnpoolfast(res(i).x, res(i+1).aux, 'method', l.method) ;
+      if doder && ~gpuMode && strcmp(l.method, 'max')
+        if ~isempty(res(i+1).aux)
+          [res(i+1).x, switches{i}] = vl_nnpoolfast(res(i).x, res(i+1).aux, 'method', l.method, ...
+            'numThreads', opts.numThreads) ;
+        else
+          [res(i+1).x, switches{i}] = vl_nnpool(res(i).x, l.pool, 'pad', l.pad, 'stride', l.stride, 'method', l.method, ...
+            'numThreads', opts.numThreads) ;
+        end
+      elseif ~isempty(res(i+1).aux)
+        res(i+1).x = vl_nnpoolfast(res(i).x, res(i+1).aux, 'method', l.method, ...
+          'numThreads', opts.numThreads) ;
       else
-        res(i+1).x = vl_nnpool(res(i).x, l.pool, 'pad', l.pad, 'stride', l.stride, 'method', l.method) ;
+        res(i+1).x = vl_nnpool(res(i).x, l.pool, 'pad', l.pad, 'stride', l.stride, 'method', l.method, ...
+          'numThreads', opts.numThreads) ;
       end
     case 'normalize'
-      res(i+1).x = vl_nnnormalize(res(i).x, l.param) ;
+      res(i+1).x = vl_nnnormalize(res(i).x, l.param, 'numThreads', opts.numThreads) ;
     case 'softmax'
       res(i+1).x = vl_nnsoftmax(res(i).x) ;
     case 'loss'
@@ -250,18 +290,27 @@ if doder
                       'pad', l.pad, 'stride', l.stride, ...
                       'convindices', res(i+1).aux, ...
                       'microbatchsize', microbatchsize, ...
-                      'derfilters', derfilters, 'derbiases', derbiases) ;
+                      'derfilters', derfilters, 'derbiases', derbiases, ...
+                      'numThreads', opts.numThreads) ;
         clear derfilters derbiases dzdx
       case 'pool'
-        if ~isempty(res(i+1).aux)
+        if ~isempty(switches{i}) && ~isempty(res(i+1).aux)
+          res(i).dzdx = vl_nnpoolfast(res(i).x, res(i+1).aux, res(i+1).dzdx, ...
+            'method', l.method, 'switches', switches{i}, 'numThreads', opts.numThreads) ;
+        elseif ~isempty(switches{i})
+          res(i).dzdx = vl_nnpool(res(i).x, l.pool, res(i+1).dzdx, ...
+            'pad', l.pad, 'stride', l.stride, 'method', l.method, 'switches', switches{i}, ...
+            'numThreads', opts.numThreads) ;
+        elseif ~isempty(res(i+1).aux)
           res(i).dzdx = vl_nnpoolfast(res(i).x, res(i+1).aux, res(i+1).dzdx, ...
-            'method', l.method) ;
+            'method', l.method, 'numThreads', opts.numThreads) ;
         else
           res(i).dzdx = vl_nnpool(res(i).x, l.pool, res(i+1).dzdx, ...
-            'pad', l.pad, 'stride', l.stride, 'method', l.method) ;
+            'pad', l.pad, 'stride', l.stride, 'method', l.method, 'numThreads', opts.numThreads) ;
         end
+        switches{i} = [] ;
       case 'normalize'
-        res(i).dzdx = vl_nnnormalize(res(i).x, l.param, res(i+1).dzdx) ;
+        res(i).dzdx = vl_nnnormalize(res(i).x, l.param, res(i+1).dzdx, 'numThreads', opts.numThreads) ;
       case 'softmax'
         res(i).dzdx = vl_nnsoftmax(res(i).x, res(i+1).dzdx) ;
       case 'loss'
@@ -286,6 +335,8 @@ if doder
         end
       case 'perfzeros'
         res(i).dzdx = vl_nnperf_zeros(res(i).x, l.maskindices, res(i+1).dzdx) ;
+      case 'perfknn'
+        res(i).dzdx = vl_nnperf_knn(res(i).x, l.maskindices, l.outindices, l.weights, res(i+1).dzdx) ;
       case 'custom'
         res(i) = l.backward(l, res(i), res(i+1)) ;
     end
@@ -39,7 +39,11 @@ for l=1:numel(net.layers)
         opindices = net.layers{l}.opindices;
         % CPU and GPU implementations use different order of opindices tensor to improve memory coalescing
         if strcmp(destination, 'gpu') && ~isa(opindices, 'gpuArray')
-          % CPU -> GPU
+          % CPU -> GPU; encoded indices (run-length or deduplicated) start
+          % with a code below -1 and exist on the CPU only
+          if ~isempty(opindices) && opindices(1) < -1
+            error('The opindices of layer %d are encoded for the CPU, recompute them with NET_SET_OPINDICES.', l) ;
+          end
           opindices = permute(opindices, [2 3 1]);
         elseif strcmp(destination, 'cpu') && isa(opindices, 'gpuArray')
           % GPU -> CPU
@@ -44,4 +44,297 @@ for bias=[false true]
 end
 end
 
+disp('testing vl_nnconv with multiple threads') ;
+n = 7 ;
+w = grandn(3,3,10,fn,'single') ;
+b = grandn(1,fn,'single') ;
+x = grandn(9,18,10,n,'single') ;
+convindices = vl_nnconvidx([9 18 10 n], size(w), 'pad', 1) ;
+if gpu
+  convindices = gpuArray(convindices);
+end
+for microbatchsize=[1 2 3]
+  y = vl_nnconv(x,w,b,'convindices',convindices,'microbatchsize',microbatchsize,'numthreads',1) ;
+  dzdy = grandn(size(y),'single') ;
+  [dzdx,dzdw,dzdb] = vl_nnconv(x,w,b,dzdy,'convindices',convindices,'microbatchsize',microbatchsize,'numthreads',1) ;
+  for numthreads=[2 4]
+    y_ = vl_nnconv(x,w,b,'convindices',convindices,'microbatchsize',microbatchsize,'numthreads',numthreads) ;
+    [dzdx_,dzdw_,dzdb_] = vl_nnconv(x,w,b,dzdy,'convindices',convindices,'microbatchsize',microbatchsize,'numthreads',numthreads) ;
+    vl_testsim(y, y_) ;
+    vl_testsim(dzdx, dzdx_) ;
+    vl_testsim(dzdw, dzdw_) ;
+    vl_testsim(dzdb, dzdb_) ;
+  end
+end
+
+disp('testing vl_nnconv with filter groups and multiple threads') ;
+wg = grandn(3,3,5,2*fn,'single') ;
+bg = grandn(1,2*fn,'single') ;
+for microbatchsize=[1 3]
+  y = vl_nnconv(x,wg,bg,'convindices',convindices,'microbatchsize',microbatchsize,'numthreads',1) ;
+  dzdy = grandn(size(y),'single') ;
+  [dzdx,dzdw,dzdb] = vl_nnconv(x,wg,bg,dzdy,'convindices',convindices,'microbatchsize',microbatchsize,'numthreads',1) ;
+  y_ = vl_nnconv(x,wg,bg,'convindices',convindices,'microbatchsize',microbatchsize,'numthreads',4) ;
+  [dzdx_,dzdw_,dzdb_] = vl_nnconv(x,wg,bg,dzdy,'convindices',convindices,'microbatchsize',microbatchsize,'numthreads',4) ;
+  vl_testsim(y, y_) ;
+  vl_testsim(dzdx, dzdx_) ;
+  vl_testsim(dzdw, dzdw_) ;
+  vl_testsim(dzdb, dzdb_) ;
+end
+vl_testsim(vl_nnconv(x,wg,bg,'numthreads',1), vl_nnconv(x,wg,bg,'numthreads',4)) ;
+
+disp('testing vl_nnconv with automatic microbatch size') ;
+y = vl_nnconv(x,w,b,'convindices',convindices) ;
+dzdy = grandn(size(y),'single') ;
+[dzdx,dzdw,dzdb] = vl_nnconv(x,w,b,dzdy,'convindices',convindices) ;
+for numthreads=[1 2]
+  y_ = vl_nnconv(x,w,b,'convindices',convindices,'microbatchsize','auto','numthreads',numthreads) ;
+  [dzdx_,dzdw_,dzdb_] = vl_nnconv(x,w,b,dzdy,'convindices',convindices,'microbatchsize','auto','numthreads',numthreads) ;
+  vl_testsim(y, y_) ;
+  vl_testsim(dzdx, dzdx_) ;
+  vl_testsim(dzdw, dzdw_) ;
+  vl_testsim(dzdb, dzdb_) ;
+end
+
+disp('testing vl_nnconv with implicit GEMM') ;
+for bias=[false true]
+  if bias
+    b = grandn(1,fn,'single') ;
+  else
+    b = [] ;
+  end
+  y = vl_nnconv(x,w,b,'convindices',convindices) ;
+  for numthreads=[1 2]
+    y_ = vl_nnconv(x,w,b,'convindices',convindices,'implicitgemm','numthreads',numthreads) ;
+    vl_testsim(y, y_) ;
+  end
+end
+
+if ~gpu
+  disp('testing vl_nnconv with run-length encoded indices') ;
+  mask = rand([9 18]) >= 0.5 ;
+  maskindices = int32(find(mask(:))) - 1 ;
+  for pad=[0 1]
+    convindices = vl_nnconvidx([9 18 10 n], size(w), 'pad', pad, 'maskindices', maskindices) ;
+    convindicesrle = vl_nnconvidx([9 18 10 n], size(w), 'pad', pad, 'maskindices', maskindices, 'runlength') ;
+    y = vl_nnconv(x,w,b,'convindices',convindices) ;
+    y_ = vl_nnconv(x,w,b,'convindices',convindicesrle) ;
+    vl_testsim(y, y_) ;
+    dzdy = grandn(size(y),'single') ;
+    [dzdx,dzdw,dzdb] = vl_nnconv(x,w,b,dzdy,'convindices',convindices,'microbatchsize',2) ;
+    [dzdx_,dzdw_,dzdb_] = vl_nnconv(x,w,b,dzdy,'convindices',convindicesrle,'microbatchsize',2) ;
+    vl_testsim(dzdx, dzdx_) ;
+    vl_testsim(dzdw, dzdw_) ;
+    vl_testsim(dzdb, dzdb_) ;
+  end
+
+  disp('testing vl_nnconv with channel-last data') ;
+  xt = permute(x, [3 1 2 4]) ;
+  for groups=[1 5]
+    w = grandn(3,3,10/groups,fn,'single') ;
+    convindices = vl_nnconvidx([9 18 10 n], size(w), 'pad', 1, 'maskindices', maskindices) ;
+    y = vl_nnconv(x,w,b,'convindices',convindices) ;
+    dzdy = grandn(size(y),'single') ;
+    for microbatchsize=[1 3]
+      y_ = vl_nnconv(xt,w,b,'convindices',convindices,'microbatchsize',microbatchsize,'layout','nhwc') ;
+      vl_testsim(permute(y, [3 1 2 4]), y_) ;
+      [dzdx,dzdw,dzdb] = vl_nnconv(x,w,b,dzdy,'convindices',convindices,'microbatchsize',microbatchsize) ;
+      [dzdx_,dzdw_,dzdb_] = vl_nnconv(xt,w,b,permute(dzdy, [3 1 2 4]),'convindices',convindices,'microbatchsize',microbatchsize,'layout','nhwc') ;
+      vl_testsim(permute(dzdx, [3 1 2 4]), dzdx_) ;
+      vl_testsim(dzdw, dzdw_) ;
+      vl_testsim(dzdb, dzdb_) ;
+    end
+  end
+
+  disp('testing vl_nnconv with plans') ;
+  w = grandn(3,3,10,fn,'single') ;
+  convindices = vl_nnconvidx([9 18 10 n], size(w), 'pad', 1, 'maskindices', maskindices) ;
+  for microbatchsize=[1 3]
+    plan = vl_nnconv(x,w,b,'convindices',convindices,'microbatchsize',microbatchsize,'createplan') ;
+    for n_=[n 2]
+      x_ = grandn(9,18,10,n_,'single') ;
+      y = vl_nnconv(x_,w,b,'convindices',convindices,'microbatchsize',microbatchsize) ;
+      y_ = vl_nnconv(x_,w,b,'plan',plan) ;
+      vl_testsim(y, y_) ;
+      dzdy = grandn(size(y),'single') ;
+      [dzdx,dzdw,dzdb] = vl_nnconv(x_,w,b,dzdy,'convindices',convindices,'microbatchsize',microbatchsize) ;
+      [dzdx_,dzdw_,dzdb_] = vl_nnconv(x_,w,b,dzdy,'plan',plan) ;
+      vl_testsim(dzdx, dzdx_) ;
+      vl_testsim(dzdw, dzdw_) ;
+      vl_testsim(dzdb, dzdb_) ;
+    end
+    vl_nnconv('freeplan', plan) ;
+  end
+
+  disp('testing vl_nnconv with fused ReLU') ;
+  for bias=[false true]
+    if bias
+      b = grandn(1,fn,'single') ;
+    else
+      b = [] ;
+    end
+    y = vl_nnrelu(vl_nnconv(x,w,b,'convindices',convindices)) ;
+    vl_testsim(y, vl_nnconv(x,w,b,'convindices',convindices,'microbatchsize',3,'relu')) ;
+    vl_testsim(y, vl_nnconv(x,w,b,'convindices',convindices,'implicitgemm','relu')) ;
+    y_ = vl_nnconv(permute(x, [3 1 2 4]),w,b,'convindices',convindices,'layout','nhwc','relu') ;
+    vl_testsim(permute(y, [3 1 2 4]), y_) ;
+    plan = vl_nnconv(x,w,b,'convindices',convindices,'createplan') ;
+    vl_testsim(y, vl_nnconv(x,w,b,'plan',plan,'relu')) ;
+    vl_nnconv('freeplan', plan) ;
+    y = vl_nnrelu(vl_nnconv(x,w,b,'pad',1)) ;
+    vl_testsim(y, vl_nnconv(x,w,b,'pad',1,'relu')) ;
+    b_ = grandn(1,10*bias,'single') ;
+    y = vl_nnrelu(vl_nnconv(x,[],b_,'stride',2)) ;
+    vl_testsim(y, vl_nnconv(x,[],b_,'stride',2,'relu')) ;
+    x_ = grandn(3,3,10,n,'single') ;
+    y = vl_nnrelu(vl_nnconv(x_,w,b)) ;
+    vl_testsim(y, vl_nnconv(x_,w,b,'relu')) ;
+  end
+
+  disp('testing vl_nnconv with interpolated output') ;
+  m = numel(maskindices) ;
+  interpindices = int32(floor(rand(9,18) * (m + 1))) - 1 ;
+  interpindices(maskindices + 1) = 0:m-1 ;
+  sel = interpindices(:) + 1 ;
+  for relu=[false true]
+    y = vl_nnconv(x,w,b,'convindices',convindices) ;
+    opts = {} ;
+    if relu, y = vl_nnrelu(y) ; opts = {'relu'} ; end
+    y = reshape(y, m, fn, n) ;
+    yi = zeros(9*18, fn, n, 'single') ;
+    yi(sel > 0,:,:) = y(sel(sel > 0),:,:) ;
+    yi = reshape(yi, 9, 18, fn, n) ;
+    for microbatchsize=[1 3]
+      y_ = vl_nnconv(x,w,b,'convindices',convindices,'interpolationindices',interpindices, ...
+                     'microbatchsize',microbatchsize,opts{:}) ;
+      vl_testsim(yi, y_) ;
+      y_ = vl_nnconv(xt,w,b,'convindices',convindices,'interpolationindices',interpindices, ...
+                     'microbatchsize',microbatchsize,'layout','nhwc',opts{:}) ;
+      vl_testsim(permute(yi, [3 1 2 4]), y_) ;
+    end
+  end
+  dzdy = grandn(9,18,fn,n,'single') ;
+  dzdyc = zeros(m, fn, n, 'single') ;
+  for i=find(sel > 0)'
+    dzdyc(sel(i),:,:) = dzdyc(sel(i),:,:) + reshape(dzdy(i + (0:fn*n-1) * 9*18), 1, fn, n) ;
+  end
+  dzdyc = reshape(dzdyc, size(vl_nnconv(x,w,b,'convindices',convindices))) ;
+  [dzdx,dzdw,dzdb] = vl_nnconv(x,w,b,dzdyc,'convindices',convindices) ;
+  [dzdx_,dzdw_,dzdb_] = vl_nnconv(x,w,b,dzdy,'convindices',convindices,'interpolationindices',interpindices) ;
+  vl_testsim(dzdx, dzdx_) ;
+  vl_testsim(dzdw, dzdw_) ;
+  vl_testsim(dzdb, dzdb_) ;
+  vl_testder(@(x) vl_nnconv(x,w,b,'convindices',convindices,'interpolationindices',interpindices), ...
+             x, dzdy, dzdx_, range * 1e-2) ;
+
+  disp('testing vl_nnconv with reordered mask indices') ;
+  convindices = vl_nnconvidx([9 18 10 n], size(w), 'pad', 1, 'maskindices', maskindices) ;
+  y = reshape(vl_nnconv(x,w,b,'convindices',convindices), m, fn, n) ;
+  mr = maskindices(end:-1:1) ;
+  for order={'given', 'memory', 'morton'}
+    [convindices_, order_] = vl_nnconvidx([9 18 10 n], size(w), 'pad', 1, 'maskindices', mr, 'order', order{1}) ;
+    assert(isequal(sort(order_), int32(0:m-1)')) ;
+    if strcmp(order{1}, 'memory'), assert(isequal(mr(order_ + 1), maskindices)) ; end
+    [~, pos] = ismember(mr(order_ + 1), maskindices) ;
+    y_ = vl_nnconv(x,w,b,'convindices',convindices_) ;
+    vl_testsim(y(pos,:,:), reshape(y_, m, fn, n)) ;
+  end
+
+  disp('testing vl_nnconv with the reference BLAS') ;
+  convindices = vl_nnconvidx([9 18 10 n], size(w), 'pad', 1) ;
+  y = vl_nnconv(x,w,b,'convindices',convindices) ;
+  dzdy = grandn(size(y),'single') ;
+  [dzdx,dzdw,dzdb] = vl_nnconv(x,w,b,dzdy,'convindices',convindices) ;
+  for numthreads=[0 2]
+    y_ = vl_nnconv(x,w,b,'convindices',convindices,'blas','reference','numthreads',numthreads) ;
+    [dzdx_,dzdw_,dzdb_] = vl_nnconv(x,w,b,dzdy,'convindices',convindices,'blas','reference','numthreads',numthreads) ;
+    vl_testsim(y, y_) ;
+    vl_testsim(dzdx, dzdx_) ;
+    vl_testsim(dzdw, dzdw_) ;
+    vl_testsim(dzdb, dzdb_) ;
+  end
+  vl_testsim(vl_nnconv(x,w,b), vl_nnconv(x,w,b,'blas','reference')) ;
+
+  disp('testing vl_nnconv with each gather/scatter implementation') ;
+  % the gathers and scatters have length WIDTH, with padding (-1) lanes
+  % and, for the sparse masks, runs of repeated indices
+  for width=1:40
+    for density=[1 0.3]
+      mask = rand([1 width]) < density ;
+      mask(randi(width)) = true ;
+      maskindices = int32(find(mask(:))) - 1 ;
+      inindices = vl_maskindices_to_outindices(maskindices, [1 width]) ;
+      xw = grandn(numel(maskindices),1,10,2,'single') ;
+      for fw=[1 3]
+        f = grandn(1,fw,10,fn,'single') ;
+        convindices = vl_nnconvidx([1 width 10 2], size(f), 'pad', [0 0 1 1] * (fw > 1), ...
+                                   'inindices', inindices) ;
+        y = vl_nnconv(xw,f,b,'convindices',convindices,'simd','scalar','numthreads',1) ;
+        dzdy = grandn(size(y),'single') ;
+        [dzdx,dzdw,dzdb] = vl_nnconv(xw,f,b,dzdy,'convindices',convindices,'simd','scalar','numthreads',1) ;
+        for simd={'avx2', 'avx512'}
+          try
+            y_ = vl_nnconv(xw,f,b,'convindices',convindices,'simd',simd{1},'numthreads',1) ;
+          catch err
+            assert(~isempty(strfind(err.message, 'SIMD is not supported by this CPU.'))) ;
+            continue ;
+          end
+          [dzdx_,dzdw_,dzdb_] = vl_nnconv(xw,f,b,dzdy,'convindices',convindices,'simd',simd{1},'numthreads',1) ;
+          assert(isequal(y, y_)) ;
+          assert(isequal(dzdx, dzdx_)) ;
+          assert(isequal(dzdw, dzdw_)) ;
+          assert(isequal(dzdb, dzdb_)) ;
+        end
+      end
+    end
+  end
+
+  disp('testing vl_nnconv with Winograd') ;
+  for pad=[0 1]
+    for groups=[1 5]
+      w = grandn(3,3,10/groups,fn,'single') ;
+      y = vl_nnconv(x,w,b,'pad',pad,'winograd',false) ;
+      vl_testsim(y, vl_nnconv(x,w,b,'pad',pad,'winograd',true)) ;
+      vl_testsim(vl_nnrelu(y), vl_nnconv(x,w,b,'pad',pad,'winograd',true,'relu','numthreads',2)) ;
+    end
+    mask = false(size(y,1), size(y,2)) ;
+    mask(2:3:end, 1:2:end) = true ;
+    gridindices = int32(find(mask(:))) - 1 ;
+    convindices = vl_nnconvidx([9 18 10 n], size(w), 'pad', pad, 'maskindices', gridindices) ;
+    vl_testsim(vl_nnconv(x,w,b,'convindices',convindices), ...
+               vl_nnconv(x,w,b,'pad',pad,'maskindices',gridindices,'winograd',true)) ;
+  end
+
+  % the automatic choice must leave the error to the depth check
+  xs = grandn(9,18,16,n,'single') ;
+  ws = grandn(3,3,32,32,'single') ;
+  try
+    vl_nnconv(xs,ws,[]) ;
+    error('A too shallow input was accepted.') ;
+  catch err
+    assert(~isempty(strfind(err.message, 'The filter depth does not divide the image depth.'))) ;
+  end
+
+  disp('testing vl_nnconv with masked 1x1 filters') ;
+  mask = rand([9 18]) >= 0.7 ;
+  mask(:, 5:9) = true ;
+  maskindices = int32(find(mask(:))) - 1 ;
+  for groups=[1 5]
+    w = grandn(1,1,10/groups,fn,'single') ;
+    convindices = vl_nnconvidx([9 18 10 n], size(w), 'maskindices', maskindices) ;
+    convindicesrle = vl_nnconvidx([9 18 10 n], size(w), 'maskindices', maskindices, 'runlength') ;
+    y = reshape(vl_nnconv(x,w,b), [9*18 1 fn n]) ;
+    y_ = vl_nnconv(x,w,b,'convindices',convindices,'numthreads',2) ;
+    vl_testsim(y(maskindices + 1,:,:,:), y_) ;
+    dzdy = grandn(size(y_),'single') ;
+    for microbatchsize=[1 3]
+      [dzdx,dzdw,dzdb] = vl_nnconv(x,w,b,dzdy,'convindices',convindicesrle,'microbatchsize',microbatchsize) ;
+      [dzdx_,dzdw_,dzdb_] = vl_nnconv(x,w,b,dzdy,'convindices',convindices,'microbatchsize',microbatchsize) ;
+      vl_testsim(dzdx, dzdx_) ;
+      vl_testsim(dzdw, dzdw_) ;
+      vl_testsim(dzdb, dzdb_) ;
+    end
+  end
+end
+
 end
@@ -335,6 +335,21 @@ for l = tests
               x, dzdy, dzdx, range * 1e-2) ;
           end
         end
+
+        % large windows with unit stride, which the separable pooling
+        % reduces by running max or prefix sums
+        pools = {[5 3], [6 2], [7 7]} ;
+        for k = 1:numel(pools)
+          pool = pools{k} ;
+          args = {'verbose','stride',1,'pad',[2 3 1 0], 'method', methods{mi}};
+          y = vl_nnpool(x,pool,args{:}) ;
+          idx = vl_nnpoolidx(size(x), pool, args{:}) ;
+          vl_testsim(gather(y), vl_nnpoolfast(gather(x),idx,'method',methods{mi})) ;
+          dzdy = grandn(size(y),'single') ;
+          dzdx = vl_nnpool(x,pool,dzdy,args{:}) ;
+          vl_testder(@(x) vl_nnpool(x,pool,args{:}), ...
+            x, dzdy, dzdx, range * 1e-2) ;
+        end
       end
 
     case 6
@@ -372,6 +387,36 @@ for l = tests
       y = vl_nnnormalize(x, [20, 0, 1, .5]) ;
       vl_testsim(sum(y(:).^2), 1, 1e-2) ;
 
+      if ~gpu
+        x = grandn(5,6,7,2,'single') ;
+        param = [5, .1, .5, .75] ;
+        y = vl_nnnormalize(x,param) ;
+        dzdy = grand(size(y),'single')-0.5 ;
+        dzdx = vl_nnnormalize(x,param,dzdy) ;
+        y_ = vl_nnnormalize(permute(x,[3 1 2 4]),param,'layout','nhwc') ;
+        dzdx_ = vl_nnnormalize(permute(x,[3 1 2 4]),param,permute(dzdy,[3 1 2 4]),'layout','nhwc') ;
+        vl_testsim(permute(y,[3 1 2 4]), y_) ;
+        vl_testsim(permute(dzdx,[3 1 2 4]), dzdx_) ;
+
+        % large enough to be split among the threads
+        for n=[1 3]
+          x = grandn(64,64,32,n,'single') ;
+          dzdy = grand(size(x),'single')-0.5 ;
+          y = vl_nnnormalize(x,param,'numthreads',1) ;
+          dzdx = vl_nnnormalize(x,param,dzdy,'numthreads',1) ;
+          vl_testsim(y, vl_nnnormalize(x,param,'numthreads',4)) ;
+          vl_testsim(dzdx, vl_nnnormalize(x,param,dzdy,'numthreads',4)) ;
+          xt = permute(x,[3 1 2 4]) ;
+          dzdyt = permute(dzdy,[3 1 2 4]) ;
+          yt = vl_nnnormalize(xt,param,'layout','nhwc','numthreads',1) ;
+          dzdxt = vl_nnnormalize(xt,param,dzdyt,'layout','nhwc','numthreads',1) ;
+          vl_testsim(yt, vl_nnnormalize(xt,param,'layout','nhwc','numthreads',4)) ;
+          vl_testsim(dzdxt, vl_nnnormalize(xt,param,dzdyt,'layout','nhwc','numthreads',4)) ;
+          vl_testsim(permute(y,[3 1 2 4]), yt) ;
+          vl_testsim(permute(dzdx,[3 1 2 4]), dzdxt) ;
+        end
+      end
+
     case 7
       disp('testing relu') ;
       % make sure that all elements in x are different. in this way,
@@ -0,0 +1,89 @@
+function vl_test_nnperf(gpu)
+
+range = 100 ;
+
+if nargin < 1, gpu = false ; end
+if gpu
+  grandn = @(varargin) range * gpuArray.randn(varargin{:}) ;
+else
+  grandn = @(varargin) range * randn(varargin{:}) ;
+end
+
+sz = [9 18] ;
+x = grandn(sz(1),sz(2),10,3,'single') ;
+mask = rand(sz) >= 0.7 ;
+mask(1) = true ;
+maskindices = int32(find(mask(:))) - 1 ;
+
+disp('testing vl_nnperf_zeros') ;
+y = vl_nnperf_zeros(x, maskindices) ;
+vl_testsim(y, bsxfun(@times, x, single(mask))) ;
+dzdy = grandn(size(y),'single') ;
+dzdx = vl_nnperf_zeros(x, maskindices, dzdy) ;
+vl_testder(@(x) vl_nnperf_zeros(x, maskindices), x, dzdy, dzdx, range * 1e-2) ;
+
+disp('testing vl_nninterpidx') ;
+for msz={sz, [1 13], [13 1], [20 20]}
+  msz = msz{1} ;
+  m = rand(msz) >= 0.8 ;
+  m(randi(numel(m))) = true ;
+  mi = int32(find(m(:))) - 1 ;
+  oi = vl_nninterpidx(mi, msz) ;
+  assert(isequal(size(oi), msz) && isa(oi, 'int32')) ;
+  [r, c] = ind2sub(msz, double(mi) + 1) ;
+  [gr, gc] = ndgrid(1:msz(1), 1:msz(2)) ;
+  d2 = bsxfun(@minus, gr(:), r').^2 + bsxfun(@minus, gc(:), c').^2 ;
+  [dmin, best] = min(d2, [], 2) ;
+  assert(isequal(oi(:), int32(best) - 1)) ;
+  % among the ties, the computed pixel nearest in memory
+  dm = abs(bsxfun(@minus, (1:prod(msz))', double(mi') + 1)) ;
+  dm(bsxfun(@ne, d2, dmin)) = inf ;
+  [~, best] = min(dm, [], 2) ;
+  assert(isequal(vl_nninterpidx(mi, msz, 'ties', 'nearest'), reshape(int32(best) - 1, msz))) ;
+  % the random rule picks one of the ties, the same for the same seed
+  oi = vl_nninterpidx(mi, msz, 'ties', 'random', 'seed', 3) ;
+  assert(isequal(oi, vl_nninterpidx(mi, msz, 'ties', 'random', 'seed', 3))) ;
+  assert(isequal(d2(sub2ind(size(d2), (1:prod(msz))', double(oi(:)) + 1)), dmin)) ;
+end
+
+disp('testing vl_nnperf_knn') ;
+for k=[1 3]
+  outindices = int32(floor(rand([sz k]) * numel(maskindices))) ;
+  outindices(:,:,1) = vl_maskindices_to_outindices(maskindices, sz) ;
+  for scalar=[false true]
+    if scalar
+      weights = single(0.5) ;
+    else
+      weights = single(rand([sz k])) ;
+    end
+    if gpu
+      mi = gpuArray(maskindices) ;
+      oi = gpuArray(outindices) ;
+      weights = gpuArray(weights) ;
+    else
+      mi = maskindices ;
+      oi = outindices ;
+    end
+    y = vl_nnperf_knn(x, mi, oi, weights) ;
+    x_ = reshape(x, prod(sz), []) ;
+    y_ = zeros(size(x_), 'like', x) ;
+    idx = maskindices(outindices + 1) + 1 ;
+    for i=1:k
+      w = weights ;
+      if ~scalar, w = reshape(weights(:,:,i), [], 1) ; end
+      y_ = y_ + bsxfun(@times, x_(idx(:,:,i),:), w) ;
+    end
+    vl_testsim(y, reshape(y_, size(x))) ;
+    dzdy = grandn(size(y),'single') ;
+    dzdx = vl_nnperf_knn(x, mi, oi, weights, dzdy) ;
+    vl_testder(@(x) vl_nnperf_knn(x, mi, oi, weights), x, dzdy, dzdx, range * 1e-2) ;
+    if ~gpu
+      xt = permute(x, [3 1 2 4]) ;
+      vl_testsim(permute(y, [3 1 2 4]), vl_nnperf_knn(xt, mi, oi, weights, 'layout', 'nhwc')) ;
+      vl_testsim(permute(dzdx, [3 1 2 4]), ...
+                 vl_nnperf_knn(xt, mi, oi, weights, permute(dzdy, [3 1 2 4]), 'layout', 'nhwc')) ;
+      vl_testsim(permute(vl_nnperf_zeros(x, mi), [3 1 2 4]), ...
+                 vl_nnperf_zeros(xt, mi, 'layout', 'nhwc')) ;
+    end
+  end
+end
@@ -114,4 +114,106 @@ for mi = 1:numel(methods)
     end
   end
 
+  % windows whose size has no unrolled CPU kernel
+  pools = {[1 11], [8 8], [5 9]} ;
+  for k = 1:numel(pools)
+    pool = pools{k} ;
+    args = {'verbose','stride',[1 2],'pad',0,'method',methods{mi}};
+    idx = vl_nnpoolidx(size(x), pool, args{:});
+    if gpu
+      idx = gpuArray(permute(idx, [2 3 1]));
+    end
+    y = vl_nnpoolfast(x,idx,'method',methods{mi}) ;
+    y1 = vl_nnpool(x,pool,args{:}) ;
+    vl_testsim(y, y1, range * 1e-2);
+    dzdy = grandn(size(y),'single') ;
+    dzdx = vl_nnpoolfast(x,idx,dzdy,'verbose','method',methods{mi}) ;
+    vl_testder(@(x) vl_nnpoolfast(x,idx,'method',methods{mi}), ...
+      x, dzdy, dzdx, range * 1e-2) ;
+  end
+
+  if ~gpu
+    fprintf('testing vl_nnpoolfast with run-length encoded indices\n') ;
+    for pool=2:3
+      for stride=1:2
+        args = {'stride',stride,'pad',1,'method',methods{mi}};
+        idx = vl_nnpoolidx(size(x), pool, args{:}, 'runlength');
+        y = vl_nnpoolfast(x,idx,'method',methods{mi}) ;
+        y1 = vl_nnpool(x,pool,args{:}) ;
+        vl_testsim(y, y1, range * 1e-2);
+        dzdy = grandn(size(y),'single') ;
+        dzdx = vl_nnpoolfast(x,idx,dzdy,'method',methods{mi}) ;
+        dzdx1 = vl_nnpool(x,pool,dzdy,args{:}) ;
+        vl_testsim(dzdx, dzdx1, range * 1e-2);
+      end
+    end
+
+    fprintf('testing vl_nnpoolfast with channel-last data\n') ;
+    xt = permute(x, [3 1 2 4]) ;
+    for pool=2:3
+      for stride=1:2
+        args = {'stride',stride,'pad',1,'method',methods{mi}};
+        idx = vl_nnpoolidx(size(x), pool, args{:});
+        y = vl_nnpoolfast(x,idx,'method',methods{mi}) ;
+        y_ = vl_nnpoolfast(xt,idx,'method',methods{mi},'layout','nhwc') ;
+        vl_testsim(permute(y, [3 1 2 4]), y_) ;
+        dzdy = grandn(size(y),'single') ;
+        dzdx = vl_nnpoolfast(x,idx,dzdy,'method',methods{mi}) ;
+        dzdx_ = vl_nnpoolfast(xt,idx,permute(dzdy, [3 1 2 4]),'method',methods{mi},'layout','nhwc') ;
+        vl_testsim(permute(dzdx, [3 1 2 4]), dzdx_) ;
+      end
+    end
+
+    fprintf('testing vl_nnpoolfast with deduplicated indices\n') ;
+    maskindices = int32(find(rand(15,14) >= 0.6)) - 1 ;
+    inindices = vl_nninterpidx(maskindices, [15 14]) ;
+    xm = grandn(numel(maskindices),1,3,2,'single') ;
+    for pool=2:3
+      for stride=1:2
+        args = {'stride',stride,'pad',1,'method',methods{mi},'inindices',inindices};
+        idx = vl_nnpoolidx(size(x), pool, args{:});
+        idx_ = vl_nnpoolidx(size(x), pool, args{:}, 'deduplicate');
+        y = vl_nnpoolfast(xm,idx,'method',methods{mi}) ;
+        vl_testsim(y, vl_nnpoolfast(xm,idx_,'method',methods{mi})) ;
+        dzdy = grandn(size(y),'single') ;
+        dzdx = vl_nnpoolfast(xm,idx,dzdy,'method',methods{mi}) ;
+        vl_testsim(dzdx, vl_nnpoolfast(xm,idx_,dzdy,'method',methods{mi})) ;
+      end
+    end
+
+    if strcmp(methods{mi}, 'max')
+      fprintf('testing vl_nnpool and vl_nnpoolfast with switches\n') ;
+      for pool=2:3
+        for stride=1:2
+          args = {'stride',stride,'pad',1,'method',methods{mi}};
+          [y, switches] = vl_nnpool(x,pool,args{:}) ;
+          vl_testsim(y, vl_nnpool(x,pool,args{:})) ;
+          dzdy = grandn(size(y),'single') ;
+          dzdx = vl_nnpool(x,pool,dzdy,args{:}) ;
+          vl_testsim(dzdx, vl_nnpool(x,pool,dzdy,args{:},'switches',switches)) ;
+
+          idx = vl_nnpoolidx(size(x), pool, args{:});
+          [y_, switches_] = vl_nnpoolfast(x,idx,'method',methods{mi}) ;
+          vl_testsim(y, y_) ;
+          assert(isequal(switches, switches_)) ;
+          vl_testsim(dzdx, vl_nnpoolfast(x,idx,dzdy,'method',methods{mi},'switches',switches_)) ;
+        end
+      end
+    end
+
+    fprintf('testing vl_nnpool and vl_nnpoolfast with several threads\n') ;
+    xl = grandn(40,41,16,3,'single') ;
+    for pool=[2 3 7]
+      args = {'stride',[1 2],'pad',1,'method',methods{mi}};
+      y = vl_nnpool(xl,pool,args{:},'numthreads',1) ;
+      vl_testsim(y, vl_nnpool(xl,pool,args{:},'numthreads',4)) ;
+      dzdy = grandn(size(y),'single') ;
+      dzdx = vl_nnpool(xl,pool,dzdy,args{:},'numthreads',1) ;
+      vl_testsim(dzdx, vl_nnpool(xl,pool,dzdy,args{:},'numthreads',4)) ;
+      idx = vl_nnpoolidx(size(xl), pool, args{:});
+      vl_testsim(y, vl_nnpoolfast(xl,idx,'method',methods{mi},'numthreads',4)) ;
+      vl_testsim(dzdx, vl_nnpoolfast(xl,idx,dzdy,'method',methods{mi},'numthreads',4)) ;
+    end
+  end
+
 end
\ No newline at end of file